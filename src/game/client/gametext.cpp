@@ -27,6 +27,7 @@
 #include "main.h"   // For ApplicationHWnd
 #include "minmax.h"
 #include "rtsutils.h"
+#include "stringformat.h"
 
 using rts::FourCC;
 
@@ -701,7 +702,7 @@ void GameTextManager::Init()
     AsciiString csfpath;
     bool use_csf = true;
 
-    csfpath.Format("data/%s/Generals.csf", Get_Registry_Language().Str());
+    Format_String(csfpath, "data/{}/Generals.csf", Get_Registry_Language());
 
     // Check if we can use a standard string file, if not, try the csf file.
     if ( m_useStringFile && Get_String_Count("data/Generals.str", m_textCount) ) {
@@ -835,7 +836,7 @@ UnicodeString GameTextManager::Fetch(const char *args, bool *success)
     UnicodeString missing;
     NoString *no_string;
 
-    missing.Format(L"MISSING: '%hs'", args);
+    Format_String(missing, L"MISSING: '{}'", args);
 
     // Find missing string in NoString list if it already exists.
     for ( no_string = m_noStringList; no_string != nullptr; no_string = no_string->next ) {
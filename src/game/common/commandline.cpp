@@ -24,6 +24,7 @@
 #include "commandline.h"
 #include "archivefilesystem.h"
 #include "localfilesystem.h"
+#include "stringformat.h"
 #include "globaldata.h"
 #include "version.h"
 #include <cstring>
@@ -156,7 +157,7 @@ int Parse_Mod(char const **argv, int argc)
 
         // If its not an absolute path, make it relative to user data dir.
         if ( !strchr(path.Str(), ':') && !path.Starts_With("/") && !path.Starts_With("\\") ) {
-            path.Format("%s%s", TheWriteableGlobalData->m_userDataDirectory.Str(), argv[1]);
+            Format_String(path, "{}{}", TheWriteableGlobalData->m_userDataDirectory, argv[1]);
         }
 
         // Check if it exists
@@ -23,6 +23,7 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "commandlist.h"
 #include "gamemessage.h"
+#include "mempoolfact.h"
 
 void CommandList::Destroy_All_Messages()
 {
@@ -35,6 +36,15 @@ void CommandList::Destroy_All_Messages()
 
     m_firstMessage = nullptr;
     m_lastMessage = nullptr;
+
+    //
+    // The original logic clears the command list through here once it has run
+    // the frame's commands, it is the one hooked point that runs every frame.
+    //
+    if ( TheMemoryPoolFactory != nullptr ) {
+        TheMemoryPoolFactory->Update_Stats_Dump();
+        TheMemoryPoolFactory->Update_Load_Upkeep();
+    }
 }
 
 void CommandList::Append_Message_List(GameMessage *list)
@@ -22,6 +22,7 @@
 //
 ////////////////////////////////////////////////////////////////////////////////
 #include "gameengine.h"
+#include "framearena.h"
 
 #ifdef PLATFORM_WINDOWS
 #include <mmsystem.h>
@@ -52,6 +53,11 @@ void GameEngine::Reset()
 
 void GameEngine::Update()
 {
+    //
+    // Last thing in the frame, anything allocated from the arena is done with.
+    // Not hooked, so the DLL never gets here and the arena never resets in game.
+    //
+    FrameArena::Reset();
 }
 
 void GameEngine::Init(int argc, char ** argv)
@@ -27,6 +27,7 @@
 #include "file.h"
 #include "filesystem.h"
 #include "gamedebug.h"
+#include "memtag.h"
 #include "minmax.h"
 #include "xfer.h"
 #include <cctype>
@@ -198,6 +199,11 @@ void INI::Load(AsciiString filename, INILoadType type, Xfer *xfer)
                 token
             );
 
+            //
+            // Init_Subsystem isn't ours yet, so what a subsystem loads is
+            // charged by the block type it comes from instead.
+            //
+            MemoryTagScope tag(token);
             parser(this);
         }
     }
@@ -22,6 +22,7 @@
 //
 ////////////////////////////////////////////////////////////////////////////////
 #include "archivefile.h"
+#include "asciistringview.h"
 #include "file.h"
 
 ArchiveFile::ArchiveFile() :
@@ -33,29 +34,30 @@ ArchiveFile::ArchiveFile() :
 
 ArchivedFileInfo *ArchiveFile::Get_Archived_File_Info(AsciiString const &filename)
 {
-    AsciiString path = filename;
-    AsciiString token;
+    AsciiStringView path = filename;
+    AsciiStringView token;
     DetailedArchiveDirectoryInfo *dirp = &ArchiveInfo;
 
-    // Lower case for matching and get first item of the path.
-    path.To_Lower();
+    // Get first item of the path, each is lower cased for matching as it is looked up.
     path.Next_Token(&token, "\\/");
 
     // Consider existence of '.' to indicate file as all should have .ext format
     // checks the remaining path does not contain one to catch directories in path
     // that do.
-    while ( strchr(token.Str(), '.') == nullptr || strchr(path.Str(), '.') != nullptr ) {
-        if ( dirp->Directories.find(token) == dirp->Directories.end() ) {
+    while ( token.Find('.') == nullptr || path.Find('.') != nullptr ) {
+        auto dir_it = dirp->Directories.find(AsciiStringKey(token, true));
+
+        if ( dir_it == dirp->Directories.end() ) {
             return nullptr;
         }
         
-        dirp = &dirp->Directories[token];
+        dirp = &dir_it->second;
         path.Next_Token(&token, "\\/");
     }
 
     // Assuming we didn't run out of directories to try, find the file
     // in the reached directory.
-    auto file_it = dirp->Files.find(token);
+    auto file_it = dirp->Files.find(AsciiStringKey(token, true));
 
     if ( file_it == dirp->Files.end() ) {
         return nullptr;
@@ -101,22 +103,21 @@ void ArchiveFile::Attach_File(File *file)
 
 void ArchiveFile::Get_File_List_From_Dir(AsciiString const &subdir, AsciiString const &dirpath, AsciiString const &filter, std::set<AsciiString, rts::less_than_nocase<AsciiString> > &filelist, bool search_subdir) const
 {
-    AsciiString path = dirpath;
-    AsciiString token;
+    AsciiStringView path = dirpath;
+    AsciiStringView token;
     DetailedArchiveDirectoryInfo const *dirp = &ArchiveInfo;
 
-
-    // Lower case for matching and get first item of the path.
-    path.To_Lower();
-
-    // Go to the last InfoNode in the path to extract file contents from.
+    // Go to the last InfoNode in the path to extract file contents from, lower
+    // casing each item for matching.
     for ( path.Next_Token(&token, "\\/"); token.Is_Not_Empty(); path.Next_Token(&token, "\\/") ) {
+        auto dir_it = dirp->Directories.find(AsciiStringKey(token, true));
+
         // If an element of the path doesn't have a node for our next directory, return.
-        if ( dirp->Directories.find(token) == dirp->Directories.end() ) {
+        if ( dir_it == dirp->Directories.end() ) {
             return;
         }
 
-        dirp = &dirp->Directories[token];
+        dirp = &dir_it->second;
     }
 
     Get_File_List_From_Dir(dirp, dirpath, filter, filelist, search_subdir);
@@ -30,6 +30,7 @@
 
 #include "asciistring.h"
 #include "file.h"
+#include "poolallocator.h"
 #include "rtsutils.h"
 #include <map>
 #include <set>
@@ -48,8 +49,8 @@ struct ArchivedFileInfo
 struct DetailedArchiveDirectoryInfo
 {
     AsciiString Name;
-    mutable std::map<AsciiString, DetailedArchiveDirectoryInfo> Directories;    // Mutable to use operator[] in const functions
-    std::map<AsciiString, ArchivedFileInfo> Files;
+    mutable std::map<AsciiString, DetailedArchiveDirectoryInfo, std::less<AsciiString>, PoolAllocator<std::pair<AsciiString const, DetailedArchiveDirectoryInfo> > > Directories;    // Mutable to use operator[] in const functions
+    std::map<AsciiString, ArchivedFileInfo, std::less<AsciiString>, PoolAllocator<std::pair<AsciiString const, ArchivedFileInfo> > > Files;
 };
 
 class ArchiveFile
@@ -23,6 +23,7 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "archivefilesystem.h"
 #include "archivefile.h"
+#include "asciistringview.h"
 #include "globaldata.h"
 
 ArchiveFileSystem::ArchiveFileSystem()
@@ -50,30 +51,31 @@ File *ArchiveFileSystem::Open_File(char const *filename, int mode)
 
 bool ArchiveFileSystem::Does_File_Exist(char const *filename)
 {
-    AsciiString path = filename;
-    AsciiString token;
+    AsciiStringView path = filename;
+    AsciiStringView token;
     ArchivedDirectoryInfo *dirp = &ArchiveDirInfo;
 
-    // Lower case for matching and get first item of the path.
-    path.To_Lower();
+    // Get first item of the path, each is lower cased for matching as it is looked up.
     path.Next_Token(&token, "\\/");
 
     // Consider existence of '.' to indicate file as all should have .ext format
     // checks the remaining path does not contain one to catch directories in path
     // that do.
-    while ( strchr(token.Str(), '.') == nullptr || strchr(path.Str(), '.') != nullptr ) {
+    while ( token.Find('.') == nullptr || path.Find('.') != nullptr ) {
+        auto dir_it = dirp->Directories.find(AsciiStringKey(token, true));
+
         // If we ran out of directories, we don't have the directory that has the file.
-        if ( dirp->Directories.find(token) == dirp->Directories.end() ) {
+        if ( dir_it == dirp->Directories.end() ) {
             return false;
         }
 
-        dirp = &dirp->Directories[token];
+        dirp = &dir_it->second;
         path.Next_Token(&token, "\\/");
     }
 
     // Assuming we didn't run out of directories to try, find the file
     // in the reached directory.
-    if ( dirp->Files.find(token) == dirp->Files.end() ) {
+    if ( dirp->Files.find(AsciiStringKey(token, true)) == dirp->Files.end() ) {
         return false;
     }
 
@@ -138,33 +140,36 @@ bool ArchiveFileSystem::Get_File_Info(AsciiString const &name, FileInfo *info)
 // Returns the filname of the archive file containing the passed in file name. 
 AsciiString ArchiveFileSystem::Get_Archive_Filename_For_File(AsciiString const &filename)
 {
-    AsciiString path = filename;
-    AsciiString token;
+    AsciiStringView path = filename;
+    AsciiStringView token;
     ArchivedDirectoryInfo *dirp = &ArchiveDirInfo;
 
-    // Lower case for matching and get first item of the path.
-    path.To_Lower();
+    // Get first item of the path, each is lower cased for matching as it is looked up.
     path.Next_Token(&token, "\\/");
 
     // Consider existence of '.' to indicate file as all should have .ext format
     // checks the remaining path does not contain one to catch directories in path
     // that do.
-    while ( strchr(token.Str(), '.') == nullptr || strchr(path.Str(), '.') != nullptr ) {
-        if ( dirp->Directories.find(token) == dirp->Directories.end() ) {
+    while ( token.Find('.') == nullptr || path.Find('.') != nullptr ) {
+        auto dir_it = dirp->Directories.find(AsciiStringKey(token, true));
+
+        if ( dir_it == dirp->Directories.end() ) {
             return AsciiString();
         }
 
-        dirp = &dirp->Directories[token];
+        dirp = &dir_it->second;
         path.Next_Token(&token, "\\/");
     }
 
     // Assuming we didn't run out of directories to try, find the file
     // in the reached directory.
-    if ( dirp->Files.find(token) == dirp->Files.end() ) {
+    auto file_it = dirp->Files.find(AsciiStringKey(token, true));
+
+    if ( file_it == dirp->Files.end() ) {
         return AsciiString();
     }
 
-    return dirp->Files[token];
+    return file_it->second;
 }
 
 // Populates a std::set of file paths based on the passed in filter and path to examine.
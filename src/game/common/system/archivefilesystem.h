@@ -30,6 +30,7 @@
 
 #include "subsysteminterface.h"
 #include "hooker.h"
+#include "poolallocator.h"
 #include "rtsutils.h"
 #include <map>
 #include <set>
@@ -43,8 +44,8 @@ struct FileInfo;
 struct ArchivedDirectoryInfo
 {
     AsciiString Name;
-    std::map<AsciiString, ArchivedDirectoryInfo> Directories;
-    std::map<AsciiString, AsciiString> Files;   // Maps the filenames in the archive to the actual filename on disk
+    std::map<AsciiString, ArchivedDirectoryInfo, std::less<AsciiString>, PoolAllocator<std::pair<AsciiString const, ArchivedDirectoryInfo> > > Directories;
+    std::map<AsciiString, AsciiString, std::less<AsciiString>, PoolAllocator<std::pair<AsciiString const, AsciiString> > > Files;   // Maps the filenames in the archive to the actual filename on disk
 };
 
 class ArchiveFileSystem : public SubsystemInterface 
@@ -67,7 +68,7 @@ public:
     void Load_Mods();
 
 protected:
-    std::map<AsciiString, ArchiveFile*> ArchiveFiles;
+    std::map<AsciiString, ArchiveFile*, std::less<AsciiString>, PoolAllocator<std::pair<AsciiString const, ArchiveFile*>, false> > ArchiveFiles;
     ArchivedDirectoryInfo ArchiveDirInfo;
 };
 
@@ -28,20 +28,23 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "asciistring.h"
 #include "unicodestring.h"
+#include "casefold.h"
 #include "gamedebug.h"
+#include "minmax.h"
 #include <cctype>
 #include <cstdio>
 
 AsciiString const AsciiString::EmptyString(nullptr);
 
-AsciiString::AsciiString() :
-    m_data(nullptr)
+AsciiString::AsciiString()
 {
+    Set_Empty();
 }
 
-AsciiString::AsciiString(char const *s) :
-    m_data(nullptr)
+AsciiString::AsciiString(char const *s)
 {
+    Set_Empty();
+
     if ( s != nullptr ) {
         int len = (int)strlen(s);
         if ( len > 0 ) {
@@ -50,18 +53,44 @@ AsciiString::AsciiString(char const *s) :
     }
 }
 
-AsciiString::AsciiString(AsciiString const &string) :
-    m_data(string.m_data)
+AsciiString::AsciiString(AsciiString const &string)
 {
+    Share(string);
+}
+
+//
+// Points this at the same chars as string, only call it with nothing held.
+//
+void AsciiString::Share(AsciiString const &string)
+{
+#ifdef GAME_ASCIISTRING_SSO
+    // Copying every byte covers both layouts, only a heap string needs a reference on top.
+    memcpy(m_inline, string.m_inline, INLINE_SIZE);
+
+    if ( !Is_Heap() ) {
+        return;
+    }
+#else
+    m_data = string.m_data;
+#endif // GAME_ASCIISTRING_SSO
+
     if ( m_data != nullptr ) {
     #ifdef COMPILER_MSVC
-        InterlockedIncrement16((volatile short*)&string.m_data->ref_count);
+        InterlockedIncrement16((volatile short*)&m_data->ref_count);
     #elif defined COMPILER_GNUC || defined COMPILER_CLANG
-        __sync_add_and_fetch(&string.m_data->ref_count, 1);
+        __sync_add_and_fetch(&m_data->ref_count, 1);
     #endif
     }
 }
 
+void AsciiString::Set_Heap_Data(AsciiStringData *data)
+{
+    m_data = data;
+#ifdef GAME_ASCIISTRING_SSO
+    m_inline[INLINE_SIZE - 1] = char(INLINE_HEAP);
+#endif // GAME_ASCIISTRING_SSO
+}
+
 void AsciiString::Validate()
 {
     //TODO, doesnt seem to be implimented anywhere? It is called though...
@@ -69,6 +98,12 @@ void AsciiString::Validate()
 
 char *AsciiString::Peek() const
 {
+#ifdef GAME_ASCIISTRING_SSO
+    if ( !Is_Heap() ) {
+        return const_cast<char *>(m_inline);
+    }
+#endif // GAME_ASCIISTRING_SSO
+
     ASSERT_PRINT(m_data != nullptr, "null string ptr");
     
     return m_data->Peek();
@@ -77,6 +112,14 @@ char *AsciiString::Peek() const
 
 void AsciiString::Release_Buffer()
 {
+#ifdef GAME_ASCIISTRING_SSO
+    if ( !Is_Heap() ) {
+        Set_Empty();
+
+        return;
+    }
+#endif // GAME_ASCIISTRING_SSO
+
     if ( m_data != nullptr ) {
     #ifdef COMPILER_MSVC
         InterlockedDecrement16((volatile short*)&m_data->ref_count);
@@ -87,62 +130,144 @@ void AsciiString::Release_Buffer()
             TheDynamicMemoryAllocator->Free_Bytes(m_data);
         }
         
-        m_data = nullptr;
+        Set_Empty();
     }
 }
 
 void AsciiString::Ensure_Unique_Buffer_Of_Size(int chars_needed, bool keep_data, char const *str_to_cpy, char const *str_to_cat)
 {
-    if ( m_data != nullptr && m_data->ref_count == 1 && m_data->num_chars_allocated >= chars_needed ) {
+    AsciiStringData *data = Get_Data();
+    bool reuse = data != nullptr && data->ref_count == 1 && data->num_chars_allocated >= chars_needed;
+
+    //
+    // Every length is taken once up front. The strings passed in can point into
+    // the buffer being written, Next_Token and Trim hand over a tail of it.
+    //
+    int keep_len = Has_Data() && (reuse || keep_data) ? Data_Length() : 0;
+    int cpy_len = str_to_cpy != nullptr ? strlen(str_to_cpy) : 0;
+    int cat_len = str_to_cat != nullptr ? strlen(str_to_cat) : 0;
+    int len = str_to_cpy != nullptr ? cpy_len : keep_len;
+
+    chars_needed = MAX(chars_needed, len + cat_len + 1);
+
+    if ( reuse ) {
+        char *buf = Peek();
+
         if ( str_to_cpy != nullptr ) {
-            strcpy(Peek(), str_to_cpy);
+            memmove(buf, str_to_cpy, cpy_len);
         }
 
-        if ( str_to_cat != nullptr ) {
-            strcpy(Peek() + strlen(Peek()), str_to_cat);
+        if ( cat_len > 0 ) {
+            memmove(buf + len, str_to_cat, cat_len);
         }
 
-    } else {
+        buf[len + cat_len] = '\0';
+        Set_Data_Length(len + cat_len);
 
-        //this block would have been a macro like DEBUG_CRASH(numCharsNeeded + 8 > MAX_LEN, THROW_02); (see cl_debug.h)
-        //if ( numCharsNeeded + 8 > MAX_LEN ) {
-            // *&preserveData = 0xDEAD0002;
-            //throw(&preserveData, &_TI1_AW4ErrorCode__);
-        //}
+        return;
+    }
 
-        int size = TheDynamicMemoryAllocator->Get_Actual_Allocation_Size(chars_needed + sizeof(AsciiStringData));
-        AsciiStringData *new_data = reinterpret_cast<AsciiStringData *>(TheDynamicMemoryAllocator->Allocate_Bytes_No_Zero(size));
-        
-        new_data->ref_count = 1;
-        new_data->num_chars_allocated = size - sizeof(AsciiStringData);
-        //new_data->num_chars_allocated = numCharsNeeded;
-    #ifdef GAME_DEBUG_STRUCTS
-        new_data->debug_ptr = new_data->Peek();
-    #endif
+#ifdef GAME_ASCIISTRING_SSO
+    //
+    // Short enough to go inline, built on the side as the old chars have to
+    // last until it is done.
+    //
+    if ( chars_needed <= INLINE_SIZE ) {
+        char buf[INLINE_SIZE];
 
-        if ( m_data != nullptr && keep_data ) {
-            strcpy(new_data->Peek(), Peek());
-        } else {
-            *new_data->Peek() = '\0';
+        // Through data, Peek() reloads m_data and GCC warns on a null heap copy.
+        if ( len > 0 ) {
+            memcpy(buf, str_to_cpy != nullptr ? str_to_cpy : data != nullptr ? data->Peek() : m_inline, len);
         }
 
-        if ( str_to_cpy != nullptr ) {
-            strcpy(new_data->Peek(), str_to_cpy);
+        if ( cat_len > 0 ) {
+            memcpy(buf + len, str_to_cat, cat_len);
         }
 
-        if ( str_to_cat != nullptr ) {
-            strcat(new_data->Peek(), str_to_cat);
-        }
+        buf[len + cat_len] = '\0';
 
         Release_Buffer();
-        m_data = new_data;
+        memcpy(m_inline, buf, len + cat_len + 1);
+
+        return;
+    }
+#endif // GAME_ASCIISTRING_SSO
+
+    //this block would have been a macro like DEBUG_CRASH(numCharsNeeded + 8 > MAX_LEN, THROW_02); (see cl_debug.h)
+    //if ( numCharsNeeded + 8 > MAX_LEN ) {
+        // *&preserveData = 0xDEAD0002;
+        //throw(&preserveData, &_TI1_AW4ErrorCode__);
+    //}
+
+    int size = TheDynamicMemoryAllocator->Get_Actual_Allocation_Size(chars_needed + sizeof(AsciiStringData));
+    AsciiStringData *new_data = reinterpret_cast<AsciiStringData *>(TheDynamicMemoryAllocator->Allocate_Bytes_No_Zero(size));
+
+    new_data->ref_count = 1;
+    new_data->num_chars_allocated = size - sizeof(AsciiStringData);
+    //new_data->num_chars_allocated = numCharsNeeded;
+#ifdef GAME_DEBUG_STRUCTS
+    new_data->debug_ptr = new_data->Peek();
+#endif
+
+    char *buf = new_data->Peek();
+
+    if ( len > 0 ) {
+        memcpy(buf, str_to_cpy != nullptr ? str_to_cpy : Peek(), len);
+    }
+
+    if ( cat_len > 0 ) {
+        memcpy(buf + len, str_to_cat, cat_len);
+    }
+
+    buf[len + cat_len] = '\0';
+
+    Release_Buffer();
+    Set_Heap_Data(new_data);
+    Set_Data_Length(len + cat_len);
+}
+
+//
+// Length of whatever is held, cached when the build keeps it. Unlike
+// Get_Length it doesn't mind an empty buffer.
+//
+int AsciiString::Data_Length() const
+{
+#ifdef GAME_ASCIISTRING_CACHE
+    AsciiStringData *data = Get_Data();
+
+    if ( data != nullptr ) {
+        if ( data->num_chars == LENGTH_UNKNOWN ) {
+            data->num_chars = strlen(data->Peek());
+        }
+
+        return data->num_chars;
+    }
+#endif // GAME_ASCIISTRING_CACHE
+
+    return strlen(Str());
+}
+
+#ifdef GAME_ASCIISTRING_CACHE
+//
+// Called after anything changes the chars, LENGTH_UNKNOWN has the next
+// Data_Length measure them. The hashes always start over.
+//
+void AsciiString::Set_Data_Length(int len)
+{
+    AsciiStringData *data = Get_Data();
+
+    if ( data != nullptr ) {
+        data->num_chars = len;
+        data->hash = 0;
+        data->hash_no_case = 0;
     }
 }
+#endif // GAME_ASCIISTRING_CACHE
 
 int AsciiString::Get_Length() const
 {
-    if ( m_data != nullptr ) {
-        int len = strlen(Str());
+    if ( Has_Data() ) {
+        int len = Data_Length();
         ASSERT_PRINT(len > 0, "length of string is less than or equal to 0.");
         
         return len;
@@ -161,6 +286,10 @@ char AsciiString::Get_Char(int index) const
 
 const char *AsciiString::Str() const
 {
+#ifdef GAME_ASCIISTRING_SSO
+    // An empty inline string is already "".
+    return Peek();
+#else
     static char const TheNullChr[4] = "";
 
     if ( m_data != nullptr ) {
@@ -168,6 +297,7 @@ const char *AsciiString::Str() const
     }
     
     return TheNullChr;
+#endif // GAME_ASCIISTRING_SSO
 }
 
 char *AsciiString::Get_Buffer_For_Read(int len)
@@ -178,13 +308,14 @@ char *AsciiString::Get_Buffer_For_Read(int len)
     // Generate buffer sufficient to read requested size into.
     //
     Ensure_Unique_Buffer_Of_Size(len + 1, 0, 0, 0);
+    Set_Data_Length(LENGTH_UNKNOWN);
 
     return Peek();
 }
 
 void AsciiString::Set(char const *s)
 {
-    if ( m_data != nullptr || s != m_data->Peek() ) {
+    if ( !Has_Data() || s != Peek() ) {
         size_t len;
         
         if ( s && (len = strlen(s) + 1, len != 1) ) {
@@ -199,15 +330,7 @@ void AsciiString::Set(AsciiString const &string)
 {
     if ( &string != this ) {
         Release_Buffer();
-        m_data = string.m_data;
-        
-        if ( string.m_data != nullptr ) {
-        #ifdef COMPILER_MSVC
-            InterlockedIncrement16((volatile short*)&string.m_data->ref_count);
-        #elif defined COMPILER_GNUC || defined COMPILER_CLANG
-            __sync_add_and_fetch(&string.m_data->ref_count, 1);
-        #endif
-        }
+        Share(string);
     }
 }
 
@@ -258,8 +381,8 @@ void AsciiString::Concat(char const *s)
     int len = strlen(s);
 
     if ( len > 0 ) {
-        if ( m_data != nullptr ) {
-            Ensure_Unique_Buffer_Of_Size(strlen(Peek()) + len + 1, true, 0, s);
+        if ( Has_Data() ) {
+            Ensure_Unique_Buffer_Of_Size(Data_Length() + len + 1, true, 0, s);
         } else {
             Set(s);
         }
@@ -269,7 +392,7 @@ void AsciiString::Concat(char const *s)
 void AsciiString::Trim()
 {
     // No string, no Trim.
-    if ( m_data == nullptr ) {
+    if ( !Has_Data() ) {
         return;
     }
 
@@ -288,11 +411,11 @@ void AsciiString::Trim()
     }
 
     // Oops, Set call broke the string.
-    if ( m_data == nullptr ) {
+    if ( !Has_Data() ) {
         return;
     }
 
-    for ( int i = strlen(Peek()) - 1; i >= 0; --i ) {
+    for ( int i = Data_Length() - 1; i >= 0; --i ) {
         if ( !isspace(Get_Char(i)) ) {
             break;
         }
@@ -301,30 +424,35 @@ void AsciiString::Trim()
     }
 }
 
+//
+// Only unshares the buffer when there is something to lower, paths from the
+// archives mostly come in lower case already.
+//
 void AsciiString::To_Lower()
 {
-    char buf[MAX_FORMAT_BUF_LEN];
-
-    if ( m_data == nullptr ) {
+    if ( !Has_Data() ) {
         return;
     }
 
-    strcpy(buf, Peek());
+    int len = Data_Length();
+    int first = Find_Upper_Char(Peek(), len);
 
-    for ( char *c = buf; *c != '\0'; ++c ) {
-        *c = tolower(*c);
+    if ( first < 0 ) {
+        return;
     }
 
-    Set(buf);
+    Ensure_Unique_Buffer_Of_Size(len + 1, true);
+    Lower_Chars(Peek() + first, len - first);
+    Set_Data_Length(len);
 }
 
 void AsciiString::Remove_Last_Char()
 {
-    if ( m_data == nullptr ) {
+    if ( !Has_Data() ) {
         return;
     }
 
-    int len = strlen(Peek());
+    int len = Data_Length();
 
     if ( len > 0 ) {
         Ensure_Unique_Buffer_Of_Size(len + 1, true);
@@ -372,7 +500,7 @@ bool AsciiString::Starts_With(char const *p)
         return true;
     }
     
-    int thislen = m_data != nullptr ? strlen(Peek()) : 0;
+    int thislen = Has_Data() ? Data_Length() : 0;
     int thatlen = strlen(p);
     
     if ( thislen < thatlen ) {
@@ -388,7 +516,7 @@ bool AsciiString::Ends_With(char const *p)
         return true;
     }
     
-    int thislen = m_data != nullptr ? strlen(Peek()) : 0;
+    int thislen = Has_Data() ? Data_Length() : 0;
     int thatlen = strlen(p);
     
     if ( thislen < thatlen ) {
@@ -404,7 +532,7 @@ bool AsciiString::Starts_With_No_Case(char const *p) const
         return true;
     }
     
-    int thislen = m_data != nullptr ? strlen(Peek()) : 0;
+    int thislen = Has_Data() ? Data_Length() : 0;
     int thatlen = strlen(p);
     
     if ( thislen < thatlen ) {
@@ -420,7 +548,7 @@ bool AsciiString::Ends_With_No_Case(char const *p) const
         return true;
     }
     
-    int thislen = m_data != nullptr ? strlen(Peek()) : 0;
+    int thislen = Has_Data() ? Data_Length() : 0;
     int thatlen = strlen(p);
     
     if ( thislen < thatlen ) {
@@ -430,9 +558,117 @@ bool AsciiString::Ends_With_No_Case(char const *p) const
     return strncasecmp(Peek() + thislen - thatlen, p, thatlen) == 0;
 }
 
+bool AsciiString::Equals(AsciiString const &string) const
+{
+    AsciiStringData *data = Get_Data();
+    AsciiStringData *that = string.Get_Data();
+
+    if ( data != nullptr && data == that ) {
+        return true;
+    }
+
+#ifdef GAME_ASCIISTRING_CACHE
+    if ( data != nullptr && that != nullptr ) {
+        if ( Data_Length() != string.Data_Length() ) {
+            return false;
+        }
+
+        // Only hashes already worked out are used, working one out costs more than the compare.
+        if ( data->hash != 0 && that->hash != 0 && data->hash != that->hash ) {
+            return false;
+        }
+    }
+#endif // GAME_ASCIISTRING_CACHE
+
+    return strcmp(Str(), string.Str()) == 0;
+}
+
+bool AsciiString::Equals_No_Case(AsciiString const &string) const
+{
+    AsciiStringData *data = Get_Data();
+    AsciiStringData *that = string.Get_Data();
+
+    if ( data != nullptr && data == that ) {
+        return true;
+    }
+
+#ifdef GAME_ASCIISTRING_CACHE
+    if ( data != nullptr && that != nullptr ) {
+        if ( Data_Length() != string.Data_Length() ) {
+            return false;
+        }
+
+        if ( data->hash_no_case != 0 && that->hash_no_case != 0 && data->hash_no_case != that->hash_no_case ) {
+            return false;
+        }
+    }
+#endif // GAME_ASCIISTRING_CACHE
+
+    return strcasecmp(Str(), string.Str()) == 0;
+}
+
+//
+// FNV-1a, the no case variant folds A-Z like Pool_Name_Hash. Both are moved off
+// 0 so 0 can mean not worked out yet.
+//
+uint32_t AsciiString::Hash_Chars(char const *s, int len, bool no_case)
+{
+    uint32_t hash = 2166136261u;
+
+    for ( int i = 0; i < len; ++i ) {
+        unsigned char c = s[i];
+
+        if ( no_case && c >= 'A' && c <= 'Z' ) {
+            c += 'a' - 'A';
+        }
+
+        hash = (hash ^ c) * 16777619u;
+    }
+
+    return hash != 0 ? hash : 1;
+}
+
+//
+// Cached hashes are filled in from const methods on shared buffers. Threads
+// racing on one all store the same value so no lock is needed.
+//
+uint32_t AsciiString::Get_Hash() const
+{
+#ifdef GAME_ASCIISTRING_CACHE
+    AsciiStringData *data = Get_Data();
+
+    if ( data != nullptr ) {
+        if ( data->hash == 0 ) {
+            data->hash = Hash_Chars(data->Peek(), Data_Length(), false);
+        }
+
+        return data->hash;
+    }
+#endif // GAME_ASCIISTRING_CACHE
+
+    return Hash_Chars(Str(), Data_Length(), false);
+}
+
+uint32_t AsciiString::Get_Hash_No_Case() const
+{
+#ifdef GAME_ASCIISTRING_CACHE
+    AsciiStringData *data = Get_Data();
+
+    if ( data != nullptr ) {
+        if ( data->hash_no_case == 0 ) {
+            data->hash_no_case = Hash_Chars(data->Peek(), Data_Length(), true);
+        }
+
+        return data->hash_no_case;
+    }
+#endif // GAME_ASCIISTRING_CACHE
+
+    return Hash_Chars(Str(), Data_Length(), true);
+}
+
 bool AsciiString::Next_Token(AsciiString *tok, char const *delims)
 {
-    if ( m_data == nullptr ) {
+    if ( !Has_Data() ) {
         return false;
     }
     
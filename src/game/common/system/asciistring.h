@@ -33,20 +33,34 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "always.h"
 #include "memdynalloc.h"
+#include <cstdarg>
+#include <cstring>
 
 class UnicodeString;
 
+//
+// Building with GAME_ASCIISTRING_SSO keeps strings of up to INLINE_SIZE - 1
+// chars inside the object and only allocates AsciiStringData for longer ones.
+// It changes the size of AsciiString so can't be used while hooking the
+// original exe.
+//
+// GAME_ASCIISTRING_CACHE has AsciiStringData carry the length and both hashes
+// so they are only worked out once per buffer. That changes the header the exe
+// expects in front of the chars, so the same goes for it.
+//
 class AsciiString
 {
     // So we can hook functions we think should be private.
     friend void Setup_Hooks();
 
     friend class UnicodeString;
+    friend class AsciiStringKey;
 
 public:
     enum {
         MAX_FORMAT_BUF_LEN = 2048,
         MAX_LEN = 32767,
+        LENGTH_UNKNOWN = 0xFFFF,
     };
 
     struct AsciiStringData
@@ -57,6 +71,11 @@ public:
 
         uint16_t ref_count;
         uint16_t num_chars_allocated;
+    #ifdef GAME_ASCIISTRING_CACHE
+        uint16_t num_chars;     // LENGTH_UNKNOWN from Get_Buffer_For_Read until measured.
+        uint32_t hash;          // Both are 0 until first asked for.
+        uint32_t hash_no_case;
+    #endif // GAME_ASCIISTRING_CACHE
 
         char *Peek()
         {
@@ -68,12 +87,15 @@ public:
     AsciiString();
     AsciiString(char const *s);
     AsciiString(AsciiString const &string);
+    // Takes the buffer over without touching the ref count, the source is left empty.
+    AsciiString(AsciiString &&string) { Take(string); }
     //AsciiString(UnicodeString const &stringSrc);
     ~AsciiString() { Release_Buffer(); }
 
     AsciiString &operator=(char *s) { Set(s); return *this; }
     AsciiString &operator=(char const *s) { Set(s); return *this; }
     AsciiString &operator=(AsciiString const &stringSrc) { Set(stringSrc); return *this; }
+    AsciiString &operator=(AsciiString &&stringSrc);
     //AsciiString &operator=(UnicodeString const &stringSrc);
 
     AsciiString &operator+=(char s) { Concat(s); return *this; }
@@ -82,6 +104,7 @@ public:
     //AsciiString &operator+=(UnicodeString const &stringSrc);
 
     void Validate();
+    // Writing through this leaves any cached length and hash stale, use Get_Buffer_For_Read.
     char *Peek() const;
     void Release_Buffer();
     int Get_Length() const;
@@ -115,6 +138,17 @@ public:
 
     int Compare_No_Case(char const *s) const { return strcasecmp(Str(), s); }
     int Compare_No_Case(AsciiString const &string) const { return strcasecmp(Str(), string.Str()); }
+
+    // Cheaper than Compare when only a match matters, shared buffers and cached lengths and hashes settle most.
+    bool Equals(AsciiString const &string) const;
+    bool Equals_No_Case(AsciiString const &string) const;
+
+    // Never 0, the no case one folds A-Z the same way Compare_No_Case does.
+    uint32_t Get_Hash() const;
+    uint32_t Get_Hash_No_Case() const;
+
+    // What the two above use, AsciiStringView hashes the same way through it.
+    static uint32_t Hash_Chars(char const *s, int len, bool no_case);
         
     // I assume these do this, though have no examples in binaries.
     char *Find(char c) { return strchr(Peek(), c); }
@@ -128,7 +162,7 @@ public:
 
     bool Next_Token(AsciiString *tok, char const *seps);
 
-    bool Is_None() const { return m_data != nullptr && strcasecmp(Peek(), "None") == 0; }
+    bool Is_None() const { return Has_Data() && strcasecmp(Peek(), "None") == 0; }
     bool Is_Empty() const { return Get_Length() <= 0; }
     bool Is_Not_Empty() const { return !Is_Empty(); }
     bool Is_Not_None() const { return !Is_None(); }
@@ -147,14 +181,60 @@ private:
     void Format_VA(char const *format, va_list args);
     void Format_VA(AsciiString &format, va_list args);
 
+    void Share(AsciiString const &string);
+    void Set_Heap_Data(AsciiStringData *data);
+    int Data_Length() const;
+#ifdef GAME_ASCIISTRING_CACHE
+    void Set_Data_Length(int len);
+#else
+    void Set_Data_Length(int) {}
+#endif // GAME_ASCIISTRING_CACHE
+
+#ifdef GAME_ASCIISTRING_SSO
+    enum {
+        INLINE_SIZE = 16,   // Includes the terminator.
+        INLINE_HEAP = 0xFF, // Last byte when the chars are in m_data.
+    };
+
+    //
+    // Inline strings always end in a 0 byte so all zero bits is an empty string,
+    // a heap string marks the last byte instead. The pointer never reaches it.
+    //
+    bool Is_Heap() const { return uint8_t(m_inline[INLINE_SIZE - 1]) == INLINE_HEAP; }
+    AsciiStringData *Get_Data() const { return Is_Heap() ? m_data : nullptr; }
+    bool Has_Data() const { return Is_Heap() || m_inline[0] != '\0'; }
+    void Set_Empty() { m_inline[0] = '\0'; m_inline[INLINE_SIZE - 1] = '\0'; }
+    void Take(AsciiString &string) { memcpy(m_inline, string.m_inline, INLINE_SIZE); string.Set_Empty(); }
+
+    union {
+        AsciiStringData *m_data;
+        char m_inline[INLINE_SIZE];
+    };
+#else
+    AsciiStringData *Get_Data() const { return m_data; }
+    bool Has_Data() const { return m_data != nullptr; }
+    void Set_Empty() { m_data = nullptr; }
+    void Take(AsciiString &string) { m_data = string.m_data; string.m_data = nullptr; }
+
     AsciiStringData *m_data;
+#endif // GAME_ASCIISTRING_SSO
 };
 
-inline bool operator==(AsciiString const &left, AsciiString const &right) { return left.Compare(right) == 0; }
+inline AsciiString &AsciiString::operator=(AsciiString &&stringSrc)
+{
+    if ( &stringSrc != this ) {
+        Release_Buffer();
+        Take(stringSrc);
+    }
+
+    return *this;
+}
+
+inline bool operator==(AsciiString const &left, AsciiString const &right) { return left.Equals(right); }
 inline bool operator==(AsciiString const &left, char const *right) { return left.Compare(right) == 0; }
 inline bool operator==(char const *left, AsciiString const &right) { return right.Compare(left) == 0; }
 
-inline bool operator!=(AsciiString const &left, AsciiString const &right) { return left.Compare(right) != 0; }
+inline bool operator!=(AsciiString const &left, AsciiString const &right) { return !left.Equals(right); }
 inline bool operator!=(AsciiString const &left, char const *right) { return left.Compare(right) != 0; }
 inline bool operator!=(char const *left, AsciiString const &right) { return right.Compare(left) != 0; }
 
@@ -166,4 +246,18 @@ inline bool operator>(AsciiString const &left, AsciiString const &right) { retur
 inline bool operator>(AsciiString const &left, char const *right) { return left.Compare(right) < 0; }
 inline bool operator>(char const *left, AsciiString const &right) { return right.Compare(left) >= 0; }
 
+//
+// Hash functors for hashed containers keyed on AsciiString, the no case one
+// pairs with rts::equal_to_nocase.
+//
+struct AsciiStringHash
+{
+    size_t operator()(AsciiString const &string) const { return string.Get_Hash(); }
+};
+
+struct AsciiStringHashNoCase
+{
+    size_t operator()(AsciiString const &string) const { return string.Get_Hash_No_Case(); }
+};
+
 #endif // _ASCIISTRING_H_
@@ -0,0 +1,171 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: ASCIISTRINGVIEW.CPP
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Non owning view of chars for tokenizing without
+//                 allocating, and a stack backed AsciiString for lookups.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "asciistringview.h"
+#include "casefold.h"
+#include "gamedebug.h"
+#include "minmax.h"
+
+char AsciiStringView::Get_Char(int index) const
+{
+    ASSERT_PRINT(index >= 0, "Index must be 0 or greater.\n");
+    ASSERT_PRINT(index < m_length, "Index must be less than the length of the view.\n");
+
+    return m_chars[index];
+}
+
+int AsciiStringView::Compare(AsciiStringView const &view) const
+{
+    int result = memcmp(m_chars, view.m_chars, MIN(m_length, view.m_length));
+
+    if ( result != 0 ) {
+        return result;
+    }
+
+    return m_length - view.m_length;
+}
+
+int AsciiStringView::Compare_No_Case(AsciiStringView const &view) const
+{
+    int result = strncasecmp(m_chars, view.m_chars, MIN(m_length, view.m_length));
+
+    if ( result != 0 ) {
+        return result;
+    }
+
+    return m_length - view.m_length;
+}
+
+bool AsciiStringView::Equals(AsciiStringView const &view) const
+{
+    return m_length == view.m_length && memcmp(m_chars, view.m_chars, m_length) == 0;
+}
+
+bool AsciiStringView::Equals_No_Case(AsciiStringView const &view) const
+{
+    return m_length == view.m_length && strncasecmp(m_chars, view.m_chars, m_length) == 0;
+}
+
+//
+// Works like AsciiString::Next_Token, a failed call empties both this view
+// and tok, a good one leaves this view starting at the delimiter after tok.
+//
+bool AsciiStringView::Next_Token(AsciiStringView *tok, char const *seps)
+{
+    if ( m_length <= 0 || this == tok ) {
+        return false;
+    }
+
+    //
+    // If no separators provided, default to white space.
+    //
+    if ( seps == nullptr ) {
+        seps = " \n\r\t";
+    }
+
+    char const *end = m_chars + m_length;
+    char const *start = m_chars;
+
+    while ( start < end && strchr(seps, *start) != nullptr ) {
+        ++start;
+    }
+
+    if ( start == end ) {
+        *this = AsciiStringView();
+        *tok = AsciiStringView();
+
+        return false;
+    }
+
+    char const *tok_end = start;
+
+    while ( tok_end < end && strchr(seps, *tok_end) == nullptr ) {
+        ++tok_end;
+    }
+
+    *tok = AsciiStringView(start, tok_end - start);
+    m_chars = tok_end;
+    m_length = end - tok_end;
+
+    return true;
+}
+
+AsciiString AsciiStringView::To_String() const
+{
+    AsciiString string;
+
+    if ( m_length > 0 ) {
+        char *buf = string.Get_Buffer_For_Read(m_length);
+        memcpy(buf, m_chars, m_length);
+        buf[m_length] = '\0';
+    }
+
+    return string;
+}
+
+AsciiStringKey::AsciiStringKey(AsciiStringView const &view, bool lower)
+{
+    int len = view.Get_Length();
+
+    //
+    // Too long for the stack, make do with a real string.
+    //
+    if ( len >= KEY_BUF_LEN ) {
+        m_string = view.To_String();
+
+        if ( lower ) {
+            m_string.To_Lower();
+        }
+
+        return;
+    }
+
+    memcpy(m_buffer.chars, view.Peek(), len);
+    m_buffer.chars[len] = '\0';
+
+    if ( lower ) {
+        Lower_Chars(m_buffer.chars, len);
+    }
+
+    //
+    // The key holds the only reference for as long as it lives, the destructor
+    // drops it without going through Release_Buffer.
+    //
+    m_buffer.header.ref_count = 1;
+    m_buffer.header.num_chars_allocated = KEY_BUF_LEN;
+#ifdef GAME_DEBUG_STRUCTS
+    m_buffer.header.debug_ptr = m_buffer.chars;
+#endif // GAME_DEBUG_STRUCTS
+
+    m_string.Set_Heap_Data(&m_buffer.header);
+    m_string.Set_Data_Length(len);
+}
+
+AsciiStringKey::~AsciiStringKey()
+{
+    if ( m_string.Get_Data() == &m_buffer.header ) {
+        ASSERT_PRINT(m_buffer.header.ref_count == 1, "AsciiStringKey was copied, the copy will outlive its buffer.\n");
+        m_string.Set_Empty();
+    }
+}
@@ -0,0 +1,115 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: ASCIISTRINGVIEW.H
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Non owning view of chars for tokenizing without
+//                 allocating, and a stack backed AsciiString for lookups.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifdef _MSC_VER
+#pragma once
+#endif // _MSC_VER
+
+#ifndef _ASCIISTRINGVIEW_H_
+#define _ASCIISTRINGVIEW_H_
+
+#include "always.h"
+#include "asciistring.h"
+
+//
+// A pointer and a length into chars owned by someone else, usually the
+// AsciiString or C string a path came in as. The chars are not terminated so
+// pass Peek() on with Get_Length(). The view is only good for as long as the
+// chars it looks at are left alone.
+//
+class AsciiStringView
+{
+public:
+    AsciiStringView() : m_chars(""), m_length(0) {}
+    AsciiStringView(char const *s) : m_chars(s), m_length(strlen(s)) {}
+    AsciiStringView(char const *s, int len) : m_chars(s), m_length(len) {}
+    AsciiStringView(AsciiString const &string) : m_chars(string.Str()), m_length(string.Get_Length()) {}
+
+    char const *Peek() const { return m_chars; }
+    int Get_Length() const { return m_length; }
+    char Get_Char(int index) const;
+
+    bool Is_Empty() const { return m_length <= 0; }
+    bool Is_Not_Empty() const { return !Is_Empty(); }
+
+    char const *Find(char c) const { return static_cast<char const *>(memchr(m_chars, c, m_length)); }
+
+    int Compare(AsciiStringView const &view) const;
+    int Compare_No_Case(AsciiStringView const &view) const;
+    bool Equals(AsciiStringView const &view) const;
+    bool Equals_No_Case(AsciiStringView const &view) const;
+
+    // Match AsciiString::Get_Hash and Get_Hash_No_Case for the same chars.
+    uint32_t Get_Hash() const { return AsciiString::Hash_Chars(m_chars, m_length, false); }
+    uint32_t Get_Hash_No_Case() const { return AsciiString::Hash_Chars(m_chars, m_length, true); }
+
+    // Same rules as AsciiString::Next_Token, tok ends up looking into the same chars.
+    bool Next_Token(AsciiStringView *tok, char const *seps);
+
+    AsciiString To_String() const;
+
+private:
+    char const *m_chars;
+    int m_length;
+};
+
+//
+// Stands in for an AsciiString as the key to find() in containers keyed on
+// one. Short keys are copied onto the stack behind an AsciiStringData header
+// that is never released, so making one costs no allocation.
+// Only for lookups, anything that keeps a copy of the key such as operator[]
+// or insert would end up sharing the stack buffer.
+//
+class AsciiStringKey
+{
+public:
+    enum {
+        KEY_BUF_LEN = 256,  // Includes the terminator, longer keys go on the heap.
+    };
+
+    explicit AsciiStringKey(AsciiStringView const &view, bool lower = false);
+    ~AsciiStringKey();
+
+    operator AsciiString const &() const { return m_string; }
+    AsciiString const &Get() const { return m_string; }
+
+private:
+    // Not copyable, the copy would point at this one's buffer.
+    AsciiStringKey(AsciiStringKey const &that);
+    AsciiStringKey &operator=(AsciiStringKey const &that);
+
+    struct KeyBuffer
+    {
+        AsciiString::AsciiStringData header;
+        char chars[KEY_BUF_LEN];
+    };
+
+    AsciiString m_string;
+    KeyBuffer m_buffer;
+};
+
+inline bool operator==(AsciiStringView const &left, AsciiStringView const &right) { return left.Equals(right); }
+inline bool operator!=(AsciiStringView const &left, AsciiStringView const &right) { return !left.Equals(right); }
+
+#endif // _ASCIISTRINGVIEW_H_
@@ -0,0 +1,411 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: CASEFOLD.CPP
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: ASCII case insensitive compares and lower casing with SSE2
+//                 and AVX2 versions picked at run time.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "casefold.h"
+#include <cstring>
+
+#if (defined PROCESSOR_X86 || defined PROCESSOR_X86_64) && (defined COMPILER_MSVC || defined COMPILER_GNUC || defined COMPILER_CLANG)
+#define CASEFOLD_X86
+#endif
+
+#ifdef CASEFOLD_X86
+#include <immintrin.h>
+#ifdef COMPILER_MSVC
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif // COMPILER_MSVC
+#endif // CASEFOLD_X86
+
+//
+// GCC and Clang only allow the intrinsics in functions marked for the
+// instruction set, MSVC allows them anywhere.
+//
+#if defined COMPILER_GNUC || defined COMPILER_CLANG
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+struct CaseFoldFuncs
+{
+    int (*Find_Upper)(char const *s, int len);
+    void (*Lower)(char *s, int len);
+};
+
+static inline unsigned char Fold_Char(unsigned char c)
+{
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+static inline int Lowest_Set_Bit(uint32_t bits)
+{
+#ifdef COMPILER_MSVC
+    unsigned long index;
+    _BitScanForward(&index, bits);
+
+    return index;
+#elif defined COMPILER_GNUC || defined COMPILER_CLANG
+    return __builtin_ctz(bits);
+#endif
+}
+
+/////////
+// Scalar
+/////////
+
+static int Find_Upper_Scalar(char const *s, int len)
+{
+    for ( int i = 0; i < len; ++i ) {
+        if ( s[i] >= 'A' && s[i] <= 'Z' ) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void Lower_Scalar(char *s, int len)
+{
+    for ( int i = 0; i < len; ++i ) {
+        s[i] = Fold_Char(s[i]);
+    }
+}
+
+static CaseFoldFuncs const ScalarFuncs = { Find_Upper_Scalar, Lower_Scalar };
+
+#ifdef CASEFOLD_X86
+///////
+// SWAR
+///////
+
+//
+// Eight chars at a time in a plain register for what is left under a vector.
+// Bytes from 0x80 up are dropped from the A-Z mask before it is shifted down
+// to the 0x20 case bit.
+//
+static inline uint64_t Upper_Mask_8(uint64_t x)
+{
+    uint64_t const ones = 0x0101010101010101ull;
+    uint64_t low = x & (ones * 0x7F);
+    uint64_t at_least_a = low + ones * (0x80 - 'A');
+    uint64_t past_z = low + ones * (0x80 - 'Z' - 1);
+
+    return at_least_a & ~past_z & ~x & (ones * 0x80);
+}
+
+static inline uint64_t Fold_8(uint64_t x)
+{
+    return x | (Upper_Mask_8(x) >> 2);
+}
+
+static inline uint64_t Load_8(char const *s)
+{
+    uint64_t x;
+    memcpy(&x, s, sizeof(x));
+
+    return x;
+}
+
+static inline int Lowest_Set_Byte(uint64_t bits)
+{
+    uint32_t low = uint32_t(bits);
+
+    return low != 0 ? Lowest_Set_Bit(low) / 8 : 4 + Lowest_Set_Bit(uint32_t(bits >> 32)) / 8;
+}
+
+//
+// Under 16 chars, two 8 char reads that overlap in the middle cover 8 to 16
+// and anything shorter goes a char at a time.
+//
+static inline int Find_Upper_Short(char const *s, int len)
+{
+    if ( len < 8 ) {
+        return Find_Upper_Scalar(s, len);
+    }
+
+    uint64_t upper = Upper_Mask_8(Load_8(s));
+
+    if ( upper != 0 ) {
+        return Lowest_Set_Byte(upper);
+    }
+
+    upper = Upper_Mask_8(Load_8(s + len - 8));
+
+    return upper != 0 ? len - 8 + Lowest_Set_Byte(upper) : -1;
+}
+
+static inline void Lower_Short(char *s, int len)
+{
+    if ( len < 8 ) {
+        Lower_Scalar(s, len);
+
+        return;
+    }
+
+    // Lowering twice is harmless so the overlap needs no care.
+    uint64_t head = Fold_8(Load_8(s));
+    uint64_t tail = Fold_8(Load_8(s + len - 8));
+    memcpy(s, &head, sizeof(head));
+    memcpy(s + len - 8, &tail, sizeof(tail));
+}
+#endif // CASEFOLD_X86
+
+#ifdef CASEFOLD_X86
+///////
+// SSE2
+///////
+
+//
+// Signed compares, so bytes from 0x80 up count as negative and are never
+// taken for A-Z.
+//
+TARGET_SSE2 static inline __m128i Upper_Mask_16(__m128i x)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(x, _mm_set1_epi8('Z' + 1)));
+}
+
+TARGET_SSE2 static inline __m128i Fold_16(__m128i x)
+{
+    return _mm_or_si128(x, _mm_and_si128(Upper_Mask_16(x), _mm_set1_epi8('a' - 'A')));
+}
+
+TARGET_SSE2 static inline uint32_t Find_Upper_Mask_16(char const *s)
+{
+    return _mm_movemask_epi8(Upper_Mask_16(_mm_loadu_si128(reinterpret_cast<__m128i const *>(s))));
+}
+
+TARGET_SSE2 static inline void Lower_16(char *s)
+{
+    __m128i *p = reinterpret_cast<__m128i *>(s);
+    _mm_storeu_si128(p, Fold_16(_mm_loadu_si128(p)));
+}
+
+//
+// The last block is read ending on the last char, overlapping the one before
+// rather than falling back to a char at a time.
+//
+TARGET_SSE2 static int Find_Upper_SSE2(char const *s, int len)
+{
+    if ( len < 16 ) {
+        return Find_Upper_Short(s, len);
+    }
+
+    for ( int i = 0; i < len - 16; i += 16 ) {
+        uint32_t upper = Find_Upper_Mask_16(s + i);
+
+        if ( upper != 0 ) {
+            return i + Lowest_Set_Bit(upper);
+        }
+    }
+
+    uint32_t upper = Find_Upper_Mask_16(s + len - 16);
+
+    return upper != 0 ? len - 16 + Lowest_Set_Bit(upper) : -1;
+}
+
+TARGET_SSE2 static void Lower_SSE2(char *s, int len)
+{
+    if ( len < 16 ) {
+        Lower_Short(s, len);
+
+        return;
+    }
+
+    for ( int i = 0; i < len - 16; i += 16 ) {
+        Lower_16(s + i);
+    }
+
+    Lower_16(s + len - 16);
+}
+
+static CaseFoldFuncs const SSE2Funcs = { Find_Upper_SSE2, Lower_SSE2 };
+
+///////
+// AVX2
+///////
+
+TARGET_AVX2 static inline __m256i Upper_Mask_32(__m256i x)
+{
+    return _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), x));
+}
+
+TARGET_AVX2 static inline __m256i Fold_32(__m256i x)
+{
+    return _mm256_or_si256(x, _mm256_and_si256(Upper_Mask_32(x), _mm256_set1_epi8('a' - 'A')));
+}
+
+TARGET_AVX2 static int Find_Upper_AVX2(char const *s, int len)
+{
+    if ( len < 32 ) {
+        return Find_Upper_SSE2(s, len);
+    }
+
+    for ( int i = 0; i < len - 32; i += 32 ) {
+        uint32_t upper = _mm256_movemask_epi8(Upper_Mask_32(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(s + i))));
+
+        if ( upper != 0 ) {
+            return i + Lowest_Set_Bit(upper);
+        }
+    }
+
+    uint32_t upper = _mm256_movemask_epi8(Upper_Mask_32(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(s + len - 32))));
+
+    return upper != 0 ? len - 32 + Lowest_Set_Bit(upper) : -1;
+}
+
+TARGET_AVX2 static void Lower_AVX2(char *s, int len)
+{
+    if ( len < 32 ) {
+        Lower_SSE2(s, len);
+
+        return;
+    }
+
+    for ( int i = 0; i < len - 32; i += 32 ) {
+        __m256i *p = reinterpret_cast<__m256i *>(s + i);
+        _mm256_storeu_si256(p, Fold_32(_mm256_loadu_si256(p)));
+    }
+
+    __m256i *p = reinterpret_cast<__m256i *>(s + len - 32);
+    _mm256_storeu_si256(p, Fold_32(_mm256_loadu_si256(p)));
+}
+
+static CaseFoldFuncs const AVX2Funcs = { Find_Upper_AVX2, Lower_AVX2 };
+
+static void Cpu_Id(uint32_t regs[4], uint32_t leaf)
+{
+#ifdef COMPILER_MSVC
+    __cpuidex(reinterpret_cast<int *>(regs), leaf, 0);
+#else
+    __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif // COMPILER_MSVC
+}
+
+// Which register states the OS saves, AVX needs it to keep the YMM halves.
+static uint32_t Get_XCR0()
+{
+#ifdef COMPILER_MSVC
+    return uint32_t(_xgetbv(0));
+#else
+    uint32_t eax;
+    uint32_t edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+
+    return eax;
+#endif // COMPILER_MSVC
+}
+#endif // CASEFOLD_X86
+
+static CaseFoldLevel Detect_Level()
+{
+#ifdef CASEFOLD_X86
+    uint32_t regs[4];
+
+    Cpu_Id(regs, 0);
+    uint32_t max_leaf = regs[0];
+
+    Cpu_Id(regs, 1);
+
+    if ( (regs[3] & (1 << 26)) == 0 ) {
+        return CASEFOLD_SCALAR;
+    }
+
+    bool osxsave = (regs[2] & (1 << 27)) != 0;
+    bool avx = (regs[2] & (1 << 28)) != 0;
+
+    if ( max_leaf >= 7 && osxsave && avx && (Get_XCR0() & 6) == 6 ) {
+        Cpu_Id(regs, 7);
+
+        if ( (regs[1] & (1 << 5)) != 0 ) {
+            return CASEFOLD_AVX2;
+        }
+    }
+
+    return CASEFOLD_SSE2;
+#else
+    return CASEFOLD_SCALAR;
+#endif // CASEFOLD_X86
+}
+
+static CaseFoldLevel SupportedLevel;
+static CaseFoldLevel CurrentLevel;
+static CaseFoldFuncs const *CurrentFuncs;
+
+static CaseFoldFuncs const *Funcs_For_Level(CaseFoldLevel level)
+{
+    switch ( level ) {
+#ifdef CASEFOLD_X86
+        case CASEFOLD_AVX2:
+            return &AVX2Funcs;
+        case CASEFOLD_SSE2:
+            return &SSE2Funcs;
+#endif // CASEFOLD_X86
+        default:
+            return &ScalarFuncs;
+    }
+}
+
+//
+// Threads racing the first call all pick the same table, so no lock.
+//
+static CaseFoldFuncs const *Get_Funcs()
+{
+    if ( CurrentFuncs == nullptr ) {
+        SupportedLevel = Detect_Level();
+        CurrentLevel = SupportedLevel;
+        CurrentFuncs = Funcs_For_Level(SupportedLevel);
+    }
+
+    return CurrentFuncs;
+}
+
+int Find_Upper_Char(char const *s, int len)
+{
+    return Get_Funcs()->Find_Upper(s, len);
+}
+
+void Lower_Chars(char *s, int len)
+{
+    Get_Funcs()->Lower(s, len);
+}
+
+CaseFoldLevel Get_Case_Fold_Level()
+{
+    Get_Funcs();
+
+    return CurrentLevel;
+}
+
+CaseFoldLevel Set_Case_Fold_Level(CaseFoldLevel level)
+{
+    Get_Funcs();
+
+    CurrentLevel = level < SupportedLevel ? level : SupportedLevel;
+    CurrentFuncs = Funcs_For_Level(CurrentLevel);
+
+    return CurrentLevel;
+}
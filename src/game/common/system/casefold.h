@@ -0,0 +1,58 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: CASEFOLD.H
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: ASCII case insensitive compares and lower casing with SSE2
+//                 and AVX2 versions picked at run time.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifdef _MSC_VER
+#pragma once
+#endif // _MSC_VER
+
+#ifndef _CASEFOLD_H_
+#define _CASEFOLD_H_
+
+#include "always.h"
+
+//
+// Only A-Z fold, the same as tolower in the C locale the game runs in. Lengths
+// are always passed so nothing reads past the chars, AsciiString has them to
+// hand anyway.
+// The widest version the CPU and OS support is picked on first use, x86 builds
+// carry all three and anything else only has the scalar one.
+// Only lowering is here, no case compares stay on strcasecmp as vector compares
+// lost to it on the short paths the game uses.
+//
+enum CaseFoldLevel
+{
+    CASEFOLD_SCALAR,
+    CASEFOLD_SSE2,
+    CASEFOLD_AVX2,
+};
+
+// Index of the first A-Z, -1 if there isn't one.
+int Find_Upper_Char(char const *s, int len);
+void Lower_Chars(char *s, int len);
+
+CaseFoldLevel Get_Case_Fold_Level();
+// For benchmarks and tests, asking for more than the CPU has gets what it has.
+CaseFoldLevel Set_Case_Fold_Level(CaseFoldLevel level);
+
+#endif // _CASEFOLD_H_
@@ -0,0 +1,249 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: FRAMEARENA.CPP
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Bump pointer arena for allocations that only live until the
+//                 end of the current frame.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "framearena.h"
+#include "gamedebug.h"
+#include "minmax.h"
+#include "mempool.h"
+#include "rawalloc.h"
+
+char *FrameArena::Base = nullptr;
+char *FrameArena::Top = nullptr;
+char *FrameArena::Committed = nullptr;
+unsigned FrameArena::Frame = 0;
+int FrameArena::LiveObjects = 0;
+int FrameArena::PeakBytes = 0;
+#ifdef PLATFORM_WINDOWS
+DWORD FrameArena::OwnerThread;
+#else
+pthread_t FrameArena::OwnerThread;
+#endif // PLATFORM_WINDOWS
+
+#ifdef GAME_DEBUG_LOG
+static unsigned const FRAME_STAMP_MAGIC = 0xF4A3E5A7;
+static unsigned char const FRAME_POISON = 0xDD;
+#endif // GAME_DEBUG_LOG
+
+void FrameArena::Init()
+{
+    if ( Base != nullptr ) {
+        return;
+    }
+
+    Base = static_cast<char *>(Raw_Reserve(RESERVE_SIZE));
+
+    if ( Base == nullptr ) {
+        DEBUG_LOG("Failed to reserve frame arena, frame allocations will use the pools.\n");
+
+        return;
+    }
+
+    Top = Base;
+    Committed = Base;
+    Frame = 0;
+    LiveObjects = 0;
+    PeakBytes = 0;
+
+    // Until the frame loop calls Reset assume the thread starting things up owns it.
+#ifdef PLATFORM_WINDOWS
+    OwnerThread = GetCurrentThreadId();
+#else
+    OwnerThread = pthread_self();
+#endif // PLATFORM_WINDOWS
+}
+
+void FrameArena::Shutdown()
+{
+    if ( Base == nullptr ) {
+        return;
+    }
+
+    Raw_Decommit(Base, int(Committed - Base));
+    Raw_Release(Base, RESERVE_SIZE);
+    Base = nullptr;
+    Top = nullptr;
+    Committed = nullptr;
+}
+
+void FrameArena::Reset()
+{
+    if ( Base == nullptr ) {
+        return;
+    }
+
+#ifdef GAME_DEBUG_LOG
+    if ( LiveObjects != 0 ) {
+        DEBUG_LOG("%d frame arena objects escaped frame %u.\n", LiveObjects, Frame);
+    }
+
+    Poison(Base, Top);
+#endif // GAME_DEBUG_LOG
+
+    //
+    // Whoever runs the frame loop owns the arena, no allocations are live at
+    // this point so it is safe to hand it over.
+    //
+#ifdef PLATFORM_WINDOWS
+    OwnerThread = GetCurrentThreadId();
+#else
+    OwnerThread = pthread_self();
+#endif // PLATFORM_WINDOWS
+
+    Top = Base;
+    LiveObjects = 0;
+    ++Frame;
+}
+
+void *FrameArena::Allocate(int bytes)
+{
+    if ( Base == nullptr || !Is_Owner_Thread() ) {
+        return nullptr;
+    }
+
+    int size = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+    if ( size > Committed - Top ) {
+        int needed = int(Top + size - Committed);
+        int commit = (needed + COMMIT_STEP - 1) & ~(COMMIT_STEP - 1);
+
+        if ( commit > Base + RESERVE_SIZE - Committed || !Raw_Commit(Committed, commit, false) ) {
+            return nullptr;
+        }
+
+        Committed += commit;
+    }
+
+    void *block = Top;
+    Top += size;
+    PeakBytes = MAX(PeakBytes, int(Top - Base));
+
+    return block;
+}
+
+void *FrameArena::Allocate_Object(MemoryPool *fallback)
+{
+    int size = fallback->Get_Alloc_Size();
+
+    //
+    // The arena only keeps ALIGNMENT, anything wanting more stays in its pool.
+    // Nothing would reclaim objects before the first frame has ended.
+    //
+    if ( fallback->Get_Alignment() > ALIGNMENT || Frame == 0 ) {
+        return fallback->Allocate_Block();
+    }
+
+#ifdef GAME_DEBUG_LOG
+    ObjectStamp *stamp = static_cast<ObjectStamp *>(Allocate(size + sizeof(ObjectStamp)));
+
+    if ( stamp == nullptr ) {
+        return fallback->Allocate_Block();
+    }
+
+    stamp->Frame = Frame;
+    stamp->Magic = FRAME_STAMP_MAGIC;
+    void *object = &stamp[1];
+#else
+    void *object = Allocate(size);
+
+    if ( object == nullptr ) {
+        return fallback->Allocate_Block();
+    }
+#endif // GAME_DEBUG_LOG
+
+    ++LiveObjects;
+
+    // Match what the pool would have handed out.
+    memset(object, 0, size);
+
+    return object;
+}
+
+#ifdef GAME_DEBUG_LOG
+void FrameArena::Free_Object(void *object)
+{
+    ObjectStamp *stamp = static_cast<ObjectStamp *>(object) - 1;
+
+    ASSERT_PRINT(Is_Owner_Thread(), "Frame arena object freed from another thread.\n");
+
+    if ( stamp->Magic != FRAME_STAMP_MAGIC || stamp->Frame != Frame ) {
+        DEBUG_LOG("Frame arena object %p freed after its frame ended.\n", object);
+
+        return;
+    }
+
+    // Catches a double free, the object would otherwise look live still.
+    stamp->Magic = 0;
+    --LiveObjects;
+}
+#endif // GAME_DEBUG_LOG
+
+FrameArena::Marker FrameArena::Get_Marker()
+{
+    Marker marker;
+    marker.Top = Top;
+    marker.LiveObjects = LiveObjects;
+    marker.Frame = Frame;
+
+    return marker;
+}
+
+void FrameArena::Rewind(Marker const &marker)
+{
+    //
+    // Scopes opened off the owner thread got nothing from us, nothing to undo.
+    // A Reset inside the scope already took back everything it had.
+    //
+    if ( Base == nullptr || !Is_Owner_Thread() || marker.Top == nullptr || marker.Frame != Frame ) {
+        return;
+    }
+
+    ASSERT_PRINT(marker.Top >= Base && marker.Top <= Top, "Frame arena marker is past the top.\n");
+
+#ifdef GAME_DEBUG_LOG
+    if ( LiveObjects != marker.LiveObjects ) {
+        DEBUG_LOG("%d frame arena objects escaped their scope.\n", LiveObjects - marker.LiveObjects);
+    }
+
+    Poison(marker.Top, Top);
+#endif // GAME_DEBUG_LOG
+
+    Top = marker.Top;
+    LiveObjects = marker.LiveObjects;
+}
+
+bool FrameArena::Is_Owner_Thread()
+{
+#ifdef PLATFORM_WINDOWS
+    return GetCurrentThreadId() == OwnerThread;
+#else
+    return pthread_equal(pthread_self(), OwnerThread) != 0;
+#endif // PLATFORM_WINDOWS
+}
+
+#ifdef GAME_DEBUG_LOG
+void FrameArena::Poison(char *start, char *end)
+{
+    memset(start, FRAME_POISON, end - start);
+}
+#endif // GAME_DEBUG_LOG
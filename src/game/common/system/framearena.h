@@ -0,0 +1,134 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: FRAMEARENA.H
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Bump pointer arena for allocations that only live until the
+//                 end of the current frame.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifdef _MSC_VER
+#pragma once
+#endif // _MSC_VER
+
+#ifndef _FRAMEARENA_H_
+#define _FRAMEARENA_H_
+
+#include "always.h"
+
+#ifndef PLATFORM_WINDOWS
+#include <pthread.h>
+#endif // !PLATFORM_WINDOWS
+
+class MemoryPool;
+
+//
+// Owned by the thread running the frame loop, other threads get nullptr from
+// Allocate and should fall back to the normal allocators. Everything handed
+// out is reclaimed in one go by Reset at the end of each frame.
+//
+// Only GameEngine::Update calls Reset and the DLL doesn't hook it, so inside
+// the original game no frame ever ends. Until Reset has run once frame objects
+// come from their pool instead, only scoped temporaries use the arena.
+// MemoryPool::Free_Block doesn't look for arena pointers so pool frees don't
+// pay for this, frame pool instances go back through Free_Pool_Instance.
+//
+// With GAME_DEBUG_LOG objects carry a small stamp so frees from a later frame,
+// objects still alive at Reset or Rewind and use after Reset can be caught.
+//
+class FrameArena
+{
+public:
+    enum {
+        RESERVE_SIZE = 32 * 1024 * 1024,
+        COMMIT_STEP = 0x40000,
+        ALIGNMENT = 16,
+    };
+
+    struct Marker
+    {
+        char *Top;
+        int LiveObjects;
+        unsigned Frame;
+    };
+
+    static void Init();
+    static void Shutdown();
+    static void Reset();
+
+    static void *Allocate(int bytes);
+    static void *Allocate_Object(MemoryPool *fallback);
+#ifdef GAME_DEBUG_LOG
+    static void Free_Object(void *object);
+#else
+    static void Free_Object(void *) { --LiveObjects; }
+#endif // GAME_DEBUG_LOG
+    static bool Owns(void const *ptr) { return uintptr_t(ptr) - uintptr_t(Base) < uintptr_t(Committed - Base); }
+
+    static Marker Get_Marker();
+    static void Rewind(Marker const &marker);
+
+    static unsigned Get_Frame() { return Frame; }
+    static int Get_Used_Bytes() { return int(Top - Base); }
+    static int Get_Peak_Bytes() { return PeakBytes; }
+
+private:
+    struct ObjectStamp
+    {
+        unsigned Frame;
+        unsigned Magic;
+        char Pad[ALIGNMENT - 2 * sizeof(unsigned)];
+    };
+
+    static bool Is_Owner_Thread();
+#ifdef GAME_DEBUG_LOG
+    static void Poison(char *start, char *end);
+#endif // GAME_DEBUG_LOG
+
+private:
+    static char *Base;
+    static char *Top;
+    static char *Committed;
+    static unsigned Frame;
+    static int LiveObjects;
+    static int PeakBytes;
+#ifdef PLATFORM_WINDOWS
+    static DWORD OwnerThread;
+#else
+    static pthread_t OwnerThread;
+#endif // PLATFORM_WINDOWS
+};
+
+//
+// Hands back everything allocated from the arena during its lifetime, for
+// nested temporaries that shouldn't wait for the end of the frame.
+//
+class FrameArenaScope
+{
+public:
+    FrameArenaScope() : Mark(FrameArena::Get_Marker()) {}
+    ~FrameArenaScope() { FrameArena::Rewind(Mark); }
+
+private:
+    FrameArenaScope(FrameArenaScope const &);
+    FrameArenaScope &operator=(FrameArenaScope const &);
+
+    FrameArena::Marker Mark;
+};
+
+#endif // _FRAMEARENA_H_
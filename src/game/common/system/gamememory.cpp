@@ -25,12 +25,17 @@
 #include "gamememory.h"
 #include "gamememoryinit.h"
 #include "critsection.h"
+#include "framearena.h"
 #include "gamedebug.h"
+#include "heapprofiler.h"
 #include "memblob.h"
 #include "memblock.h"
 #include "memdynalloc.h"
 #include "mempool.h"
 #include "mempoolfact.h"
+#include "memtag.h"
+#include "memthreadcache.h"
+#include "memtrace.h"
 #include "minmax.h"
 
 //////////
@@ -51,11 +56,15 @@ void Init_Memory_Manager()
 
     if ( TheMemoryPoolFactory == nullptr ) {
         DEBUG_LOG("Memory Manager initialising normally.\n");
+        MemoryPoolThreadCache::Init();
+        MemoryTag::Init();
+        FrameArena::Init();
+        // Read the ini first, it can override the DMA pool counts.
+        User_Memory_Init_Pools();
         User_Memory_Get_DMA_Params(&param_count, &params);
         TheMemoryPoolFactory = new MemoryPoolFactory;
         TheMemoryPoolFactory->Init();
         TheDynamicMemoryAllocator = TheMemoryPoolFactory->Create_Dynamic_Memory_Allocator(param_count, params);
-        User_Memory_Init_Pools();
         ThePreMainInitFlag = false;
     }
 
@@ -92,19 +101,40 @@ void Init_Memory_Manager_Pre_Main()
         DEBUG_INIT(DEBUG_LOG_TO_FILE);
         DEBUG_LOG("Memory Manager initialising prior to WinMain\n");
 
+        MemoryPoolThreadCache::Init();
+        MemoryTag::Init();
+        FrameArena::Init();
+        // Read the ini first, it can override the DMA pool counts.
+        User_Memory_Init_Pools();
         User_Memory_Get_DMA_Params(&param_count, &params);
         TheMemoryPoolFactory = new MemoryPoolFactory;
         TheMemoryPoolFactory->Init();
         TheDynamicMemoryAllocator = TheMemoryPoolFactory->Create_Dynamic_Memory_Allocator(param_count, params);
-        User_Memory_Init_Pools();
         ThePreMainInitFlag = true;
     }
 }
 
 void Shutdown_Memory_Manager()
 {
+    // Needs the pools still alive, does nothing unless tuning was turned on.
+    User_Memory_Write_Tuned_Pools();
+
+    // Flushes the trace MemoryPools.ini asked for, if any.
+    MemoryTrace::Stop();
+
+    // Same for the heap profile, while the pools it sampled are still there.
+    HeapProfiler::Finish();
+
+    if ( TheMemoryPoolFactory != nullptr ) {
+        TheMemoryPoolFactory->Finish_Stats_Dump();
+    }
+
     if ( !ThePreMainInitFlag ) {
         if ( TheMemoryPoolFactory != nullptr ) {
+            MemoryPoolThreadCache::Shutdown();
+            MemoryTag::Shutdown();
+            FrameArena::Shutdown();
+
             if ( TheDynamicMemoryAllocator != nullptr ) {
                 TheMemoryPoolFactory->Destroy_Dynamic_Memory_Allocator(TheDynamicMemoryAllocator);
                 TheDynamicMemoryAllocator = nullptr;
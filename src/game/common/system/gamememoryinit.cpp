@@ -24,17 +24,33 @@
 #include "gamememoryinit.h"
 #include "minmax.h"
 #include "gamedebug.h"
+#include "heapprofiler.h"
 #include "rawalloc.h"
+#include "memdynalloc.h"
+#include "mempool.h"
+#include "mempoolfact.h"
+#include "memtag.h"
+#include "memtrace.h"
 #include <cstdio>
 
-static PoolInitRec const UserDMAParameters[7] = {
+//
+// Intermediate classes between the powers of two keep the rounding waste for
+// common odd sizes such as 40, 72 or 136 bytes down to at most a third.
+//
+static PoolInitRec UserDMAParameters[] = {
     { "dmaPool_16",     16, 130000, 10000 },
-    { "dmaPool_32",     32, 250000, 10000 },
-    { "dmaPool_64",     64, 100000, 10000 },
-    { "dmaPool_128",   128,  80000, 10000 },
-    { "dmaPool_256",   256,  20000,  5000 },
-    { "dmaPool_512",   512,  16000,  5000 },
-    { "dmaPool_1024", 1024,   6000,  1024 },
+    { "dmaPool_24",     24, 100000, 10000 },
+    { "dmaPool_32",     32, 150000, 10000 },
+    { "dmaPool_48",     48,  50000, 10000 },
+    { "dmaPool_64",     64,  50000, 10000 },
+    { "dmaPool_96",     96,  40000,  5000 },
+    { "dmaPool_128",   128,  40000,  5000 },
+    { "dmaPool_192",   192,  10000,  2500 },
+    { "dmaPool_256",   256,  10000,  2500 },
+    { "dmaPool_384",   384,   8000,  2500 },
+    { "dmaPool_512",   512,   8000,  2500 },
+    { "dmaPool_768",   768,   3000,   512 },
+    { "dmaPool_1024", 1024,   3000,   512 },
 };
 
 static PoolSizeRec UserMemoryPools[] =
@@ -652,43 +668,109 @@ static PoolSizeRec UserMemoryPools[] =
     { nullptr, 0, 0 }       // Last entry always null.
 };
 
+//
+// Pools big and busy enough that TLB misses show up, their virtual ranges ask
+// for transparent huge pages where the platform supports it.
+//
+static char const *const UserHugePagePools[] = {
+    "dmaPool_32",
+    "SightingInfo",
+    "ParticlePool",
+    nullptr
+};
 
+//
+// Pools whose objects get swept in address order, they keep a bit per block
+// so MemoryPoolLiveIterator can find the live ones.
+//
+static char const *const UserLiveTrackedPools[] = {
+    "Drawable",
+    "ParticlePool",
+    "SightingInfo",
+    nullptr
+};
 
-void User_Memory_Adjust_Pool_Size(char const *name, int &initial_alloc, int &overflow_alloc)
+//
+// Pools only the client and renderer draw from. The headless profile gives
+// them no initial blob, their first allocation pulls in an overflow blob like
+// any other pool that ran out. "ClientOnly <pool>" lines in the ini add to the
+// list.
+//
+enum
 {
-    if ( initial_alloc > 0 ) {
-        return;
-    }
+    USER_CLIENT_ONLY_EXTRA = 64,
+};
 
-    for ( PoolSizeRec *psr = UserMemoryPools; psr->PoolName != nullptr; ++psr ) {
-        if ( strcmp(psr->PoolName, name) == 0 ) {
-            initial_alloc = psr->InitialAllocationCount;
-            overflow_alloc = psr->OverflowAllocationCount;
-        }
-    }
-}
+static char const *const UserClientOnlyPools[] = {
+    "Anim2D",
+    "Anim2DTemplate",
+    "DisplayString",
+    "Drawable",
+    "DrawableIconInfo",
+    "DrawableLocoInfo",
+    "Image",
+    "ParticlePool",
+    "ParticleSystemPool",
+    "WindowLayoutPool",
+    "AnimateWindow",
+    "GameFont",
+    "TintEnvelope",
+    "W3DDisplayString",
+    "W3DGameWindow",
+    "W3DDefaultDraw",
+    "W3DDebrisDraw",
+    "W3DModelDraw",
+    "W3DTankDraw",
+    "W3DTruckDraw",
+    "W3DTankTruckDraw",
+    "W3DTreeDraw",
+    "W3DPropDraw",
+    "W3DTracerDraw",
+    "W3DTreeTextureClass",
+    "W3DPrototypeClass",
+    "TextureClass",
+    "VertexMaterialClass",
+    "MeshClass",
+    "MeshModelClass",
+    "HLodClass",
+    "HTreeClass",
+    "Render2DClass",
+    "SurfaceClass",
+    "SortingNodeStruct",
+    "TerrainTracksRenderObjClass",
+    "DynamicIBAccessClass",
+    "DX8IndexBufferClass",
+    "SortingIndexBufferClass",
+    "DX8VertexBufferClass",
+    "SortingVertexBufferClass",
+    "DynD3DMATERIAL8",
+    "DynamicMatrix3D",
+    "FontCharsClass",
+    "FontCharsClassCharDataStruct",
+    "FontCharsBuffer",
+    "ThumbnailManagerClass",
+    "SmudgeSet",
+    "Smudge",
+    nullptr
+};
 
-void User_Memory_Get_DMA_Params(int *count, PoolInitRec const **params)
-{
-    DEBUG_LOG("Retrieving user DynamicMemoryAllocator parameters.\n");
+static char UserClientOnlyExtra[USER_CLIENT_ONLY_EXTRA][64];
+static int UserClientOnlyExtraCount = 0;
+static bool HeadlessProfile = false;
 
-    *count = 7; //Array size UserDMAParameters
-    *params = UserDMAParameters;
-}
+//
+// Recording mode for working out better pool sizes, see User_Memory_Write_Tuned_Pools.
+//
+static bool TunePools = false;
+static int TuneHeadroom = 20;
 
-void User_Memory_Init_Pools()
+static void Get_Ini_Path(char *path, char const *filename)
 {
-    DEBUG_LOG("Initialising user memory pools.\n");
-
-    char path[PATH_MAX];
-    char pool_name[256];
-    int initial_alloc;
-    int overflow_alloc;
-
 #ifdef PLATFORM_WINDOWS
     GetModuleFileNameA(0, path, PATH_MAX);
 #else
     // Cross-Platform TODO
+    *path = '\0';
 #endif
     //
     // Get path to current exe without filename.
@@ -708,27 +790,415 @@ void User_Memory_Init_Pools()
         *path_end = '\0';
     }
 
+    strcat(path, "/Data/INI/");
+    strcat(path, filename);
+}
+
+static int Tuned_Count(int peak)
+{
+    return MAX(1, peak + (peak * TuneHeadroom + 99) / 100);
+}
+
+//
+// Name hash index into UserMemoryPools, built on first use. Slots hold the table
+// index plus one so zero is empty. A name listed twice keeps the later entry,
+// which is the one a straight search of the table would settle on.
+//
+enum
+{
+    USER_POOL_INDEX_SIZE = 2048,
+};
+
+static short UserPoolIndex[USER_POOL_INDEX_SIZE];
+static bool UserPoolIndexBuilt = false;
+
+static void Build_User_Pool_Index()
+{
+    static_assert(sizeof(UserMemoryPools) / sizeof(UserMemoryPools[0]) < USER_POOL_INDEX_SIZE * 3 / 4, "User pool index too small.");
+
+    for ( int i = 0; UserMemoryPools[i].PoolName != nullptr; ++i ) {
+        int slot = Pool_Name_Hash(UserMemoryPools[i].PoolName) & (USER_POOL_INDEX_SIZE - 1);
+
+        while ( UserPoolIndex[slot] != 0
+            && strcasecmp(UserMemoryPools[UserPoolIndex[slot] - 1].PoolName, UserMemoryPools[i].PoolName) != 0 ) {
+            slot = (slot + 1) & (USER_POOL_INDEX_SIZE - 1);
+        }
+
+        UserPoolIndex[slot] = i + 1;
+    }
+
+    UserPoolIndexBuilt = true;
+}
+
+//
+// Names from the game are matched exactly, names from the ini ignore case. The
+// hash folds case so both probe the same slots.
+//
+static PoolSizeRec *Find_User_Pool(char const *name, unsigned hash, bool ignore_case)
+{
+    if ( !UserPoolIndexBuilt ) {
+        Build_User_Pool_Index();
+    }
+
+    for ( int slot = hash & (USER_POOL_INDEX_SIZE - 1); UserPoolIndex[slot] != 0; slot = (slot + 1) & (USER_POOL_INDEX_SIZE - 1) ) {
+        PoolSizeRec *psr = &UserMemoryPools[UserPoolIndex[slot] - 1];
+
+        if ( (ignore_case ? strcasecmp(psr->PoolName, name) : strcmp(psr->PoolName, name)) == 0 ) {
+            return psr;
+        }
+    }
+
+    return nullptr;
+}
+
+void User_Memory_Adjust_Pool_Size(char const *name, int &initial_alloc, int &overflow_alloc)
+{
+    User_Memory_Adjust_Pool_Size(name, Pool_Name_Hash(name), initial_alloc, overflow_alloc);
+}
+
+static bool Is_Client_Only_Pool(char const *name)
+{
+    for ( char const *const *i = UserClientOnlyPools; *i != nullptr; ++i ) {
+        if ( strcmp(*i, name) == 0 ) {
+            return true;
+        }
+    }
+
+    for ( int i = 0; i < UserClientOnlyExtraCount; ++i ) {
+        if ( strcasecmp(UserClientOnlyExtra[i], name) == 0 ) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void User_Memory_Adjust_Pool_Size(char const *name, unsigned hash, int &initial_alloc, int &overflow_alloc)
+{
+    //
+    // Checked ahead of any count the caller passed, the profile wins over both
+    // the table and the code's own defaults. Overflow still comes from wherever
+    // it would have.
+    //
+    if ( HeadlessProfile && Is_Client_Only_Pool(name) ) {
+        if ( initial_alloc <= 0 ) {
+            PoolSizeRec *psr = Find_User_Pool(name, hash, false);
+
+            if ( psr != nullptr ) {
+                overflow_alloc = psr->OverflowAllocationCount;
+            }
+        }
+
+        initial_alloc = 0;
+
+        return;
+    }
+
+    if ( initial_alloc > 0 ) {
+        return;
+    }
+
+    PoolSizeRec *psr = Find_User_Pool(name, hash, false);
+
+    if ( psr != nullptr ) {
+        initial_alloc = psr->InitialAllocationCount;
+        overflow_alloc = psr->OverflowAllocationCount;
+    }
+}
+
+bool User_Memory_Use_Huge_Pages(char const *name)
+{
+    for ( char const *const *i = UserHugePagePools; *i != nullptr; ++i ) {
+        if ( strcmp(*i, name) == 0 ) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool User_Memory_Track_Live_Blocks(char const *name)
+{
+    for ( char const *const *i = UserLiveTrackedPools; *i != nullptr; ++i ) {
+        if ( strcmp(*i, name) == 0 ) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void User_Memory_Set_Headless(bool headless)
+{
+    if ( headless != HeadlessProfile ) {
+        DEBUG_LOG("%s headless memory pool profile.\n", headless ? "Using" : "Leaving");
+    }
+
+    HeadlessProfile = headless;
+}
+
+void User_Memory_Get_DMA_Params(int *count, PoolInitRec const **params)
+{
+    DEBUG_LOG("Retrieving user DynamicMemoryAllocator parameters.\n");
+
+    *count = ARRAY_SIZE(UserDMAParameters);
+    *params = UserDMAParameters;
+}
+
+void User_Memory_Set_Tuning(bool enabled, int headroom_percent)
+{
+    TunePools = enabled;
+    TuneHeadroom = MAX(0, headroom_percent);
+    DynamicMemoryAllocator::Set_Record_Requests(enabled);
+}
+
+void User_Memory_Init_Pools()
+{
+    DEBUG_LOG("Initialising user memory pools.\n");
+
+    char path[PATH_MAX];
+    char pool_name[256];
+    char format[16];
+    int initial_alloc;
+    int overflow_alloc;
+    bool prefault = false;
+    bool release_empties = false;
+
     //
     // Get the path to the user configurable memory pool ini.
     //
-    strcat(path, "/Data/INI/MemoryPools.ini");
+    Get_Ini_Path(path, "MemoryPools.ini");
 
     FILE *fp = fopen(path, "r");
 
     //
     // Go through file and match entries against internal table and update
     // table as needed. If a pool name is specified twice, last entry wins.
+    // A "TunePools <headroom %>" line turns on recording for the tuner and a
+    // "ResetRetain <peak %>" line sets how much capacity pools keep across resets.
+    // "MemoryTags 1" turns on memory tags, "TagBudget <tag> <KiB>" gives a tag a
+    // soft budget and turns them on too. "MemoryTrace <file>" records every
+    // allocation from here on for memreplay. "HeapProfile <file> <sample bytes>"
+    // samples allocations and writes a pprof heap profile at shutdown, a sample
+    // size of 0 takes the default. "PoolProfile Headless" leaves the
+    // client only pools empty until used and "ClientOnly <pool>" adds a pool to
+    // that list. "StatsDump <file> <csv|json> <seconds>" appends the pool stats
+    // to the file every so many seconds and once more at shutdown.
+    // On the first frame after each load "ReleaseEmpties 1" hands empty pool
+    // blobs back and "PrefaultPools 1" faults the rest of the pools in.
     //
     if ( fp != nullptr ) {
         while ( fgets(path, PATH_MAX, fp) != nullptr ) {
-            if ( *path != ';' && sscanf(path, "%s %d %d", pool_name, &initial_alloc, &overflow_alloc) == 3 ) {
-                for ( PoolSizeRec *psr = UserMemoryPools; psr->PoolName != nullptr; ++psr ) {
-                    if ( strcasecmp(psr->PoolName, pool_name) == 0 ) {
-                        psr->InitialAllocationCount = MAX((int)sizeof(void*), Round_Up_Word_Size(initial_alloc));
-                        psr->OverflowAllocationCount = MAX((int)sizeof(void*), Round_Up_Word_Size(overflow_alloc));
+            if ( *path == ';' ) {
+                continue;
+            }
+
+            if ( sscanf(path, "%s %d %d", pool_name, &initial_alloc, &overflow_alloc) == 3 ) {
+                initial_alloc = MAX((int)sizeof(void*), Round_Up_Word_Size(initial_alloc));
+                overflow_alloc = MAX((int)sizeof(void*), Round_Up_Word_Size(overflow_alloc));
+
+                PoolSizeRec *psr = Find_User_Pool(pool_name, Pool_Name_Hash(pool_name), true);
+
+                if ( psr != nullptr ) {
+                    psr->InitialAllocationCount = initial_alloc;
+                    psr->OverflowAllocationCount = overflow_alloc;
+                }
+
+                for ( int i = 0; i < int(ARRAY_SIZE(UserDMAParameters)); ++i ) {
+                    if ( strcasecmp(UserDMAParameters[i].PoolName, pool_name) == 0 ) {
+                        UserDMAParameters[i].InitialAllocationCount = initial_alloc;
+                        UserDMAParameters[i].OverflowAllocationCount = overflow_alloc;
                     }
                 }
+            } else if ( sscanf(path, "TunePools %d", &initial_alloc) == 1 ) {
+                User_Memory_Set_Tuning(true, initial_alloc);
+            } else if ( sscanf(path, "ResetRetain %d", &initial_alloc) == 1 ) {
+                MemoryPool::Set_Reset_Retain_Percent(initial_alloc);
+            } else if ( sscanf(path, "MemoryTags %d", &initial_alloc) == 1 ) {
+                MemoryTag::Set_Enabled(initial_alloc != 0);
+            } else if ( sscanf(path, "TagBudget %255s %d", pool_name, &initial_alloc) == 2 ) {
+                MemoryTag::Set_Budget(pool_name, initial_alloc * 1024);
+                MemoryTag::Set_Enabled(true);
+            } else if ( sscanf(path, "MemoryTrace %255s", pool_name) == 1 ) {
+                MemoryTrace::Start(pool_name);
+            } else if ( sscanf(path, "HeapProfile %255s %d", pool_name, &initial_alloc) == 2 ) {
+                HeapProfiler::Start(initial_alloc > 0 ? initial_alloc : HeapProfiler::DEFAULT_SAMPLE_RATE, pool_name);
+            } else if ( sscanf(path, "PoolProfile %255s", pool_name) == 1 ) {
+                // Only ever switches it on so the ini can't undo -headless.
+                if ( strcasecmp(pool_name, "Headless") == 0 ) {
+                    User_Memory_Set_Headless(true);
+                }
+            } else if ( sscanf(path, "StatsDump %255s %15s %d", pool_name, format, &initial_alloc) == 3 ) {
+                MemoryPoolFactory::Set_Stats_Dump(pool_name,
+                    strcasecmp(format, "json") == 0 ? MEMORY_STATS_JSON : MEMORY_STATS_CSV,
+                    initial_alloc * 1000);
+            } else if ( sscanf(path, "PrefaultPools %d", &initial_alloc) == 1 ) {
+                prefault = initial_alloc != 0;
+                MemoryPoolFactory::Set_Load_Upkeep(prefault, release_empties);
+            } else if ( sscanf(path, "ReleaseEmpties %d", &initial_alloc) == 1 ) {
+                release_empties = initial_alloc != 0;
+                MemoryPoolFactory::Set_Load_Upkeep(prefault, release_empties);
+            } else if ( sscanf(path, "ClientOnly %63s", pool_name) == 1 ) {
+                if ( UserClientOnlyExtraCount < USER_CLIENT_ONLY_EXTRA ) {
+                    strcpy(UserClientOnlyExtra[UserClientOnlyExtraCount++], pool_name);
+                }
+            }
+        }
+
+        fclose(fp);
+    }
+}
+
+//
+// Suggests the DMA size classes for UserDMAParameters. Each existing class
+// keeps its size with the count sized from its peak, and a class whose requests
+// mostly sit well below its size gets a new class in front of it at the point
+// that saves the most rounding.
+//
+static void Write_Tuned_DMA_Classes(FILE *fp, DynamicMemoryAllocator *dma)
+{
+    enum { SHIFT = DynamicMemoryAllocator::SIZE_CLASS_SHIFT };
+
+    int entries = dma->Get_Request_Histogram(nullptr, 0);
+    int *hist = static_cast<int *>(Raw_Allocate_No_Zero(entries * sizeof(int)));
+    int total = 0;
+    dma->Get_Request_Histogram(hist, entries);
+
+    for ( int i = 0; i < entries; ++i ) {
+        total += hist[i];
+    }
+
+    fprintf(fp, ";\n; Recommended UserDMAParameters from %d recorded requests:\n", total);
+
+    for ( int p = 0, lo = 0; p < dma->Get_Pool_Count(); ++p ) {
+        MemoryPoolStats stats;
+        dma->Get_Pool(p)->Get_Stats(stats);
+
+        int hi = stats.AllocationSize;
+        int first = (lo >> SHIFT) + 1;
+        int last = MIN(hi >> SHIFT, entries - 1);
+        int requests = 0;
+        int64_t bytes = 0;
+
+        for ( int i = first; i <= last; ++i ) {
+            requests += hist[i];
+            bytes += int64_t(hist[i]) * hi;
+        }
+
+        int best_split = 0;
+        int best_below = 0;
+        int64_t best_cost = bytes;
+
+        for ( int s = first; s < last; ++s ) {
+            int below = 0;
+            int64_t cost = 0;
+
+            for ( int i = first; i <= last; ++i ) {
+                cost += int64_t(hist[i]) * (i <= s ? s << SHIFT : hi);
+                below += i <= s ? hist[i] : 0;
             }
+
+            if ( cost < best_cost ) {
+                best_cost = cost;
+                best_split = s << SHIFT;
+                best_below = below;
+            }
+        }
+
+        int peak = stats.SessionPeakUsedBlocks;
+
+        //
+        // Only worth a new pool if it saves a tenth of the class's bytes and the
+        // class sees a meaningful share of traffic.
+        //
+        if ( best_split != 0 && requests * 100 >= total && (bytes - best_cost) * 10 >= bytes ) {
+            int moved = int(int64_t(peak) * best_below / requests);
+            fprintf(fp, ";    { \"dmaPool_%d\", %d, %d, %d },  // New, saves %d%% of dmaPool_%d bytes.\n",
+                best_split, best_split, Tuned_Count(moved), stats.OverflowAllocationCount,
+                int((bytes - best_cost) * 100 / bytes), hi);
+            peak -= moved;
+        }
+
+        fprintf(fp, ";    { \"%s\", %d, %d, %d },%s\n", stats.PoolName, hi, Tuned_Count(peak),
+            stats.OverflowAllocationCount, requests == 0 ? "  // Unused this session." : "");
+        lo = hi;
+    }
+
+    Raw_Free(hist);
+}
+
+//
+// Only pools in our tables pick their sizes up from MemoryPools.ini, the
+// medium DMA classes and STLNode pools are sized where they are created.
+//
+static bool Is_Ini_Sized_Pool(char const *name)
+{
+    if ( Find_User_Pool(name, Pool_Name_Hash(name), true) != nullptr ) {
+        return true;
+    }
+
+    for ( int i = 0; i < int(ARRAY_SIZE(UserDMAParameters)); ++i ) {
+        if ( strcasecmp(UserDMAParameters[i].PoolName, name) == 0 ) {
+            return true;
         }
     }
+
+    return false;
+}
+
+void User_Memory_Write_Tuned_Pools()
+{
+    if ( !TunePools || TheMemoryPoolFactory == nullptr ) {
+        return;
+    }
+
+    char path[PATH_MAX];
+    Get_Ini_Path(path, "MemoryPools.tuned.ini");
+
+    FILE *fp = fopen(path, "w");
+
+    if ( fp == nullptr ) {
+        DEBUG_LOG("Failed to open '%s' to write tuned memory pools.\n", path);
+
+        return;
+    }
+
+    int count = TheMemoryPoolFactory->Get_Pool_Stats(nullptr, 0);
+    MemoryPoolStats *stats = static_cast<MemoryPoolStats *>(Raw_Allocate_No_Zero(count * sizeof(MemoryPoolStats)));
+    count = MIN(count, TheMemoryPoolFactory->Get_Pool_Stats(stats, count));
+
+    fprintf(fp, "; Pool sizes from the peak usage seen this session plus %d%% headroom.\n", TuneHeadroom);
+    fprintf(fp, "; Copy the lines you want into MemoryPools.ini, unused pools and ones it's not read for are left commented.\n");
+
+    //
+    // Initial count covers the peak so a similar session never grows a pool
+    // mid game, overflow is left as it was for anything bigger.
+    //
+    for ( int i = 0; i < count; ++i ) {
+        MemoryPoolStats &s = stats[i];
+
+        if ( !Is_Ini_Sized_Pool(s.PoolName) ) {
+            // Listed for reference only, the loader would ignore the line.
+            fprintf(fp, ";%s %d %d  ; Not sized from MemoryPools.ini, peak %d.\n", s.PoolName,
+                s.InitialAllocationCount, s.OverflowAllocationCount, s.SessionPeakUsedBlocks);
+        } else if ( HeadlessProfile && Is_Client_Only_Pool(s.PoolName) ) {
+            // A headless session says nothing about what the client needs.
+            fprintf(fp, ";%s 0 %d  ; Client only, peak %d in a headless session.\n", s.PoolName,
+                s.OverflowAllocationCount, s.SessionPeakUsedBlocks);
+        } else if ( s.SessionPeakUsedBlocks == 0 ) {
+            fprintf(fp, ";%s %d %d  ; Unused this session.\n", s.PoolName, s.InitialAllocationCount,
+                s.OverflowAllocationCount);
+        } else {
+            fprintf(fp, "%s %d %d  ; Peak %d of %d, %d overflow blobs.\n", s.PoolName,
+                Tuned_Count(s.SessionPeakUsedBlocks), s.OverflowAllocationCount, s.SessionPeakUsedBlocks,
+                s.InitialAllocationCount, s.SessionOverflowBlobCount);
+        }
+    }
+
+    if ( TheDynamicMemoryAllocator != nullptr ) {
+        Write_Tuned_DMA_Classes(fp, TheDynamicMemoryAllocator);
+    }
+
+    fclose(fp);
+    Raw_Free(stats);
 }
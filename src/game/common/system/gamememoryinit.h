@@ -46,7 +46,13 @@ struct PoolSizeRec
 };
 
 void User_Memory_Adjust_Pool_Size(char const *name, int &initial_alloc, int &overflow_alloc);
+void User_Memory_Adjust_Pool_Size(char const *name, unsigned hash, int &initial_alloc, int &overflow_alloc);
+bool User_Memory_Use_Huge_Pages(char const *name);
+bool User_Memory_Track_Live_Blocks(char const *name);
+void User_Memory_Set_Headless(bool headless);
 void User_Memory_Get_DMA_Params(int *count, PoolInitRec const **params);
 void User_Memory_Init_Pools();
+void User_Memory_Set_Tuning(bool enabled, int headroom_percent);
+void User_Memory_Write_Tuned_Pools();
 
 #endif // _GAMEMEMORYINIT_H_
\ No newline at end of file
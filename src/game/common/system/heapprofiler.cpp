@@ -0,0 +1,371 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: HEAPPROFILER.CPP
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Sampling heap profiler for the game allocators, writes
+//                 profiles pprof can read.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "heapprofiler.h"
+#include "critsection.h"
+#include "gamedebug.h"
+#include "minmax.h"
+#include "rawalloc.h"
+#include <cmath>
+
+#ifdef PLATFORM_WINDOWS
+#include <tlhelp32.h>
+#else
+#include <execinfo.h>
+#endif // PLATFORM_WINDOWS
+
+bool HeapProfiler::Active = false;
+int volatile HeapProfiler::Countdown = 0;
+int HeapProfiler::SampleRate = HeapProfiler::DEFAULT_SAMPLE_RATE;
+uint32_t HeapProfiler::RandomState = 0x9E3779B9;
+int HeapProfiler::DroppedSamples = 0;
+int volatile HeapProfiler::SampledFilter[HeapProfiler::FILTER_SIZE];
+HeapProfiler::StackEntry *HeapProfiler::Stacks = nullptr;
+HeapProfiler::LiveEntry *HeapProfiler::Live = nullptr;
+
+//
+// Everything past the countdown happens under this lock. Nothing in here may
+// go near the game allocators, the tables come straight from Raw_Allocate.
+//
+static FastCriticalSectionClass ProfilerLock;
+
+// Where Finish writes the profile, empty if nobody asked for one.
+static char ProfilePath[260];
+
+static unsigned Hash_Pointer(void const *ptr)
+{
+    uintptr_t v = uintptr_t(ptr) >> 3;
+
+    return unsigned(v ^ (v >> 16)) * 0x45D9F3B;
+}
+
+void HeapProfiler::Start(int sample_rate, char const *filename)
+{
+    FastCriticalSectionClass::LockClass lock(ProfilerLock);
+
+    if ( Active ) {
+        return;
+    }
+
+    if ( filename != nullptr ) {
+        strncpy(ProfilePath, filename, sizeof(ProfilePath) - 1);
+        ProfilePath[sizeof(ProfilePath) - 1] = '\0';
+    }
+
+    SampleRate = MAX(1, sample_rate);
+    DroppedSamples = 0;
+    Stacks = static_cast<StackEntry *>(Raw_Allocate(STACK_TABLE_SIZE * sizeof(StackEntry)));
+    Live = static_cast<LiveEntry *>(Raw_Allocate(LIVE_TABLE_SIZE * sizeof(LiveEntry)));
+    Countdown = Next_Sample_Gap();
+    Active = true;
+}
+
+void HeapProfiler::Stop()
+{
+    FastCriticalSectionClass::LockClass lock(ProfilerLock);
+
+    //
+    // Blocks sampled so far are forgotten, frees stop being checked as soon as
+    // the flag drops so the live table would only go stale.
+    //
+    Active = false;
+    Raw_Free(Stacks);
+    Raw_Free(Live);
+    Stacks = nullptr;
+    Live = nullptr;
+    memset(const_cast<int *>(SampledFilter), 0, sizeof(SampledFilter));
+}
+
+void HeapProfiler::Finish()
+{
+    if ( !Active ) {
+        return;
+    }
+
+    if ( *ProfilePath != '\0' ) {
+        Write_Profile(ProfilePath);
+    }
+
+    Stop();
+}
+
+int HeapProfiler::Next_Sample_Gap()
+{
+    // xorshift32, quality doesn't matter much here, speed and no allocation do.
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 17;
+    RandomState ^= RandomState << 5;
+
+    double u = (RandomState >> 8) * (1.0 / (1 << 24)) + (0.5 / (1 << 24));
+
+    return int(MIN(-log(u) * SampleRate, 2147483647.0 / 2)) + 1;
+}
+
+int HeapProfiler::Capture_Stack(void **frames)
+{
+#ifdef PLATFORM_WINDOWS
+    return CaptureStackBackTrace(2, MAX_FRAMES, frames, nullptr);
+#else
+    void *buffer[MAX_FRAMES + 2];
+    int depth = backtrace(buffer, MAX_FRAMES + 2);
+
+    // Drop ourselves and Record_Allocation.
+    depth = MAX(0, depth - 2);
+    memcpy(frames, &buffer[2], depth * sizeof(void *));
+
+    return depth;
+#endif // PLATFORM_WINDOWS
+}
+
+int HeapProfiler::Find_Stack(void **frames, int depth)
+{
+    unsigned hash = 0;
+
+    for ( int i = 0; i < depth; ++i ) {
+        hash = (hash * 31) ^ Hash_Pointer(frames[i]);
+    }
+
+    for ( int i = 0, index = hash & (STACK_TABLE_SIZE - 1); i < STACK_TABLE_SIZE; ++i, index = (index + 1) & (STACK_TABLE_SIZE - 1) ) {
+        StackEntry &entry = Stacks[index];
+
+        if ( entry.Depth == 0 ) {
+            entry.Hash = hash;
+            entry.Depth = depth;
+            memcpy(entry.Frames, frames, depth * sizeof(void *));
+
+            return index;
+        }
+
+        if ( entry.Hash == hash && entry.Depth == depth && memcmp(entry.Frames, frames, depth * sizeof(void *)) == 0 ) {
+            return index;
+        }
+    }
+
+    return -1;
+}
+
+void HeapProfiler::Record_Allocation(void *block, int bytes)
+{
+    void *frames[MAX_FRAMES];
+    int depth = Capture_Stack(frames);
+
+    FastCriticalSectionClass::LockClass lock(ProfilerLock);
+
+    if ( !Active ) {
+        return;
+    }
+
+    //
+    // Other threads may also have taken the count past zero before we got the
+    // lock, they all get sampled and the first one in sets the next gap. The
+    // gap is added rather than stored so we don't lose a racing decrement.
+    //
+    if ( Countdown <= 0 ) {
+#ifdef COMPILER_MSVC
+        InterlockedExchangeAdd(reinterpret_cast<volatile long *>(&Countdown), Next_Sample_Gap());
+#elif defined COMPILER_GNUC || defined COMPILER_CLANG
+        __sync_add_and_fetch(&Countdown, Next_Sample_Gap());
+#endif
+    }
+
+    if ( depth == 0 ) {
+        frames[0] = nullptr;
+        depth = 1;
+    }
+
+    int stack = Find_Stack(frames, depth);
+
+    if ( stack < 0 ) {
+        ++DroppedSamples;
+
+        return;
+    }
+
+    for ( int i = 0, index = Hash_Pointer(block) & (LIVE_TABLE_SIZE - 1); i < LIVE_TABLE_SIZE; ++i, index = (index + 1) & (LIVE_TABLE_SIZE - 1) ) {
+        if ( Live[index].Block == nullptr ) {
+            Live[index].Block = block;
+            Live[index].Bytes = bytes;
+            Live[index].Stack = stack;
+            ++SampledFilter[Hash_Pointer(block) & (FILTER_SIZE - 1)];
+            ++Stacks[stack].LiveCount;
+            Stacks[stack].LiveBytes += bytes;
+            ++Stacks[stack].AllocCount;
+            Stacks[stack].AllocBytes += bytes;
+
+            return;
+        }
+    }
+
+    ++DroppedSamples;
+}
+
+void HeapProfiler::Record_Free(void *block)
+{
+    //
+    // Only sampled blocks are in the live table. The count for their bucket
+    // went up before the block could reach another thread, so a zero here
+    // means this one wasn't sampled and the lock can be skipped.
+    //
+    if ( SampledFilter[Hash_Pointer(block) & (FILTER_SIZE - 1)] == 0 ) {
+        return;
+    }
+
+    FastCriticalSectionClass::LockClass lock(ProfilerLock);
+
+    if ( !Active ) {
+        return;
+    }
+
+    int index = Hash_Pointer(block) & (LIVE_TABLE_SIZE - 1);
+
+    for ( ; Live[index].Block != block; index = (index + 1) & (LIVE_TABLE_SIZE - 1) ) {
+        if ( Live[index].Block == nullptr ) {
+            return;
+        }
+    }
+
+    --SampledFilter[Hash_Pointer(block) & (FILTER_SIZE - 1)];
+    StackEntry &entry = Stacks[Live[index].Stack];
+    --entry.LiveCount;
+    entry.LiveBytes -= Live[index].Bytes;
+
+    //
+    // Shift later entries of the probe run back into the hole so lookups never
+    // need tombstones.
+    //
+    for ( int next = (index + 1) & (LIVE_TABLE_SIZE - 1); Live[next].Block != nullptr; next = (next + 1) & (LIVE_TABLE_SIZE - 1) ) {
+        int home = Hash_Pointer(Live[next].Block) & (LIVE_TABLE_SIZE - 1);
+
+        if ( ((next - home) & (LIVE_TABLE_SIZE - 1)) >= ((next - index) & (LIVE_TABLE_SIZE - 1)) ) {
+            Live[index] = Live[next];
+            index = next;
+        }
+    }
+
+    Live[index].Block = nullptr;
+}
+
+bool HeapProfiler::Write_Profile(char const *filename)
+{
+    FILE *fp = fopen(filename, "w");
+
+    if ( fp == nullptr ) {
+        DEBUG_LOG("Failed to open '%s' for the heap profile.\n", filename);
+
+        return false;
+    }
+
+    FastCriticalSectionClass::LockClass lock(ProfilerLock);
+
+    if ( Stacks == nullptr ) {
+        fclose(fp);
+
+        return false;
+    }
+
+    int live_count = 0;
+    int alloc_count = 0;
+    int64_t live_bytes = 0;
+    int64_t alloc_bytes = 0;
+
+    for ( int i = 0; i < STACK_TABLE_SIZE; ++i ) {
+        live_count += Stacks[i].LiveCount;
+        live_bytes += Stacks[i].LiveBytes;
+        alloc_count += Stacks[i].AllocCount;
+        alloc_bytes += Stacks[i].AllocBytes;
+    }
+
+    //
+    // Legacy gperftools heap format. Counts are the raw samples, the heap_v2
+    // tag tells pprof the rate so it scales them up to estimated totals.
+    //
+    fprintf(fp, "heap profile: %d: %lld [%d: %lld] @ heap_v2/%d\n",
+        live_count, (long long)live_bytes, alloc_count, (long long)alloc_bytes, SampleRate);
+
+    for ( int i = 0; i < STACK_TABLE_SIZE; ++i ) {
+        StackEntry &entry = Stacks[i];
+
+        if ( entry.Depth == 0 ) {
+            continue;
+        }
+
+        fprintf(fp, "%d: %lld [%d: %lld] @", entry.LiveCount, (long long)entry.LiveBytes, entry.AllocCount,
+            (long long)entry.AllocBytes);
+
+        for ( int j = 0; j < entry.Depth; ++j ) {
+            fprintf(fp, " 0x%llx", (unsigned long long)uintptr_t(entry.Frames[j]));
+        }
+
+        fprintf(fp, "\n");
+    }
+
+    if ( DroppedSamples != 0 ) {
+        DEBUG_LOG("Heap profile dropped %d samples, tables were full.\n", DroppedSamples);
+    }
+
+    fprintf(fp, "\nMAPPED_LIBRARIES:\n");
+    Write_Mappings(fp);
+    fclose(fp);
+
+    return true;
+}
+
+void HeapProfiler::Write_Mappings(FILE *fp)
+{
+#ifdef PLATFORM_WINDOWS
+    //
+    // pprof wants /proc/self/maps style lines to symbolise against, build them
+    // from the loaded module list.
+    //
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE, GetCurrentProcessId());
+
+    if ( snapshot == INVALID_HANDLE_VALUE ) {
+        return;
+    }
+
+    MODULEENTRY32 module;
+    module.dwSize = sizeof(module);
+
+    for ( BOOL ok = Module32First(snapshot, &module); ok; ok = Module32Next(snapshot, &module) ) {
+        fprintf(fp, "%08lx-%08lx r-xp 00000000 00:00 0 %s\n", (unsigned long)(uintptr_t)module.modBaseAddr,
+            (unsigned long)((uintptr_t)module.modBaseAddr + module.modBaseSize), module.szExePath);
+    }
+
+    CloseHandle(snapshot);
+#else
+    FILE *maps = fopen("/proc/self/maps", "r");
+
+    if ( maps == nullptr ) {
+        return;
+    }
+
+    char line[1024];
+
+    while ( fgets(line, sizeof(line), maps) != nullptr ) {
+        fputs(line, fp);
+    }
+
+    fclose(maps);
+#endif // PLATFORM_WINDOWS
+}
@@ -0,0 +1,113 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: HEAPPROFILER.H
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Sampling heap profiler for the game allocators, writes
+//                 profiles pprof can read.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifdef _MSC_VER
+#pragma once
+#endif // _MSC_VER
+
+#ifndef _HEAPPROFILER_H_
+#define _HEAPPROFILER_H_
+
+#include "always.h"
+#include <cstdio>
+
+//
+// Samples on average one allocation per SampleRate bytes, with the gap drawn
+// from an exponential distribution so every byte has the same chance of being
+// picked whatever the allocation sizes look like. Sampled blocks keep their
+// stack trace until they are freed.
+//
+// The allocators test Is_Active() before anything else, so with the profiler
+// stopped the cost is that one branch. While it runs, frees check a counting
+// filter of sampled blocks first so only those take the profiler lock.
+//
+class HeapProfiler
+{
+public:
+    enum {
+        MAX_FRAMES = 32,
+        DEFAULT_SAMPLE_RATE = 512 * 1024,
+        LIVE_TABLE_SIZE = 1 << 16,      // Sampled blocks that can be tracked at once.
+        STACK_TABLE_SIZE = 1 << 14,     // Distinct call stacks.
+        FILTER_SIZE = 1 << 14,          // Buckets in the sampled block filter.
+    };
+
+    static void Start(int sample_rate = DEFAULT_SAMPLE_RATE, char const *filename = nullptr);
+    static void Stop();
+    static void Finish();
+    static bool Is_Active() { return Active; }
+
+    static inline void Sample_Allocation(void *block, int bytes);
+    static void Record_Free(void *block);
+
+    static bool Write_Profile(char const *filename);
+
+private:
+    struct StackEntry
+    {
+        unsigned Hash;
+        int Depth;
+        void *Frames[MAX_FRAMES];
+        int LiveCount;
+        int64_t LiveBytes;
+        int AllocCount;
+        int64_t AllocBytes;
+    };
+
+    struct LiveEntry
+    {
+        void *Block;
+        int Bytes;
+        int Stack;
+    };
+
+    static void Record_Allocation(void *block, int bytes);
+    static int Next_Sample_Gap();
+    static int Find_Stack(void **frames, int depth);
+    static int Capture_Stack(void **frames);
+    static void Write_Mappings(FILE *fp);
+
+private:
+    static bool Active;
+    static int volatile Countdown;
+    static int SampleRate;
+    static uint32_t RandomState;
+    static int DroppedSamples;
+    static int volatile SampledFilter[FILTER_SIZE];     // Sampled blocks per pointer hash bucket.
+    static StackEntry *Stacks;
+    static LiveEntry *Live;
+};
+
+inline void HeapProfiler::Sample_Allocation(void *block, int bytes)
+{
+#ifdef COMPILER_MSVC
+    if ( InterlockedExchangeAdd(reinterpret_cast<volatile long *>(&Countdown), -bytes) - bytes <= 0 ) {
+#elif defined COMPILER_GNUC || defined COMPILER_CLANG
+    if ( __sync_sub_and_fetch(&Countdown, bytes) <= 0 ) {
+#endif
+        Record_Allocation(block, bytes);
+    }
+}
+
+#endif // _HEAPPROFILER_H_
@@ -23,8 +23,105 @@
 //
 ////////////////////////////////////////////////////////////////////////////////
 #include "memblob.h"
+#include "critsection.h"
 #include "memblock.h"
 #include "mempool.h"
+#include "memvirtual.h"
+#include "minmax.h"
+
+//
+// Two level bitmap of which SLAB_SIZE regions of the address space belong to
+// slab layout blobs. DynamicMemoryAllocator needs it to tell slab blocks from
+// raw blocks before it dares read anything in front of the pointer.
+//
+namespace {
+
+enum {
+    SLAB_MAP_LEAF_SHIFT = 16,
+    SLAB_MAP_LEAF_BITS = 1 << SLAB_MAP_LEAF_SHIFT,
+    SLAB_MAP_ROOT_SIZE = 1 << 16,   // Covers 48 bit addresses with 64KiB slabs.
+};
+
+//
+// Lookups don't take the lock. A block's own bit is set before the block can
+// be handed out and cleared only after it is freed, so racing with an update
+// to a neighbouring bit in the same word can't change the answer we get.
+//
+uint32_t volatile *volatile SlabMap[SLAB_MAP_ROOT_SIZE];
+FastCriticalSectionClass SlabMapLock;
+
+}
+
+bool MemoryPoolBlob::Is_Slab_Address(void const *ptr)
+{
+    uintptr_t index = uintptr_t(ptr) >> SLAB_SHIFT;
+    uintptr_t root = index >> SLAB_MAP_LEAF_SHIFT;
+
+    if ( root >= SLAB_MAP_ROOT_SIZE ) {
+        return false;
+    }
+
+    uint32_t volatile *leaf = SlabMap[root];
+
+    if ( leaf == nullptr ) {
+        return false;
+    }
+
+    uintptr_t bit = index & (SLAB_MAP_LEAF_BITS - 1);
+
+    return (leaf[bit >> 5] & (1u << (bit & 31))) != 0;
+}
+
+void MemoryPoolBlob::Mark_Slabs(char const *start, int slabs, bool in_use)
+{
+    FastCriticalSectionClass::LockClass lock(SlabMapLock);
+
+    for ( int i = 0; i < slabs; ++i ) {
+        uintptr_t index = (uintptr_t(start) >> SLAB_SHIFT) + i;
+        uintptr_t root = index >> SLAB_MAP_LEAF_SHIFT;
+        uintptr_t bit = index & (SLAB_MAP_LEAF_BITS - 1);
+
+        ASSERT_THROW(root < SLAB_MAP_ROOT_SIZE, 0xDEAD0002);
+
+        if ( SlabMap[root] == nullptr ) {
+            // Leaves are never freed, there are only ever a handful of them.
+            SlabMap[root] = static_cast<uint32_t volatile *>(Raw_Allocate(SLAB_MAP_LEAF_BITS / 8));
+        }
+
+        if ( in_use ) {
+            SlabMap[root][bit >> 5] |= 1u << (bit & 31);
+        } else {
+            SlabMap[root][bit >> 5] &= ~(1u << (bit & 31));
+        }
+    }
+}
+
+MemoryPoolBlob::~MemoryPoolBlob()
+{
+    if ( SlabCount != 0 ) {
+        Mark_Slabs(BlockData, SlabCount, false);
+    }
+
+    if ( ExtentBytes != 0 ) {
+        OwningPool->VirtualRange->Decommit_Extent(BlockData, ExtentBytes);
+    } else if ( SlabCount != 0 ) {
+        Raw_Free_Aligned(BlockData);
+    } else {
+        Raw_Free(BlockData);
+    }
+
+    Raw_Free(const_cast<uint32_t *>(LiveBits));
+    Raw_Free(BlockTags);
+}
+
+int MemoryPoolBlob::Get_Data_Size() const
+{
+    if ( SlabCount != 0 ) {
+        return SlabCount * SLAB_SIZE;
+    }
+
+    return OwningPool->Get_Blob_Padding() + TotalBlocksInBlob * OwningPool->Get_Block_Stride();
+}
 
 void MemoryPoolBlob::Init_Blob(MemoryPool *owning_pool, int count)
 {
@@ -34,9 +131,37 @@ void MemoryPoolBlob::Init_Blob(MemoryPool *owning_pool, int count)
     TotalBlocksInBlob = count;
     UsedBlocksInBlob = 0;
 
-    int alloc_size = Round_Up_Word_Size(owning_pool->AllocationSize) + sizeof(MemoryPoolSingleBlock);
-    BlockData = static_cast<char *>(Raw_Allocate(alloc_size * TotalBlocksInBlob));
-    char *current_block = BlockData;
+    if ( owning_pool->Headerless ) {
+        Init_Slabs(count);
+    } else {
+        BlockData = Allocate_Data(owning_pool->Get_Blob_Padding() + owning_pool->Get_Block_Stride() * TotalBlocksInBlob);
+        Init_Headers();
+    }
+
+    // Slab blobs may have rounded the count up so this goes last.
+    if ( owning_pool->TrackLive ) {
+        LiveBits = static_cast<uint32_t volatile *>(Raw_Allocate(((TotalBlocksInBlob + 31) / 32) * sizeof(uint32_t)));
+    }
+
+    if ( owning_pool->TrackTags ) {
+        BlockTags = static_cast<uint8_t *>(Raw_Allocate(TotalBlocksInBlob));
+    }
+}
+
+char *MemoryPoolBlob::Get_First_Header() const
+{
+    // Headers sit just in front of the aligned user data, the padding takes up the slack.
+    uintptr_t first_data = uintptr_t(BlockData) + sizeof(MemoryPoolSingleBlock);
+    first_data = (first_data + OwningPool->Alignment - 1) & ~uintptr_t(OwningPool->Alignment - 1);
+
+    return reinterpret_cast<char *>(first_data - sizeof(MemoryPoolSingleBlock));
+}
+
+void MemoryPoolBlob::Init_Headers()
+{
+    int alloc_size = OwningPool->Get_Block_Stride();
+    char *current_block = Get_First_Header();
+    FirstFreeBlock = reinterpret_cast<MemoryPoolSingleBlock *>(current_block);
 
     for ( int i = TotalBlocksInBlob - 1; i >= 0; --i ) {
         MemoryPoolSingleBlock *block_header = reinterpret_cast<MemoryPoolSingleBlock *>(current_block);
@@ -56,6 +181,267 @@ void MemoryPoolBlob::Init_Blob(MemoryPool *owning_pool, int count)
             block_header->NextBlock = nullptr;
         }
     }
+}
+
+void MemoryPoolBlob::Reset_Blocks()
+{
+    UsedBlocksInBlob = 0;
+
+    if ( LiveBits != nullptr ) {
+        memset(const_cast<uint32_t *>(LiveBits), 0, ((TotalBlocksInBlob + 31) / 32) * sizeof(uint32_t));
+    }
+
+    if ( BlockTags != nullptr ) {
+        memset(BlockTags, 0, TotalBlocksInBlob);
+    }
+
+    if ( SlabCount == 0 ) {
+        Init_Headers();
+
+        return;
+    }
+
+    //
+    // Thread everything carved so far back onto the free list in address order.
+    // Whatever was never carved stays with the carve pointer as it's still zero.
+    //
+    int size = OwningPool->AllocationSize;
+    int offset = OwningPool->Get_Slab_Offset();
+    int per_slab = (SLAB_SIZE - offset) / size;
+    void **link = &FirstFreeSlot;
+
+    for ( int i = 0; i < SlabCount; ++i ) {
+        char *block = BlockData + i * SLAB_SIZE + offset;
+        char *end = block + per_slab * size;
+        bool last = CarveSlot != nullptr && CarveSlot < end;
+
+        if ( last ) {
+            end = CarveSlot;
+        }
+
+        for ( ; block < end; block += size ) {
+            *link = block;
+            link = reinterpret_cast<void **>(block);
+        }
+
+        if ( last ) {
+            break;
+        }
+    }
+
+    *link = nullptr;
+}
+
+//
+// Walks the free list rather than trusting UsedBlocksInBlob, never carved slab
+// blocks are free too. Stops one past the total so a looped list still ends.
+//
+int MemoryPoolBlob::Count_Free_Blocks() const
+{
+    int count = 0;
+
+    if ( SlabCount == 0 ) {
+        for ( MemoryPoolSingleBlock *i = FirstFreeBlock; i != nullptr && count <= TotalBlocksInBlob; i = i->NextBlock ) {
+            ++count;
+        }
+
+        return count;
+    }
+
+    for ( void *i = FirstFreeSlot; i != nullptr && count <= TotalBlocksInBlob; i = *static_cast<void **>(i) ) {
+        ++count;
+    }
+
+    if ( CarveSlot != nullptr ) {
+        int slab = int(CarveSlot - BlockData) >> SLAB_SHIFT;
+        count += int(CarveEnd - CarveSlot) / OwningPool->AllocationSize;
+        count += (SlabCount - slab - 1) * (TotalBlocksInBlob / SlabCount);
+    }
+
+    return count;
+}
+
+int MemoryPoolBlob::Get_Block_Index(void const *block) const
+{
+    if ( SlabCount == 0 ) {
+        int header = static_cast<char const *>(block) - sizeof(MemoryPoolSingleBlock) - Get_First_Header();
+
+        return header / OwningPool->Get_Block_Stride();
+    }
+
+    int offset = static_cast<char const *>(block) - BlockData;
+    int slot = ((offset & (SLAB_SIZE - 1)) - OwningPool->Get_Slab_Offset()) / OwningPool->AllocationSize;
+
+    return (offset >> SLAB_SHIFT) * (TotalBlocksInBlob / SlabCount) + slot;
+}
+
+void *MemoryPoolBlob::Get_Block_Address(int index) const
+{
+    if ( SlabCount == 0 ) {
+        return Get_First_Header() + index * OwningPool->Get_Block_Stride() + sizeof(MemoryPoolSingleBlock);
+    }
+
+    int per_slab = TotalBlocksInBlob / SlabCount;
+
+    return BlockData + (index / per_slab) * SLAB_SIZE + OwningPool->Get_Slab_Offset()
+        + (index % per_slab) * OwningPool->AllocationSize;
+}
+
+int MemoryPoolBlob::Get_Block_Tag(void const *block) const
+{
+    return BlockTags != nullptr ? BlockTags[Get_Block_Index(block)] : 0;
+}
+
+void MemoryPoolBlob::Set_Block_Tag(void const *block, int tag)
+{
+    //
+    // Each block has a byte to itself and only the thread holding the block
+    // writes it, so unlike the live bits no atomics are needed. Blobs made
+    // before the pool started tracking tags have nowhere to put one.
+    //
+    if ( BlockTags != nullptr ) {
+        BlockTags[Get_Block_Index(block)] = tag;
+    }
+}
+
+bool MemoryPoolBlob::Mark_Live(void const *block, bool live)
+{
+    int index = Get_Block_Index(block);
+    uint32_t bit = 1u << (index & 31);
+    uint32_t volatile *word = &LiveBits[index >> 5];
+    uint32_t old;
+
+    //
+    // Neighbouring blocks can be allocated and freed on other threads at the same
+    // time, only the thread cache path is lock free, so the update must be atomic.
+    //
+#ifdef COMPILER_MSVC
+    if ( live ) {
+        old = InterlockedOr(reinterpret_cast<long volatile *>(word), bit);
+    } else {
+        old = InterlockedAnd(reinterpret_cast<long volatile *>(word), ~bit);
+    }
+#elif defined COMPILER_GNUC || defined COMPILER_CLANG
+    if ( live ) {
+        old = __sync_fetch_and_or(word, bit);
+    } else {
+        old = __sync_fetch_and_and(word, ~bit);
+    }
+#endif
+
+    // Lets the caller catch double frees.
+    return (old & bit) != 0;
+}
+
+void MemoryPoolBlob::Init_Slabs(int count)
+{
+    int size = OwningPool->AllocationSize;
+    int per_slab = (SLAB_SIZE - OwningPool->Get_Slab_Offset()) / size;
+
+    //
+    // Round up to whole slabs and use every block in them, the tail of the last
+    // slab would otherwise just be wasted.
+    //
+    SlabCount = (count + per_slab - 1) / per_slab;
+    TotalBlocksInBlob = SlabCount * per_slab;
+    BlockData = Allocate_Data(SlabCount * SLAB_SIZE);
+
+    //
+    // Only the slab headers get written now, blocks are carved when first used
+    // so a new blob doesn't fault in every page it holds.
+    //
+    for ( int i = 0; i < SlabCount; ++i ) {
+        *reinterpret_cast<MemoryPoolBlob **>(BlockData + i * SLAB_SIZE) = this;
+    }
+
+    FirstFreeSlot = nullptr;
+    CarveEnd = BlockData;
+    Next_Carve_Slab();
+    Mark_Slabs(BlockData, SlabCount, true);
+}
+
+void MemoryPoolBlob::Next_Carve_Slab()
+{
+    //
+    // CarveEnd is somewhere in the slab just used up, or BlockData to start with.
+    //
+    char *slab = BlockData + ((CarveEnd - BlockData + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1));
+
+    if ( slab >= BlockData + SlabCount * SLAB_SIZE ) {
+        CarveSlot = nullptr;
+        CarveEnd = nullptr;
+
+        return;
+    }
+
+    int size = OwningPool->AllocationSize;
+    int offset = OwningPool->Get_Slab_Offset();
+
+    CarveSlot = slab + offset;
+    CarveEnd = CarveSlot + (SLAB_SIZE - offset) / size * size;
+}
+
+void *MemoryPoolBlob::Carve_Slot()
+{
+    //ASSERT_PRINT(CarveSlot != nullptr, "Trying to carve from a used up blob for pool %s\n", OwningPool->PoolName);
+    void *slot = CarveSlot;
+    CarveSlot += OwningPool->AllocationSize;
+
+    if ( CarveSlot == CarveEnd ) {
+        Next_Carve_Slab();
+    }
+
+    return slot;
+}
+
+int MemoryPoolBlob::Carve_Slots(void **slots, int count)
+{
+    int size = OwningPool->AllocationSize;
+    int carved = 0;
+
+    //
+    // Hands out runs of never used slots in address order, they are still zero
+    // from when the blob's memory was committed or allocated.
+    //
+    while ( carved < count && CarveSlot != nullptr ) {
+        int run = MIN<int>(count - carved, (CarveEnd - CarveSlot) / size);
+
+        for ( int i = 0; i < run; ++i ) {
+            slots[carved++] = CarveSlot;
+            CarveSlot += size;
+        }
+
+        if ( CarveSlot == CarveEnd ) {
+            Next_Carve_Slab();
+        }
+    }
+
+    UsedBlocksInBlob += carved;
+
+    return carved;
+}
+
+char *MemoryPoolBlob::Allocate_Data(int bytes)
+{
+    //
+    // Extents are SLAB_SIZE aligned so either layout can use the virtual range,
+    // only fall back to the heap once it is used up.
+    //
+    MemoryPoolVirtualRange *range = OwningPool->VirtualRange;
+
+    if ( range != nullptr ) {
+        char *data = static_cast<char *>(range->Commit_Extent(bytes));
+
+        if ( data != nullptr ) {
+            ExtentBytes = bytes;
+
+            return data;
+        }
+    }
+
+    if ( SlabCount != 0 ) {
+        return static_cast<char *>(Raw_Allocate_Aligned(bytes, SLAB_SIZE));
+    }
 
-    FirstFreeBlock = reinterpret_cast<MemoryPoolSingleBlock *>(BlockData);
+    return static_cast<char *>(Raw_Allocate(bytes));
 }
@@ -34,16 +34,64 @@
 
 class MemoryPool;
 
+//
+// Blobs come in two layouts. The original puts a MemoryPoolSingleBlock header
+// in front of every block. The slab layout carves blocks out of SLAB_SIZE
+// aligned slabs that start with a small header pointing back at the blob, so
+// a block's blob is found by masking its address and free blocks are linked
+// through their own payload. Slab blocks are carved in address order as they
+// are first needed, so blocks never handed out are untouched and still zero.
+//
 class MemoryPoolBlob
 {
 public:
+    enum {
+        SLAB_SHIFT = 16,
+        SLAB_SIZE = 1 << SLAB_SHIFT,
+        SLAB_HEADER_SIZE = 16,  // Keeps 16 byte alignment for block sizes that are multiples of it.
+    };
+
     MemoryPoolBlob();
     ~MemoryPoolBlob();
     void Init_Blob(MemoryPool *owning_pool, int count);
+    void Reset_Blocks();
     void Add_Blob_To_List(MemoryPoolBlob **head, MemoryPoolBlob **tail);
     void Remove_Blob_From_List(MemoryPoolBlob **head, MemoryPoolBlob **tail);
+    void Add_Blob_To_Fill_List(MemoryPoolBlob **head, int list);
+    void Remove_Blob_From_Fill_List(MemoryPoolBlob **head);
     MemoryPoolSingleBlock *Allocate_Single_Block();
     void Free_Single_Block(MemoryPoolSingleBlock *block);
+    void *Allocate_Slot();
+    int Carve_Slots(void **slots, int count);
+    void Free_Slot(void *slot);
+    bool Has_Free_Blocks() const { return UsedBlocksInBlob < TotalBlocksInBlob; }
+    int Count_Free_Blocks() const;
+    bool Is_Slab_Layout() const { return SlabCount != 0; }
+    int Get_Data_Size() const;
+
+    // Liveness bitmap, only there when the owning pool tracks live blocks.
+    bool Mark_Live(void const *block, bool live);
+    int Get_Block_Index(void const *block) const;
+    void *Get_Block_Address(int index) const;
+
+    // Memory tag bytes, only there once the owning pool tracks tags.
+    int Get_Block_Tag(void const *block) const;
+    void Set_Block_Tag(void const *block, int tag);
+
+    //
+    // Only worth it while a slab holds enough blocks to keep tail waste small and
+    // the pool's blobs are big enough that rounding them up to whole slabs doesn't
+    // more than double them. Lazy pools with no initial blob only have overflow
+    // blobs to go by.
+    //
+    static bool Slab_Layout_Fits(int size, int count, int overflow)
+    {
+        return size <= (SLAB_SIZE - SLAB_HEADER_SIZE) / 16
+            && (count == 0 || size * count >= SLAB_SIZE / 2)
+            && size * overflow >= SLAB_SIZE / 2;
+    }
+    static bool Is_Slab_Address(void const *ptr);
+    static MemoryPoolBlob *Recover_Blob_From_Slot(void const *slot);
 
     void *operator new(size_t size) throw()
     {
@@ -56,34 +104,60 @@ public:
     }
 
     friend class MemoryPool;
+    friend class MemoryPoolLiveIterator;
     friend class DynamicMemoryAllocator;
+
+private:
+    char *Get_First_Header() const;
+    void Init_Headers();
+    void Init_Slabs(int count);
+    void *Carve_Slot();
+    void Next_Carve_Slab();
+    char *Allocate_Data(int bytes);
+    static void Mark_Slabs(char const *start, int slabs, bool in_use);
+
 private:
     MemoryPool *OwningPool;
     MemoryPoolBlob *NextBlob;
     MemoryPoolBlob *PrevBlob;
+    MemoryPoolBlob *NextFillBlob;   // Links the blobs on the same one of the pool's fill lists.
+    MemoryPoolBlob *PrevFillBlob;
+    int FillList;
     MemoryPoolSingleBlock *FirstFreeBlock;
     int UsedBlocksInBlob;
     int TotalBlocksInBlob;
     char *BlockData;
+    void *FirstFreeSlot;
+    char *CarveSlot;    // Next never used slot, nullptr once the last slab is used up.
+    char *CarveEnd;     // End of the carvable slots in CarveSlot's slab.
+    int SlabCount;
+    int ExtentBytes;    // Non zero when BlockData was committed from the pool's virtual range.
+    uint32_t volatile *LiveBits;    // A bit per block in address order, set while it is handed out.
+    uint8_t *BlockTags;     // MemoryTag each block was charged to, in address order.
 };
 
 inline MemoryPoolBlob::MemoryPoolBlob() :
     OwningPool(nullptr),
     NextBlob(nullptr),
     PrevBlob(nullptr),
+    NextFillBlob(nullptr),
+    PrevFillBlob(nullptr),
+    FillList(0),
     FirstFreeBlock(nullptr),
     UsedBlocksInBlob(0),
     TotalBlocksInBlob(0),
-    BlockData(nullptr)
+    BlockData(nullptr),
+    FirstFreeSlot(nullptr),
+    CarveSlot(nullptr),
+    CarveEnd(nullptr),
+    SlabCount(0),
+    ExtentBytes(0),
+    LiveBits(nullptr),
+    BlockTags(nullptr)
 {
 
 }
 
-inline MemoryPoolBlob::~MemoryPoolBlob()
-{
-    Raw_Free(BlockData);
-}
-
 inline void MemoryPoolBlob::Add_Blob_To_List(MemoryPoolBlob **head, MemoryPoolBlob **tail)
 {
     NextBlob = 0;
@@ -115,12 +189,39 @@ inline void MemoryPoolBlob::Remove_Blob_From_List(MemoryPoolBlob **head, MemoryP
     }
 }
 
+inline void MemoryPoolBlob::Add_Blob_To_Fill_List(MemoryPoolBlob **head, int list)
+{
+    FillList = list;
+    NextFillBlob = *head;
+    PrevFillBlob = nullptr;
+
+    if ( *head != nullptr ) {
+        (*head)->PrevFillBlob = this;
+    }
+
+    *head = this;
+}
+
+inline void MemoryPoolBlob::Remove_Blob_From_Fill_List(MemoryPoolBlob **head)
+{
+    if ( *head == this ) {
+        *head = NextFillBlob;
+    } else {
+        PrevFillBlob->NextFillBlob = NextFillBlob;
+    }
+
+    if ( NextFillBlob != nullptr ) {
+        NextFillBlob->PrevFillBlob = PrevFillBlob;
+    }
+}
+
 inline MemoryPoolSingleBlock *MemoryPoolBlob::Allocate_Single_Block()
 {
     //ASSERT_PRINT(UsedBlocksInBlob < TotalBlocksInBlob, "Trying to allocate when all blocks allocated in blob for pool %s\n", OwningPool->PoolName);
     //ASSERT_PRINT(FirstFreeBlock != nullptr, "Trying to allocated block from blob with null FirstFreeBlock for pool %s\n", OwningPool->PoolName);
     MemoryPoolSingleBlock *block = FirstFreeBlock;
     FirstFreeBlock = block->NextBlock;
+    block->OwnerCache = nullptr;
     ++UsedBlocksInBlob;
 
     return block;
@@ -132,4 +233,32 @@ inline void MemoryPoolBlob::Free_Single_Block(MemoryPoolSingleBlock *block)
     --UsedBlocksInBlob;
 }
 
+inline void *MemoryPoolBlob::Allocate_Slot()
+{
+    void *slot = FirstFreeSlot;
+
+    if ( slot != nullptr ) {
+        FirstFreeSlot = *static_cast<void **>(slot);
+    } else {
+        slot = Carve_Slot();
+    }
+
+    ++UsedBlocksInBlob;
+
+    return slot;
+}
+
+inline void MemoryPoolBlob::Free_Slot(void *slot)
+{
+    *static_cast<void **>(slot) = FirstFreeSlot;
+    FirstFreeSlot = slot;
+    --UsedBlocksInBlob;
+}
+
+inline MemoryPoolBlob *MemoryPoolBlob::Recover_Blob_From_Slot(void const *slot)
+{
+    // First thing in every slab is the pointer back to the blob that owns it.
+    return *reinterpret_cast<MemoryPoolBlob *const *>(uintptr_t(slot) & ~uintptr_t(SLAB_SIZE - 1));
+}
+
 #endif
@@ -33,38 +33,76 @@
 #include "rawalloc.h"
 
 class MemoryPoolBlob;
+class MemoryPoolThreadCache;
 
 class MemoryPoolSingleBlock
 {
 public:
+    enum {
+        RAW_ALIGNED_TAG = 1,    // OwningBlob of a raw block whose allocation starts somewhere in front of it.
+        RAW_HUGE_TAG = 2,       // OwningBlob of a raw block that has a page mapping to itself.
+        RAW_TAG_WORDS = 2,      // Aligned and huge raw blocks keep their memory tag and the bytes charged to it.
+        RAW_HUGE_PREFIX = (sizeof(void *) * (RAW_TAG_WORDS + 4) + 15) & ~15,   // Tag, mapping size and header, keeps user data 16 byte aligned.
+    };
+
     MemoryPoolSingleBlock() : OwningBlob(nullptr), NextBlock(nullptr), PrevBlock(nullptr) {}
     void Init_Block(int size, MemoryPoolBlob *owning_blob);
     void Remove_Block_From_List(MemoryPoolSingleBlock **list_head);
     void Add_Block_To_List(MemoryPoolSingleBlock **list_head);
     void *Get_User_Data() { return reinterpret_cast<void *>(&this[1]); }
+    bool Is_Raw_Block() const { return uintptr_t(OwningBlob) <= RAW_HUGE_TAG; }
+    bool Is_Huge_Block() const { return uintptr_t(OwningBlob) == RAW_HUGE_TAG; }
+    int Get_Huge_Map_Size() const { return int(reinterpret_cast<intptr_t const *>(this)[-1]); }
+    int Get_Raw_Tag() const { return int(reinterpret_cast<intptr_t const *>(this)[-2]); }
+    int Get_Raw_Tag_Bytes() const { return int(reinterpret_cast<intptr_t const *>(this)[-3]); }
+    int Get_Aligned_Size() const { return int(reinterpret_cast<intptr_t const *>(this)[-4]); }
+    int Get_Aligned_Alignment() const { return int(reinterpret_cast<intptr_t const *>(this)[-5]); }
+    void Set_Raw_Tag(int tag, int bytes);
+    void Raw_Free_Single_Block(MemoryPoolSingleBlock **list_head);
+    void Raw_Free_Memory();
+    MemoryPoolSingleBlock *Raw_Remap_Huge_Single_Block(int size);
     static MemoryPoolSingleBlock *Recover_Block_From_User_Data(void *data);
     static MemoryPoolSingleBlock *Raw_Allocate_Single_Block(MemoryPoolSingleBlock **list_head, int size);
+    static MemoryPoolSingleBlock *Raw_Allocate_Aligned_Single_Block(MemoryPoolSingleBlock **list_head, int size, int alignment);
+    static MemoryPoolSingleBlock *Raw_Map_Huge_Single_Block(int size);
 
     friend class MemoryPoolBlob;
     friend class MemoryPool;
+    friend class MemoryPoolThreadCache;
     friend class DynamicMemoryAllocator;
 
 private:
     MemoryPoolBlob *OwningBlob;
     MemoryPoolSingleBlock *NextBlock;
-    MemoryPoolSingleBlock *PrevBlock;
+
+    //
+    // Pool blocks only use the previous link while they sit in a free list, once
+    // handed out the slot records which thread cache allocated them so a free on
+    // another thread can be sent back the remote free route.
+    //
+    union {
+        MemoryPoolSingleBlock *PrevBlock;
+        MemoryPoolThreadCache *OwnerCache;
+    };
 };
 
-inline void MemoryPoolSingleBlock::Init_Block(int size, MemoryPoolBlob *owning_blob)
+inline void MemoryPoolSingleBlock::Init_Block(int, MemoryPoolBlob *owning_blob)
 {
     NextBlock = 0;
     PrevBlock = 0;
     OwningBlob = owning_blob;
 }
 
+inline void MemoryPoolSingleBlock::Set_Raw_Tag(int tag, int bytes)
+{
+    // The words in front of the aligned base or mapping size word.
+    reinterpret_cast<intptr_t *>(this)[-2] = tag;
+    reinterpret_cast<intptr_t *>(this)[-3] = bytes;
+}
+
 inline void MemoryPoolSingleBlock::Remove_Block_From_List(MemoryPoolSingleBlock **list_head)
 {
-    ASSERT_PRINT(OwningBlob == nullptr, "This function should only be used on raw blocks.\n");
+    ASSERT_PRINT(Is_Raw_Block(), "This function should only be used on raw blocks.\n");
 
     // Do we have previous? If not, we are the head?
     if ( PrevBlock != nullptr ) {
@@ -81,13 +119,14 @@ inline void MemoryPoolSingleBlock::Remove_Block_From_List(MemoryPoolSingleBlock
 
 inline void MemoryPoolSingleBlock::Add_Block_To_List(MemoryPoolSingleBlock **list_head)
 {
+    PrevBlock = nullptr;
     NextBlock = *list_head;
 
     if ( *list_head != nullptr ) {
         (*list_head)->PrevBlock = this;
     }
 
-    //*list_head = this;
+    *list_head = this;
 }
 
 inline MemoryPoolSingleBlock *MemoryPoolSingleBlock::Recover_Block_From_User_Data(void *data)
@@ -110,4 +149,85 @@ inline MemoryPoolSingleBlock *MemoryPoolSingleBlock::Raw_Allocate_Single_Block(M
     return block;
 }
 
+inline MemoryPoolSingleBlock *MemoryPoolSingleBlock::Raw_Allocate_Aligned_Single_Block(MemoryPoolSingleBlock **list_head, int size, int alignment)
+{
+    //
+    // The header goes right in front of the aligned user data as usual with the
+    // start of the allocation saved in the word before it so the free can find
+    // it again, then the memory tag words and the size and alignment asked for
+    // so realloc knows how much to copy and where the copy may go. The tag in
+    // OwningBlob says those words are there.
+    //
+    int prefix = sizeof(void *) * (RAW_TAG_WORDS + 3) + sizeof(MemoryPoolSingleBlock);
+    char *base = static_cast<char *>(Raw_Allocate_No_Zero(Round_Up_Word_Size(size) + prefix + alignment));
+    uintptr_t data = uintptr_t(base) + prefix;
+    data = (data + alignment - 1) & ~uintptr_t(alignment - 1);
+
+    MemoryPoolSingleBlock *block = reinterpret_cast<MemoryPoolSingleBlock *>(data) - 1;
+    reinterpret_cast<char **>(block)[-1] = base;
+    block->Set_Raw_Tag(0, 0);
+    reinterpret_cast<intptr_t *>(block)[-4] = size;
+    reinterpret_cast<intptr_t *>(block)[-5] = alignment;
+    block->Init_Block(size, reinterpret_cast<MemoryPoolBlob *>(RAW_ALIGNED_TAG));
+    block->Add_Block_To_List(list_head);
+
+    return block;
+}
+
+inline MemoryPoolSingleBlock *MemoryPoolSingleBlock::Raw_Map_Huge_Single_Block(int size)
+{
+    //
+    // Whole pages from the OS with the mapping size in the word in front of the
+    // header and the tag words before that. Not put on a list here, the caller
+    // does that under its own lock.
+    //
+    int map_size = Raw_Map_Size(size + RAW_HUGE_PREFIX);
+    char *base = static_cast<char *>(Raw_Map(map_size));
+
+    MemoryPoolSingleBlock *block = reinterpret_cast<MemoryPoolSingleBlock *>(base + RAW_HUGE_PREFIX) - 1;
+    reinterpret_cast<intptr_t *>(block)[-1] = map_size;
+    block->Set_Raw_Tag(0, 0);
+    block->Init_Block(size, reinterpret_cast<MemoryPoolBlob *>(RAW_HUGE_TAG));
+
+    return block;
+}
+
+inline MemoryPoolSingleBlock *MemoryPoolSingleBlock::Raw_Remap_Huge_Single_Block(int size)
+{
+    //
+    // The header moves along with the data, list links in it are stale after so
+    // the caller takes it off its list first. Returns nullptr and leaves the
+    // block alone if it can't be remapped.
+    //
+    int map_size = Raw_Map_Size(size + RAW_HUGE_PREFIX);
+    char *base = static_cast<char *>(Get_User_Data()) - RAW_HUGE_PREFIX;
+    base = static_cast<char *>(Raw_Remap(base, Get_Huge_Map_Size(), map_size));
+
+    if ( base == nullptr ) {
+        return nullptr;
+    }
+
+    MemoryPoolSingleBlock *block = reinterpret_cast<MemoryPoolSingleBlock *>(base + RAW_HUGE_PREFIX) - 1;
+    reinterpret_cast<intptr_t *>(block)[-1] = map_size;
+
+    return block;
+}
+
+inline void MemoryPoolSingleBlock::Raw_Free_Single_Block(MemoryPoolSingleBlock **list_head)
+{
+    Remove_Block_From_List(list_head);
+    Raw_Free_Memory();
+}
+
+inline void MemoryPoolSingleBlock::Raw_Free_Memory()
+{
+    if ( Is_Huge_Block() ) {
+        Raw_Release(static_cast<char *>(Get_User_Data()) - RAW_HUGE_PREFIX, Get_Huge_Map_Size());
+    } else if ( OwningBlob != nullptr ) {
+        Raw_Free(reinterpret_cast<char **>(this)[-1]);
+    } else {
+        Raw_Free(this);
+    }
+}
+
 #endif // _MEMBLOCK_H_
@@ -25,21 +25,87 @@
 #include "memdynalloc.h"
 #include "critsection.h"
 #include "gamememoryinit.h"
+#include "heapprofiler.h"
 #include "memblob.h"
 #include "memblock.h"
 #include "mempool.h"
 #include "mempoolfact.h"
+#include "memtag.h"
+#include "memtrace.h"
+#include "minmax.h"
 
 SimpleCriticalSectionClass *DmaCriticalSection = nullptr;
+bool DynamicMemoryAllocator::RecordRequests = false;
+
+//
+// Requests above the largest DMA pool used to each get their own heap block.
+// Up to MEDIUM_MAX_SIZE they now go to these, four classes per power of two so
+// rounding wastes under a quarter, with counts that make each blob around
+// 128KiB. The smaller ones fit the slab layout.
+//
+static PoolInitRec const MediumClasses[DynamicMemoryAllocator::MEDIUM_CLASS_COUNT] = {
+    { "dmaMedium_1280",  1280,  102, 102 },
+    { "dmaMedium_1536",  1536,  85, 85 },
+    { "dmaMedium_1792",  1792,  73, 73 },
+    { "dmaMedium_2048",  2048,  64, 64 },
+    { "dmaMedium_2560",  2560,  51, 51 },
+    { "dmaMedium_3072",  3072,  42, 42 },
+    { "dmaMedium_3584",  3584,  36, 36 },
+    { "dmaMedium_4096",  4096,  32, 32 },
+    { "dmaMedium_5120",  5120,  25, 25 },
+    { "dmaMedium_6144",  6144,  21, 21 },
+    { "dmaMedium_7168",  7168,  18, 18 },
+    { "dmaMedium_8192",  8192,  16, 16 },
+    { "dmaMedium_10240", 10240, 12, 12 },
+    { "dmaMedium_12288", 12288, 10, 10 },
+    { "dmaMedium_14336", 14336, 9, 9 },
+    { "dmaMedium_16384", 16384, 8, 8 },
+    { "dmaMedium_20480", 20480, 6, 6 },
+    { "dmaMedium_24576", 24576, 5, 5 },
+    { "dmaMedium_28672", 28672, 4, 4 },
+    { "dmaMedium_32768", 32768, 4, 4 },
+    { "dmaMedium_40960", 40960, 3, 3 },
+    { "dmaMedium_49152", 49152, 2, 2 },
+    { "dmaMedium_57344", 57344, 2, 2 },
+    { "dmaMedium_65536", 65536, 2, 2 },
+};
+
+//
+// Slab blocks of a size class can sit on the largest power of 2 dividing the
+// size, up to a cache line, for nothing more than a bigger slab header. That
+// lets aligned requests use the normal size classes. Headered pools would pad
+// every block for it so they stay word aligned.
+//
+static int Size_Class_Alignment(PoolInitRec const &params)
+{
+    int size = Round_Up_Word_Size(params.AllocationSize);
+
+    if ( !MemoryPoolBlob::Slab_Layout_Fits(size, params.InitialAllocationCount, params.OverflowAllocationCount) ) {
+        return 0;
+    }
+
+    return MIN<int>(size & -size, MemoryPool::CACHE_LINE_SIZE);
+}
 
 DynamicMemoryAllocator::DynamicMemoryAllocator() :
     Factory(nullptr),
     NextDmaInFactory(nullptr),
     PoolCount(0),
     UsedBlocksInDma(0),
-    RawBlocks(0)
+    Pools(nullptr),
+    RawBlocks(0),
+    MaxPoolSize(0),
+    SizeClassTable(nullptr),
+    RawAllocations(0),
+    RawAllocatedBytes(0),
+    RequestHistogram(nullptr),
+    HugeBlocks(0),
+    HugeBytes(0),
+    HugeRemaps(0),
+    TrackTags(false)
 {
-    memset(Pools, 0, sizeof(Pools));
+    memset(RawHistogram, 0, sizeof(RawHistogram));
+    memset(MediumPools, 0, sizeof(MediumPools));
 }
 
 void DynamicMemoryAllocator::Init(MemoryPoolFactory *factory, int subpools, PoolInitRec const *const params)
@@ -67,13 +133,82 @@ void DynamicMemoryAllocator::Init(MemoryPoolFactory *factory, int subpools, Pool
 
     Factory = factory;
     UsedBlocksInDma = 0;
+    Pools = static_cast<MemoryPool **>(Raw_Allocate(PoolCount * sizeof(MemoryPool *)));
 
-    if ( PoolCount > 8 ) {
-        PoolCount = 8;
+    for ( int i = 0; i < PoolCount; ++i ) {
+        Pools[i] = Factory->Create_Memory_Pool(
+            init_list[i].PoolName,
+            Pool_Name_Hash(init_list[i].PoolName),
+            init_list[i].AllocationSize,
+            init_list[i].InitialAllocationCount,
+            init_list[i].OverflowAllocationCount,
+            Size_Class_Alignment(init_list[i])
+        );
+        Pools[i]->TraceBlocks = false;
     }
 
-    for ( int i = 0; i < PoolCount; ++i ) {
-        Pools[i] = Factory->Create_Memory_Pool(&init_list[i]);
+    Build_Size_Class_Table();
+    Build_Medium_Class_Table();
+
+    //
+    // Blocks carry their tag so frees can be credited, the pools only make room
+    // for it when asked. Turning tags on later doesn't reach this allocator.
+    //
+    TrackTags = MemoryTag::Is_Enabled();
+
+    if ( TrackTags ) {
+        for ( int i = 0; i < PoolCount; ++i ) {
+            Pools[i]->Enable_Block_Tags();
+        }
+    }
+}
+
+void DynamicMemoryAllocator::Build_Size_Class_Table()
+{
+    //
+    // Lookup relies on the pools being in ascending size order, user tables
+    // should be but sort them anyway rather than trust it.
+    //
+    for ( int i = 1; i < PoolCount; ++i ) {
+        MemoryPool *pool = Pools[i];
+        int j = i - 1;
+
+        for ( ; j >= 0 && Pools[j]->AllocationSize > pool->AllocationSize; --j ) {
+            Pools[j + 1] = Pools[j];
+        }
+
+        Pools[j + 1] = pool;
+    }
+
+    MaxPoolSize = Pools[PoolCount - 1]->AllocationSize;
+
+    //
+    // Each entry covers sizes up to (index << SIZE_CLASS_SHIFT) and holds the
+    // smallest pool that fits that, so lookup is a shift and a load.
+    //
+    int entries = ((MaxPoolSize + (1 << SIZE_CLASS_SHIFT) - 1) >> SIZE_CLASS_SHIFT) + 1;
+    SizeClassTable = static_cast<uint16_t *>(Raw_Allocate(entries * sizeof(uint16_t)));
+    RequestHistogram = static_cast<int *>(Raw_Allocate(entries * sizeof(int)));
+
+    for ( int i = 0, pool = 0; i < entries; ++i ) {
+        int size = i << SIZE_CLASS_SHIFT;
+
+        while ( pool < PoolCount - 1 && Pools[pool]->AllocationSize < size ) {
+            ++pool;
+        }
+
+        SizeClassTable[i] = pool;
+    }
+}
+
+void DynamicMemoryAllocator::Build_Medium_Class_Table()
+{
+    for ( int i = 0, index = 0; i <= (MEDIUM_MAX_SIZE >> MEDIUM_CLASS_SHIFT); ++i ) {
+        while ( index < MEDIUM_CLASS_COUNT - 1 && MediumClasses[index].AllocationSize < (i << MEDIUM_CLASS_SHIFT) ) {
+            ++index;
+        }
+
+        MediumClassTable[i] = index;
     }
 }
 
@@ -86,24 +221,74 @@ DynamicMemoryAllocator::~DynamicMemoryAllocator()
         Pools[i] = nullptr;
     }
 
+    for ( int i = 0; i < MEDIUM_CLASS_COUNT; ++i ) {
+        if ( MediumPools[i] != nullptr ) {
+            Factory->Destroy_Memory_Pool(MediumPools[i]);
+            MediumPools[i] = nullptr;
+        }
+    }
+
     for ( MemoryPoolSingleBlock *b = RawBlocks; b != nullptr; b = RawBlocks ) {
         Free_Bytes(b->Get_User_Data());
     }
+
+    Raw_Free(Pools);
+    Raw_Free(SizeClassTable);
+    Raw_Free(RequestHistogram);
 }
 
 MemoryPool *DynamicMemoryAllocator::Find_Pool_For_Size(int size)
 {
-    if ( PoolCount <= 0 ) {
+    if ( PoolCount <= 0 || size > MaxPoolSize ) {
         return nullptr;
     }
 
-    for ( int i = 0; i < PoolCount; ++i ) {
-        if ( size <= Pools[i]->AllocationSize ) {
-            return Pools[i];
+    if ( size < 0 ) {
+        return Pools[0];
+    }
+
+    return Pools[SizeClassTable[(size + (1 << SIZE_CLASS_SHIFT) - 1) >> SIZE_CLASS_SHIFT]];
+}
+
+MemoryPool *DynamicMemoryAllocator::Find_Medium_Pool(int size)
+{
+    int index = MediumClassTable[(size + (1 << MEDIUM_CLASS_SHIFT) - 1) >> MEDIUM_CLASS_SHIFT];
+
+    //
+    // Most classes never see a request so their pools are only made on first use.
+    // The factory hands every thread that races here the same pool. It has to
+    // have room for tags before other threads can pick it up from the table, so
+    // the table entry is only read and written with acquire and release order.
+    //
+#ifdef COMPILER_MSVC
+    MemoryPool *pool = *static_cast<MemoryPool *volatile *>(&MediumPools[index]);
+#elif defined COMPILER_GNUC || defined COMPILER_CLANG
+    MemoryPool *pool = __atomic_load_n(&MediumPools[index], __ATOMIC_ACQUIRE);
+#endif
+
+    if ( pool == nullptr ) {
+        PoolInitRec const &params = MediumClasses[index];
+        pool = Factory->Create_Memory_Pool(
+            params.PoolName,
+            Pool_Name_Hash(params.PoolName),
+            params.AllocationSize,
+            params.InitialAllocationCount,
+            params.OverflowAllocationCount
+        );
+
+        if ( TrackTags ) {
+            pool->Enable_Block_Tags();
         }
+
+        pool->TraceBlocks = false;
+#ifdef COMPILER_MSVC
+        InterlockedExchangePointer(reinterpret_cast<void *volatile *>(&MediumPools[index]), pool);
+#elif defined COMPILER_GNUC || defined COMPILER_CLANG
+        __atomic_store_n(&MediumPools[index], pool, __ATOMIC_RELEASE);
+#endif
     }
 
-    return nullptr;
+    return pool;
 }
 
 void DynamicMemoryAllocator::Add_To_List(DynamicMemoryAllocator **head)
@@ -137,50 +322,325 @@ void DynamicMemoryAllocator::Remove_From_List(DynamicMemoryAllocator **head)
     }
 }
 
-void *DynamicMemoryAllocator::Allocate_Bytes_No_Zero(int bytes)
+void DynamicMemoryAllocator::Increment_Used_Blocks()
 {
-    ScopedCriticalSectionClass cs(DmaCriticalSection);
+#ifdef COMPILER_MSVC
+    InterlockedIncrement(reinterpret_cast<volatile long *>(&UsedBlocksInDma));
+#elif defined COMPILER_GNUC || defined COMPILER_CLANG
+    __sync_add_and_fetch(&UsedBlocksInDma, 1);
+#endif
+}
+
+void DynamicMemoryAllocator::Decrement_Used_Blocks()
+{
+#ifdef COMPILER_MSVC
+    InterlockedDecrement(reinterpret_cast<volatile long *>(&UsedBlocksInDma));
+#elif defined COMPILER_GNUC || defined COMPILER_CLANG
+    __sync_sub_and_fetch(&UsedBlocksInDma, 1);
+#endif
+}
 
+void *DynamicMemoryAllocator::Allocate_Bytes_No_Zero(int bytes)
+{
     MemoryPool *mp = Find_Pool_For_Size(bytes);
     void *block;
 
+    //
+    // Pool sizes are serialised by the pool itself, we only need our own lock
+    // to protect the raw block list.
+    //
     if ( mp != nullptr ) {
+        if ( RecordRequests && bytes >= 0 ) {
+            int index = (bytes + (1 << SIZE_CLASS_SHIFT) - 1) >> SIZE_CLASS_SHIFT;
+#ifdef COMPILER_MSVC
+            InterlockedIncrement(reinterpret_cast<volatile long *>(&RequestHistogram[index]));
+#elif defined COMPILER_GNUC || defined COMPILER_CLANG
+            __sync_add_and_fetch(&RequestHistogram[index], 1);
+#endif
+        }
+
         block = mp->Allocate_Block_No_Zero();
+    } else if ( bytes <= MEDIUM_MAX_SIZE ) {
+        block = Find_Medium_Pool(bytes)->Allocate_Block_No_Zero();
     } else {
-        block = MemoryPoolSingleBlock::Raw_Allocate_Single_Block(&RawBlocks, bytes)->Get_User_Data();
+        block = Allocate_Huge_Block(bytes);
+    }
+
+    if ( TrackTags ) {
+        Tag_Block(block, bytes);
+    }
+
+    if ( MemoryTrace::Is_Active() ) {
+        MemoryTrace::Record_Allocate_Bytes(block, bytes);
     }
 
-    ++UsedBlocksInDma;
+    Increment_Used_Blocks();
+
+    return block;
+}
+
+void *DynamicMemoryAllocator::Allocate_Huge_Block(int bytes)
+{
+    //
+    // Mapping and unmapping happen outside the lock, it only covers the list
+    // that lets Reset find everything.
+    //
+    MemoryPoolSingleBlock *sblock = MemoryPoolSingleBlock::Raw_Map_Huge_Single_Block(bytes);
+    void *block = sblock->Get_User_Data();
+
+    {
+        ScopedCriticalSectionClass cs(DmaCriticalSection);
+        sblock->Add_Block_To_List(&RawBlocks);
+        Record_Raw_Allocation(bytes);
+        ++HugeBlocks;
+        HugeBytes += sblock->Get_Huge_Map_Size();
+    }
+
+    // Pool sized requests get sampled by the pool itself.
+    if ( HeapProfiler::Is_Active() ) {
+        HeapProfiler::Sample_Allocation(block, bytes);
+    }
 
     return block;
 }
 
 void *DynamicMemoryAllocator::Allocate_Bytes(int bytes)
 {
+    // Huge blocks are fresh pages, already zero.
+    if ( bytes > MaxPoolSize && bytes > MEDIUM_MAX_SIZE ) {
+        return Allocate_Bytes_No_Zero(bytes);
+    }
+
     void *block = Allocate_Bytes_No_Zero(bytes);
     memset(block, 0, bytes);
 
     return block;
 }
 
+void *DynamicMemoryAllocator::Allocate_Bytes_Aligned_No_Zero(int bytes, int alignment)
+{
+    if ( alignment <= int(sizeof(void *)) ) {
+        return Allocate_Bytes_No_Zero(bytes);
+    }
+
+    ASSERT_THROW((alignment & (alignment - 1)) == 0, 0xDEAD0002);
+
+    void *block = nullptr;
+
+    //
+    // Pools are in size order, take the first one from the size class up that
+    // is aligned enough.
+    //
+    if ( PoolCount > 0 && bytes <= MaxPoolSize ) {
+        int i = bytes <= 0 ? 0 : SizeClassTable[(bytes + (1 << SIZE_CLASS_SHIFT) - 1) >> SIZE_CLASS_SHIFT];
+
+        for ( ; i < PoolCount; ++i ) {
+            if ( Pools[i]->Alignment >= alignment ) {
+                block = Pools[i]->Allocate_Block_No_Zero();
+
+                break;
+            }
+        }
+    }
+
+    if ( block == nullptr ) {
+        {
+            ScopedCriticalSectionClass cs(DmaCriticalSection);
+            block = MemoryPoolSingleBlock::Raw_Allocate_Aligned_Single_Block(&RawBlocks, bytes, alignment)->Get_User_Data();
+            Record_Raw_Allocation(bytes);
+        }
+
+        if ( HeapProfiler::Is_Active() ) {
+            HeapProfiler::Sample_Allocation(block, bytes);
+        }
+    }
+
+    if ( TrackTags ) {
+        Tag_Block(block, bytes);
+    }
+
+    if ( MemoryTrace::Is_Active() ) {
+        MemoryTrace::Record_Allocate_Aligned(block, bytes, alignment);
+    }
+
+    Increment_Used_Blocks();
+
+    return block;
+}
+
+void *DynamicMemoryAllocator::Allocate_Bytes_Aligned(int bytes, int alignment)
+{
+    void *block = Allocate_Bytes_Aligned_No_Zero(bytes, alignment);
+    memset(block, 0, bytes);
+
+    return block;
+}
+
 void DynamicMemoryAllocator::Free_Bytes(void *block)
 {
     if ( block == nullptr ) {
         return;
     }
 
-    ScopedCriticalSectionClass cs(DmaCriticalSection);
+    // Has to happen while we still own the block.
+    if ( TrackTags ) {
+        Untag_Block(block);
+    }
+
+    if ( MemoryTrace::Is_Active() ) {
+        MemoryTrace::Record_Free_Bytes(block);
+    }
+
+    //
+    // Slab blocks have nothing in front of them, so check for those before
+    // treating the pointer as having a header.
+    //
+    if ( MemoryPoolBlob::Is_Slab_Address(block) ) {
+        MemoryPoolBlob::Recover_Blob_From_Slot(block)->OwningPool->Free_Block(block);
+        Decrement_Used_Blocks();
+
+        return;
+    }
 
     MemoryPoolSingleBlock *sblock = MemoryPoolSingleBlock::Recover_Block_From_User_Data(block);
 
-    if ( sblock->OwningBlob != nullptr ) {
+    if ( !sblock->Is_Raw_Block() ) {
         sblock->OwningBlob->OwningPool->Free_Block(block);
+    } else if ( sblock->Is_Huge_Block() ) {
+        if ( HeapProfiler::Is_Active() ) {
+            HeapProfiler::Record_Free(block);
+        }
+
+        {
+            ScopedCriticalSectionClass cs(DmaCriticalSection);
+            sblock->Remove_Block_From_List(&RawBlocks);
+            --HugeBlocks;
+            HugeBytes -= sblock->Get_Huge_Map_Size();
+        }
+
+        sblock->Raw_Free_Memory();
     } else {
-        sblock->Remove_Block_From_List(&RawBlocks);
-        Raw_Free(sblock);
+        if ( HeapProfiler::Is_Active() ) {
+            HeapProfiler::Record_Free(block);
+        }
+
+        ScopedCriticalSectionClass cs(DmaCriticalSection);
+        sblock->Raw_Free_Single_Block(&RawBlocks);
     }
 
-    --UsedBlocksInDma;
+    Decrement_Used_Blocks();
+}
+
+void *DynamicMemoryAllocator::Reallocate_Bytes_No_Zero(void *block, int bytes)
+{
+    if ( block == nullptr ) {
+        return Allocate_Bytes_No_Zero(bytes);
+    }
+
+    MemoryPoolSingleBlock *sblock = nullptr;
+
+    if ( !MemoryPoolBlob::Is_Slab_Address(block) ) {
+        sblock = MemoryPoolSingleBlock::Recover_Block_From_User_Data(block);
+    }
+
+    //
+    // A huge block staying huge gets its pages moved by the OS where it can, no
+    // copy. It has to come off the list meanwhile as the header moves with it.
+    //
+    if ( sblock != nullptr && sblock->Is_Huge_Block() && bytes > MaxPoolSize && bytes > MEDIUM_MAX_SIZE ) {
+        int old_map_size = sblock->Get_Huge_Map_Size();
+
+        {
+            ScopedCriticalSectionClass cs(DmaCriticalSection);
+            sblock->Remove_Block_From_List(&RawBlocks);
+        }
+
+        MemoryPoolSingleBlock *moved = sblock->Raw_Remap_Huge_Single_Block(bytes);
+
+        {
+            ScopedCriticalSectionClass cs(DmaCriticalSection);
+
+            if ( moved != nullptr ) {
+                HugeBytes += moved->Get_Huge_Map_Size() - old_map_size;
+                ++HugeRemaps;
+                sblock = moved;
+            }
+
+            sblock->Add_Block_To_List(&RawBlocks);
+        }
+
+        if ( moved != nullptr ) {
+            if ( HeapProfiler::Is_Active() ) {
+                HeapProfiler::Record_Free(block);
+                HeapProfiler::Sample_Allocation(moved->Get_User_Data(), bytes);
+            }
+
+            // The tag words moved with the pages, the tag just needs charging for the new size.
+            int tag = moved->Get_Raw_Tag();
+
+            if ( tag != MemoryTag::UNTAGGED ) {
+                int charge = moved->Get_Huge_Map_Size() - MemoryPoolSingleBlock::RAW_HUGE_PREFIX;
+                MemoryTag::Credit(tag, moved->Get_Raw_Tag_Bytes());
+                MemoryTag::Charge(tag, charge);
+                moved->Set_Raw_Tag(tag, charge);
+            }
+
+            if ( MemoryTrace::Is_Active() ) {
+                MemoryTrace::Record_Reallocate_Bytes(block, moved->Get_User_Data(), bytes);
+            }
+
+            return moved->Get_User_Data();
+        }
+    }
+
+    int old_size = Get_Block_Size(block);
+
+    if ( bytes <= old_size && Get_Actual_Allocation_Size(bytes) == old_size ) {
+        if ( MemoryTrace::Is_Active() ) {
+            MemoryTrace::Record_Reallocate_Bytes(block, block, bytes);
+        }
+
+        return block;
+    }
+
+    //
+    // An aligned raw block has to stay as aligned as it was asked to be, the
+    // size class the new size lands in might not be.
+    //
+    void *new_block;
+
+    if ( sblock != nullptr && uintptr_t(sblock->OwningBlob) == MemoryPoolSingleBlock::RAW_ALIGNED_TAG ) {
+        new_block = Allocate_Bytes_Aligned_No_Zero(bytes, sblock->Get_Aligned_Alignment());
+    } else {
+        new_block = Allocate_Bytes_No_Zero(bytes);
+    }
+
+    memcpy(new_block, block, MIN(old_size, bytes));
+    Free_Bytes(block);
+
+    return new_block;
+}
+
+int DynamicMemoryAllocator::Get_Block_Size(void *block)
+{
+    if ( MemoryPoolBlob::Is_Slab_Address(block) ) {
+        return MemoryPoolBlob::Recover_Blob_From_Slot(block)->OwningPool->AllocationSize;
+    }
+
+    MemoryPoolSingleBlock *sblock = MemoryPoolSingleBlock::Recover_Block_From_User_Data(block);
+
+    if ( !sblock->Is_Raw_Block() ) {
+        return sblock->OwningBlob->OwningPool->AllocationSize;
+    }
+
+    if ( sblock->Is_Huge_Block() ) {
+        return sblock->Get_Huge_Map_Size() - MemoryPoolSingleBlock::RAW_HUGE_PREFIX;
+    }
+
+    // Plain raw blocks don't keep their size, we only hand out aligned and huge ones.
+    ASSERT_THROW(uintptr_t(sblock->OwningBlob) == MemoryPoolSingleBlock::RAW_ALIGNED_TAG, 0xDEAD0002);
+
+    return sblock->Get_Aligned_Size();
 }
 
 int DynamicMemoryAllocator::Get_Actual_Allocation_Size(int bytes)
@@ -191,21 +651,172 @@ int DynamicMemoryAllocator::Get_Actual_Allocation_Size(int bytes)
         return mp->AllocationSize;
     }
 
-    return bytes;
+    if ( bytes <= MEDIUM_MAX_SIZE ) {
+        return MediumClasses[MediumClassTable[(bytes + (1 << MEDIUM_CLASS_SHIFT) - 1) >> MEDIUM_CLASS_SHIFT]].AllocationSize;
+    }
+
+    // Huge blocks can use the rest of their last page.
+    return Raw_Map_Size(bytes + MemoryPoolSingleBlock::RAW_HUGE_PREFIX) - MemoryPoolSingleBlock::RAW_HUGE_PREFIX;
 }
 
 void DynamicMemoryAllocator::Reset()
 {
-    for ( int i = 0; i < PoolCount; ++i ) {
-        if ( Pools[i] != nullptr ) {
-            Pools[i]->Reset();
-        }
-    }
-
+    //
+    // Our pools, medium ones included, are on the factory's pool list and it has
+    // already reset them. Resetting them again here would see the peak the first
+    // reset cleared and trim every pool back to its initial count.
+    //
     for ( MemoryPoolSingleBlock *sb = RawBlocks; sb != nullptr; sb = RawBlocks ) {
         Free_Bytes(sb->Get_User_Data());
     }
 
     UsedBlocksInDma = 0;
+    RawAllocations = 0;
+    RawAllocatedBytes = 0;
+    memset(RawHistogram, 0, sizeof(RawHistogram));
+    HugeRemaps = 0;
+
+    // The pools dropped their blocks without freeing them one by one.
+    if ( TrackTags ) {
+        MemoryTag::Reset();
+    }
+}
+
+void DynamicMemoryAllocator::Record_Raw_Allocation(int bytes)
+{
+    int bucket = 0;
+
+    for ( int i = (bytes - 1) >> 17; i != 0 && bucket < DynamicMemoryAllocatorStats::RAW_HISTOGRAM_BUCKETS - 1; i >>= 1 ) {
+        ++bucket;
+    }
+
+    ++RawHistogram[bucket];
+    ++RawAllocations;
+    RawAllocatedBytes += bytes;
+}
+
+void DynamicMemoryAllocator::Tag_Block(void *block, int bytes)
+{
+    int tag = MemoryTag::Get_Current();
+
+    if ( tag == MemoryTag::UNTAGGED ) {
+        return;
+    }
+
+    //
+    // Pool blocks are charged their whole size class, raw ones what they can
+    // hold. Raw blocks keep the charge themselves as the aligned ones don't
+    // otherwise know their size.
+    //
+    int charge;
+
+    if ( MemoryPoolBlob::Is_Slab_Address(block) ) {
+        MemoryPoolBlob *blob = MemoryPoolBlob::Recover_Blob_From_Slot(block);
+        blob->Set_Block_Tag(block, tag);
+        charge = blob->OwningPool->AllocationSize;
+    } else {
+        MemoryPoolSingleBlock *sblock = MemoryPoolSingleBlock::Recover_Block_From_User_Data(block);
+
+        if ( !sblock->Is_Raw_Block() ) {
+            sblock->OwningBlob->Set_Block_Tag(block, tag);
+            charge = sblock->OwningBlob->OwningPool->AllocationSize;
+        } else {
+            charge = sblock->Is_Huge_Block() ? sblock->Get_Huge_Map_Size() - MemoryPoolSingleBlock::RAW_HUGE_PREFIX : Round_Up_Word_Size(bytes);
+            sblock->Set_Raw_Tag(tag, charge);
+        }
+    }
+
+    MemoryTag::Charge(tag, charge);
+}
+
+void DynamicMemoryAllocator::Untag_Block(void *block)
+{
+    int tag;
+    int charge;
+
+    if ( MemoryPoolBlob::Is_Slab_Address(block) ) {
+        MemoryPoolBlob *blob = MemoryPoolBlob::Recover_Blob_From_Slot(block);
+        tag = blob->Get_Block_Tag(block);
+
+        if ( tag == MemoryTag::UNTAGGED ) {
+            return;
+        }
+
+        blob->Set_Block_Tag(block, MemoryTag::UNTAGGED);
+        charge = blob->OwningPool->AllocationSize;
+    } else {
+        MemoryPoolSingleBlock *sblock = MemoryPoolSingleBlock::Recover_Block_From_User_Data(block);
+
+        if ( !sblock->Is_Raw_Block() ) {
+            tag = sblock->OwningBlob->Get_Block_Tag(block);
+
+            if ( tag == MemoryTag::UNTAGGED ) {
+                return;
+            }
+
+            sblock->OwningBlob->Set_Block_Tag(block, MemoryTag::UNTAGGED);
+            charge = sblock->OwningBlob->OwningPool->AllocationSize;
+        } else {
+            // Raw blocks are gone once freed so there is no need to clear theirs.
+            tag = sblock->Get_Raw_Tag();
+            charge = sblock->Get_Raw_Tag_Bytes();
+
+            if ( tag == MemoryTag::UNTAGGED ) {
+                return;
+            }
+        }
+    }
+
+    MemoryTag::Credit(tag, charge);
+}
+
+int DynamicMemoryAllocator::Get_Request_Histogram(int *counts, int max_count)
+{
+    //
+    // Entry i counts requests of ((i - 1) << SIZE_CLASS_SHIFT, i << SIZE_CLASS_SHIFT]
+    // bytes. Returns the number of entries, fills at most max_count of them.
+    //
+    int entries = ((MaxPoolSize + (1 << SIZE_CLASS_SHIFT) - 1) >> SIZE_CLASS_SHIFT) + 1;
+
+    for ( int i = 0; i < entries && i < max_count; ++i ) {
+        counts[i] = RequestHistogram[i];
+    }
+
+    return entries;
+}
+
+void DynamicMemoryAllocator::Get_Stats(DynamicMemoryAllocatorStats &stats)
+{
+    MemoryPoolStats ps;
+
+    stats.MediumPoolCount = 0;
+    stats.MediumBlocks = 0;
+    stats.MediumBytes = 0;
+
+    // Pools take their own locks, not worth holding ours over them.
+    for ( int i = 0; i < MEDIUM_CLASS_COUNT; ++i ) {
+        if ( MediumPools[i] != nullptr ) {
+            MediumPools[i]->Get_Stats(ps);
+            ++stats.MediumPoolCount;
+            stats.MediumBlocks += ps.UsedBlocks;
+            stats.MediumBytes += ps.BlobBytes;
+        }
+    }
+
+    ScopedCriticalSectionClass cs(DmaCriticalSection);
+
+    stats.PoolCount = PoolCount;
+    stats.UsedBlocks = UsedBlocksInDma;
+    stats.RawBlocks = 0;
+    stats.RawAllocations = RawAllocations;
+    stats.RawAllocatedBytes = RawAllocatedBytes;
+    memcpy(stats.RawHistogram, RawHistogram, sizeof(RawHistogram));
+    stats.HugeBlocks = HugeBlocks;
+    stats.HugeBytes = HugeBytes;
+    stats.HugeRemaps = HugeRemaps;
+
+    for ( MemoryPoolSingleBlock *b = RawBlocks; b != nullptr; b = b->NextBlock ) {
+        ++stats.RawBlocks;
+    }
 }
 
@@ -38,13 +38,41 @@ class MemoryPoolFactory;
 class MemoryPoolSingleBlock;
 class SimpleCriticalSectionClass;
 
+// Only guards the raw block list, pool and medium sized requests rely on the pool's own lock.
 extern SimpleCriticalSectionClass* DmaCriticalSection;
 
+struct DynamicMemoryAllocatorStats
+{
+    enum {
+        RAW_HISTOGRAM_BUCKETS = 12,     // Powers of two from 128KiB, the last bucket takes everything over 128MiB.
+    };
+
+    int PoolCount;
+    int UsedBlocks;
+    int MediumPoolCount;    // Medium size classes used so far, their pools show up in the pool stats too.
+    int MediumBlocks;
+    int MediumBytes;        // Everything the medium pools' blobs hold.
+    int RawBlocks;          // Huge blocks plus over aligned ones that didn't fit a pool.
+    int RawAllocations;     // Since Init or the last Reset.
+    uint64_t RawAllocatedBytes;
+    int RawHistogram[RAW_HISTOGRAM_BUCKETS];
+    int HugeBlocks;
+    uint64_t HugeBytes;     // Mapped for the huge blocks in use.
+    int HugeRemaps;         // Reallocations the OS did by moving pages, since Init or the last Reset.
+};
+
 #define TheDynamicMemoryAllocator (Make_Global<DynamicMemoryAllocator*>(0x00A29B98))
 
 class DynamicMemoryAllocator
 {
 public:
+    enum {
+        SIZE_CLASS_SHIFT = 3,   // Granularity of the size class lookup table, 8 bytes.
+        MEDIUM_CLASS_SHIFT = 8, // Granularity of the medium class lookup table, 256 bytes.
+        MEDIUM_CLASS_COUNT = 24,
+        MEDIUM_MAX_SIZE = 0x10000,  // Anything bigger than the largest pool and this gets its own pages.
+    };
+
     DynamicMemoryAllocator();
     void Init(MemoryPoolFactory *factory, int subpools, PoolInitRec const *const params);
     ~DynamicMemoryAllocator();
@@ -53,9 +81,19 @@ public:
     void Remove_From_List(DynamicMemoryAllocator **head);
     void *Allocate_Bytes_No_Zero(int bytes);
     void *Allocate_Bytes(int bytes);
+    void *Allocate_Bytes_Aligned_No_Zero(int bytes, int alignment);
+    void *Allocate_Bytes_Aligned(int bytes, int alignment);
+    void *Reallocate_Bytes_No_Zero(void *block, int bytes);
     void Free_Bytes(void *block);
     int Get_Actual_Allocation_Size(int bytes);
     void Reset();
+    void Get_Stats(DynamicMemoryAllocatorStats &stats);
+    MemoryPool *Get_Pool(int index) { return Pools[index]; }
+    int Get_Pool_Count() const { return PoolCount; }
+    int Get_Request_Histogram(int *counts, int max_count);
+
+    // Counts pool sized requests by size so size classes can be tuned.
+    static void Set_Record_Requests(bool record) { RecordRequests = record; }
 
     void *operator new(size_t size)
     {
@@ -74,8 +112,34 @@ private:
     DynamicMemoryAllocator *NextDmaInFactory;
     int PoolCount;
     int UsedBlocksInDma;
-    MemoryPool *Pools[8];
+    MemoryPool **Pools;
     MemoryPoolSingleBlock *RawBlocks;
+    int MaxPoolSize;
+    uint16_t *SizeClassTable;   // Pool index for each SIZE_CLASS_SHIFT sized step up to MaxPoolSize.
+    int RawAllocations;
+    uint64_t RawAllocatedBytes;
+    int RawHistogram[DynamicMemoryAllocatorStats::RAW_HISTOGRAM_BUCKETS];
+    int *RequestHistogram;      // Same indexing as SizeClassTable.
+    MemoryPool *MediumPools[MEDIUM_CLASS_COUNT];    // Created on first use.
+    uint8_t MediumClassTable[(MEDIUM_MAX_SIZE >> MEDIUM_CLASS_SHIFT) + 1];
+    int HugeBlocks;
+    uint64_t HugeBytes;
+    int HugeRemaps;
+    bool TrackTags;     // MemoryTag was enabled when Init ran.
+
+    static bool RecordRequests;
+
+private:
+    void Increment_Used_Blocks();
+    void Decrement_Used_Blocks();
+    void Build_Size_Class_Table();
+    void Build_Medium_Class_Table();
+    MemoryPool *Find_Medium_Pool(int size);
+    void *Allocate_Huge_Block(int bytes);
+    int Get_Block_Size(void *block);
+    void Record_Raw_Allocation(int bytes);
+    void Tag_Block(void *block, int bytes);
+    void Untag_Block(void *block);
 };
 
 
@@ -24,11 +24,19 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "mempool.h"
 #include "critsection.h"
+#include "gamememoryinit.h"
+#include "heapprofiler.h"
 #include "memblob.h"
 #include "memblock.h"
+#include "memthreadcache.h"
+#include "memtrace.h"
+#include "memvirtual.h"
 #include "minmax.h"
 
 SimpleCriticalSectionClass *MemoryPoolCriticalSection = nullptr;
+bool MemoryPool::UseHeaderlessBlobs = true;
+bool MemoryPool::UseVirtualBlobs = true;
+int MemoryPool::ResetRetainPercent = 100;
 
 /////////////
 // MemoryPool
@@ -46,7 +54,23 @@ MemoryPool::MemoryPool() :
     PeakUsedBlocksInPool(0),
     FirstBlob(nullptr),
     LastBlob(nullptr),
-    FirstBlobWithFreeBlocks(nullptr)
+    FirstBlobWithFreeBlocks(nullptr),
+    FillLists(),
+    RemoteFreeList(nullptr),
+    PoolLock(),
+    CacheSlot(-1),
+    CacheSerial(0),
+    MagazineSize(0),
+    RequestedSize(0),
+    OverflowBlobCount(0),
+    SessionPeakUsedBlocks(0),
+    SessionOverflowBlobCount(0),
+    Headerless(false),
+    TrackLive(false),
+    TrackTags(false),
+    TraceBlocks(true),
+    VirtualRange(nullptr),
+    Alignment(sizeof(void *))
 {
 
 }
@@ -56,13 +80,19 @@ MemoryPool::~MemoryPool()
     for ( MemoryPoolBlob *b = FirstBlob; b != nullptr; b = FirstBlob ) {
         Free_Blob(b);
     }
+
+    delete VirtualRange;
 }
 
-void MemoryPool::Init(MemoryPoolFactory *factory, char const *name, int size, int count, int overflow)
+void MemoryPool::Init(MemoryPoolFactory *factory, char const *name, int size, int count, int overflow, int alignment)
 {
+    ASSERT_THROW(alignment <= MAX_ALIGNMENT && (alignment & (alignment - 1)) == 0, 0xDEAD0002);
+
     Factory = factory;
     PoolName = name;
-    AllocationSize = Round_Up_Word_Size(size);
+    RequestedSize = size;
+    Alignment = MAX<int>(alignment, sizeof(void *));
+    AllocationSize = Round_Up_Alignment(size, Alignment);
     OverflowAllocationCount = overflow;
     InitialAllocationCount = count;
     UsedBlocksInPool = 0;
@@ -71,7 +101,56 @@ void MemoryPool::Init(MemoryPoolFactory *factory, char const *name, int size, in
     FirstBlob = nullptr;
     LastBlob = nullptr;
     FirstBlobWithFreeBlocks = nullptr;
-    Create_Blob(count);
+    RemoteFreeList = nullptr;
+    OverflowBlobCount = 0;
+
+    for ( int i = 0; i < FILL_LIST_COUNT; ++i ) {
+        FillLists[i] = nullptr;
+    }
+
+    Headerless = UseHeaderlessBlobs && MemoryPoolBlob::Slab_Layout_Fits(AllocationSize, count, overflow);
+    TrackLive = User_Memory_Track_Live_Blocks(name);
+
+    // Small pools get small magazines, otherwise a single refill forces overflow blobs.
+    MagazineSize = Clamp<int>(
+        MIN(MemoryPoolThreadCache::MAGAZINE_BYTES / AllocationSize, count / 2),
+        MemoryPoolThreadCache::MAGAZINE_MIN_BLOCKS,
+        MemoryPoolThreadCache::MAGAZINE_MAX_BLOCKS
+    );
+
+    // Reset comes back through here, the range is empty again by then so keep it.
+    if ( VirtualRange == nullptr && UseVirtualBlobs ) {
+        Init_Virtual_Range();
+    }
+
+    // Lazy pools get their first blob from Find_Blob_With_Free_Blocks.
+    if ( count > 0 ) {
+        Create_Blob(count);
+    }
+}
+
+void MemoryPool::Init_Virtual_Range()
+{
+    int block_size = Get_Block_Stride();
+    int initial_bytes = InitialAllocationCount * block_size;
+
+    //
+    // Small pools would waste most of a granularity step each, they stay on the
+    // heap. Slab rounding adds at most one slab per blob so allow for that too.
+    //
+    if ( initial_bytes < VIRTUAL_MIN_BYTES ) {
+        return;
+    }
+
+    int reserve = initial_bytes + OverflowAllocationCount * block_size * VIRTUAL_OVERFLOW_BLOBS
+        + (VIRTUAL_OVERFLOW_BLOBS + 1) * MemoryPoolVirtualRange::GRANULARITY;
+
+    VirtualRange = new MemoryPoolVirtualRange;
+
+    if ( !VirtualRange->Init(reserve, User_Memory_Use_Huge_Pages(PoolName)) ) {
+        delete VirtualRange;
+        VirtualRange = nullptr;
+    }
 }
 
 MemoryPoolBlob *MemoryPool::Create_Blob(int count)
@@ -79,11 +158,14 @@ MemoryPoolBlob *MemoryPool::Create_Blob(int count)
     MemoryPoolBlob *blob = new MemoryPoolBlob;
     blob->Init_Blob(this, count);
     blob->Add_Blob_To_List(&FirstBlob, &LastBlob);
+    blob->Add_Blob_To_Fill_List(&FillLists[FILL_LIST_EMPTY], FILL_LIST_EMPTY);
 
     ASSERT_PRINT(FirstBlobWithFreeBlocks == nullptr, "Expected nullptr here");
 
     FirstBlobWithFreeBlocks = blob;
-    TotalBlocksInPool += count;
+
+    // Slab blobs round up to whole slabs so may hold more than we asked for.
+    TotalBlocksInPool += blob->TotalBlocksInBlob;
 
     return blob;
 }
@@ -93,9 +175,10 @@ int MemoryPool::Free_Blob(MemoryPoolBlob *blob)
     ASSERT_PRINT(blob->OwningPool == this, "Blob does not belong to this pool");
 
     blob->Remove_Blob_From_List(&FirstBlob, &LastBlob);
+    blob->Remove_Blob_From_Fill_List(&FillLists[blob->FillList]);
 
     if ( FirstBlobWithFreeBlocks == blob ) {
-        FirstBlobWithFreeBlocks = FirstBlob;
+        FirstBlobWithFreeBlocks = nullptr;
     }
 
     int blob_alloc = blob->TotalBlocksInBlob * AllocationSize + sizeof(*blob);
@@ -107,37 +190,265 @@ int MemoryPool::Free_Blob(MemoryPoolBlob *blob)
     return blob_alloc;
 }
 
-void *MemoryPool::Allocate_Block_No_Zero()
+MemoryPoolBlob *MemoryPool::Find_Blob_With_Free_Blocks()
 {
-    ScopedCriticalSectionClass scs(MemoryPoolCriticalSection);
+    if ( FirstBlobWithFreeBlocks != nullptr && FirstBlobWithFreeBlocks->Has_Free_Blocks() ) {
+        return FirstBlobWithFreeBlocks;
+    }
 
-    if ( FirstBlobWithFreeBlocks != nullptr && FirstBlobWithFreeBlocks->FirstFreeBlock == nullptr ) {
-        MemoryPoolBlob *i;
-        for ( i = FirstBlob; i != nullptr; i = i->NextBlob ) {
-            if ( i->FirstFreeBlock != nullptr ) {
-                break;
-            }
-        }
+    //
+    // Blocks other threads handed back are cheaper to reuse than growing, so
+    // pick them up before choosing the next blob.
+    //
+    if ( RemoteFreeList != nullptr ) {
+        Drain_Remote_Frees();
+    }
+
+    //
+    // Fill the fullest partial blob next so the emptier ones get a chance to
+    // drain completely and be released, only start on an empty one after that.
+    //
+    FirstBlobWithFreeBlocks = nullptr;
 
-        FirstBlobWithFreeBlocks = i;
+    for ( int i = FILL_LIST_FULL - 1; i >= FILL_LIST_EMPTY; --i ) {
+        if ( FillLists[i] != nullptr ) {
+            FirstBlobWithFreeBlocks = FillLists[i];
+            break;
+        }
     }
 
     if ( FirstBlobWithFreeBlocks == nullptr ) {
         ASSERT_THROW(OverflowAllocationCount != 0, 0xDEAD0002);
+
+        // A lazy pool's first blob stands in for the initial one, it isn't an overflow.
+        bool overflowed = FirstBlob != nullptr || InitialAllocationCount > 0;
+
         Create_Blob(OverflowAllocationCount);
+
+        if ( overflowed ) {
+            ++OverflowBlobCount;
+            ++SessionOverflowBlobCount;
+        }
+    }
+
+    return FirstBlobWithFreeBlocks;
+}
+
+int MemoryPool::Get_Fill_List(MemoryPoolBlob const *blob) const
+{
+    if ( blob->UsedBlocksInBlob == 0 ) {
+        return FILL_LIST_EMPTY;
+    }
+
+    if ( blob->UsedBlocksInBlob == blob->TotalBlocksInBlob ) {
+        return FILL_LIST_FULL;
+    }
+
+    return FILL_LIST_EMPTY + 1 + blob->UsedBlocksInBlob * FILL_BINS / blob->TotalBlocksInBlob;
+}
+
+void MemoryPool::Update_Fill_List(MemoryPoolBlob *blob)
+{
+    int list = Get_Fill_List(blob);
+
+    if ( list != blob->FillList ) {
+        blob->Remove_Blob_From_Fill_List(&FillLists[blob->FillList]);
+        blob->Add_Blob_To_Fill_List(&FillLists[list], list);
     }
+}
 
-    MemoryPoolSingleBlock *block = FirstBlobWithFreeBlocks->Allocate_Single_Block();
+void *MemoryPool::Allocate_Single_Block()
+{
+    MemoryPoolBlob *blob = Find_Blob_With_Free_Blocks();
+    void *block;
+
+    if ( Headerless ) {
+        block = blob->Allocate_Slot();
+    } else {
+        block = blob->Allocate_Single_Block()->Get_User_Data();
+    }
+
+    Update_Fill_List(blob);
     ++UsedBlocksInPool;
 
-    //TODO convert to MAX()
-    //if ( PeakUsedBlocksInPool < UsedBlocksInPool ) {
-    //    PeakUsedBlocksInPool = UsedBlocksInPool;
-    //}
+    if ( UsedBlocksInPool > PeakUsedBlocksInPool ) {
+        PeakUsedBlocksInPool = UsedBlocksInPool;
+        SessionPeakUsedBlocks = MAX(SessionPeakUsedBlocks, PeakUsedBlocksInPool);
+    }
+
+    return block;
+}
+
+int MemoryPool::Allocate_Block_Run(void **blocks, int count)
+{
+    int clean = 0;
+    int dirty = 0;
+
+    //
+    // Never used slab blocks are carved in runs from the front of the array and
+    // are known to be zero, recycled blocks fill from the back. Returns where
+    // the recycled ones start.
+    //
+    while ( clean + dirty < count ) {
+        MemoryPoolBlob *blob = Find_Blob_With_Free_Blocks();
+
+        if ( Headerless && blob->FirstFreeSlot == nullptr ) {
+            clean += blob->Carve_Slots(&blocks[clean], count - clean - dirty);
+        } else if ( Headerless ) {
+            blocks[count - ++dirty] = blob->Allocate_Slot();
+        } else {
+            blocks[count - ++dirty] = blob->Allocate_Single_Block()->Get_User_Data();
+        }
+
+        Update_Fill_List(blob);
+    }
+
+    UsedBlocksInPool += count;
+
+    if ( UsedBlocksInPool > PeakUsedBlocksInPool ) {
+        PeakUsedBlocksInPool = UsedBlocksInPool;
+        SessionPeakUsedBlocks = MAX(SessionPeakUsedBlocks, PeakUsedBlocksInPool);
+    }
+
+    return clean;
+}
+
+void MemoryPool::Free_Single_Block(void *block)
+{
+    MemoryPoolBlob *mp_blob = Find_Owning_Blob(block);
+
+    ASSERT_PRINT(mp_blob != nullptr && mp_blob->OwningPool == this, "Block is not part of this pool");
+
+    if ( Headerless ) {
+        mp_blob->Free_Slot(block);
+    } else {
+        mp_blob->Free_Single_Block(MemoryPoolSingleBlock::Recover_Block_From_User_Data(block));
+    }
+
+    --UsedBlocksInPool;
+    Update_Fill_List(mp_blob);
+}
+
+MemoryPoolBlob *MemoryPool::Find_Owning_Blob(void *block)
+{
+    if ( Headerless ) {
+        return MemoryPoolBlob::Recover_Blob_From_Slot(block);
+    }
+
+    return MemoryPoolSingleBlock::Recover_Block_From_User_Data(block)->OwningBlob;
+}
+
+void MemoryPool::Mark_Live(void *block, bool live)
+{
+    bool was_live = Find_Owning_Blob(block)->Mark_Live(block, live);
+
+    ASSERT_PRINT(!was_live || !live, "Block handed out twice by pool %s\n", PoolName);
+    ASSERT_PRINT(was_live || live, "Block freed twice in pool %s\n", PoolName);
+}
+
+int MemoryPool::Get_Block_Stride() const
+{
+    if ( Headerless ) {
+        return AllocationSize;
+    }
+
+    // Header and block together round up so every block's user data stays aligned.
+    return Round_Up_Alignment(AllocationSize + sizeof(MemoryPoolSingleBlock), Alignment);
+}
+
+int MemoryPool::Get_Slab_Offset() const
+{
+    // Slabs are SLAB_SIZE aligned and sizes are a multiple of the alignment, so only the first block needs moving.
+    return MAX<int>(MemoryPoolBlob::SLAB_HEADER_SIZE, Alignment);
+}
+
+int MemoryPool::Get_Blob_Padding() const
+{
+    //
+    // Headered blob data only comes word aligned, this is the most it can take to
+    // move the first block's user data up to the pool's alignment.
+    //
+    if ( Headerless ) {
+        return 0;
+    }
+
+    return Alignment - sizeof(void *);
+}
+
+void MemoryPool::Drain_Remote_Frees()
+{
+    void *block;
+
+    //
+    // Take the whole list in one swap, pushers never pop so there is no ABA to
+    // worry about here.
+    //
+#ifdef COMPILER_MSVC
+    block = InterlockedExchangePointer(&RemoteFreeList, nullptr);
+#elif defined COMPILER_GNUC || defined COMPILER_CLANG
+    block = __sync_lock_test_and_set(&RemoteFreeList, static_cast<void *>(nullptr));
+#endif
+
+    while ( block != nullptr ) {
+        void *next = *static_cast<void **>(block);
+        Free_Single_Block(block);
+        block = next;
+    }
+}
+
+void MemoryPool::Push_Remote_Free(void *block)
+{
+    void *head;
+
+    do {
+        head = RemoteFreeList;
+        *static_cast<void **>(block) = head;
+#ifdef COMPILER_MSVC
+    } while ( InterlockedCompareExchangePointer(&RemoteFreeList, block, head) != head );
+#elif defined COMPILER_GNUC || defined COMPILER_CLANG
+    } while ( !__sync_bool_compare_and_swap(&RemoteFreeList, head, block) );
+#endif
+}
+
+int MemoryPool::Allocate_Block_Batch(void **blocks, int count)
+{
+    ScopedCriticalSectionClass scs(&PoolLock);
+    Allocate_Block_Run(blocks, count);
+
+    return count;
+}
+
+void MemoryPool::Free_Block_Batch(void **blocks, int count)
+{
+    ScopedCriticalSectionClass scs(&PoolLock);
+
+    for ( int i = 0; i < count; ++i ) {
+        Free_Single_Block(blocks[i]);
+    }
+}
+
+void *MemoryPool::Allocate_Block_No_Zero()
+{
+    void *block = MemoryPoolThreadCache::Allocate_Block(this);
+
+    if ( block == nullptr ) {
+        ScopedCriticalSectionClass scs(&PoolLock);
+        block = Allocate_Single_Block();
+    }
 
-    PeakUsedBlocksInPool = MAX(PeakUsedBlocksInPool, UsedBlocksInPool);
+    if ( TrackLive ) {
+        Mark_Live(block, true);
+    }
 
-    return block->Get_User_Data();
+    if ( HeapProfiler::Is_Active() ) {
+        HeapProfiler::Sample_Allocation(block, AllocationSize);
+    }
+
+    if ( MemoryTrace::Is_Active() && TraceBlocks ) {
+        MemoryTrace::Record_Allocate_Block(this, block);
+    }
+
+    return block;
 }
 
 void *MemoryPool::Allocate_Block()
@@ -148,24 +459,161 @@ void *MemoryPool::Allocate_Block()
     return block;
 }
 
+void *MemoryPool::Allocate_Block_Aligned(int alignment)
+{
+    //
+    // Every block already has the alignment the pool was created with, this only
+    // checks the caller isn't expecting more than that.
+    //
+    ASSERT_PRINT(alignment <= Alignment,
+        "Pool %s only aligns blocks to %d bytes, %d requested.\n",
+        PoolName,
+        Alignment,
+        alignment);
+
+    return Allocate_Block();
+}
+
+void MemoryPool::Allocate_Blocks_No_Zero(void **blocks, int count)
+{
+    {
+        ScopedCriticalSectionClass scs(&PoolLock);
+        Allocate_Block_Run(blocks, count);
+    }
+
+    if ( TrackLive ) {
+        for ( int i = 0; i < count; ++i ) {
+            Mark_Live(blocks[i], true);
+        }
+    }
+
+    if ( HeapProfiler::Is_Active() ) {
+        for ( int i = 0; i < count; ++i ) {
+            HeapProfiler::Sample_Allocation(blocks[i], AllocationSize);
+        }
+    }
+
+    if ( MemoryTrace::Is_Active() && TraceBlocks ) {
+        for ( int i = 0; i < count; ++i ) {
+            MemoryTrace::Record_Allocate_Block(this, blocks[i]);
+        }
+    }
+}
+
+void MemoryPool::Allocate_Blocks(void **blocks, int count)
+{
+    int clean;
+
+    {
+        ScopedCriticalSectionClass scs(&PoolLock);
+        clean = Allocate_Block_Run(blocks, count);
+    }
+
+    if ( TrackLive ) {
+        for ( int i = 0; i < count; ++i ) {
+            Mark_Live(blocks[i], true);
+        }
+    }
+
+    //
+    // Only recycled blocks need zeroing and that happens outside the lock. Slab
+    // blocks next to each other in memory get cleared with a single memset.
+    //
+    for ( int i = clean; i < count; ) {
+        char *lo = static_cast<char *>(blocks[i]);
+        char *hi = lo + AllocationSize;
+
+        for ( ++i; Headerless && i < count; ++i ) {
+            char *block = static_cast<char *>(blocks[i]);
+
+            if ( block == hi ) {
+                hi += AllocationSize;
+            } else if ( block + AllocationSize == lo ) {
+                lo = block;
+            } else {
+                break;
+            }
+        }
+
+        memset(lo, 0, hi - lo);
+    }
+
+    if ( HeapProfiler::Is_Active() ) {
+        for ( int i = 0; i < count; ++i ) {
+            HeapProfiler::Sample_Allocation(blocks[i], AllocationSize);
+        }
+    }
+
+    if ( MemoryTrace::Is_Active() && TraceBlocks ) {
+        for ( int i = 0; i < count; ++i ) {
+            MemoryTrace::Record_Allocate_Block(this, blocks[i]);
+        }
+    }
+}
+
+void MemoryPool::Free_Blocks(void **blocks, int count)
+{
+    if ( HeapProfiler::Is_Active() ) {
+        for ( int i = 0; i < count; ++i ) {
+            if ( blocks[i] != nullptr ) {
+                HeapProfiler::Record_Free(blocks[i]);
+            }
+        }
+    }
+
+    if ( MemoryTrace::Is_Active() && TraceBlocks ) {
+        for ( int i = 0; i < count; ++i ) {
+            if ( blocks[i] != nullptr ) {
+                MemoryTrace::Record_Free_Block(this, blocks[i]);
+            }
+        }
+    }
+
+    //
+    // Goes straight back to the blobs, handing a whole batch to this thread's
+    // cache would only have it flush most of them again.
+    //
+    ScopedCriticalSectionClass scs(&PoolLock);
+
+    for ( int i = 0; i < count; ++i ) {
+        void *block = blocks[i];
+
+        if ( block == nullptr ) {
+            continue;
+        }
+
+        if ( TrackLive ) {
+            Mark_Live(block, false);
+        }
+
+        Free_Single_Block(block);
+    }
+}
+
 void MemoryPool::Free_Block(void *block)
 {
     if ( block == nullptr ) {
         return;
     }
 
-    ScopedCriticalSectionClass scs(MemoryPoolCriticalSection);
-    MemoryPoolSingleBlock *mp_block = MemoryPoolSingleBlock::Recover_Block_From_User_Data(block);
-    MemoryPoolBlob *mp_blob = mp_block->OwningBlob;
+    if ( HeapProfiler::Is_Active() ) {
+        HeapProfiler::Record_Free(block);
+    }
 
-    ASSERT_PRINT(mp_blob != nullptr && mp_blob->OwningPool == this, "Block is not part of this pool");
+    if ( MemoryTrace::Is_Active() && TraceBlocks ) {
+        MemoryTrace::Record_Free_Block(this, block);
+    }
 
-    mp_blob->Free_Single_Block(mp_block);
+    if ( TrackLive ) {
+        Mark_Live(block, false);
+    }
 
-    if ( FirstBlobWithFreeBlocks == nullptr ) {
-        FirstBlobWithFreeBlocks = mp_blob;
-        --UsedBlocksInPool;
+    if ( MemoryPoolThreadCache::Free_Block(this, block) ) {
+        return;
     }
+
+    ScopedCriticalSectionClass scs(&PoolLock);
+    Free_Single_Block(block);
 }
 
 int MemoryPool::Count_Blobs()
@@ -179,30 +627,196 @@ int MemoryPool::Count_Blobs()
     return count;
 }
 
-int MemoryPool::Release_Empties()
+//
+// For tests and debugging. Drains the remote frees and then checks each blob's
+// free list and fill list against its counts, and the blobs against the pool.
+// Blocks sitting in thread caches count as used.
+//
+bool MemoryPool::Check_Free_Lists()
 {
-    int count = 0;
+    ScopedCriticalSectionClass scs(&PoolLock);
+    int blobs = 0;
+    int listed = 0;
+    int used = 0;
+    int total = 0;
+    bool ok = true;
+
+    Drain_Remote_Frees();
 
     for ( MemoryPoolBlob *i = FirstBlob; i != nullptr; i = i->NextBlob ) {
-        if ( i->UsedBlocksInBlob == 0 ) {
-            count += Free_Blob(i);
+        ++blobs;
+        used += i->UsedBlocksInBlob;
+        total += i->TotalBlocksInBlob;
+
+        if ( i->Count_Free_Blocks() != i->TotalBlocksInBlob - i->UsedBlocksInBlob ) {
+            DEBUG_LOG("Pool '%s' blob %p free list doesn't match its used count.\n", PoolName, i);
+            ok = false;
+        }
+
+        if ( i->FillList != Get_Fill_List(i) ) {
+            DEBUG_LOG("Pool '%s' blob %p is on the wrong fill list.\n", PoolName, i);
+            ok = false;
+        }
+    }
+
+    for ( int list = 0; list < FILL_LIST_COUNT; ++list ) {
+        for ( MemoryPoolBlob *i = FillLists[list]; i != nullptr && listed <= blobs; i = i->NextFillBlob ) {
+            ++listed;
+            ok = ok && i->FillList == list;
         }
     }
 
+    if ( listed != blobs || used != UsedBlocksInPool || total != TotalBlocksInPool ) {
+        DEBUG_LOG("Pool '%s' blob counts don't add up, %d of %d blobs on fill lists, %d/%d used, %d/%d total.\n",
+            PoolName, listed, blobs, used, UsedBlocksInPool, total, TotalBlocksInPool);
+        ok = false;
+    }
+
+    return ok;
+}
+
+int MemoryPool::Release_Empties()
+{
+    ScopedCriticalSectionClass scs(&PoolLock);
+    int count = 0;
+
+    Drain_Remote_Frees();
+
+    while ( FillLists[FILL_LIST_EMPTY] != nullptr ) {
+        count += Free_Blob(FillLists[FILL_LIST_EMPTY]);
+    }
+
     return  count;
 }
 
+void MemoryPool::Prefault()
+{
+    ScopedCriticalSectionClass scs(&PoolLock);
+
+    for ( MemoryPoolBlob *i = FirstBlob; i != nullptr; i = i->NextBlob ) {
+        Raw_Prefault(i->BlockData, i->Get_Data_Size());
+    }
+}
+
+void MemoryPool::Enable_Block_Tags()
+{
+    ScopedCriticalSectionClass scs(&PoolLock);
+
+    if ( TrackTags ) {
+        return;
+    }
+
+    // Blocks already handed out get a zero tag, same as untagged ones.
+    for ( MemoryPoolBlob *i = FirstBlob; i != nullptr; i = i->NextBlob ) {
+        i->BlockTags = static_cast<uint8_t *>(Raw_Allocate(i->TotalBlocksInBlob));
+    }
+
+    TrackTags = true;
+}
+
+void MemoryPool::Get_Stats(MemoryPoolStats &stats)
+{
+    ScopedCriticalSectionClass scs(&PoolLock);
+
+    stats.PoolName = PoolName;
+    stats.AllocationSize = AllocationSize;
+    stats.RequestedSize = RequestedSize;
+    stats.InitialAllocationCount = InitialAllocationCount;
+    stats.OverflowAllocationCount = OverflowAllocationCount;
+    stats.UsedBlocks = UsedBlocksInPool;
+    stats.PeakUsedBlocks = PeakUsedBlocksInPool;
+    stats.TotalBlocks = TotalBlocksInPool;
+    stats.OverflowBlobCount = OverflowBlobCount;
+    stats.SessionPeakUsedBlocks = SessionPeakUsedBlocks;
+    stats.SessionOverflowBlobCount = SessionOverflowBlobCount;
+    stats.BlobCount = 0;
+    stats.EmptyBlobCount = 0;
+    stats.FullBlobCount = 0;
+    stats.BlobBytes = 0;
+
+    for ( MemoryPoolBlob *i = FirstBlob; i != nullptr; i = i->NextBlob ) {
+        ++stats.BlobCount;
+        stats.EmptyBlobCount += i->FillList == FILL_LIST_EMPTY;
+        stats.FullBlobCount += i->FillList == FILL_LIST_FULL;
+        stats.BlobBytes += i->Get_Data_Size();
+    }
+
+    stats.RoundingBytes = (AllocationSize - RequestedSize) * TotalBlocksInPool;
+    stats.OverheadBytes = stats.BlobBytes - AllocationSize * TotalBlocksInPool;
+}
+
+void MemoryPool::For_Each_Live_Block(MemoryPoolLiveBlockCallback callback, void *user_data, int part, int parts)
+{
+    MemoryPoolLiveIterator it(this, part, parts);
+
+    for ( void *block = it.Next(); block != nullptr; block = it.Next() ) {
+        callback(block, user_data);
+    }
+}
+
 void MemoryPool::Reset()
 {
-    for ( MemoryPoolBlob *i = FirstBlob; i != nullptr; i = FirstBlob ) {
-        Free_Blob(i);
+    //
+    // Any blocks still sitting in thread caches belong to blobs we are about to
+    // free or rebuild, this makes every cache drop them rather than hand them out again.
+    //
+    MemoryPoolThreadCache::Invalidate_Pool(this);
+
+    ScopedCriticalSectionClass scs(&PoolLock);
+
+    if ( ResetRetainPercent <= 0 ) {
+        for ( MemoryPoolBlob *i = FirstBlob; i != nullptr; i = FirstBlob ) {
+            Free_Blob(i);
+        }
+
+        FirstBlob = nullptr;
+        LastBlob = nullptr;
+        FirstBlob = nullptr;
+
+        Init(Factory, PoolName, RequestedSize, InitialAllocationCount, OverflowAllocationCount, Alignment);
+
+        return;
     }
 
-    FirstBlob = nullptr;
-    LastBlob = nullptr;
-    FirstBlob = nullptr;
+    //
+    // Warm reset, keep enough blobs to cover the retained share of the last peak
+    // and rebuild their free lists in place. Anything still allocated is gone
+    // after a reset anyway, same as when the blobs were freed.
+    //
+    int retain = MAX(InitialAllocationCount, PeakUsedBlocksInPool * ResetRetainPercent / 100);
+    int kept = 0;
+
+    RemoteFreeList = nullptr;
+
+    for ( MemoryPoolBlob *i = FirstBlob, *next; i != nullptr; i = next ) {
+        next = i->NextBlob;
+
+        if ( i != FirstBlob && kept >= retain ) {
+            Free_Blob(i);
+        } else {
+            kept += i->TotalBlocksInBlob;
+            i->Reset_Blocks();
+        }
+    }
 
-    Init(Factory, PoolName, AllocationSize, InitialAllocationCount, OverflowAllocationCount);
+    for ( int i = 0; i < FILL_LIST_COUNT; ++i ) {
+        FillLists[i] = nullptr;
+    }
+
+    // Backwards so the blobs get reused in the order they were created.
+    for ( MemoryPoolBlob *i = LastBlob; i != nullptr; i = i->PrevBlob ) {
+        i->Add_Blob_To_Fill_List(&FillLists[FILL_LIST_EMPTY], FILL_LIST_EMPTY);
+    }
+
+    UsedBlocksInPool = 0;
+    TotalBlocksInPool = kept;
+    PeakUsedBlocksInPool = 0;
+    OverflowBlobCount = 0;
+    FirstBlobWithFreeBlocks = FirstBlob;
+
+    if ( FirstBlob == nullptr && InitialAllocationCount > 0 ) {
+        Create_Blob(InitialAllocationCount);
+    }
 }
 
 void MemoryPool::Add_To_List(MemoryPool **head)
@@ -236,3 +850,84 @@ void MemoryPool::Remove_From_List(MemoryPool **head)
     }
 }
 
+
+/////////////////////////
+// MemoryPoolLiveIterator
+/////////////////////////
+
+static inline int Lowest_Set_Bit(uint32_t bits)
+{
+#ifdef COMPILER_MSVC
+    unsigned long index;
+    _BitScanForward(&index, bits);
+
+    return index;
+#elif defined COMPILER_GNUC || defined COMPILER_CLANG
+    return __builtin_ctz(bits);
+#endif
+}
+
+MemoryPoolLiveIterator::MemoryPoolLiveIterator(MemoryPool *pool, int part, int parts) :
+    Blob(nullptr),
+    EndBlob(nullptr),
+    WordIndex(-1),
+    WordCount(0),
+    Bits(0)
+{
+    ASSERT_PRINT(pool->TrackLive, "Pool %s doesn't track live blocks\n", pool->PoolName);
+    ASSERT_PRINT(part >= 0 && part < parts, "Bad part %d of %d\n", part, parts);
+
+    //
+    // Blobs go to the part their first block falls in when the pool's blocks are
+    // shared out evenly, so parts cover every blob once whatever the blob sizes.
+    //
+    int first = int(int64_t(pool->TotalBlocksInPool) * part / parts);
+    int last = int(int64_t(pool->TotalBlocksInPool) * (part + 1) / parts);
+    int start = 0;
+
+    for ( MemoryPoolBlob *i = pool->FirstBlob; i != nullptr; i = i->NextBlob ) {
+        if ( Blob == nullptr && start >= first ) {
+            Blob = i;
+        }
+
+        if ( start >= last ) {
+            EndBlob = i;
+
+            break;
+        }
+
+        start += i->TotalBlocksInBlob;
+    }
+
+    if ( Blob == nullptr ) {
+        Blob = EndBlob;
+    }
+
+    if ( Blob != EndBlob ) {
+        WordCount = (Blob->TotalBlocksInBlob + 31) / 32;
+    }
+}
+
+void *MemoryPoolLiveIterator::Next()
+{
+    while ( Bits == 0 ) {
+        if ( Blob == EndBlob ) {
+            return nullptr;
+        }
+
+        if ( ++WordIndex < WordCount ) {
+            Bits = Blob->LiveBits[WordIndex];
+
+            continue;
+        }
+
+        Blob = Blob->NextBlob;
+        WordIndex = -1;
+        WordCount = Blob != EndBlob ? (Blob->TotalBlocksInBlob + 31) / 32 : 0;
+    }
+
+    int index = WordIndex * 32 + Lowest_Set_Bit(Bits);
+    Bits &= Bits - 1;
+
+    return Blob->Get_Block_Address(index);
+}
@@ -29,33 +29,120 @@
 #ifndef _MEMPOOL_H_
 #define _MEMPOOL_H_
 
+#include "critsection.h"
 #include "rawalloc.h"
 
 class MemoryPoolFactory;
+class MemoryPool;
 class MemoryPoolBlob;
+class MemoryPoolSingleBlock;
+class MemoryPoolThreadCache;
+class MemoryPoolVirtualRange;
 class SimpleCriticalSectionClass;
 
-// Allocated a critical section in WinMain, hooked to original currently.
+// Allocated a critical section in WinMain, hooked to original currently. Only
+// guards the factory pool list now, each pool has its own lock for blocks.
 extern SimpleCriticalSectionClass* MemoryPoolCriticalSection;
 
+struct MemoryPoolStats
+{
+    char const *PoolName;
+    int AllocationSize;
+    int RequestedSize;
+    int InitialAllocationCount;
+    int OverflowAllocationCount;
+    int UsedBlocks;         // Includes blocks parked in thread caches.
+    int PeakUsedBlocks;
+    int TotalBlocks;
+    int BlobCount;
+    int EmptyBlobCount;
+    int FullBlobCount;
+    int OverflowBlobCount;  // Overflow blobs created since Init, not just the ones still alive.
+    int RoundingBytes;      // Lost to rounding the requested size up to AllocationSize.
+    int OverheadBytes;      // Block headers and slab headers/tails.
+    int BlobBytes;          // Everything the blobs hold, blocks and overhead.
+    int SessionPeakUsedBlocks;      // Like the above but not cleared by Reset.
+    int SessionOverflowBlobCount;
+};
+
+// Gets each live block of a pool, see MemoryPool::For_Each_Live_Block.
+typedef void (*MemoryPoolLiveBlockCallback)(void *block, void *user_data);
+
+//
+// Walks the live blocks of a pool that tracks them, in address order blob by
+// blob. With parts > 1 it only covers the given part's share of the blobs so a
+// sweep can be split across threads. Nothing is locked, the pool must not be
+// allocated from during a walk but freeing the block just returned is fine.
+//
+class MemoryPoolLiveIterator
+{
+public:
+    MemoryPoolLiveIterator(MemoryPool *pool, int part = 0, int parts = 1);
+    void *Next();
+
+private:
+    MemoryPoolBlob *Blob;
+    MemoryPoolBlob *EndBlob;
+    int WordIndex;
+    int WordCount;
+    uint32_t Bits;
+};
+
 class MemoryPool
 {
 public:
+    enum {
+        VIRTUAL_MIN_BYTES = 0x40000,    // Initial blob size a pool needs before it gets its own range.
+        VIRTUAL_OVERFLOW_BLOBS = 16,    // Overflow blobs the range has room for past the initial one.
+        CACHE_LINE_SIZE = 64,           // Pools aligned to this don't share lines between blocks.
+        MAX_ALIGNMENT = 4096,
+        FILL_BINS = 4,                  // Partial blobs are binned by how full they are.
+        FILL_LIST_EMPTY = 0,
+        FILL_LIST_FULL = FILL_BINS + 1,
+        FILL_LIST_COUNT,
+    };
+
     MemoryPool();
     ~MemoryPool();
-    void Init(MemoryPoolFactory *factory, char const *name, int size, int count, int overflow);
+    void Init(MemoryPoolFactory *factory, char const *name, int size, int count, int overflow, int alignment = 0);
     MemoryPoolBlob *Create_Blob(int count);
     int Free_Blob(MemoryPoolBlob *blob);
     void *Allocate_Block_No_Zero();
     void *Allocate_Block();
+    void *Allocate_Block_Aligned(int alignment);
     void Free_Block(void *block);
+
+    // Take the lock once for a whole batch of blocks, no thread cache involved.
+    void Allocate_Blocks_No_Zero(void **blocks, int count);
+    void Allocate_Blocks(void **blocks, int count);
+    void Free_Blocks(void **blocks, int count);
+
     int Count_Blobs();
+    bool Check_Free_Lists();
     int Release_Empties();
+    void Prefault();
+    void Get_Stats(MemoryPoolStats &stats);
+    void For_Each_Live_Block(MemoryPoolLiveBlockCallback callback, void *user_data, int part = 0, int parts = 1);
     void Reset();
     void Add_To_List(MemoryPool **head);
     void Remove_From_List(MemoryPool **head);
 
     int Get_Alloc_Size() { return AllocationSize; }
+    int Get_Alignment() const { return Alignment; }
+    bool Is_Headerless() const { return Headerless; }
+    bool Is_Tracking_Live_Blocks() const { return TrackLive; }
+
+    // Gives every blob a tag byte per block for the dynamic allocator's memory tags.
+    void Enable_Block_Tags();
+
+    // Pools created while this is set use the slab blob layout when the block size allows it.
+    static void Set_Use_Headerless_Blobs(bool use) { UseHeaderlessBlobs = use; }
+
+    // Pools created while this is set commit large blobs from a reserved address range.
+    static void Set_Use_Virtual_Blobs(bool use) { UseVirtualBlobs = use; }
+
+    // Share of a pool's peak use that Reset keeps warm, 0 frees every blob like it used to.
+    static void Set_Reset_Retain_Percent(int percent) { ResetRetainPercent = percent; }
 
     void *operator new(size_t size) throw()
     {
@@ -69,8 +156,32 @@ public:
 
     friend class MemoryPoolBlob;
     friend class MemoryPoolFactory;
+    friend class MemoryPoolThreadCache;
+    friend class MemoryPoolLiveIterator;
+    friend class MemoryTrace;
     friend class DynamicMemoryAllocator;
 
+private:
+    // These expect the caller to hold PoolLock.
+    void *Allocate_Single_Block();
+    int Allocate_Block_Run(void **blocks, int count);
+    void Free_Single_Block(void *block);
+    MemoryPoolBlob *Find_Blob_With_Free_Blocks();
+    int Get_Fill_List(MemoryPoolBlob const *blob) const;
+    void Update_Fill_List(MemoryPoolBlob *blob);
+    void Drain_Remote_Frees();
+    void Init_Virtual_Range();
+    MemoryPoolBlob *Find_Owning_Blob(void *block);
+    void Mark_Live(void *block, bool live);
+    int Get_Block_Stride() const;
+    int Get_Slab_Offset() const;
+    int Get_Blob_Padding() const;
+
+    // Lock once and move a run of blocks between the blobs and a thread cache.
+    int Allocate_Block_Batch(void **blocks, int count);
+    void Free_Block_Batch(void **blocks, int count);
+    void Push_Remote_Free(void *block);
+
 private:
     MemoryPoolFactory *Factory;
     MemoryPool *NextPoolInFactory;
@@ -83,7 +194,27 @@ private:
     int PeakUsedBlocksInPool;
     MemoryPoolBlob *FirstBlob;
     MemoryPoolBlob *LastBlob;
-    MemoryPoolBlob *FirstBlobWithFreeBlocks;
+    MemoryPoolBlob *FirstBlobWithFreeBlocks;   // Allocations come from here until it fills up.
+    MemoryPoolBlob *FillLists[FILL_LIST_COUNT]; // Empty, partial blobs by fill bin, then full.
+    void *volatile RemoteFreeList;  // Linked through the first word of each block.
+    SimpleCriticalSectionClass PoolLock;
+    int CacheSlot;
+    unsigned int CacheSerial;
+    int MagazineSize;
+    int RequestedSize;
+    int OverflowBlobCount;
+    int SessionPeakUsedBlocks;
+    int SessionOverflowBlobCount;
+    bool Headerless;
+    bool TrackLive;     // Blobs keep a liveness bitmap, set from User_Memory_Track_Live_Blocks.
+    bool TrackTags;     // Blobs keep a MemoryTag per block, only for dynamic allocator pools.
+    bool TraceBlocks;   // Off for dynamic allocator pools, MemoryTrace gets their requests from the allocator.
+    MemoryPoolVirtualRange *VirtualRange;
+    int Alignment;      // Of user data, at least a word and AllocationSize is a multiple of it.
+
+    static bool UseHeaderlessBlobs;
+    static bool UseVirtualBlobs;
+    static int ResetRetainPercent;
 };
 
 #endif
@@ -23,10 +23,197 @@
 //
 ////////////////////////////////////////////////////////////////////////////////
 #include "mempoolfact.h"
+#include "critsection.h"
 #include "gamedebug.h"
 #include "gamememoryinit.h"
 #include "memdynalloc.h"
 #include "mempool.h"
+#include "memtag.h"
+#include "memthreadcache.h"
+#include "memtrace.h"
+#include <time.h>
+
+//
+// Periodic stats dump settings, kept out of the factory itself as the original
+// code shares the object with us.
+//
+static char StatsDumpPath[260];
+static MemoryStatsFormat StatsDumpFormat = MEMORY_STATS_CSV;
+static int StatsDumpInterval = 0;
+static unsigned StatsDumpLast = 0;
+
+//
+// Pool upkeep after a load, set from MemoryPools.ini. A frame that ends this
+// long after the one before it is taken to have sat through a load.
+//
+enum
+{
+    LOAD_GAP_MS = 1000,
+};
+
+static bool PrefaultAfterLoad = false;
+static bool ReleaseAfterLoad = false;
+static bool FrameSeen = false;
+static unsigned LastFrameTime = 0;
+
+//
+// Name hash index over the factory's pool list so lookups don't strcmp every
+// pool, open addressed with backward shift deletes. Past the load limit pools
+// only go on the list and lookups that miss fall back to walking it.
+//
+enum
+{
+    POOL_TABLE_SIZE = 4096,
+    POOL_TABLE_LIMIT = POOL_TABLE_SIZE * 3 / 4,
+};
+
+struct PoolTableEntry
+{
+    unsigned Hash;
+    MemoryPool *Pool;
+};
+
+static PoolTableEntry PoolTable[POOL_TABLE_SIZE];
+static int PoolTableCount = 0;
+static bool PoolTableOverflowed = false;
+
+MemoryPoolRegistration *MemoryPoolRegistration::FirstRegistration = nullptr;
+
+static char const *const RawHistogramLabels[DynamicMemoryAllocatorStats::RAW_HISTOGRAM_BUCKETS] = {
+    "raw_128k", "raw_256k", "raw_512k", "raw_1m", "raw_2m", "raw_4m",
+    "raw_8m", "raw_16m", "raw_32m", "raw_64m", "raw_128m", "raw_over_128m"
+};
+
+static unsigned Get_Stats_Time()
+{
+#ifdef PLATFORM_WINDOWS
+    return GetTickCount();
+#elif defined PLATFORM_APPLE
+    return mach_absolute_time() / 1000000;
+#else
+    struct timespec now;
+
+    if ( clock_gettime(CLOCK_MONOTONIC, &now) != 0 ) {
+        return 0;
+    }
+
+    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#endif
+}
+
+static void Pool_Table_Insert(MemoryPool *pool, unsigned hash)
+{
+    if ( PoolTableCount >= POOL_TABLE_LIMIT ) {
+        PoolTableOverflowed = true;
+
+        return;
+    }
+
+    int index = hash & (POOL_TABLE_SIZE - 1);
+
+    while ( PoolTable[index].Pool != nullptr ) {
+        index = (index + 1) & (POOL_TABLE_SIZE - 1);
+    }
+
+    PoolTable[index].Hash = hash;
+    PoolTable[index].Pool = pool;
+    ++PoolTableCount;
+}
+
+static void Pool_Table_Remove(MemoryPool *pool, unsigned hash)
+{
+    int index = hash & (POOL_TABLE_SIZE - 1);
+
+    while ( PoolTable[index].Pool != pool ) {
+        // Pools added after the table filled up aren't in it.
+        if ( PoolTable[index].Pool == nullptr ) {
+            return;
+        }
+
+        index = (index + 1) & (POOL_TABLE_SIZE - 1);
+    }
+
+    //
+    // Pull back any following entries that would no longer be reachable from
+    // their home slot once this one is empty.
+    //
+    for ( int next = (index + 1) & (POOL_TABLE_SIZE - 1); PoolTable[next].Pool != nullptr; next = (next + 1) & (POOL_TABLE_SIZE - 1) ) {
+        int home = PoolTable[next].Hash & (POOL_TABLE_SIZE - 1);
+
+        if ( ((next - home) & (POOL_TABLE_SIZE - 1)) >= ((next - index) & (POOL_TABLE_SIZE - 1)) ) {
+            PoolTable[index] = PoolTable[next];
+            index = next;
+        }
+    }
+
+    PoolTable[index].Pool = nullptr;
+    --PoolTableCount;
+}
+
+/////////////////////////
+// MemoryPoolRegistration
+/////////////////////////
+
+MemoryPoolRegistration::MemoryPoolRegistration(char const *name, unsigned hash, int size, int alignment) :
+    PoolName(name),
+    NameHash(hash),
+    AllocationSize(size),
+    Alignment(alignment),
+    DefaultCount(-1),
+    DefaultOverflow(-1),
+    Pool(nullptr),
+    NextRegistration(FirstRegistration)
+{
+    // Runs during static init, nothing here can touch the factory yet.
+    FirstRegistration = this;
+}
+
+MemoryPoolRegistration::MemoryPoolRegistration(char const *name, unsigned hash, int size, int count, int overflow) :
+    PoolName(name),
+    NameHash(hash),
+    AllocationSize(size),
+    Alignment(0),
+    DefaultCount(count),
+    DefaultOverflow(overflow),
+    Pool(nullptr),
+    NextRegistration(FirstRegistration)
+{
+    FirstRegistration = this;
+}
+
+MemoryPool *MemoryPoolRegistration::Create_Pool()
+{
+    int count = -1;
+    int overflow = -1;
+
+    // Generated pools like the STL node ones can't all be listed, let them fall back to their own sizes.
+    User_Memory_Adjust_Pool_Size(PoolName, NameHash, count, overflow);
+
+    // A count of 0 is a lazy pool from the headless profile, only negative means no entry.
+    if ( count < 0 ) {
+        count = DefaultCount;
+    }
+
+    if ( overflow <= 0 ) {
+        overflow = DefaultOverflow;
+    }
+
+    MemoryPool *pool = TheMemoryPoolFactory->Create_Memory_Pool(PoolName, NameHash, AllocationSize, count, overflow, Alignment);
+
+    //
+    // Checked once here rather than on every new, a registration sharing a
+    // named pool with a differently sized class trips this.
+    //
+    ASSERT_PRINT(pool->Get_Alloc_Size() == Round_Up_Alignment(AllocationSize, pool->Get_Alignment()),
+        "Pool %s is wrong size for class (need %d, currently %d)",
+        PoolName,
+        AllocationSize,
+        pool->Get_Alloc_Size());
+
+    Pool = pool;
+
+    return pool;
+}
 
 ////////////////////
 // MemoryPoolFactory
@@ -55,24 +242,40 @@ MemoryPool *MemoryPoolFactory::Create_Memory_Pool(PoolInitRec const *params)
 
 MemoryPool *MemoryPoolFactory::Create_Memory_Pool(char const *name, int size, int count, int overflow)
 {
-    MemoryPool *pool = Find_Memory_Pool(name);
+    return Create_Memory_Pool(name, Pool_Name_Hash(name), size, count, overflow);
+}
+
+MemoryPool *MemoryPoolFactory::Create_Aligned_Memory_Pool(char const *name, int size, int alignment, int count, int overflow)
+{
+    return Create_Memory_Pool(name, Pool_Name_Hash(name), size, count, overflow, alignment);
+}
+
+MemoryPool *MemoryPoolFactory::Create_Memory_Pool(char const *name, unsigned hash, int size, int count, int overflow, int alignment)
+{
+    // Pools are looked up and created lazily from any thread, keep the list sane.
+    ScopedCriticalSectionClass scs(MemoryPoolCriticalSection);
+    MemoryPool *pool = Find_Memory_Pool(name, hash);
 
     if ( pool != nullptr ) {
         ASSERT_PRINT(pool->AllocationSize == size, "Pool size mismatch");
+        ASSERT_PRINT(pool->Alignment >= alignment, "Pool alignment mismatch");
 
         return pool;
     }
 
-    User_Memory_Adjust_Pool_Size(name, count, overflow);
+    User_Memory_Adjust_Pool_Size(name, hash, count, overflow);
 
     //
-    // Count and overflow should never end up as 0 from adjustment.
+    // Overflow should never end up as 0 from adjustment, count only does for
+    // pools the headless profile leaves empty until first use.
     //
-    ASSERT_THROW(count > 0 && overflow > 0, 0xDEAD0002);
+    ASSERT_THROW(count >= 0 && overflow > 0, 0xDEAD0002);
 
     pool = new MemoryPool;
-    pool->Init(this, name, size, count, overflow);
+    pool->Init(this, name, size, count, overflow, alignment);
     pool->Add_To_List(&FirstPoolInFactory);
+    Pool_Table_Insert(pool, hash);
+    MemoryPoolThreadCache::Register_Pool(pool);
 
     return pool;
 }
@@ -86,16 +289,46 @@ void MemoryPoolFactory::Destroy_Memory_Pool(MemoryPool *pool)
         return;
     }
 
+    // Return what every thread still has cached so the used count is accurate.
+    MemoryPoolThreadCache::Unregister_Pool(pool);
+
     ASSERT_PRINT(pool->UsedBlocksInPool == 0, "Destroying none empty pool.");
 
-    pool->Remove_From_List(&FirstPoolInFactory);
+    {
+        ScopedCriticalSectionClass scs(MemoryPoolCriticalSection);
+        pool->Remove_From_List(&FirstPoolInFactory);
+        Pool_Table_Remove(pool, Pool_Name_Hash(pool->PoolName));
+
+        // Classes that cached this pool go back to creating it on next use.
+        for ( MemoryPoolRegistration *reg = MemoryPoolRegistration::FirstRegistration; reg != nullptr; reg = reg->NextRegistration ) {
+            if ( reg->Pool == pool ) {
+                reg->Pool = nullptr;
+            }
+        }
+    }
+
     delete pool;
 }
 
 MemoryPool *MemoryPoolFactory::Find_Memory_Pool(char const *name)
+{
+    return Find_Memory_Pool(name, Pool_Name_Hash(name));
+}
+
+MemoryPool *MemoryPoolFactory::Find_Memory_Pool(char const *name, unsigned hash)
 {
     MemoryPool *pool = nullptr;
 
+    for ( int index = hash & (POOL_TABLE_SIZE - 1); PoolTable[index].Pool != nullptr; index = (index + 1) & (POOL_TABLE_SIZE - 1) ) {
+        if ( PoolTable[index].Hash == hash && strcmp(PoolTable[index].Pool->PoolName, name) == 0 ) {
+            return PoolTable[index].Pool;
+        }
+    }
+
+    if ( !PoolTableOverflowed ) {
+        return nullptr;
+    }
+
     //
     // Go through the pools and break on matching requested name.
     //
@@ -129,6 +362,11 @@ void MemoryPoolFactory::Destroy_Dynamic_Memory_Allocator(DynamicMemoryAllocator
 
 void MemoryPoolFactory::Reset()
 {
+    // Blocks still out when the pools are reset are gone, a replay has to drop them too.
+    if ( MemoryTrace::Is_Active() ) {
+        MemoryTrace::Record_Reset();
+    }
+
     for ( MemoryPool *mp = FirstPoolInFactory; mp != nullptr; mp = mp->NextPoolInFactory ) {
         mp->Reset();
     }
@@ -138,3 +376,260 @@ void MemoryPoolFactory::Reset()
     }
 }
 
+
+int MemoryPoolFactory::Release_Empties()
+{
+    ScopedCriticalSectionClass scs(MemoryPoolCriticalSection);
+    int freed = 0;
+
+    //
+    // Blobs in a pool's virtual range get decommitted here so the memory really
+    // goes back to the OS rather than just back to the heap.
+    //
+    for ( MemoryPool *mp = FirstPoolInFactory; mp != nullptr; mp = mp->NextPoolInFactory ) {
+        freed += mp->Release_Empties();
+    }
+
+    return freed;
+}
+
+void MemoryPoolFactory::Prefault_Pools()
+{
+    ScopedCriticalSectionClass scs(MemoryPoolCriticalSection);
+
+    //
+    // Meant to be called once a map has loaded so the first frames of play don't
+    // take the page faults for pool memory.
+    //
+    for ( MemoryPool *mp = FirstPoolInFactory; mp != nullptr; mp = mp->NextPoolInFactory ) {
+        mp->Prefault();
+    }
+}
+
+int MemoryPoolFactory::Get_Pool_Stats(MemoryPoolStats *stats, int max_count)
+{
+    ScopedCriticalSectionClass scs(MemoryPoolCriticalSection);
+    int count = 0;
+
+    //
+    // Returns how many pools there are, only the first max_count are filled in
+    // so callers can pass nullptr/0 to size their buffer first.
+    //
+    for ( MemoryPool *mp = FirstPoolInFactory; mp != nullptr; mp = mp->NextPoolInFactory ) {
+        if ( count < max_count ) {
+            mp->Get_Stats(stats[count]);
+        }
+
+        ++count;
+    }
+
+    return count;
+}
+
+void MemoryPoolFactory::Dump_Stats(FILE *fp, MemoryStatsFormat format)
+{
+    ScopedCriticalSectionClass scs(MemoryPoolCriticalSection);
+    unsigned now = Get_Stats_Time();
+    MemoryPoolStats ps;
+    DynamicMemoryAllocatorStats ds;
+    MemoryTagStats tags[MemoryTag::MAX_TAGS];
+    int tag_count = MemoryTag::Get_Stats(tags, MemoryTag::MAX_TAGS);
+
+    if ( format == MEMORY_STATS_CSV ) {
+        //
+        // Every row leads with the time and record type so one file can hold a
+        // whole series of snapshots. Headers only go at the top of the file.
+        //
+        if ( ftell(fp) == 0 ) {
+            fprintf(fp, "#time_ms,pool,name,size,requested,initial,overflow,used,peak,total,blobs,"
+                "empty_blobs,full_blobs,overflow_blobs,rounding_bytes,overhead_bytes,blob_bytes\n");
+            fprintf(fp, "#time_ms,dma,index,pools,used,medium_pools,medium_blocks,medium_bytes,huge_blocks,"
+                "huge_bytes,huge_remaps,raw_blocks,raw_allocations,raw_bytes");
+
+            for ( int i = 0; i < DynamicMemoryAllocatorStats::RAW_HISTOGRAM_BUCKETS; ++i ) {
+                fprintf(fp, ",%s", RawHistogramLabels[i]);
+            }
+
+            fprintf(fp, "\n");
+            fprintf(fp, "#time_ms,tag,name,live_bytes,peak_bytes,live_blocks,allocations,budget_bytes,over_budget\n");
+        }
+
+        for ( MemoryPool *mp = FirstPoolInFactory; mp != nullptr; mp = mp->NextPoolInFactory ) {
+            mp->Get_Stats(ps);
+            fprintf(fp, "%u,pool,%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n",
+                now, ps.PoolName, ps.AllocationSize, ps.RequestedSize, ps.InitialAllocationCount,
+                ps.OverflowAllocationCount, ps.UsedBlocks, ps.PeakUsedBlocks, ps.TotalBlocks, ps.BlobCount,
+                ps.EmptyBlobCount, ps.FullBlobCount, ps.OverflowBlobCount, ps.RoundingBytes, ps.OverheadBytes,
+                ps.BlobBytes);
+        }
+
+        int index = 0;
+
+        for ( DynamicMemoryAllocator *dma = FirstDmaInFactory; dma != nullptr; dma = dma->NextDmaInFactory, ++index ) {
+            dma->Get_Stats(ds);
+            fprintf(fp, "%u,dma,%d,%d,%d,%d,%d,%d,%d,%llu,%d,%d,%d,%llu", now, index, ds.PoolCount, ds.UsedBlocks,
+                ds.MediumPoolCount, ds.MediumBlocks, ds.MediumBytes, ds.HugeBlocks, (unsigned long long)ds.HugeBytes,
+                ds.HugeRemaps, ds.RawBlocks, ds.RawAllocations, (unsigned long long)ds.RawAllocatedBytes);
+
+            for ( int i = 0; i < DynamicMemoryAllocatorStats::RAW_HISTOGRAM_BUCKETS; ++i ) {
+                fprintf(fp, ",%d", ds.RawHistogram[i]);
+            }
+
+            fprintf(fp, "\n");
+        }
+
+        for ( int i = 0; i < tag_count; ++i ) {
+            fprintf(fp, "%u,tag,%s,%d,%d,%d,%d,%d,%d\n", now, tags[i].TagName, tags[i].LiveBytes, tags[i].PeakBytes,
+                tags[i].LiveBlocks, tags[i].Allocations, tags[i].BudgetBytes, tags[i].OverBudgetCount);
+        }
+    } else {
+        // Pool names are plain identifiers so nothing needs escaping.
+        fprintf(fp, "{\"time_ms\":%u,\"pools\":[", now);
+
+        for ( MemoryPool *mp = FirstPoolInFactory; mp != nullptr; mp = mp->NextPoolInFactory ) {
+            mp->Get_Stats(ps);
+            fprintf(fp, "%s{\"name\":\"%s\",\"size\":%d,\"requested\":%d,\"initial\":%d,\"overflow\":%d,"
+                "\"used\":%d,\"peak\":%d,\"total\":%d,\"blobs\":%d,\"empty_blobs\":%d,"
+                "\"full_blobs\":%d,\"overflow_blobs\":%d,\"rounding_bytes\":%d,\"overhead_bytes\":%d,"
+                "\"blob_bytes\":%d}",
+                mp == FirstPoolInFactory ? "" : ",", ps.PoolName, ps.AllocationSize, ps.RequestedSize,
+                ps.InitialAllocationCount, ps.OverflowAllocationCount, ps.UsedBlocks, ps.PeakUsedBlocks,
+                ps.TotalBlocks, ps.BlobCount, ps.EmptyBlobCount, ps.FullBlobCount, ps.OverflowBlobCount,
+                ps.RoundingBytes, ps.OverheadBytes, ps.BlobBytes);
+        }
+
+        fprintf(fp, "],\"dmas\":[");
+
+        for ( DynamicMemoryAllocator *dma = FirstDmaInFactory; dma != nullptr; dma = dma->NextDmaInFactory ) {
+            dma->Get_Stats(ds);
+            fprintf(fp, "%s{\"pools\":%d,\"used\":%d,\"medium_pools\":%d,\"medium_blocks\":%d,"
+                "\"medium_bytes\":%d,\"huge_blocks\":%d,\"huge_bytes\":%llu,\"huge_remaps\":%d,"
+                "\"raw_blocks\":%d,\"raw_allocations\":%d,\"raw_bytes\":%llu,\"raw_histogram\":[",
+                dma == FirstDmaInFactory ? "" : ",", ds.PoolCount, ds.UsedBlocks, ds.MediumPoolCount,
+                ds.MediumBlocks, ds.MediumBytes, ds.HugeBlocks, (unsigned long long)ds.HugeBytes, ds.HugeRemaps,
+                ds.RawBlocks, ds.RawAllocations, (unsigned long long)ds.RawAllocatedBytes);
+
+            for ( int i = 0; i < DynamicMemoryAllocatorStats::RAW_HISTOGRAM_BUCKETS; ++i ) {
+                fprintf(fp, "%s%d", i == 0 ? "" : ",", ds.RawHistogram[i]);
+            }
+
+            fprintf(fp, "]}");
+        }
+
+        // Tag names are cleaned up when they are added, they don't need escaping either.
+        fprintf(fp, "],\"tags\":[");
+
+        for ( int i = 0; i < tag_count; ++i ) {
+            fprintf(fp, "%s{\"name\":\"%s\",\"live_bytes\":%d,\"peak_bytes\":%d,\"live_blocks\":%d,"
+                "\"allocations\":%d,\"budget_bytes\":%d,\"over_budget\":%d}",
+                i == 0 ? "" : ",", tags[i].TagName, tags[i].LiveBytes, tags[i].PeakBytes, tags[i].LiveBlocks,
+                tags[i].Allocations, tags[i].BudgetBytes, tags[i].OverBudgetCount);
+        }
+
+        fprintf(fp, "]}\n");
+    }
+}
+
+bool MemoryPoolFactory::Dump_Stats(char const *filename, MemoryStatsFormat format)
+{
+    FILE *fp = fopen(filename, "a");
+
+    if ( fp == nullptr ) {
+        DEBUG_LOG("Failed to open '%s' for memory stats.\n", filename);
+
+        return false;
+    }
+
+    // Append mode doesn't promise the position starts at the end until the first write.
+    fseek(fp, 0, SEEK_END);
+    Dump_Stats(fp, format);
+    fclose(fp);
+
+    return true;
+}
+
+void MemoryPoolFactory::Set_Stats_Dump(char const *filename, MemoryStatsFormat format, int interval_ms)
+{
+    //
+    // A null name or an interval of 0 turns periodic dumps off.
+    //
+    if ( filename == nullptr || interval_ms <= 0 ) {
+        StatsDumpInterval = 0;
+
+        return;
+    }
+
+    strncpy(StatsDumpPath, filename, sizeof(StatsDumpPath) - 1);
+    StatsDumpPath[sizeof(StatsDumpPath) - 1] = '\0';
+    StatsDumpFormat = format;
+    StatsDumpInterval = interval_ms;
+    StatsDumpLast = Get_Stats_Time();
+}
+
+void MemoryPoolFactory::Update_Stats_Dump()
+{
+    if ( StatsDumpInterval <= 0 ) {
+        return;
+    }
+
+    unsigned now = Get_Stats_Time();
+
+    if ( now - StatsDumpLast < unsigned(StatsDumpInterval) ) {
+        return;
+    }
+
+    StatsDumpLast = now;
+    Dump_Stats(StatsDumpPath, StatsDumpFormat);
+}
+
+void MemoryPoolFactory::Set_Load_Upkeep(bool prefault, bool release_empties)
+{
+    PrefaultAfterLoad = prefault;
+    ReleaseAfterLoad = release_empties;
+}
+
+void MemoryPoolFactory::Update_Load_Upkeep()
+{
+    if ( !PrefaultAfterLoad && !ReleaseAfterLoad ) {
+        return;
+    }
+
+    unsigned now = Get_Stats_Time();
+    bool loaded = !FrameSeen || now - LastFrameTime >= unsigned(LOAD_GAP_MS);
+
+    FrameSeen = true;
+    LastFrameTime = now;
+
+    if ( !loaded ) {
+        return;
+    }
+
+    //
+    // What the last map left empty goes first so none of it gets faulted in
+    // just to be handed back.
+    //
+    if ( ReleaseAfterLoad ) {
+        Release_Empties();
+    }
+
+    if ( PrefaultAfterLoad ) {
+        Prefault_Pools();
+    }
+
+    // Our own work shouldn't make the next frame look like another load.
+    LastFrameTime = Get_Stats_Time();
+}
+
+//
+// One last dump at shutdown so the end of the session is in the file too, even
+// when it was shorter than the interval.
+//
+void MemoryPoolFactory::Finish_Stats_Dump()
+{
+    if ( StatsDumpInterval <= 0 ) {
+        return;
+    }
+
+    Dump_Stats(StatsDumpPath, StatsDumpFormat);
+    StatsDumpInterval = 0;
+}
@@ -31,13 +31,66 @@
 
 #include "rawalloc.h"
 #include "hooker.h"
+#include <cstdio>
 
 struct PoolInitRec;
+struct MemoryPoolStats;
 class MemoryPool;
 class DynamicMemoryAllocator;
 
+enum MemoryStatsFormat
+{
+    MEMORY_STATS_CSV,
+    MEMORY_STATS_JSON,  // One object per line so periodic dumps can append.
+};
+
 #define TheMemoryPoolFactory (Make_Global<MemoryPoolFactory*>(0x00A29B94))
 
+//
+// FNV-1a of a pool name with ASCII case folded so the same hash also serves the
+// case insensitive ini lookups. It is constexpr so the pool macros hash their
+// names at compile time.
+//
+constexpr unsigned Pool_Name_Hash(char const *name, unsigned hash = 2166136261u)
+{
+    return *name == '\0'
+        ? hash
+        : Pool_Name_Hash(name + 1, (hash ^ (unsigned char)(*name >= 'A' && *name <= 'Z' ? *name + 32 : *name)) * 16777619u);
+}
+
+//
+// Pools declared with the IMPLEMENT_*POOL macros register one of these during
+// static init. The pool is still created on first use, after that the class
+// reaches it with a plain pointer load.
+//
+class MemoryPoolRegistration
+{
+    friend class MemoryPoolFactory;
+public:
+    MemoryPoolRegistration(char const *name, unsigned hash, int size, int alignment = 0);
+    MemoryPoolRegistration(char const *name, unsigned hash, int size, int count, int overflow);
+
+    MemoryPool *Get_Pool() { return Pool != nullptr ? Pool : Create_Pool(); }
+
+private:
+    MemoryPoolRegistration(MemoryPoolRegistration const &that);
+    MemoryPoolRegistration &operator=(MemoryPoolRegistration const &that);
+
+    MemoryPool *Create_Pool();
+
+private:
+    char const *PoolName;
+    unsigned NameHash;
+    int AllocationSize;
+    int Alignment;
+    int DefaultCount;       // Used when MemoryPools.ini has no entry, -1 requires one.
+    int DefaultOverflow;
+    MemoryPool *Pool;
+    MemoryPoolRegistration *NextRegistration;
+
+    static MemoryPoolRegistration *FirstRegistration;
+};
+
 class MemoryPoolFactory
 {
 public:
@@ -46,11 +99,27 @@ public:
     void Init() {}
     MemoryPool *Create_Memory_Pool(PoolInitRec const *params);
     MemoryPool *Create_Memory_Pool(char const *name, int size, int count, int overflow);
+    MemoryPool *Create_Memory_Pool(char const *name, unsigned hash, int size, int count, int overflow, int alignment = 0);
+    MemoryPool *Create_Aligned_Memory_Pool(char const *name, int size, int alignment, int count, int overflow);
     MemoryPool *Find_Memory_Pool(char const *name);
+    MemoryPool *Find_Memory_Pool(char const *name, unsigned hash);
     void Destroy_Memory_Pool(MemoryPool *pool);
     DynamicMemoryAllocator *Create_Dynamic_Memory_Allocator(int subpools, PoolInitRec const *const params);
     void Destroy_Dynamic_Memory_Allocator(DynamicMemoryAllocator *allocator);
     void Reset();
+    int Release_Empties();
+    void Prefault_Pools();
+
+    int Get_Pool_Stats(MemoryPoolStats *stats, int max_count);
+    void Dump_Stats(FILE *fp, MemoryStatsFormat format);
+    bool Dump_Stats(char const *filename, MemoryStatsFormat format);
+    // Static so MemoryPools.ini can set it up before the factory exists.
+    static void Set_Stats_Dump(char const *filename, MemoryStatsFormat format, int interval_ms);
+    void Update_Stats_Dump();
+    void Finish_Stats_Dump();
+    // Static for the same reason, the update runs once a frame.
+    static void Set_Load_Upkeep(bool prefault, bool release_empties);
+    void Update_Load_Upkeep();
 
     void *operator new(size_t size) throw()
     {
@@ -29,6 +29,7 @@
 #ifndef _MEMPOOLOBJ_H_
 #define _MEMPOOLOBJ_H_
 
+#include "framearena.h"
 #include "gamedebug.h"
 #include "mempool.h"
 #include "mempoolfact.h"
@@ -46,27 +47,47 @@ public:
     // use macros below to generated them.
 };
 
-// Use within a class declaration on a none virtual MemoryPoolObject
-// based class to implement required functions. "classname" must match
-// the name of the class in which it is used.
-#define IMPLEMENT_POOL(classname) \
+//
+// Holds the registration for a class using the pool macros below. Being a
+// template static it can be defined here in the header and still only exists
+// once, it gets constructed during static init.
+//
+template<typename T>
+class MemoryPoolClassRegistration
+{
+public:
+    static MemoryPoolRegistration Registration;
+};
+
+template<typename T>
+MemoryPoolRegistration MemoryPoolClassRegistration<T>::Registration(
+    T::Get_Class_Pool_Name(),
+    T::ClassPoolHash,
+    sizeof(T),
+    int(T::ClassPoolAlignment) > int(alignof(T)) ? int(T::ClassPoolAlignment) : int(alignof(T)));
+
+// Shared part of the macros below, not for use on its own.
+#define DECLARE_CLASS_POOL(classname, poolname, alignment) \
     private: \
+        friend class MemoryPoolClassRegistration<classname>; \
+        static constexpr unsigned ClassPoolHash = Pool_Name_Hash(#poolname); \
+        enum { ClassPoolAlignment = alignment }; \
+        static char const *Get_Class_Pool_Name() { return #poolname; } \
         static MemoryPool *Get_Class_Pool() \
         { \
-            static MemoryPool *The##classname##Pool; \
-            static bool PoolInit; \
-            if ( !PoolInit ) { \
-                PoolInit = true; \
-                The##classname##Pool = TheMemoryPoolFactory->Create_Memory_Pool(#classname, sizeof(classname), -1, -1); \
-            } \
-            ASSERT_PRINT(The##classname##Pool->Get_Alloc_Size() == sizeof(classname), "Pool %s is wrong size for class (need %d, currently %d)", #classname, sizeof(classname), The##classname##Pool->Get_Alloc_Size()); \
-            return The##classname##Pool; \
+            return MemoryPoolClassRegistration<classname>::Registration.Get_Pool(); \
         } \
     public: \
         virtual MemoryPool *Get_Object_Pool() \
         { \
             return Get_Class_Pool(); \
-        } \
+        }
+
+// Use within a class declaration on a none virtual MemoryPoolObject
+// based class to implement required functions. "classname" must match
+// the name of the class in which it is used.
+#define IMPLEMENT_POOL(classname) \
+    DECLARE_CLASS_POOL(classname, classname, 0) \
         void *operator new(size_t size) \
         { \
             return Get_Class_Pool()->Allocate_Block(); \
@@ -81,23 +102,38 @@ public:
 // the name of the class in which it is used, "poolname" should match a 
 // gamememoryinit.cpp entry.
 #define IMPLEMENT_NAMED_POOL(classname, poolname) \
-    private: \
-        static MemoryPool *Get_Class_Pool() \
+    DECLARE_CLASS_POOL(classname, poolname, 0) \
+        void *operator new(size_t size) \
         { \
-            static MemoryPool *The##classname##Pool; \
-            static bool PoolInit; \
-            if ( !PoolInit ) { \
-                PoolInit = true; \
-                The##classname##Pool = TheMemoryPoolFactory->Create_Memory_Pool(#poolname, sizeof(classname), -1, -1); \
-            } \
-            ASSERT_PRINT(The##classname##Pool->Get_Alloc_Size() == sizeof(classname), "Pool %s is wrong size for class (need %d, currently %d)", #classname, sizeof(classname), The##classname##Pool->Get_Alloc_Size()); \
-            return The##classname##Pool; \
+            return Get_Class_Pool()->Allocate_Block(); \
         } \
-    public: \
-        virtual MemoryPool *Get_Object_Pool() \
+        void operator delete(void *ptr) \
         { \
-            return Get_Class_Pool(); \
+            return Get_Class_Pool()->Free_Block(ptr); \
+        }
+
+// Use within a class declaration on a none virtual MemoryPoolObject
+// based class like IMPLEMENT_POOL, but new places instances in the frame
+// arena so they only live until the end of the current frame. Off the frame
+// thread or with the arena full they come from the class pool instead, delete
+// and Delete_Instance work for either. MemoryPool::Free_Block doesn't know
+// about the arena, so the original code must never free these instances.
+#define IMPLEMENT_FRAME_POOL(classname) \
+    DECLARE_CLASS_POOL(classname, classname, 0) \
+        void *operator new(size_t size) \
+        { \
+            return FrameArena::Allocate_Object(Get_Class_Pool()); \
         } \
+        void operator delete(void *ptr) \
+        { \
+            return Free_Pool_Instance(Get_Class_Pool(), ptr); \
+        }
+
+// Use like IMPLEMENT_POOL where instances need their start aligned to more than
+// the class would get on its own, "alignment" is a power of 2 up to
+// MemoryPool::MAX_ALIGNMENT. Classes declared with a larger alignas get it anyway.
+#define IMPLEMENT_ALIGNED_POOL(classname, alignment) \
+    DECLARE_CLASS_POOL(classname, classname, alignment) \
         void *operator new(size_t size) \
         { \
             return Get_Class_Pool()->Allocate_Block(); \
@@ -107,13 +143,28 @@ public:
             return Get_Class_Pool()->Free_Block(ptr); \
         }
 
+// Gives each instance whole cache lines to itself so objects that different
+// threads write to frequently don't false share.
+#define IMPLEMENT_CACHE_ALIGNED_POOL(classname) \
+    IMPLEMENT_ALIGNED_POOL(classname, MemoryPool::CACHE_LINE_SIZE)
+
+// Frame pool instances may live in the arena rather than their pool.
+inline void Free_Pool_Instance(MemoryPool *pool, void *ptr)
+{
+    if ( FrameArena::Owns(ptr) ) {
+        FrameArena::Free_Object(ptr);
+    } else {
+        pool->Free_Block(ptr);
+    }
+}
+
 // Delete a MemoryPoolObject instance.
 inline void Delete_Instance(MemoryPoolObject *ptr)
 {
     if ( ptr != nullptr ) {
         MemoryPool *pool = ptr->Get_Object_Pool();
         ptr->~MemoryPoolObject();
-        pool->Free_Block(ptr);
+        Free_Pool_Instance(pool, ptr);
     }
 }
 
@@ -130,7 +181,7 @@ public:
         if ( Obj != nullptr ) {
             MemoryPool *mp = Obj->Get_Object_Pool();
             Obj->~MemoryPoolObject();
-            mp->Free_Block(Obj);
+            Free_Pool_Instance(mp, Obj);
         }
     }
 
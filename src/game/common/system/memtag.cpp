@@ -0,0 +1,264 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: MEMTAG.CPP
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Charges dynamic allocations to the subsystem that made
+//                 them, with optional soft budgets.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "memtag.h"
+#include "critsection.h"
+#include "gamedebug.h"
+#include "minmax.h"
+#include <cstring>
+#include <ctype.h>
+
+#ifndef PLATFORM_WINDOWS
+#include <pthread.h>
+#endif // !PLATFORM_WINDOWS
+
+bool MemoryTag::Enabled = false;
+bool MemoryTag::Initialised = false;
+int volatile MemoryTag::TagCount = 1;
+MemoryTag::TagEntry MemoryTag::Tags[MAX_TAGS];
+
+// Only adding tags takes this, charging and lookups of existing tags don't.
+static FastCriticalSectionClass TagLock;
+
+//
+// TLS API rather than compiler thread locals for the same reason as the pool
+// thread caches, the DLL is loaded late. The slot holds the tag itself.
+//
+#ifdef PLATFORM_WINDOWS
+static DWORD CurrentTagTls = TLS_OUT_OF_INDEXES;
+#else
+static pthread_key_t CurrentTagKey;
+#endif // PLATFORM_WINDOWS
+
+static int Atomic_Add(int volatile *value, int amount)
+{
+#ifdef COMPILER_MSVC
+    return InterlockedExchangeAdd(reinterpret_cast<volatile long *>(value), amount) + amount;
+#elif defined COMPILER_GNUC || defined COMPILER_CLANG
+    return __sync_add_and_fetch(value, amount);
+#endif
+}
+
+// Tag entries are filled in before the count goes up, readers must see them in that order.
+static int Atomic_Load(int volatile *value)
+{
+#ifdef COMPILER_MSVC
+    return *value;
+#elif defined COMPILER_GNUC || defined COMPILER_CLANG
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static void Atomic_Max(int volatile *value, int candidate)
+{
+    for ( int old = *value; candidate > old; old = *value ) {
+#ifdef COMPILER_MSVC
+        if ( InterlockedCompareExchange(reinterpret_cast<volatile long *>(value), candidate, old) == old ) {
+#elif defined COMPILER_GNUC || defined COMPILER_CLANG
+        if ( __sync_val_compare_and_swap(value, old, candidate) == old ) {
+#endif
+            break;
+        }
+    }
+}
+
+void MemoryTag::Init()
+{
+    if ( Initialised ) {
+        return;
+    }
+
+#ifdef PLATFORM_WINDOWS
+    CurrentTagTls = TlsAlloc();
+
+    if ( CurrentTagTls == TLS_OUT_OF_INDEXES ) {
+        DEBUG_LOG("Failed to allocate TLS index, memory tags are disabled.\n");
+        return;
+    }
+#else
+    if ( pthread_key_create(&CurrentTagKey, nullptr) != 0 ) {
+        DEBUG_LOG("Failed to allocate TLS key, memory tags are disabled.\n");
+        return;
+    }
+#endif // PLATFORM_WINDOWS
+
+    strcpy(Tags[UNTAGGED].Name, "Untagged");
+    Initialised = true;
+}
+
+void MemoryTag::Shutdown()
+{
+    if ( !Initialised ) {
+        return;
+    }
+
+    Initialised = false;
+
+#ifdef PLATFORM_WINDOWS
+    TlsFree(CurrentTagTls);
+    CurrentTagTls = TLS_OUT_OF_INDEXES;
+#else
+    pthread_key_delete(CurrentTagKey);
+#endif // PLATFORM_WINDOWS
+}
+
+int MemoryTag::Find_Tag(char const *name)
+{
+    //
+    // Names get cut down to plain characters when they are added so the stats
+    // dumps never need to escape them, compare the same way.
+    //
+    char clean[MAX_NAME_LENGTH];
+    int length = 0;
+
+    for ( ; name[length] != '\0' && length < MAX_NAME_LENGTH - 1; ++length ) {
+        char c = name[length];
+        clean[length] = isalnum((unsigned char)c) || c == '_' || c == '.' || c == '-' ? c : '_';
+    }
+
+    clean[length] = '\0';
+
+    // Tags are never removed so anything under the count can be read without the lock.
+    int count = Atomic_Load(&TagCount);
+
+    for ( int i = UNTAGGED + 1; i < count; ++i ) {
+        if ( strcasecmp(Tags[i].Name, clean) == 0 ) {
+            return i;
+        }
+    }
+
+    FastCriticalSectionClass::LockClass lock(TagLock);
+
+    for ( int i = count; i < TagCount; ++i ) {
+        if ( strcasecmp(Tags[i].Name, clean) == 0 ) {
+            return i;
+        }
+    }
+
+    if ( TagCount >= MAX_TAGS ) {
+        DEBUG_LOG("Memory tag table is full, '%s' is left untagged.\n", clean);
+
+        return UNTAGGED;
+    }
+
+    int tag = TagCount;
+    strcpy(Tags[tag].Name, clean);
+    Atomic_Add(&TagCount, 1);
+
+    return tag;
+}
+
+void MemoryTag::Set_Budget(char const *name, int bytes)
+{
+    int tag = Find_Tag(name);
+
+    if ( tag != UNTAGGED ) {
+        Tags[tag].BudgetBytes = MAX(0, bytes);
+    }
+}
+
+int MemoryTag::Get_Current()
+{
+    if ( !Initialised ) {
+        return UNTAGGED;
+    }
+
+#ifdef PLATFORM_WINDOWS
+    return int(intptr_t(TlsGetValue(CurrentTagTls)));
+#else
+    return int(intptr_t(pthread_getspecific(CurrentTagKey)));
+#endif // PLATFORM_WINDOWS
+}
+
+void MemoryTag::Set_Current(int tag)
+{
+    if ( !Initialised ) {
+        return;
+    }
+
+#ifdef PLATFORM_WINDOWS
+    TlsSetValue(CurrentTagTls, reinterpret_cast<void *>(intptr_t(tag)));
+#else
+    pthread_setspecific(CurrentTagKey, reinterpret_cast<void *>(intptr_t(tag)));
+#endif // PLATFORM_WINDOWS
+}
+
+void MemoryTag::Charge(int tag, int bytes)
+{
+    TagEntry &entry = Tags[tag];
+    int live = Atomic_Add(&entry.LiveBytes, bytes);
+    Atomic_Add(&entry.LiveBlocks, 1);
+    Atomic_Add(&entry.Allocations, 1);
+    Atomic_Max(&entry.PeakBytes, live);
+
+    //
+    // Budgets are soft, only the allocation that takes the tag over gets logged
+    // so a tag hovering around its budget doesn't flood the log.
+    //
+    if ( entry.BudgetBytes > 0 && live > entry.BudgetBytes && live - bytes <= entry.BudgetBytes ) {
+        Atomic_Add(&entry.OverBudgetCount, 1);
+        DEBUG_LOG("Memory tag '%s' went over its %d byte budget, %d bytes live.\n", entry.Name, entry.BudgetBytes, live);
+    }
+}
+
+void MemoryTag::Credit(int tag, int bytes)
+{
+    TagEntry &entry = Tags[tag];
+    Atomic_Add(&entry.LiveBytes, -bytes);
+    Atomic_Add(&entry.LiveBlocks, -1);
+}
+
+void MemoryTag::Reset()
+{
+    // The allocator has just thrown away every block, names and budgets stay.
+    for ( int i = 0, count = Atomic_Load(&TagCount); i < count; ++i ) {
+        Tags[i].LiveBytes = 0;
+        Tags[i].PeakBytes = 0;
+        Tags[i].LiveBlocks = 0;
+        Tags[i].Allocations = 0;
+        Tags[i].OverBudgetCount = 0;
+    }
+}
+
+int MemoryTag::Get_Stats(MemoryTagStats *stats, int max_count)
+{
+    //
+    // Returns how many tags there are, fills at most max_count of them. The
+    // untagged entry is left out as nothing is charged to it.
+    //
+    int count = Atomic_Load(&TagCount);
+
+    for ( int i = UNTAGGED + 1; i < count && i - 1 < max_count; ++i ) {
+        MemoryTagStats &s = stats[i - 1];
+        s.TagName = Tags[i].Name;
+        s.LiveBytes = Tags[i].LiveBytes;
+        s.PeakBytes = Tags[i].PeakBytes;
+        s.LiveBlocks = Tags[i].LiveBlocks;
+        s.Allocations = Tags[i].Allocations;
+        s.BudgetBytes = Tags[i].BudgetBytes;
+        s.OverBudgetCount = Tags[i].OverBudgetCount;
+    }
+
+    return count - 1;
+}
@@ -0,0 +1,143 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: MEMTAG.H
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Charges dynamic allocations to the subsystem that made
+//                 them, with optional soft budgets.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifdef _MSC_VER
+#pragma once
+#endif // _MSC_VER
+
+#ifndef _MEMTAG_H_
+#define _MEMTAG_H_
+
+#include "always.h"
+
+struct MemoryTagStats
+{
+    char const *TagName;
+    int LiveBytes;
+    int PeakBytes;
+    int LiveBlocks;
+    int Allocations;        // Since Init or the last Reset.
+    int BudgetBytes;        // 0 when the tag has no budget.
+    int OverBudgetCount;    // Times live bytes went over the budget.
+};
+
+//
+// Each thread has a current tag, set with MemoryTagScope, and the dynamic
+// allocator charges whatever it hands out to it. The tag goes with the block so
+// the free is credited back to the same tag whichever thread does it. Blocks
+// allocated outside any scope are left untagged and cost nothing to track.
+//
+// Tagging has to be enabled before the dynamic allocator is created, the
+// MemoryPools.ini "MemoryTags 1" and "TagBudget <name> <KiB>" lines do that.
+//
+class MemoryTag
+{
+public:
+    enum {
+        UNTAGGED = 0,
+        MAX_TAGS = 256,     // Blocks keep their tag in a byte.
+        MAX_NAME_LENGTH = 32,
+    };
+
+    static void Init();
+    static void Shutdown();
+    static void Set_Enabled(bool enabled) { Enabled = enabled; }
+    static bool Is_Enabled() { return Enabled; }
+
+    // Adds the tag if it is new, UNTAGGED once the table is full.
+    static int Find_Tag(char const *name);
+    static void Set_Budget(char const *name, int bytes);
+
+    static int Get_Current();
+    static void Set_Current(int tag);
+
+    static void Charge(int tag, int bytes);
+    static void Credit(int tag, int bytes);
+    static void Reset();
+
+    static int Get_Stats(MemoryTagStats *stats, int max_count);
+
+private:
+    struct TagEntry
+    {
+        char Name[MAX_NAME_LENGTH];
+        int volatile LiveBytes;
+        int volatile PeakBytes;
+        int volatile LiveBlocks;
+        int volatile Allocations;
+        int BudgetBytes;
+        int volatile OverBudgetCount;
+    };
+
+private:
+    static bool Enabled;
+    static bool Initialised;
+    static int volatile TagCount;
+    static TagEntry Tags[MAX_TAGS];
+};
+
+//
+// Makes a tag current for the rest of the scope, does nothing with tagging
+// disabled. Loaders can cache a tag from MemoryTag::Find_Tag and pass that to
+// skip the name lookup.
+//
+class MemoryTagScope
+{
+public:
+    MemoryTagScope(char const *name) : PreviousTag(-1)
+    {
+        if ( MemoryTag::Is_Enabled() ) {
+            Enter(MemoryTag::Find_Tag(name));
+        }
+    }
+
+    MemoryTagScope(int tag) : PreviousTag(-1)
+    {
+        if ( MemoryTag::Is_Enabled() ) {
+            Enter(tag);
+        }
+    }
+
+    ~MemoryTagScope()
+    {
+        if ( PreviousTag >= 0 ) {
+            MemoryTag::Set_Current(PreviousTag);
+        }
+    }
+
+private:
+    MemoryTagScope(MemoryTagScope const &that);
+    MemoryTagScope &operator=(MemoryTagScope const &that);
+
+    void Enter(int tag)
+    {
+        PreviousTag = MemoryTag::Get_Current();
+        MemoryTag::Set_Current(tag);
+    }
+
+private:
+    int PreviousTag;
+};
+
+#endif // _MEMTAG_H_
@@ -0,0 +1,400 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: MEMTHREADCACHE.CPP
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Per thread magazines of free blocks that sit in front of
+//                 each MemoryPool so the common allocate/free path needs no
+//                 lock.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "memthreadcache.h"
+#include "critsection.h"
+#include "memblock.h"
+#include "mempool.h"
+
+#ifndef PLATFORM_WINDOWS
+#include <pthread.h>
+#endif // !PLATFORM_WINDOWS
+
+MemoryPoolThreadCache *MemoryPoolThreadCache::FirstCache = nullptr;
+SimpleCriticalSectionClass MemoryPoolThreadCache::CacheListLock;
+bool MemoryPoolThreadCache::Enabled = true;
+bool MemoryPoolThreadCache::Initialised = false;
+unsigned int MemoryPoolThreadCache::NextSerial = 0;
+int MemoryPoolThreadCache::SlotsUsed = 0;
+int MemoryPoolThreadCache::FreeSlotCount = 0;
+int MemoryPoolThreadCache::FreeSlotList[MAX_POOL_SLOTS];
+MemoryPoolThreadCache::PoolSlot MemoryPoolThreadCache::Slots[MAX_POOL_SLOTS];
+
+//
+// The DLL gets injected into the game after it starts so we use the TLS API
+// rather than compiler thread locals which aren't reliable for late loaded DLLs.
+//
+#ifdef PLATFORM_WINDOWS
+static DWORD ThreadCacheTls = TLS_OUT_OF_INDEXES;
+#else
+static pthread_key_t ThreadCacheKey;
+
+static void Thread_Cache_Destructor(void *cache)
+{
+    // pthreads clears the value before calling us, put it back so detach can find it.
+    pthread_setspecific(ThreadCacheKey, cache);
+    MemoryPoolThreadCache::Thread_Detach();
+}
+#endif // PLATFORM_WINDOWS
+
+MemoryPoolThreadCache::MemoryPoolThreadCache() :
+    NextCache(nullptr),
+    PrevCache(nullptr)
+{
+    memset(Magazines, 0, sizeof(Magazines));
+}
+
+MemoryPoolThreadCache::~MemoryPoolThreadCache()
+{
+    for ( int i = 0; i < MAX_POOL_SLOTS; ++i ) {
+        Raw_Free(Magazines[i]);
+    }
+}
+
+void MemoryPoolThreadCache::Init()
+{
+    if ( Initialised ) {
+        return;
+    }
+
+#ifdef PLATFORM_WINDOWS
+    ThreadCacheTls = TlsAlloc();
+
+    if ( ThreadCacheTls == TLS_OUT_OF_INDEXES ) {
+        DEBUG_LOG("Failed to allocate TLS index, pool thread caches are disabled.\n");
+        return;
+    }
+#else
+    if ( pthread_key_create(&ThreadCacheKey, Thread_Cache_Destructor) != 0 ) {
+        DEBUG_LOG("Failed to allocate TLS key, pool thread caches are disabled.\n");
+        return;
+    }
+#endif // PLATFORM_WINDOWS
+
+    Initialised = true;
+}
+
+void MemoryPoolThreadCache::Shutdown()
+{
+    if ( !Initialised ) {
+        return;
+    }
+
+    //
+    // Only the calling thread can be flushed safely, any other thread still
+    // running this late gets its cache torn down when it exits.
+    //
+    Thread_Detach();
+    Initialised = false;
+
+#ifdef PLATFORM_WINDOWS
+    TlsFree(ThreadCacheTls);
+    ThreadCacheTls = TLS_OUT_OF_INDEXES;
+#else
+    pthread_key_delete(ThreadCacheKey);
+#endif // PLATFORM_WINDOWS
+}
+
+void MemoryPoolThreadCache::Thread_Detach()
+{
+    MemoryPoolThreadCache *cache = Peek_Current();
+
+    if ( cache == nullptr ) {
+        return;
+    }
+
+    Set_Current(nullptr);
+
+    {
+        //
+        // Flushed while still holding the list lock so a pool being destroyed
+        // either finds this cache and drains it or finds it already empty.
+        //
+        ScopedCriticalSectionClass scs(&CacheListLock);
+
+        if ( cache->PrevCache != nullptr ) {
+            cache->PrevCache->NextCache = cache->NextCache;
+        } else {
+            FirstCache = cache->NextCache;
+        }
+
+        if ( cache->NextCache != nullptr ) {
+            cache->NextCache->PrevCache = cache->PrevCache;
+        }
+
+        cache->Flush_All();
+    }
+
+    delete cache;
+}
+
+void MemoryPoolThreadCache::Register_Pool(MemoryPool *pool)
+{
+    ScopedCriticalSectionClass scs(MemoryPoolCriticalSection);
+    int slot;
+
+    if ( FreeSlotCount > 0 ) {
+        slot = FreeSlotList[--FreeSlotCount];
+    } else if ( SlotsUsed < MAX_POOL_SLOTS ) {
+        slot = SlotsUsed++;
+    } else {
+        DEBUG_LOG("Out of thread cache slots, pool '%s' will not be cached.\n", pool->PoolName);
+        pool->CacheSlot = -1;
+
+        return;
+    }
+
+    //
+    // Serial 0 is never handed out so a fresh magazine never matches by accident.
+    //
+    if ( ++NextSerial == 0 ) {
+        ++NextSerial;
+    }
+
+    pool->CacheSlot = slot;
+    pool->CacheSerial = NextSerial;
+    Slots[slot].Pool = pool;
+    Slots[slot].Serial = NextSerial;
+}
+
+void MemoryPoolThreadCache::Unregister_Pool(MemoryPool *pool)
+{
+    if ( pool->CacheSlot < 0 ) {
+        return;
+    }
+
+    //
+    // Pools are only destroyed once nothing uses them, so no other thread can be
+    // touching its magazine for this slot and every thread's blocks can go back
+    // now. Blocks freed across threads are waiting on the remote list instead.
+    //
+    {
+        ScopedCriticalSectionClass scs(&CacheListLock);
+
+        for ( MemoryPoolThreadCache *cache = FirstCache; cache != nullptr; cache = cache->NextCache ) {
+            cache->Flush_Magazine(pool->CacheSlot);
+        }
+    }
+
+    {
+        ScopedCriticalSectionClass scs(&pool->PoolLock);
+        pool->Drain_Remote_Frees();
+    }
+
+    ScopedCriticalSectionClass scs(MemoryPoolCriticalSection);
+
+    Slots[pool->CacheSlot].Pool = nullptr;
+    Slots[pool->CacheSlot].Serial = 0;
+    FreeSlotList[FreeSlotCount++] = pool->CacheSlot;
+    pool->CacheSlot = -1;
+    pool->CacheSerial = 0;
+}
+
+void MemoryPoolThreadCache::Invalidate_Pool(MemoryPool *pool)
+{
+    if ( pool->CacheSlot < 0 ) {
+        return;
+    }
+
+    ScopedCriticalSectionClass scs(MemoryPoolCriticalSection);
+
+    if ( ++NextSerial == 0 ) {
+        ++NextSerial;
+    }
+
+    pool->CacheSerial = NextSerial;
+    Slots[pool->CacheSlot].Serial = NextSerial;
+}
+
+void *MemoryPoolThreadCache::Allocate_Block(MemoryPool *pool)
+{
+    if ( pool->CacheSlot < 0 ) {
+        return nullptr;
+    }
+
+    MemoryPoolThreadCache *cache = Get_Current();
+
+    if ( cache == nullptr ) {
+        return nullptr;
+    }
+
+    Magazine *mag = cache->Get_Magazine(pool);
+
+    if ( mag->Count == 0 ) {
+        // Only take half so a following run of frees doesn't immediately flush.
+        mag->Count = pool->Allocate_Block_Batch(mag->Blocks, (mag->Capacity + 1) / 2);
+    }
+
+    void *block = mag->Blocks[--mag->Count];
+
+    // Slab layout blocks have no header to stamp, they always free locally.
+    if ( !pool->Headerless ) {
+        MemoryPoolSingleBlock::Recover_Block_From_User_Data(block)->OwnerCache = cache;
+    }
+
+    return block;
+}
+
+bool MemoryPoolThreadCache::Free_Block(MemoryPool *pool, void *block)
+{
+    if ( pool->CacheSlot < 0 ) {
+        return false;
+    }
+
+    MemoryPoolThreadCache *cache = Get_Current();
+
+    if ( cache == nullptr ) {
+        return false;
+    }
+
+    //
+    // Blocks that came out of another thread's magazine go back on the pool's
+    // remote list rather than filling ours, the next refill picks them up.
+    //
+    if ( !pool->Headerless ) {
+        MemoryPoolSingleBlock *header = MemoryPoolSingleBlock::Recover_Block_From_User_Data(block);
+
+        if ( header->OwnerCache != nullptr && header->OwnerCache != cache ) {
+            pool->Push_Remote_Free(block);
+
+            return true;
+        }
+    }
+
+    Magazine *mag = cache->Get_Magazine(pool);
+
+    if ( mag->Count == mag->Capacity ) {
+        // Hand back the oldest half, the most recently freed blocks are the warm ones.
+        int flush = mag->Capacity / 2;
+        pool->Free_Block_Batch(mag->Blocks, flush);
+        mag->Count -= flush;
+        memmove(mag->Blocks, &mag->Blocks[flush], mag->Count * sizeof(void *));
+    }
+
+    mag->Blocks[mag->Count++] = block;
+
+    return true;
+}
+
+void MemoryPoolThreadCache::Flush_Pool(MemoryPool *pool)
+{
+    MemoryPoolThreadCache *cache = Peek_Current();
+
+    if ( cache != nullptr && pool->CacheSlot >= 0 ) {
+        cache->Flush_Magazine(pool->CacheSlot);
+    }
+}
+
+MemoryPoolThreadCache::Magazine *MemoryPoolThreadCache::Get_Magazine(MemoryPool *pool)
+{
+    Magazine *mag = Magazines[pool->CacheSlot];
+
+    if ( mag == nullptr ) {
+        mag = static_cast<Magazine *>(Raw_Allocate_No_Zero(sizeof(Magazine)));
+        mag->Count = 0;
+        mag->Serial = pool->CacheSerial;
+        mag->Capacity = pool->MagazineSize;
+        Magazines[pool->CacheSlot] = mag;
+    } else if ( mag->Serial != pool->CacheSerial ) {
+        //
+        // Pool was reset or the slot was reused since we last looked, whatever we
+        // held pointed into blobs that no longer exist so just forget them.
+        //
+        mag->Count = 0;
+        mag->Serial = pool->CacheSerial;
+        mag->Capacity = pool->MagazineSize;
+    }
+
+    return mag;
+}
+
+void MemoryPoolThreadCache::Flush_Magazine(int slot)
+{
+    Magazine *mag = Magazines[slot];
+
+    if ( mag == nullptr || mag->Count == 0 ) {
+        return;
+    }
+
+    if ( Slots[slot].Pool != nullptr && Slots[slot].Serial == mag->Serial ) {
+        Slots[slot].Pool->Free_Block_Batch(mag->Blocks, mag->Count);
+    }
+
+    mag->Count = 0;
+}
+
+void MemoryPoolThreadCache::Flush_All()
+{
+    for ( int i = 0; i < MAX_POOL_SLOTS; ++i ) {
+        Flush_Magazine(i);
+    }
+}
+
+MemoryPoolThreadCache *MemoryPoolThreadCache::Get_Current()
+{
+    if ( !Enabled || !Initialised ) {
+        return nullptr;
+    }
+
+    MemoryPoolThreadCache *cache = Peek_Current();
+
+    if ( cache == nullptr ) {
+        cache = new MemoryPoolThreadCache;
+        Set_Current(cache);
+
+        ScopedCriticalSectionClass scs(&CacheListLock);
+        cache->NextCache = FirstCache;
+
+        if ( FirstCache != nullptr ) {
+            FirstCache->PrevCache = cache;
+        }
+
+        FirstCache = cache;
+    }
+
+    return cache;
+}
+
+MemoryPoolThreadCache *MemoryPoolThreadCache::Peek_Current()
+{
+    if ( !Initialised ) {
+        return nullptr;
+    }
+
+#ifdef PLATFORM_WINDOWS
+    return static_cast<MemoryPoolThreadCache *>(TlsGetValue(ThreadCacheTls));
+#else
+    return static_cast<MemoryPoolThreadCache *>(pthread_getspecific(ThreadCacheKey));
+#endif // PLATFORM_WINDOWS
+}
+
+void MemoryPoolThreadCache::Set_Current(MemoryPoolThreadCache *cache)
+{
+#ifdef PLATFORM_WINDOWS
+    TlsSetValue(ThreadCacheTls, cache);
+#else
+    pthread_setspecific(ThreadCacheKey, cache);
+#endif // PLATFORM_WINDOWS
+}
@@ -0,0 +1,116 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: MEMTHREADCACHE.H
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Per thread magazines of free blocks that sit in front of
+//                 each MemoryPool so the common allocate/free path needs no
+//                 lock.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifdef _MSC_VER
+#pragma once
+#endif // _MSC_VER
+
+#ifndef _MEMTHREADCACHE_H_
+#define _MEMTHREADCACHE_H_
+
+#include "always.h"
+#include "critsection.h"
+#include "rawalloc.h"
+
+class MemoryPool;
+
+class MemoryPoolThreadCache
+{
+public:
+    enum {
+        MAX_POOL_SLOTS = 2048,      // Pools beyond this just don't get cached.
+        MAGAZINE_BYTES = 8192,      // Rough amount of memory a magazine should hold.
+        MAGAZINE_MIN_BLOCKS = 4,
+        MAGAZINE_MAX_BLOCKS = 64,
+    };
+
+    static void Init();
+    static void Shutdown();
+    static void Thread_Detach();
+
+    static void Set_Enabled(bool enabled) { Enabled = enabled; }
+    static bool Is_Enabled() { return Enabled; }
+
+    static void Register_Pool(MemoryPool *pool);
+    static void Unregister_Pool(MemoryPool *pool);
+    static void Invalidate_Pool(MemoryPool *pool);
+
+    static void *Allocate_Block(MemoryPool *pool);
+    static bool Free_Block(MemoryPool *pool, void *block);
+    static void Flush_Pool(MemoryPool *pool);
+
+    void *operator new(size_t size) throw()
+    {
+        return Raw_Allocate(size);
+    }
+
+    void operator delete(void *obj)
+    {
+        Raw_Free(obj);
+    }
+
+private:
+    struct Magazine
+    {
+        unsigned int Serial;    // CacheSerial of the pool when the blocks were taken.
+        int Count;
+        int Capacity;
+        void *Blocks[MAGAZINE_MAX_BLOCKS];
+    };
+
+    struct PoolSlot
+    {
+        MemoryPool *Pool;
+        unsigned int Serial;
+    };
+
+    MemoryPoolThreadCache();
+    ~MemoryPoolThreadCache();
+
+    Magazine *Get_Magazine(MemoryPool *pool);
+    void Flush_Magazine(int slot);
+    void Flush_All();
+
+    static MemoryPoolThreadCache *Get_Current();
+    static MemoryPoolThreadCache *Peek_Current();
+    static void Set_Current(MemoryPoolThreadCache *cache);
+
+private:
+    Magazine *Magazines[MAX_POOL_SLOTS];
+    MemoryPoolThreadCache *NextCache;
+    MemoryPoolThreadCache *PrevCache;
+
+    static MemoryPoolThreadCache *FirstCache;   // Every live thread's cache, guarded by CacheListLock.
+    static SimpleCriticalSectionClass CacheListLock;
+    static bool Enabled;
+    static bool Initialised;
+    static unsigned int NextSerial;
+    static int SlotsUsed;
+    static int FreeSlotCount;
+    static int FreeSlotList[MAX_POOL_SLOTS];
+    static PoolSlot Slots[MAX_POOL_SLOTS];
+};
+
+#endif // _MEMTHREADCACHE_H_
@@ -0,0 +1,466 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: MEMTRACE.CPP
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Records every request the game allocators see to a binary
+//                 trace that memreplay can play back.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "memtrace.h"
+#include "critsection.h"
+#include "gamedebug.h"
+#include "mempool.h"
+#include "minmax.h"
+#include "rawalloc.h"
+#include <cstring>
+
+#ifndef PLATFORM_WINDOWS
+#include <pthread.h>
+#include <time.h>
+#endif // !PLATFORM_WINDOWS
+
+bool MemoryTrace::Active = false;
+FILE *MemoryTrace::TraceFile = nullptr;
+MemoryTraceRecord *MemoryTrace::Buffer = nullptr;
+int MemoryTrace::BufferCount = 0;
+uint64_t MemoryTrace::LastTime = 0;
+MemoryTrace::LiveEntry *MemoryTrace::Live = nullptr;
+int MemoryTrace::LiveSize = 0;
+int MemoryTrace::LiveCount = 0;
+uint32_t *MemoryTrace::FreeIds = nullptr;
+int MemoryTrace::FreeIdCount = 0;
+int MemoryTrace::FreeIdSize = 0;
+uint32_t MemoryTrace::NextId = 0;
+MemoryTrace::PoolEntry *MemoryTrace::Pools = nullptr;
+int MemoryTrace::PoolCount = 0;
+uintptr_t MemoryTrace::Threads[MemoryTrace::MAX_THREADS];
+int MemoryTrace::ThreadCount = 0;
+int MemoryTrace::DroppedFrees = 0;
+
+//
+// Everything past Is_Active() happens under this lock. Like the heap profiler
+// nothing in here may go near the game allocators, the tables come straight
+// from Raw_Allocate.
+//
+static FastCriticalSectionClass TraceLock;
+
+static unsigned Hash_Pointer(void const *ptr)
+{
+    uintptr_t v = uintptr_t(ptr) >> 3;
+
+    return unsigned(v ^ (v >> 16)) * 0x45D9F3B;
+}
+
+static uint64_t Get_Trace_Time()
+{
+#ifdef PLATFORM_WINDOWS
+    LARGE_INTEGER now;
+    LARGE_INTEGER frequency;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&frequency);
+
+    return uint64_t(now.QuadPart) * 1000000 / uint64_t(frequency.QuadPart);
+#elif defined PLATFORM_APPLE
+    return mach_absolute_time() / 1000;
+#else
+    struct timespec now;
+
+    if ( clock_gettime(CLOCK_MONOTONIC, &now) != 0 ) {
+        return 0;
+    }
+
+    return uint64_t(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+bool MemoryTrace::Start(char const *filename)
+{
+    FastCriticalSectionClass::LockClass lock(TraceLock);
+
+    if ( Active ) {
+        return true;
+    }
+
+    TraceFile = fopen(filename, "wb");
+
+    if ( TraceFile == nullptr ) {
+        DEBUG_LOG("Failed to open '%s' for the memory trace.\n", filename);
+
+        return false;
+    }
+
+    MemoryTraceHeader header;
+    memcpy(header.Magic, "THYMTRCE", sizeof(header.Magic));
+    header.Version = VERSION;
+    header.RecordSize = sizeof(MemoryTraceRecord);
+    fwrite(&header, sizeof(header), 1, TraceFile);
+
+    Buffer = static_cast<MemoryTraceRecord *>(Raw_Allocate_No_Zero(BUFFER_RECORDS * sizeof(MemoryTraceRecord)));
+    BufferCount = 0;
+    LiveSize = INITIAL_LIVE_TABLE_SIZE;
+    LiveCount = 0;
+    Live = static_cast<LiveEntry *>(Raw_Allocate(LiveSize * sizeof(LiveEntry)));
+    FreeIdSize = INITIAL_LIVE_TABLE_SIZE;
+    FreeIdCount = 0;
+    FreeIds = static_cast<uint32_t *>(Raw_Allocate_No_Zero(FreeIdSize * sizeof(uint32_t)));
+    NextId = 0;
+    Pools = static_cast<PoolEntry *>(Raw_Allocate(POOL_TABLE_SIZE * sizeof(PoolEntry)));
+    PoolCount = 0;
+    ThreadCount = 0;
+    DroppedFrees = 0;
+    LastTime = Get_Trace_Time();
+    Active = true;
+
+    return true;
+}
+
+void MemoryTrace::Stop()
+{
+    FastCriticalSectionClass::LockClass lock(TraceLock);
+
+    if ( !Active ) {
+        return;
+    }
+
+    Active = false;
+    Flush();
+    fclose(TraceFile);
+    TraceFile = nullptr;
+
+    if ( DroppedFrees != 0 ) {
+        DEBUG_LOG("Memory trace dropped %d frees of blocks allocated before it started.\n", DroppedFrees);
+    }
+
+    DEBUG_LOG("Memory trace stopped, %u block ids used by %d pools and %d threads.\n", NextId, PoolCount, ThreadCount);
+
+    Raw_Free(Buffer);
+    Raw_Free(Live);
+    Raw_Free(FreeIds);
+    Raw_Free(Pools);
+    Buffer = nullptr;
+    Live = nullptr;
+    FreeIds = nullptr;
+    Pools = nullptr;
+}
+
+void MemoryTrace::Flush()
+{
+    if ( BufferCount != 0 ) {
+        fwrite(Buffer, sizeof(MemoryTraceRecord), BufferCount, TraceFile);
+        BufferCount = 0;
+    }
+}
+
+void MemoryTrace::Write_Record(int type, int pool, uint32_t id, int size)
+{
+    uint64_t now = Get_Trace_Time();
+    uint64_t delta = now > LastTime ? now - LastTime : 0;
+    LastTime = MAX(LastTime, now);
+
+    if ( BufferCount == BUFFER_RECORDS ) {
+        Flush();
+    }
+
+    MemoryTraceRecord &record = Buffer[BufferCount++];
+    record.Type = uint8_t(type);
+    record.Thread = uint8_t(Find_Thread());
+    record.Pool = uint16_t(pool);
+    record.Time = uint32_t(MIN<uint64_t>(delta, 0xFFFFFFFF));
+    record.Id = id;
+    record.Size = uint32_t(size);
+}
+
+int MemoryTrace::Find_Thread()
+{
+#ifdef PLATFORM_WINDOWS
+    uintptr_t thread = GetCurrentThreadId();
+#else
+    uintptr_t thread = uintptr_t(pthread_self());
+#endif // PLATFORM_WINDOWS
+
+    // A game only has a handful of threads, a scan is plenty.
+    for ( int i = 0; i < ThreadCount; ++i ) {
+        if ( Threads[i] == thread ) {
+            return i;
+        }
+    }
+
+    if ( ThreadCount == MAX_THREADS ) {
+        return MAX_THREADS - 1;
+    }
+
+    Threads[ThreadCount] = thread;
+
+    return ThreadCount++;
+}
+
+int MemoryTrace::Find_Pool(MemoryPool *pool)
+{
+    int index = Hash_Pointer(pool) & (POOL_TABLE_SIZE - 1);
+
+    for ( ; Pools[index].Pool != nullptr; index = (index + 1) & (POOL_TABLE_SIZE - 1) ) {
+        if ( Pools[index].Pool == pool ) {
+            return Pools[index].Id;
+        }
+    }
+
+    // Ids start at 1, 0 is the dynamic allocator. Keep some space free so probes end.
+    if ( PoolCount >= POOL_TABLE_SIZE * 3 / 4 ) {
+        return 0;
+    }
+
+    Pools[index].Pool = pool;
+    Pools[index].Id = ++PoolCount;
+
+    //
+    // The pool description goes out as a record's worth of bytes at a time so
+    // readers can step over it without knowing its layout.
+    //
+    MemoryTraceRecord desc[(sizeof(MemoryTracePool) + sizeof(MemoryTraceRecord) - 1) / sizeof(MemoryTraceRecord)];
+    MemoryTracePool *info = reinterpret_cast<MemoryTracePool *>(desc);
+    memset(desc, 0, sizeof(desc));
+    strncpy(info->Name, pool->PoolName, MemoryTracePool::NAME_LENGTH - 1);
+    info->AllocationSize = pool->AllocationSize;
+    info->Alignment = pool->Alignment;
+    info->InitialAllocationCount = pool->InitialAllocationCount;
+    info->OverflowAllocationCount = pool->OverflowAllocationCount;
+
+    Write_Record(TRACE_POOL, PoolCount, 0, ARRAY_SIZE(desc));
+
+    for ( int i = 0; i < int(ARRAY_SIZE(desc)); ++i ) {
+        if ( BufferCount == BUFFER_RECORDS ) {
+            Flush();
+        }
+
+        Buffer[BufferCount++] = desc[i];
+    }
+
+    return PoolCount;
+}
+
+uint32_t MemoryTrace::Insert_Live(void *block)
+{
+    uint32_t old_id;
+
+    //
+    // The address can only still be live if we missed its free, a huge block
+    // remapped on one thread can have its old pages handed out on another
+    // before the move is recorded. Free the stale id so the replay agrees.
+    //
+    if ( Remove_Live(block, old_id) ) {
+        Write_Record(TRACE_FREE_BYTES, 0, old_id, 0);
+    }
+
+    if ( LiveCount >= LiveSize / 2 ) {
+        Grow_Live();
+    }
+
+    uint32_t id;
+
+    if ( FreeIdCount != 0 ) {
+        id = FreeIds[--FreeIdCount];
+    } else {
+        id = NextId++;
+    }
+
+    int index = Hash_Pointer(block) & (LiveSize - 1);
+
+    while ( Live[index].Block != nullptr ) {
+        index = (index + 1) & (LiveSize - 1);
+    }
+
+    Live[index].Block = block;
+    Live[index].Id = id;
+    ++LiveCount;
+
+    return id;
+}
+
+bool MemoryTrace::Remove_Live(void *block, uint32_t &id)
+{
+    int index = Hash_Pointer(block) & (LiveSize - 1);
+
+    for ( ; Live[index].Block != block; index = (index + 1) & (LiveSize - 1) ) {
+        if ( Live[index].Block == nullptr ) {
+            return false;
+        }
+    }
+
+    id = Live[index].Id;
+    --LiveCount;
+
+    // Same backward shift as the heap profiler's live table, no tombstones.
+    for ( int next = (index + 1) & (LiveSize - 1); Live[next].Block != nullptr; next = (next + 1) & (LiveSize - 1) ) {
+        int home = Hash_Pointer(Live[next].Block) & (LiveSize - 1);
+
+        if ( ((next - home) & (LiveSize - 1)) >= ((next - index) & (LiveSize - 1)) ) {
+            Live[index] = Live[next];
+            index = next;
+        }
+    }
+
+    Live[index].Block = nullptr;
+
+    //
+    // Every live id can be on the free list at once, so it never needs more
+    // room than the ids handed out so far.
+    //
+    if ( FreeIdCount == FreeIdSize ) {
+        uint32_t *ids = static_cast<uint32_t *>(Raw_Allocate_No_Zero(FreeIdSize * 2 * sizeof(uint32_t)));
+        memcpy(ids, FreeIds, FreeIdSize * sizeof(uint32_t));
+        Raw_Free(FreeIds);
+        FreeIds = ids;
+        FreeIdSize *= 2;
+    }
+
+    FreeIds[FreeIdCount++] = id;
+
+    return true;
+}
+
+void MemoryTrace::Grow_Live()
+{
+    LiveEntry *old_live = Live;
+    int old_size = LiveSize;
+
+    LiveSize *= 2;
+    Live = static_cast<LiveEntry *>(Raw_Allocate(LiveSize * sizeof(LiveEntry)));
+
+    for ( int i = 0; i < old_size; ++i ) {
+        if ( old_live[i].Block != nullptr ) {
+            int index = Hash_Pointer(old_live[i].Block) & (LiveSize - 1);
+
+            while ( Live[index].Block != nullptr ) {
+                index = (index + 1) & (LiveSize - 1);
+            }
+
+            Live[index] = old_live[i];
+        }
+    }
+
+    Raw_Free(old_live);
+}
+
+void MemoryTrace::Record_Allocate_Bytes(void *block, int bytes)
+{
+    FastCriticalSectionClass::LockClass lock(TraceLock);
+
+    if ( Active ) {
+        Write_Record(TRACE_ALLOCATE_BYTES, 0, Insert_Live(block), bytes);
+    }
+}
+
+void MemoryTrace::Record_Allocate_Aligned(void *block, int bytes, int alignment)
+{
+    FastCriticalSectionClass::LockClass lock(TraceLock);
+
+    if ( Active ) {
+        Write_Record(TRACE_ALLOCATE_ALIGNED, alignment, Insert_Live(block), bytes);
+    }
+}
+
+void MemoryTrace::Record_Reallocate_Bytes(void *old_block, void *block, int bytes)
+{
+    FastCriticalSectionClass::LockClass lock(TraceLock);
+
+    if ( !Active ) {
+        return;
+    }
+
+    uint32_t id;
+
+    // A block from before the trace started turns up as a new allocation.
+    if ( !Remove_Live(old_block, id) ) {
+        Write_Record(TRACE_ALLOCATE_BYTES, 0, Insert_Live(block), bytes);
+
+        return;
+    }
+
+    //
+    // Take the id we just freed back so the block keeps it. It is on top of
+    // the free list, unless the new address was stale and pushed another.
+    //
+    uint32_t new_id = Insert_Live(block);
+
+    if ( new_id == id ) {
+        Write_Record(TRACE_REALLOCATE_BYTES, 0, id, bytes);
+    } else {
+        Write_Record(TRACE_FREE_BYTES, 0, id, 0);
+        Write_Record(TRACE_ALLOCATE_BYTES, 0, new_id, bytes);
+    }
+}
+
+void MemoryTrace::Record_Free_Bytes(void *block)
+{
+    FastCriticalSectionClass::LockClass lock(TraceLock);
+
+    if ( !Active ) {
+        return;
+    }
+
+    uint32_t id;
+
+    if ( Remove_Live(block, id) ) {
+        Write_Record(TRACE_FREE_BYTES, 0, id, 0);
+    } else {
+        ++DroppedFrees;
+    }
+}
+
+void MemoryTrace::Record_Allocate_Block(MemoryPool *pool, void *block)
+{
+    FastCriticalSectionClass::LockClass lock(TraceLock);
+
+    if ( Active ) {
+        int id = Find_Pool(pool);
+        Write_Record(TRACE_ALLOCATE_BLOCK, id, Insert_Live(block), 0);
+    }
+}
+
+void MemoryTrace::Record_Free_Block(MemoryPool *pool, void *block)
+{
+    FastCriticalSectionClass::LockClass lock(TraceLock);
+
+    if ( !Active ) {
+        return;
+    }
+
+    uint32_t id;
+
+    if ( Remove_Live(block, id) ) {
+        Write_Record(TRACE_FREE_BLOCK, Find_Pool(pool), id, 0);
+    } else {
+        ++DroppedFrees;
+    }
+}
+
+void MemoryTrace::Record_Reset()
+{
+    FastCriticalSectionClass::LockClass lock(TraceLock);
+
+    if ( !Active ) {
+        return;
+    }
+
+    Write_Record(TRACE_RESET, 0, 0, 0);
+    memset(Live, 0, LiveSize * sizeof(LiveEntry));
+    LiveCount = 0;
+    FreeIdCount = 0;
+    NextId = 0;
+}
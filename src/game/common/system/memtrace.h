@@ -0,0 +1,158 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: MEMTRACE.H
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Records every request the game allocators see to a binary
+//                 trace that memreplay can play back.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifdef _MSC_VER
+#pragma once
+#endif // _MSC_VER
+
+#ifndef _MEMTRACE_H_
+#define _MEMTRACE_H_
+
+#include "always.h"
+#include <cstdio>
+
+class MemoryPool;
+
+//
+// Trace file layout, a header then a stream of records. Everything is little
+// endian and written as is, the structs have no padding.
+//
+struct MemoryTraceHeader
+{
+    char Magic[8];          // "THYMTRCE"
+    uint32_t Version;
+    uint32_t RecordSize;
+};
+
+enum MemoryTraceRecordType
+{
+    TRACE_POOL = 1,         // Pool's first appearance, followed by a MemoryTracePool.
+    TRACE_ALLOCATE_BYTES,
+    TRACE_ALLOCATE_ALIGNED, // Pool holds the alignment.
+    TRACE_REALLOCATE_BYTES, // The block keeps its id.
+    TRACE_FREE_BYTES,
+    TRACE_ALLOCATE_BLOCK,
+    TRACE_FREE_BLOCK,
+    TRACE_RESET,            // Everything live was thrown away, ids start over.
+};
+
+struct MemoryTraceRecord
+{
+    uint8_t Type;
+    uint8_t Thread;         // Numbered in order of each thread's first request.
+    uint16_t Pool;
+    uint32_t Time;          // Microseconds since the previous record.
+    uint32_t Id;            // Freed ids get reused, the highest one is about the peak block count.
+    uint32_t Size;          // Requested bytes for the dynamic allocator, 0 for pools.
+};
+
+struct MemoryTracePool
+{
+    enum {
+        NAME_LENGTH = 48,
+    };
+
+    char Name[NAME_LENGTH];
+    int32_t AllocationSize;
+    int32_t Alignment;
+    int32_t InitialAllocationCount;
+    int32_t OverflowAllocationCount;
+};
+
+//
+// Requests go out in the order their blocks changed hands so a replay never
+// frees something before it exists. Only what was allocated since Start gets
+// traced, frees of older blocks are dropped. Requests the dynamic allocator
+// serves from its own pools are traced once with their requested size, not
+// again by the pool.
+//
+// Like the heap profiler the allocators test Is_Active() first, with no trace
+// running that one branch is the whole cost. A running trace serialises every
+// allocation on one lock so don't judge timings from a captured session.
+//
+class MemoryTrace
+{
+public:
+    enum {
+        VERSION = 1,
+        BUFFER_RECORDS = 4096,
+        POOL_TABLE_SIZE = 2048,     // Distinct pools that can be traced.
+        MAX_THREADS = 255,          // Threads after that all share the last number.
+        INITIAL_LIVE_TABLE_SIZE = 1 << 16,
+    };
+
+    static bool Start(char const *filename);
+    static void Stop();
+    static bool Is_Active() { return Active; }
+
+    static void Record_Allocate_Bytes(void *block, int bytes);
+    static void Record_Allocate_Aligned(void *block, int bytes, int alignment);
+    static void Record_Reallocate_Bytes(void *old_block, void *block, int bytes);
+    static void Record_Free_Bytes(void *block);
+    static void Record_Allocate_Block(MemoryPool *pool, void *block);
+    static void Record_Free_Block(MemoryPool *pool, void *block);
+    static void Record_Reset();
+
+private:
+    struct LiveEntry
+    {
+        void *Block;
+        uint32_t Id;
+    };
+
+    struct PoolEntry
+    {
+        MemoryPool *Pool;
+        int Id;
+    };
+
+    static void Write_Record(int type, int pool, uint32_t id, int size);
+    static int Find_Thread();
+    static int Find_Pool(MemoryPool *pool);
+    static uint32_t Insert_Live(void *block);
+    static bool Remove_Live(void *block, uint32_t &id);
+    static void Grow_Live();
+    static void Flush();
+
+private:
+    static bool Active;
+    static FILE *TraceFile;
+    static MemoryTraceRecord *Buffer;
+    static int BufferCount;
+    static uint64_t LastTime;
+    static LiveEntry *Live;
+    static int LiveSize;
+    static int LiveCount;
+    static uint32_t *FreeIds;
+    static int FreeIdCount;
+    static int FreeIdSize;
+    static uint32_t NextId;
+    static PoolEntry *Pools;
+    static int PoolCount;
+    static uintptr_t Threads[MAX_THREADS];
+    static int ThreadCount;
+    static int DroppedFrees;
+};
+
+#endif // _MEMTRACE_H_
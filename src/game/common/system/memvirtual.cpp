@@ -0,0 +1,155 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: MEMVIRTUAL.CPP
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Reserved address range that a pool commits blob memory from
+//                 incrementally and hands back to the OS when blobs die.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "memvirtual.h"
+#include "gamedebug.h"
+
+MemoryPoolVirtualRange::MemoryPoolVirtualRange() :
+    Base(nullptr),
+    ReservedBytes(0),
+    Top(0),
+    CommittedBytes(0),
+    HugePages(false),
+    FreeExtentCount(0)
+{
+
+}
+
+MemoryPoolVirtualRange::~MemoryPoolVirtualRange()
+{
+    ASSERT_PRINT(CommittedBytes == 0, "Releasing virtual range with %d bytes still committed.\n", CommittedBytes);
+    Raw_Release(Base, ReservedBytes);
+}
+
+bool MemoryPoolVirtualRange::Init(int reserve_bytes, bool huge_pages)
+{
+    ASSERT_PRINT(Base == nullptr, "Virtual range initialised twice.\n");
+
+    ReservedBytes = Round_Up_Extent(reserve_bytes);
+    Base = static_cast<char *>(Raw_Reserve(ReservedBytes));
+    HugePages = huge_pages;
+
+    if ( Base == nullptr ) {
+        DEBUG_LOG("Failed to reserve %d bytes of address space for pool blobs.\n", ReservedBytes);
+        ReservedBytes = 0;
+
+        return false;
+    }
+
+    return true;
+}
+
+void *MemoryPoolVirtualRange::Commit_Extent(int bytes)
+{
+    int size = Round_Up_Extent(bytes);
+    int offset = -1;
+
+    //
+    // Reuse a returned extent if one is big enough, otherwise take more from
+    // the top of the range.
+    //
+    for ( int i = 0; i < FreeExtentCount; ++i ) {
+        if ( FreeExtents[i].Size >= size ) {
+            offset = FreeExtents[i].Offset;
+            FreeExtents[i].Offset += size;
+            FreeExtents[i].Size -= size;
+
+            if ( FreeExtents[i].Size == 0 ) {
+                FreeExtents[i] = FreeExtents[--FreeExtentCount];
+            }
+
+            break;
+        }
+    }
+
+    if ( offset < 0 ) {
+        if ( size > ReservedBytes - Top ) {
+            return nullptr;
+        }
+
+        offset = Top;
+        Top += size;
+    }
+
+    if ( !Raw_Commit(Base + offset, size, HugePages) ) {
+        DEBUG_LOG("Failed to commit %d bytes of pool blob memory.\n", size);
+        Add_Free_Extent(offset, size);
+
+        return nullptr;
+    }
+
+    CommittedBytes += size;
+
+    return Base + offset;
+}
+
+void MemoryPoolVirtualRange::Decommit_Extent(void *extent, int bytes)
+{
+    int size = Round_Up_Extent(bytes);
+    int offset = int(static_cast<char *>(extent) - Base);
+
+    ASSERT_PRINT(offset >= 0 && offset + size <= Top, "Extent is not part of this range.\n");
+
+    Raw_Decommit(extent, size);
+    CommittedBytes -= size;
+    Add_Free_Extent(offset, size);
+}
+
+void MemoryPoolVirtualRange::Add_Free_Extent(int offset, int size)
+{
+    //
+    // Merge with any neighbours first so the list stays short and large
+    // extents can be handed out again.
+    //
+    for ( int i = 0; i < FreeExtentCount; ) {
+        if ( FreeExtents[i].Offset + FreeExtents[i].Size == offset ) {
+            offset = FreeExtents[i].Offset;
+            size += FreeExtents[i].Size;
+        } else if ( offset + size == FreeExtents[i].Offset ) {
+            size += FreeExtents[i].Size;
+        } else {
+            ++i;
+            continue;
+        }
+
+        FreeExtents[i] = FreeExtents[--FreeExtentCount];
+    }
+
+    if ( offset + size == Top ) {
+        Top = offset;
+
+        return;
+    }
+
+    if ( FreeExtentCount == MAX_FREE_EXTENTS ) {
+        // Memory is already decommitted, we just lose the address space for reuse.
+        DEBUG_LOG("Virtual range free extent list full, %d bytes of address space dropped.\n", size);
+
+        return;
+    }
+
+    FreeExtents[FreeExtentCount].Offset = offset;
+    FreeExtents[FreeExtentCount].Size = size;
+    ++FreeExtentCount;
+}
@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: MEMVIRTUAL.H
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Reserved address range that a pool commits blob memory from
+//                 incrementally and hands back to the OS when blobs die.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifdef _MSC_VER
+#pragma once
+#endif // _MSC_VER
+
+#ifndef _MEMVIRTUAL_H_
+#define _MEMVIRTUAL_H_
+
+#include "always.h"
+#include "rawalloc.h"
+
+//
+// Extents are carved from the bottom of the range and returned extents are
+// reused first fit, so a pool's blobs stay packed together rather than being
+// spread over the process heap. Not thread safe, the owning pool's lock covers
+// it.
+//
+class MemoryPoolVirtualRange
+{
+public:
+    enum {
+        GRANULARITY = 0x10000,  // Extent size step, matches the slab alignment blobs need.
+        MAX_FREE_EXTENTS = 32,
+    };
+
+    MemoryPoolVirtualRange();
+    ~MemoryPoolVirtualRange();
+
+    bool Init(int reserve_bytes, bool huge_pages);
+    void *Commit_Extent(int bytes);
+    void Decommit_Extent(void *extent, int bytes);
+
+    bool Uses_Huge_Pages() const { return HugePages; }
+    int Get_Reserved_Bytes() const { return ReservedBytes; }
+    int Get_Committed_Bytes() const { return CommittedBytes; }
+
+    void *operator new(size_t size) throw()
+    {
+        return Raw_Allocate_No_Zero(size);
+    }
+
+    void operator delete(void *obj)
+    {
+        Raw_Free(obj);
+    }
+
+private:
+    struct Extent
+    {
+        int Offset;
+        int Size;
+    };
+
+    static int Round_Up_Extent(int bytes) { return (bytes + GRANULARITY - 1) & ~(GRANULARITY - 1); }
+
+    void Add_Free_Extent(int offset, int size);
+
+private:
+    char *Base;
+    int ReservedBytes;
+    int Top;    // Nothing at or past this offset is in use.
+    int CommittedBytes;
+    bool HugePages;
+    int FreeExtentCount;
+    Extent FreeExtents[MAX_FREE_EXTENTS];
+};
+
+#endif // _MEMVIRTUAL_H_
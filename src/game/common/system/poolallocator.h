@@ -0,0 +1,235 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: POOLALLOCATOR.H
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: STL allocator that takes container nodes from the game
+//                 memory pools.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifdef _MSC_VER
+#pragma once
+#endif // _MSC_VER
+
+#ifndef _POOLALLOCATOR_H_
+#define _POOLALLOCATOR_H_
+
+#include "gamememory.h"
+#include "memdynalloc.h"
+#include "mempool.h"
+#include "mempoolfact.h"
+#include <new>
+#include <stddef.h>
+
+//
+// Node pools are shared by everything with the same rounded size, named
+// "STLNode_<size>" so MemoryPools.ini and the stats dumps can refer to them.
+// Sizes without an ini entry get the default counts here.
+//
+template<int Size>
+struct PoolAllocatorPoolName
+{
+    enum {
+        DEFAULT_COUNT = 16384 / Size,
+        DEFAULT_OVERFLOW = 16384 / Size,
+    };
+
+    static constexpr char Name[] = {
+        'S', 'T', 'L', 'N', 'o', 'd', 'e', '_',
+        char('0' + Size / 100 % 10), char('0' + Size / 10 % 10), char('0' + Size % 10), '\0'
+    };
+};
+
+template<int Size>
+constexpr char PoolAllocatorPoolName<Size>::Name[];
+
+template<int Size>
+class PoolAllocatorPool
+{
+public:
+    static MemoryPool *Get_Pool() { return Registration.Get_Pool(); }
+
+private:
+    static MemoryPoolRegistration Registration;
+};
+
+template<int Size>
+MemoryPoolRegistration PoolAllocatorPool<Size>::Registration(
+    PoolAllocatorPoolName<Size>::Name,
+    Pool_Name_Hash(PoolAllocatorPoolName<Size>::Name),
+    Size,
+    PoolAllocatorPoolName<Size>::DEFAULT_COUNT,
+    PoolAllocatorPoolName<Size>::DEFAULT_OVERFLOW);
+
+//
+// Picks the pool for a node type. Kept out of PoolAllocator so containers can
+// still be declared with a value type that isn't complete yet.
+//
+template<typename T>
+struct PoolAllocatorNode
+{
+    enum {
+        NODE_SIZE = (sizeof(T) + sizeof(void *) - 1) & ~(sizeof(void *) - 1),
+        MAX_NODE_SIZE = 256,    // Bigger than this isn't worth a pool of its own.
+
+        // Over aligned types would need a pool per alignment too, they stay on the dynamic allocator.
+        USE_POOL = NODE_SIZE <= MAX_NODE_SIZE && alignof(T) <= sizeof(void *),
+        POOL_SIZE = USE_POOL ? NODE_SIZE : sizeof(void *),
+    };
+
+    static MemoryPool *Get_Pool() { return PoolAllocatorPool<POOL_SIZE>::Get_Pool(); }
+};
+
+//
+// Allocator for node based containers, std::map, std::set and std::list take
+// their nodes one at a time and each one comes from a fixed size pool picked by
+// the rebound node type. Anything else, vector storage or STLport's tree
+// header, goes to the dynamic allocator like a plain new would. Nodes share a
+// pool with every other type that rounds up to the same size.
+//
+// Pool blocks go through the calling thread's cache unless ThreadCache is
+// false, use that for containers that are only touched rarely so their blocks
+// don't sit parked in magazines. The allocator has no state so containers stay
+// the same size and any two instances can free each other's nodes. Pools are
+// created on first use, containers must not allocate before the memory manager
+// is up.
+//
+template<typename T, bool ThreadCache = true>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef T const *const_pointer;
+    typedef T &reference;
+    typedef T const &const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template<typename U>
+    struct rebind
+    {
+        typedef PoolAllocator<U, ThreadCache> other;
+    };
+
+    PoolAllocator() {}
+    PoolAllocator(PoolAllocator const &that) {}
+    template<typename U> PoolAllocator(PoolAllocator<U, ThreadCache> const &that) {}
+
+    pointer address(reference x) const { return &x; }
+    const_pointer address(const_reference x) const { return &x; }
+
+    pointer allocate(size_type n, void const *hint = nullptr)
+    {
+        if ( n == 1 && PoolAllocatorNode<T>::USE_POOL ) {
+            return static_cast<pointer>(Allocate_Node());
+        }
+
+        if ( n == 0 ) {
+            return nullptr;
+        }
+
+        // New_New only promises word alignment, Free_Bytes takes either back.
+        if ( alignof(T) > sizeof(void *) ) {
+            return static_cast<pointer>(TheDynamicMemoryAllocator->Allocate_Bytes_Aligned_No_Zero(int(n * sizeof(T)), int(alignof(T))));
+        }
+
+        return static_cast<pointer>(New_New(n * sizeof(T)));
+    }
+
+    void deallocate(pointer p, size_type n)
+    {
+        if ( p == nullptr ) {
+            return;
+        }
+
+        if ( n == 1 && PoolAllocatorNode<T>::USE_POOL ) {
+            Free_Node(p);
+        } else {
+            New_Delete(p);
+        }
+    }
+
+    size_type max_size() const { return size_type(-1) / sizeof(T); }
+
+    void construct(pointer p, const_reference value) { new(p) T(value); }
+    void destroy(pointer p) { p->~T(); }
+
+private:
+    static void *Allocate_Node()
+    {
+        MemoryPool *pool = PoolAllocatorNode<T>::Get_Pool();
+
+        if ( ThreadCache ) {
+            return pool->Allocate_Block_No_Zero();
+        }
+
+        // The batch path takes the pool lock and never touches the thread cache.
+        void *block;
+        pool->Allocate_Blocks_No_Zero(&block, 1);
+
+        return block;
+    }
+
+    static void Free_Node(void *node)
+    {
+        MemoryPool *pool = PoolAllocatorNode<T>::Get_Pool();
+
+        if ( ThreadCache ) {
+            pool->Free_Block(node);
+        } else {
+            pool->Free_Blocks(&node, 1);
+        }
+    }
+};
+
+template<typename T, typename U, bool ThreadCache>
+inline bool operator==(PoolAllocator<T, ThreadCache> const &a, PoolAllocator<U, ThreadCache> const &b)
+{
+    return true;
+}
+
+template<typename T, typename U, bool ThreadCache>
+inline bool operator!=(PoolAllocator<T, ThreadCache> const &a, PoolAllocator<U, ThreadCache> const &b)
+{
+    return false;
+}
+
+//
+// STLport builds without member template classes can't use rebind, they look
+// for these overloads instead.
+//
+#if defined _STLPORT_VERSION && !defined _STLP_MEMBER_TEMPLATE_CLASSES
+_STLP_BEGIN_NAMESPACE
+
+template<typename T1, typename T2, bool ThreadCache>
+inline PoolAllocator<T2, ThreadCache> &__stl_alloc_rebind(PoolAllocator<T1, ThreadCache> &a, T2 const *)
+{
+    return reinterpret_cast<PoolAllocator<T2, ThreadCache> &>(a);
+}
+
+template<typename T1, typename T2, bool ThreadCache>
+inline PoolAllocator<T2, ThreadCache> __stl_alloc_create(PoolAllocator<T1, ThreadCache> const &, T2 const *)
+{
+    return PoolAllocator<T2, ThreadCache>();
+}
+
+_STLP_END_NAMESPACE
+#endif
+
+#endif // _POOLALLOCATOR_H_
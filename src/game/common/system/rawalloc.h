@@ -31,6 +31,11 @@
 #include "always.h"
 #include "gamedebug.h"
 #include <cstdlib>
+#include <cstring>
+
+#ifndef PLATFORM_WINDOWS
+#include <sys/mman.h>
+#endif // !PLATFORM_WINDOWS
 
 // Use GlobalAlloc as the raw allocator on windows to avoid CRT issues.
 // Needed until runs standalone then just use malloc/calloc
@@ -63,6 +68,53 @@ inline void *Raw_Allocate_No_Zero(int bytes)
 
 inline void Raw_Free(void *memory) { if ( memory != nullptr ) GlobalFree(memory); }
 
+// VirtualAlloc hands out regions on the 64KiB allocation granularity so that
+// covers any alignment we ask for up to that.
+inline void *Raw_Allocate_Aligned(int bytes, int alignment)
+{
+    ASSERT_PRINT(alignment <= 0x10000, "Alignment larger than allocation granularity requested.\n");
+    void *r = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+    ASSERT_THROW(r != nullptr, 0xDEAD0002);
+
+    return r;
+}
+
+inline void Raw_Free_Aligned(void *memory) { if ( memory != nullptr ) VirtualFree(memory, 0, MEM_RELEASE); }
+
+// Address space only, nothing is usable until committed. Base is 64KiB aligned.
+inline void *Raw_Reserve(int bytes)
+{
+    return VirtualAlloc(nullptr, bytes, MEM_RESERVE, PAGE_NOACCESS);
+}
+
+// Large pages can only be had for a whole allocation up front on windows, so
+// the hint is ignored and we always commit normal pages. Committed pages read
+// as zero.
+inline bool Raw_Commit(void *memory, int bytes, bool huge_pages)
+{
+    return VirtualAlloc(memory, bytes, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+}
+
+inline void Raw_Decommit(void *memory, int bytes) { VirtualFree(memory, bytes, MEM_DECOMMIT); }
+inline void Raw_Release(void *memory, int bytes) { if ( memory != nullptr ) VirtualFree(memory, 0, MEM_RELEASE); }
+
+// Regions come from the 64KiB allocation granularity, anything less is wasted address space.
+inline int Raw_Map_Size(int bytes) { return (bytes + 0xFFFF) & ~0xFFFF; }
+
+// Committed pages straight from the OS, they read as zero. Free with Raw_Release.
+inline void *Raw_Map(int bytes)
+{
+    void *r = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+    ASSERT_THROW(r != nullptr, 0xDEAD0002);
+
+    return r;
+}
+
+// Nothing like mremap here, callers fall back to a copy.
+inline void *Raw_Remap(void *memory, int old_bytes, int new_bytes) { return nullptr; }
+
 // Otherwise use standard allocators.
 #else
 inline void *Raw_Allocate(int bytes)
@@ -92,10 +144,112 @@ inline void *Raw_Allocate_No_Zero(int bytes)
 }
 
 inline void Raw_Free(void *memory) { if ( memory != nullptr ) free(memory); }
+
+inline void *Raw_Allocate_Aligned(int bytes, int alignment)
+{
+    void *r = nullptr;
+
+    ASSERT_THROW(posix_memalign(&r, alignment, bytes) == 0, 0xDEAD0002);
+    memset(r, 0, bytes);
+
+    return r;
+}
+
+inline void Raw_Free_Aligned(void *memory) { if ( memory != nullptr ) free(memory); }
+
+// Address space only, nothing is usable until committed. Base is 64KiB aligned
+// to match what VirtualAlloc gives us.
+inline void *Raw_Reserve(int bytes)
+{
+    size_t size = bytes + 0x10000;
+    char *r = static_cast<char *>(mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+
+    if ( r == MAP_FAILED ) {
+        return nullptr;
+    }
+
+    // Trim the slack either side of the aligned range.
+    char *base = reinterpret_cast<char *>((uintptr_t(r) + 0xFFFF) & ~uintptr_t(0xFFFF));
+
+    if ( base != r ) {
+        munmap(r, base - r);
+    }
+
+    munmap(base + bytes, (r + size) - (base + bytes));
+
+    return base;
+}
+
+// Committed pages read as zero.
+inline bool Raw_Commit(void *memory, int bytes, bool huge_pages)
+{
+    if ( mprotect(memory, bytes, PROT_READ | PROT_WRITE) != 0 ) {
+        return false;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if ( huge_pages ) {
+        madvise(memory, bytes, MADV_HUGEPAGE);
+    }
+#endif // MADV_HUGEPAGE
+
+    return true;
+}
+
+// Drops the pages so they read as zero again when next committed.
+inline void Raw_Decommit(void *memory, int bytes)
+{
+    madvise(memory, bytes, MADV_DONTNEED);
+    mprotect(memory, bytes, PROT_NONE);
+}
+
+inline void Raw_Release(void *memory, int bytes) { if ( memory != nullptr ) munmap(memory, bytes); }
+
+inline int Raw_Map_Size(int bytes) { return (bytes + 0xFFF) & ~0xFFF; }
+
+// Pages straight from the OS, they read as zero. Free with Raw_Release.
+inline void *Raw_Map(int bytes)
+{
+    void *r = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    ASSERT_THROW(r != MAP_FAILED, 0xDEAD0002);
+
+    return r;
+}
+
+//
+// Grows or shrinks a mapping by moving page table entries rather than copying,
+// the result may be somewhere else. Returns nullptr where that isn't supported
+// or it fails, the original mapping is untouched then.
+//
+inline void *Raw_Remap(void *memory, int old_bytes, int new_bytes)
+{
+#ifdef MREMAP_MAYMOVE
+    void *r = mremap(memory, old_bytes, new_bytes, MREMAP_MAYMOVE);
+
+    return r != MAP_FAILED ? r : nullptr;
+#else
+    return nullptr;
+#endif // MREMAP_MAYMOVE
+}
 #endif
 
+// Touches every page in the range so the faults happen now rather than on
+// first use. Adds zero atomically so it is safe on memory already in use.
+inline void Raw_Prefault(void *memory, int bytes)
+{
+    for ( int i = 0; i < bytes; i += 0x1000 ) {
+#ifdef COMPILER_MSVC
+        InterlockedExchangeAdd(reinterpret_cast<long volatile *>(static_cast<char *>(memory) + i), 0);
+#elif defined COMPILER_GNUC || defined COMPILER_CLANG
+        __sync_fetch_and_add(reinterpret_cast<int *>(static_cast<char *>(memory) + i), 0);
+#endif
+    }
+}
+
 inline int Round_Up_4(int number) { return (number + 3) & (~3); }   // For 4byte alignment
 inline int Round_Up_8(int number) { return (number + 7) & (~7); }   // For 8bytes alignment
 inline int Round_Up_Word_Size(int number) { return (number + sizeof(void*) - 1) & (~(sizeof(void*) - 1)); } // For machine wordsize alignment
+inline int Round_Up_Alignment(int number, int alignment) { return (number + alignment - 1) & (~(alignment - 1)); } // Alignment must be a power of 2
 
 #endif // _RAWALLOC_H_
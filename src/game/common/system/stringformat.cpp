@@ -0,0 +1,529 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: STRINGFORMAT.CPP
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Type checked formatting straight into AsciiString and
+//                 UnicodeString buffers.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "stringformat.h"
+#include "gamedebug.h"
+#include "minmax.h"
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+
+enum {
+    STACK_BUF_LEN = 256,    // Most UI and log lines fit, longer ones take a second pass.
+    MAX_PRECISION = 40,     // Keeps the widest double %f can make inside FLOAT_BUF_LEN.
+    FLOAT_BUF_LEN = 384,
+    INT_BUF_LEN = 72,       // 64 binary digits and a sign.
+};
+
+struct FormatSpec
+{
+    char Align;     // '<', '>' or 0 for the default of the argument type.
+    bool Zero;
+    int Width;
+    int Precision;  // -1 when not given.
+    char Type;      // 0 when not given.
+};
+
+//
+// Writes what fits in the buffer and counts the rest, so a pass that runs out
+// of room still says how much room it needed.
+//
+template<typename CharType>
+class FormatSink
+{
+public:
+    FormatSink(CharType *buffer, int capacity) : Buffer(buffer), Capacity(capacity), Length(0) {}
+
+    void Put(CharType c)
+    {
+        if ( Length < Capacity ) {
+            Buffer[Length] = c;
+        }
+
+        ++Length;
+    }
+
+    // Narrow chars are widened as unsigned so high ASCII maps across the way %hs does it.
+    void Put_Chars(char const *s, int len)
+    {
+        int count = MIN(len, Capacity - Length);
+
+        for ( int i = 0; i < count; ++i ) {
+            Buffer[Length + i] = CharType(static_cast<unsigned char>(s[i]));
+        }
+
+        Length += len;
+    }
+
+    // Only reached for wide strings, Format_String keeps them away from AsciiString.
+    void Put_Wide_Chars(wchar_t const *s, int len)
+    {
+        int count = MIN(len, Capacity - Length);
+
+        for ( int i = 0; i < count; ++i ) {
+            Buffer[Length + i] = CharType(s[i]);
+        }
+
+        Length += len;
+    }
+
+    void Pad(int count)
+    {
+        for ( ; count > 0; --count ) {
+            Put(CharType(' '));
+        }
+    }
+
+    int Get_Length() const { return Length; }
+    bool Fits() const { return Length < Capacity; }
+
+private:
+    CharType *Buffer;
+    int Capacity;
+    int Length;
+};
+
+template<typename CharType>
+int Parse_Number(CharType const *&p)
+{
+    int value = 0;
+
+    while ( *p >= CharType('0') && *p <= CharType('9') ) {
+        value = value * 10 + (*p++ - CharType('0'));
+    }
+
+    return value;
+}
+
+//
+// Reads what is between the braces after the index, p is left on the closing
+// brace. Returns false if it isn't a spec this understands.
+//
+template<typename CharType>
+bool Parse_Spec(CharType const *&p, FormatSpec &spec)
+{
+    spec.Align = 0;
+    spec.Zero = false;
+    spec.Width = 0;
+    spec.Precision = -1;
+    spec.Type = 0;
+
+    if ( *p != CharType(':') ) {
+        return *p == CharType('}');
+    }
+
+    ++p;
+
+    if ( *p == CharType('<') || *p == CharType('>') ) {
+        spec.Align = char(*p++);
+    }
+
+    if ( *p == CharType('0') ) {
+        spec.Zero = true;
+        ++p;
+    }
+
+    spec.Width = MIN(Parse_Number(p), int(AsciiString::MAX_LEN));
+
+    if ( *p == CharType('.') ) {
+        ++p;
+        spec.Precision = MIN(Parse_Number(p), int(MAX_PRECISION));
+    }
+
+    if ( (*p >= CharType('a') && *p <= CharType('z')) || (*p >= CharType('A') && *p <= CharType('Z')) ) {
+        spec.Type = char(*p++);
+    }
+
+    return *p == CharType('}');
+}
+
+//
+// Writes prefix then body inside the width, zero fill goes between the two so
+// signs and 0x stay in front.
+//
+template<typename CharType>
+void Put_Padded(FormatSink<CharType> &sink, FormatSpec const &spec, char const *prefix, int prefix_len, char const *body, int body_len, bool numeric)
+{
+    int fill = MAX(spec.Width - prefix_len - body_len, 0);
+    bool left = spec.Align == '<' || (spec.Align == 0 && !numeric);
+
+    if ( spec.Zero && spec.Align == 0 && numeric ) {
+        sink.Put_Chars(prefix, prefix_len);
+
+        for ( ; fill > 0; --fill ) {
+            sink.Put(CharType('0'));
+        }
+
+        sink.Put_Chars(body, body_len);
+
+        return;
+    }
+
+    if ( !left ) {
+        sink.Pad(fill);
+    }
+
+    sink.Put_Chars(prefix, prefix_len);
+    sink.Put_Chars(body, body_len);
+
+    if ( left ) {
+        sink.Pad(fill);
+    }
+}
+
+template<typename CharType>
+void Put_Integer(FormatSink<CharType> &sink, FormatSpec const &spec, uint64_t value, bool negative)
+{
+    char buf[INT_BUF_LEN];
+    char *end = buf + sizeof(buf);
+    char *p = end;
+    char const *digits = spec.Type == 'X' ? "0123456789ABCDEF" : "0123456789abcdef";
+    unsigned base = 10;
+
+    switch ( spec.Type ) {
+        case 'x':
+        case 'X':
+        case 'p':
+            base = 16;
+            break;
+        case 'o':
+            base = 8;
+            break;
+        case 'b':
+            base = 2;
+            break;
+        default:
+            break;
+    }
+
+    do {
+        *--p = digits[value % base];
+        value /= base;
+    } while ( value != 0 );
+
+    if ( spec.Type == 'p' ) {
+        Put_Padded(sink, spec, "0x", 2, p, int(end - p), true);
+    } else {
+        Put_Padded(sink, spec, "-", negative ? 1 : 0, p, int(end - p), true);
+    }
+}
+
+template<typename CharType>
+void Put_Float(FormatSink<CharType> &sink, FormatSpec const &spec, double value)
+{
+    char buf[FLOAT_BUF_LEN];
+    char type = spec.Type == 'f' || spec.Type == 'e' || spec.Type == 'E' || spec.Type == 'G' ? spec.Type : 'g';
+    char printf_format[] = { '%', '.', '*', type, '\0' };
+    int len = snprintf(buf, sizeof(buf), printf_format, spec.Precision >= 0 ? spec.Precision : 6, value);
+
+    if ( len < 0 ) {
+        return;
+    }
+
+    len = MIN(len, int(sizeof(buf)) - 1);
+
+    if ( buf[0] == '-' ) {
+        Put_Padded(sink, spec, buf, 1, buf + 1, len - 1, true);
+    } else {
+        Put_Padded(sink, spec, "", 0, buf, len, true);
+    }
+}
+
+//
+// Whether the argument can be written the way the spec's type asks, anything
+// else still comes out in the argument's default form.
+//
+bool Type_Fits(char type, FormatArg::ArgType arg_type)
+{
+    if ( type == 0 ) {
+        return true;
+    }
+
+    switch ( arg_type ) {
+        case FormatArg::TYPE_INT:
+        case FormatArg::TYPE_UINT:
+        case FormatArg::TYPE_CHAR:
+            return strchr("dxXobc", type) != nullptr;
+        case FormatArg::TYPE_FLOAT:
+            return strchr("feEgG", type) != nullptr;
+        case FormatArg::TYPE_BOOL:
+            return type == 'd' || type == 's';
+        case FormatArg::TYPE_WIDE_CHAR:
+            return type == 'c';
+        case FormatArg::TYPE_STRING:
+        case FormatArg::TYPE_WIDE_STRING:
+            return type == 's';
+        case FormatArg::TYPE_POINTER:
+            return type == 'p';
+        default:
+            return false;
+    }
+}
+
+template<typename CharType>
+void Put_Arg(FormatSink<CharType> &sink, FormatSpec const &spec, FormatArg const &arg)
+{
+    ASSERT_PRINT(Type_Fits(spec.Type, arg.Type), "Format type '%c' doesn't suit its argument.\n", spec.Type);
+
+    switch ( arg.Type ) {
+        case FormatArg::TYPE_INT:
+            if ( spec.Type == 'c' ) {
+                sink.Put(CharType(arg.Int));
+            } else {
+                Put_Integer(sink, spec, arg.Int < 0 ? 0 - uint64_t(arg.Int) : uint64_t(arg.Int), arg.Int < 0);
+            }
+
+            break;
+        case FormatArg::TYPE_UINT:
+            if ( spec.Type == 'c' ) {
+                sink.Put(CharType(arg.UInt));
+            } else {
+                Put_Integer(sink, spec, arg.UInt, false);
+            }
+
+            break;
+        case FormatArg::TYPE_FLOAT:
+            Put_Float(sink, spec, arg.Float);
+            break;
+        case FormatArg::TYPE_BOOL:
+            if ( spec.Type == 'd' ) {
+                Put_Integer(sink, spec, arg.Int, false);
+            } else {
+                Put_Padded(sink, spec, "", 0, arg.Int != 0 ? "true" : "false", arg.Int != 0 ? 4 : 5, false);
+            }
+
+            break;
+        case FormatArg::TYPE_CHAR:
+            if ( spec.Type != 0 && spec.Type != 'c' ) {
+                Put_Integer(sink, spec, uint64_t(arg.Int) & 0xFF, false);
+            } else {
+                char c = char(arg.Int);
+                Put_Padded(sink, spec, "", 0, &c, 1, false);
+            }
+
+            break;
+        case FormatArg::TYPE_WIDE_CHAR:
+        {
+            wchar_t c = wchar_t(arg.Int);
+            int fill = MAX(spec.Width - 1, 0);
+
+            // Left aligned unless asked otherwise, the same as Put_Padded does chars.
+            if ( spec.Align == '>' ) {
+                sink.Pad(fill);
+            }
+
+            sink.Put_Wide_Chars(&c, 1);
+
+            if ( spec.Align != '>' ) {
+                sink.Pad(fill);
+            }
+
+            break;
+        }
+        case FormatArg::TYPE_STRING:
+        {
+            int len = spec.Precision >= 0 ? MIN(arg.Length, spec.Precision) : arg.Length;
+            Put_Padded(sink, spec, "", 0, arg.String != nullptr ? arg.String : "", len, false);
+            break;
+        }
+        case FormatArg::TYPE_WIDE_STRING:
+        {
+            int len = spec.Precision >= 0 ? MIN(arg.Length, spec.Precision) : arg.Length;
+            int fill = MAX(spec.Width - len, 0);
+
+            if ( spec.Align == '>' ) {
+                sink.Pad(fill);
+            }
+
+            sink.Put_Wide_Chars(arg.WideString, len);
+
+            if ( spec.Align != '>' ) {
+                sink.Pad(fill);
+            }
+
+            break;
+        }
+        case FormatArg::TYPE_POINTER:
+        {
+            FormatSpec pointer_spec = spec;
+            pointer_spec.Type = 'p';
+            Put_Integer(sink, pointer_spec, uint64_t(uintptr_t(arg.Pointer)), false);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+//
+// One pass over the format.
+//
+template<typename CharType>
+void Run_Format(FormatSink<CharType> &sink, CharType const *format, FormatArg const *args, int count)
+{
+    int next_arg = 0;
+
+    for ( CharType const *p = format; *p != CharType('\0'); ++p ) {
+        if ( *p == CharType('}') && p[1] == CharType('}') ) {
+            sink.Put(*p++);
+
+            continue;
+        }
+
+        if ( *p != CharType('{') ) {
+            sink.Put(*p);
+
+            continue;
+        }
+
+        if ( p[1] == CharType('{') ) {
+            sink.Put(*p++);
+
+            continue;
+        }
+
+        CharType const *start = p++;
+        int index = -1;
+
+        if ( *p >= CharType('0') && *p <= CharType('9') ) {
+            index = Parse_Number(p);
+        }
+
+        FormatSpec spec;
+
+        if ( !Parse_Spec(p, spec) ) {
+            // Not one of ours, the brace goes out as it is.
+            ASSERT_PRINT(false, "Bad format placeholder.\n");
+            sink.Put(*start);
+            p = start;
+
+            continue;
+        }
+
+        if ( index < 0 ) {
+            index = next_arg++;
+        }
+
+        ASSERT_PRINT(index < count, "Format has more placeholders than arguments.\n");
+
+        if ( index < count ) {
+            Put_Arg(sink, spec, args[index]);
+        }
+    }
+}
+
+//
+// A second pass goes straight into the string's own buffer, so long as nothing
+// being formatted points into it.
+//
+template<typename CharType>
+bool Points_Into(CharType const *buffer, int len, void const *p)
+{
+    uintptr_t begin = uintptr_t(buffer);
+    uintptr_t end = uintptr_t(buffer + len + 1);
+
+    return uintptr_t(p) >= begin && uintptr_t(p) < end;
+}
+
+template<typename CharType>
+bool Args_Use_Buffer(CharType const *buffer, int len, CharType const *format, FormatArg const *args, int count)
+{
+    if ( len <= 0 ) {
+        return false;
+    }
+
+    if ( Points_Into(buffer, len, format) ) {
+        return true;
+    }
+
+    for ( int i = 0; i < count; ++i ) {
+        if ( args[i].Type == FormatArg::TYPE_STRING && Points_Into(buffer, len, args[i].String) ) {
+            return true;
+        }
+
+        if ( args[i].Type == FormatArg::TYPE_WIDE_STRING && Points_Into(buffer, len, args[i].WideString) ) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//
+// The first pass goes to the stack and is all that is needed when the result
+// fits, it is copied across once the arguments are done with. Anything longer
+// has been measured by then and is written again at its full size.
+//
+template<typename StringType, typename CharType>
+void Format_Into(StringType &string, CharType const *format, FormatArg const *args, int count)
+{
+    CharType stack_buf[STACK_BUF_LEN];
+    FormatSink<CharType> first(stack_buf, STACK_BUF_LEN);
+    Run_Format(first, format, args, count);
+
+    int len = first.Get_Length();
+
+    ASSERT_THROW_PRINT(len < StringType::MAX_LEN, 0xDEAD0002, "Formatted string is too long.\n");
+
+    if ( len == 0 ) {
+        string.Clear();
+
+        return;
+    }
+
+    if ( first.Fits() ) {
+        CharType *buffer = string.Get_Buffer_For_Read(len);
+        memcpy(buffer, stack_buf, len * sizeof(CharType));
+        buffer[len] = CharType('\0');
+
+        return;
+    }
+
+    if ( Args_Use_Buffer(string.Str(), string.Get_Length(), format, args, count) ) {
+        StringType result;
+        Format_Into(result, format, args, count);
+        string = result;
+
+        return;
+    }
+
+    CharType *buffer = string.Get_Buffer_For_Read(len);
+    FormatSink<CharType> second(buffer, len);
+    Run_Format(second, format, args, count);
+    buffer[len] = CharType('\0');
+}
+
+} // namespace
+
+void Format_Args(AsciiString &string, char const *format, FormatArg const *args, int count)
+{
+    Format_Into(string, format, args, count);
+}
+
+void Format_Args(UnicodeString &string, wchar_t const *format, FormatArg const *args, int count)
+{
+    Format_Into(string, format, args, count);
+}
@@ -0,0 +1,161 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: STRINGFORMAT.H
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Type checked formatting straight into AsciiString and
+//                 UnicodeString buffers.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifdef _MSC_VER
+#pragma once
+#endif // _MSC_VER
+
+#ifndef _STRINGFORMAT_H_
+#define _STRINGFORMAT_H_
+
+#include "always.h"
+#include "asciistring.h"
+#include "asciistringview.h"
+#include "unicodestring.h"
+#include <type_traits>
+
+//
+// Format_String works out how long the result is, sizes the string's own
+// buffer to fit and writes into it, there is no MAX_FORMAT_BUF_LEN limit.
+// How an argument is written comes from its type, not the format, so there is
+// nothing to get wrong between the two. Types it can't write don't compile.
+//
+// Placeholders are {} for the next argument or {n} for argument n, either can
+// be followed by :spec with the parts of [<|>][0][width][.precision][type] that
+// are needed. Types are d, x, X, o, b for integers, f, e, g for reals, c for a
+// char, s for strings and p for pointers. {{ and }} give a single brace.
+// A type that doesn't suit its argument asserts and is written as if none was
+// given. Numbers align right by default, chars, strings and bools left.
+//
+//     Format_String(string, "{} has {:08X} at {:.2f}", name, flags, ratio);
+//
+// UnicodeStrings take narrow strings as arguments, widening each char the way
+// %hs does. Wide arguments to an AsciiString are a compile error.
+//
+class FormatArg
+{
+public:
+    enum ArgType
+    {
+        TYPE_NONE,
+        TYPE_INT,
+        TYPE_UINT,
+        TYPE_FLOAT,
+        TYPE_BOOL,
+        TYPE_CHAR,
+        TYPE_WIDE_CHAR,
+        TYPE_STRING,
+        TYPE_WIDE_STRING,
+        TYPE_POINTER,
+    };
+
+    FormatArg() : Type(TYPE_NONE), Length(0) { Int = 0; }
+    FormatArg(bool value) : Type(TYPE_BOOL), Length(0) { Int = value; }
+    FormatArg(char value) : Type(TYPE_CHAR), Length(1) { Int = value; }
+    FormatArg(wchar_t value) : Type(TYPE_WIDE_CHAR), Length(1) { Int = value; }
+    FormatArg(signed char value) : Type(TYPE_INT), Length(0) { Int = value; }
+    FormatArg(unsigned char value) : Type(TYPE_UINT), Length(0) { UInt = value; }
+    FormatArg(short value) : Type(TYPE_INT), Length(0) { Int = value; }
+    FormatArg(unsigned short value) : Type(TYPE_UINT), Length(0) { UInt = value; }
+    FormatArg(int value) : Type(TYPE_INT), Length(0) { Int = value; }
+    FormatArg(unsigned int value) : Type(TYPE_UINT), Length(0) { UInt = value; }
+    FormatArg(long value) : Type(TYPE_INT), Length(0) { Int = value; }
+    FormatArg(unsigned long value) : Type(TYPE_UINT), Length(0) { UInt = value; }
+    FormatArg(long long value) : Type(TYPE_INT), Length(0) { Int = value; }
+    FormatArg(unsigned long long value) : Type(TYPE_UINT), Length(0) { UInt = value; }
+    FormatArg(float value) : Type(TYPE_FLOAT), Length(0) { Float = value; }
+    FormatArg(double value) : Type(TYPE_FLOAT), Length(0) { Float = value; }
+    FormatArg(char const *value) : Type(TYPE_STRING), Length(value != nullptr ? strlen(value) : 0) { String = value; }
+    FormatArg(AsciiString const &value) : Type(TYPE_STRING), Length(value.Get_Length()) { String = value.Str(); }
+    FormatArg(AsciiStringView const &value) : Type(TYPE_STRING), Length(value.Get_Length()) { String = value.Peek(); }
+    FormatArg(wchar_t const *value) : Type(TYPE_WIDE_STRING), Length(value != nullptr ? wcslen(value) : 0) { WideString = value; }
+    FormatArg(UnicodeString const &value) : Type(TYPE_WIDE_STRING), Length(value.Get_Length()) { WideString = value.Str(); }
+    FormatArg(void const *value) : Type(TYPE_POINTER), Length(0) { Pointer = value; }
+
+    ArgType Type;
+    int Length;     // Chars in String or WideString.
+
+    union
+    {
+        int64_t Int;
+        uint64_t UInt;
+        double Float;
+        char const *String;
+        wchar_t const *WideString;
+        void const *Pointer;
+    };
+};
+
+void Format_Args(AsciiString &string, char const *format, FormatArg const *args, int count);
+void Format_Args(UnicodeString &string, wchar_t const *format, FormatArg const *args, int count);
+
+//
+// Catches the wide arguments an AsciiString has no room for.
+//
+template<typename T>
+struct Is_Wide_Format_Arg
+{
+    typedef typename std::decay<T>::type DecayType;
+
+    enum {
+        VALUE = std::is_same<DecayType, wchar_t>::value
+            || std::is_same<DecayType, wchar_t *>::value
+            || std::is_same<DecayType, wchar_t const *>::value
+            || std::is_same<DecayType, UnicodeString>::value,
+    };
+};
+
+template<typename... Args>
+struct Has_Wide_Format_Arg;
+
+template<>
+struct Has_Wide_Format_Arg<>
+{
+    enum { VALUE = false };
+};
+
+template<typename T, typename... Args>
+struct Has_Wide_Format_Arg<T, Args...>
+{
+    enum { VALUE = Is_Wide_Format_Arg<T>::VALUE || Has_Wide_Format_Arg<Args...>::VALUE };
+};
+
+template<typename... Args>
+void Format_String(AsciiString &string, char const *format, Args const &... args)
+{
+    static_assert(!Has_Wide_Format_Arg<Args...>::VALUE, "Wide strings can't be formatted into an AsciiString.");
+
+    // The extra one keeps the array from being empty.
+    FormatArg const list[] = { FormatArg(args)..., FormatArg() };
+    Format_Args(string, format, list, sizeof...(Args));
+}
+
+template<typename... Args>
+void Format_String(UnicodeString &string, wchar_t const *format, Args const &... args)
+{
+    FormatArg const list[] = { FormatArg(args)..., FormatArg() };
+    Format_Args(string, format, list, sizeof...(Args));
+}
+
+#endif // _STRINGFORMAT_H_
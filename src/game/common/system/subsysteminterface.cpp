@@ -22,6 +22,7 @@
 //
 ////////////////////////////////////////////////////////////////////////////////
 #include "subsysteminterface.h"
+#include "memtag.h"
 
 ////////////
 // Interface
@@ -46,6 +47,7 @@ void SubsystemInterfaceList::Post_Process_Load_All()
         it != Subsystems.end();
         ++it
     ) {
+        MemoryTagScope tag((*it)->Get_Name().Str());
         (*it)->PostProcessLoad();
     }
 }
@@ -57,6 +59,7 @@ void SubsystemInterfaceList::Reset_All()
         it != Subsystems.end();
         ++it
     ) {
+        MemoryTagScope tag((*it)->Get_Name().Str());
         (*it)->Reset();
     }
 }
@@ -46,6 +46,7 @@ class SubsystemInterface
         virtual void Draw() {}
 
         void Set_Name(AsciiString name);    // Needs confirming.
+        AsciiString const &Get_Name() const { return SubsystemName; }
 
     private:
         AsciiString SubsystemName;     // Needs confirming.
@@ -32,6 +32,7 @@
 #include "gamedebug.h"
 #include "stringex.h"
 #include <stdio.h>
+#include <wctype.h>
 
 //#ifndef vsnwprintf
 //#define vsnwprintf _vsnwprintf
@@ -252,7 +253,7 @@ void UnicodeString::Translate(AsciiString const &string)
     for ( int i = 0; i < str_len; ++i ) {
         wchar_t c;
 
-        if ( string.m_data != nullptr ) {
+        if ( string.Has_Data() ) {
             c = string.Get_Char(i);
         } else {
             c = L'\0';
@@ -366,16 +367,16 @@ void UnicodeString::Format(UnicodeString format, ...)
     Format_VA(format, va);
 }
 
-void UnicodeString::Format_VA(wchar_t const *format, char *args)
+void UnicodeString::Format_VA(wchar_t const *format, va_list args)
 {
     wchar_t buf[MAX_FORMAT_BUF_LEN];
 
-    ASSERT_THROW_PRINT(vswprintf(buf, sizeof(buf), format, args) > 0, 0xDEAD0002, "Unable to format buffer");
+    ASSERT_THROW_PRINT(vswprintf(buf, ARRAY_SIZE(buf), format, args) > 0, 0xDEAD0002, "Unable to format buffer");
 
     Set(buf);
 }
 
-void UnicodeString::Format_VA(UnicodeString &format, char *args)
+void UnicodeString::Format_VA(UnicodeString &format, va_list args)
 {
     wchar_t buf[MAX_FORMAT_BUF_LEN];
 
@@ -397,11 +398,9 @@ bool UnicodeString::Next_Token(UnicodeString *tok, UnicodeString delims)
     //
     // If no separators provided, default to white space.
     //
-    if ( delims == nullptr ) {
+    if ( delims.Is_Empty() ) {
         delims = L" \n\r\t";
     }
-    
-    wchar_t const *start = Str();
 
     size_t pos = wcscspn(Peek(), delims.Str());
 
@@ -33,6 +33,7 @@
 //  Includes
 ////////////////////////////////////////////////////////////////////////////////
 #include "always.h"
+#include <cstdarg>
 #include <wchar.h>
 
 #define UnicodeStringCriticalSection (Make_Global<SimpleCriticalSectionClass*>(0x00A2A294))
@@ -112,8 +113,8 @@ public:
 
     void Format(wchar_t const *format, ...);
     void Format(UnicodeString format, ...);
-    void Format_VA(wchar_t const *format, char *args);
-    void Format_VA(UnicodeString &format, char *args);
+    void Format_VA(wchar_t const *format, va_list args);
+    void Format_VA(UnicodeString &format, va_list args);
 
     int Compare(wchar_t const *s) const { return wcscmp(Str(), s); };
     int Compare(UnicodeString const &string) const { return wcscmp(Str(), string.Str()); };
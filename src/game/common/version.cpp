@@ -23,6 +23,7 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include "version.h"
+#include "stringformat.h"
 
 Version::Version() :
     Major(1),
@@ -57,9 +58,9 @@ AsciiString Version::Get_Ascii_Version()
     AsciiString version;
 
     if ( LocalBuildNum != 0 ) {
-        version.Format("%d.%d.%d.%d", Major, Minor, BuildNum, LocalBuildNum);
+        Format_String(version, "{}.{}.{}.{}", Major, Minor, BuildNum, LocalBuildNum);
     } else {
-        version.Format("%d.%d.%d", Major, Minor, BuildNum);
+        Format_String(version, "{}.{}.{}", Major, Minor, BuildNum);
     }
 
     return version;
@@ -69,7 +70,7 @@ AsciiString Version::Get_Ascii_Build_Time()
 {
     AsciiString version;
 
-    version.Format("%s %s", BuildDate.Str(), BuildTime.Str());
+    Format_String(version, "{} {}", BuildDate, BuildTime);
 
     return version;
 }
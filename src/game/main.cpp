@@ -26,6 +26,7 @@
 #include "hookcrt.h"
 #include "critsection.h"
 #include "gamememory.h"
+#include "gamememoryinit.h"
 #include "mempool.h"
 #include "unicodestring.h"
 #include "version.h"
@@ -181,8 +182,9 @@ inline void Set_Working_Directory(void)
 }
 
 //
-// Check the command line for the -win parameter. We need to know it
-// earlier than the full command line parse.
+// Check the command line for the -win and -headless parameters. We need to
+// know them earlier than the full command line parse, -headless has to be set
+// before the memory manager sizes its pools.
 //
 void Check_Windowed(int argc, char *argv[])
 {
@@ -191,6 +193,8 @@ void Check_Windowed(int argc, char *argv[])
 
         if ( strcasecmp(argv[i], "-win") == 0 ) {
             GameIsWindowed = true;
+        } else if ( strcasecmp(argv[i], "-headless") == 0 ) {
+            User_Memory_Set_Headless(true);
         }
     }
 }
@@ -316,7 +320,7 @@ int __stdcall Main_Func(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCm
     DEBUG_LOG("Setting working directory.\n");
     Set_Working_Directory();
 
-    // Check command line for -win
+    // Check command line for -win and -headless
 #ifdef PLATFORM_WINDOWS
     int argc;
     char **argv = CommandLineToArgvA(GetCommandLineA(), &argc);
@@ -47,6 +47,21 @@ struct less_than_nocase
     }
 };
 
+// Equality comparator for hashed STL containers.
+// Use only for string classes.
+template<typename T>
+struct equal_to_nocase
+{
+    typedef T first_argument_type;
+    typedef T second_argument_type;
+    typedef bool result_type;
+
+    bool operator()(const T &left, const T &right) const
+    {
+        return left.Equals_No_Case(right);
+    }
+};
+
 template <int a, int b, int c, int d>
 struct FourCC
 {
@@ -42,6 +42,7 @@
 #include "gametext.h"
 #include "ini.h"
 #include "main.h"
+#include "memthreadcache.h"
 #include "namekeygenerator.h"
 #include "randomvalue.h"
 #include "w3dfilesystem.h"
@@ -166,8 +167,12 @@ BOOL WINAPI DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserved
             StopHooking();
             break;
             
-        case DLL_THREAD_ATTACH:
         case DLL_THREAD_DETACH:
+            // Hand any blocks the exiting thread cached back to their pools.
+            MemoryPoolThreadCache::Thread_Detach();
+            break;
+
+        case DLL_THREAD_ATTACH:
         default:
             break;
 
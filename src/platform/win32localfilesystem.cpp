@@ -22,6 +22,7 @@
 //
 ////////////////////////////////////////////////////////////////////////////////
 #include "win32localfilesystem.h"
+#include "asciistringview.h"
 #include "win32localfile.h"
 
 // Headers needed for posix open, close, read... etc.
@@ -44,19 +45,20 @@ File *Win32LocalFileSystem::Open_File(char const *filename, int mode)
     // If we need to write a file, ensure the needed directory exists.
     if ( (mode & File::WRITE) != 0 ) {
         DEBUG_LOG("Preparing file '%s' for write access.\n", filename);
-        AsciiString name = filename;
-        AsciiString token;
+        AsciiStringView name = filename;
+        AsciiStringView token;
         AsciiString path;
 
         name.Next_Token(&token, "\\/");
-        path = token;
+        path = token.To_String();
 
-        // Iterate over the path and create them as needed for entire path.
-        while ( strchr(token.Str(), '.') == nullptr || strchr(name.Str(), '.') != nullptr ) {
+        // Iterate over the path and create them as needed for entire path, stopping
+        // if it runs out before reaching something that looks like a file.
+        while ( token.Is_Not_Empty() && (token.Find('.') == nullptr || name.Find('.') != nullptr) ) {
             Create_Directory(path);
             path.Concat('/');
             name.Next_Token(&token, "\\/");
-            path.Concat(token.Str());
+            path.Concat(token.To_String());
         }
     }
 
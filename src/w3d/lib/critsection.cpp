@@ -23,6 +23,10 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include	"critsection.h"
 
+#ifndef PLATFORM_WINDOWS
+#include	<unistd.h>
+#endif // !PLATFORM_WINDOWS
+
 ////////////////////////////////////////////////////////////////////////////////
 ///
 /// <!-- CriticalSectionClass::CriticalSectionClass() -->
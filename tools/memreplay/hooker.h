@@ -0,0 +1,47 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: HOOKER.H
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Stands in for the DLL's hooker.h when the memory manager is
+//                 built into memreplay, there is no game exe to hook into.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifdef _MSC_VER
+#pragma once
+#endif // _MSC_VER
+
+#ifndef _HOOK_SUPPORT_H_
+#define _HOOK_SUPPORT_H_
+
+#include "always.h"
+
+//
+// Globals the DLL shares with the exe just need somewhere to live. There is one
+// per type, which is enough as long as the memory manager has no two hooked
+// globals of the same type.
+//
+template<typename T>
+inline T &Make_Global(const uintptr_t)
+{
+    static T value;
+
+    return value;
+}
+
+#endif // _HOOK_SUPPORT_H_
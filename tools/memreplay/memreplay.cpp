@@ -0,0 +1,622 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: MEMREPLAY.CPP
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Plays a memory trace captured from a game session back
+//                 against the game allocators or the system malloc and
+//                 reports throughput, peak RSS and fragmentation.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "critsection.h"
+#include "gamememoryinit.h"
+#include "memdynalloc.h"
+#include "mempool.h"
+#include "mempoolfact.h"
+#include "memthreadcache.h"
+#include "memtrace.h"
+#include "minmax.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+//
+// Usage: memreplay [options] <trace>
+//
+//   --allocator <name>  "thyme" (default) for the game allocators, "malloc"
+//                       for the system allocator.
+//   --headered          Game pools use the headered blob layout.
+//   --no-virtual        Game pools don't reserve address ranges for blobs.
+//   --no-touch          Don't write to allocated memory. By default every
+//                       block is filled so RSS reflects a game that uses what
+//                       it allocates.
+//
+// The trace is played back on one thread in the order it was recorded, the
+// thread numbers are only reported. Timing leaves out reading the trace.
+//
+
+enum {
+    READ_RECORDS = 1 << 16,
+    SAMPLE_INTERVAL = 1 << 14,  // Requests between RSS samples.
+    TOUCH_BYTE = 0xA5,
+};
+
+class ReplayAllocator
+{
+public:
+    virtual ~ReplayAllocator() {}
+    virtual void Add_Pool(int pool, MemoryTracePool const &info) = 0;
+    virtual void *Allocate_Bytes(int bytes) = 0;
+    virtual void *Allocate_Aligned(int bytes, int alignment) = 0;
+    virtual void *Reallocate_Bytes(void *block, int bytes) = 0;
+    virtual void Free_Bytes(void *block) = 0;
+    virtual void *Allocate_Block(int pool) = 0;
+    virtual void Free_Block(int pool, void *block) = 0;
+
+    // Returns false if live blocks have to be freed one by one instead.
+    virtual bool Reset() = 0;
+
+    // What the allocator holds from the OS for its blocks, -1 if it can't tell.
+    virtual int64_t Get_Reserved_Bytes() { return -1; }
+};
+
+class ThymeReplayAllocator : public ReplayAllocator
+{
+public:
+    ThymeReplayAllocator();
+    virtual void Add_Pool(int pool, MemoryTracePool const &info);
+    virtual void *Allocate_Bytes(int bytes) { return TheDynamicMemoryAllocator->Allocate_Bytes_No_Zero(bytes); }
+    virtual void *Allocate_Aligned(int bytes, int alignment) { return TheDynamicMemoryAllocator->Allocate_Bytes_Aligned_No_Zero(bytes, alignment); }
+    virtual void *Reallocate_Bytes(void *block, int bytes) { return TheDynamicMemoryAllocator->Reallocate_Bytes_No_Zero(block, bytes); }
+    virtual void Free_Bytes(void *block) { TheDynamicMemoryAllocator->Free_Bytes(block); }
+    virtual void *Allocate_Block(int pool) { return Pools[pool]->Allocate_Block_No_Zero(); }
+    virtual void Free_Block(int pool, void *block) { Pools[pool]->Free_Block(block); }
+    virtual bool Reset();
+    virtual int64_t Get_Reserved_Bytes();
+
+private:
+    SimpleCriticalSectionClass DmaLock;
+    SimpleCriticalSectionClass FactoryLock;
+    std::vector<MemoryPool *> Pools;
+};
+
+ThymeReplayAllocator::ThymeReplayAllocator()
+{
+    int param_count;
+    PoolInitRec const *params;
+
+    // Same order as Init_Memory_Manager, minus the ini the trace's session used.
+    MemoryPoolCriticalSection = &FactoryLock;
+    DmaCriticalSection = &DmaLock;
+    MemoryPoolThreadCache::Init();
+    User_Memory_Get_DMA_Params(&param_count, &params);
+    TheMemoryPoolFactory = new MemoryPoolFactory;
+    TheMemoryPoolFactory->Init();
+    TheDynamicMemoryAllocator = TheMemoryPoolFactory->Create_Dynamic_Memory_Allocator(param_count, params);
+}
+
+void ThymeReplayAllocator::Add_Pool(int pool, MemoryTracePool const &info)
+{
+    if ( int(Pools.size()) <= pool ) {
+        Pools.resize(pool + 1, nullptr);
+    }
+
+    Pools[pool] = TheMemoryPoolFactory->Find_Memory_Pool(info.Name);
+
+    if ( Pools[pool] == nullptr ) {
+        Pools[pool] = TheMemoryPoolFactory->Create_Memory_Pool(
+            info.Name,
+            Pool_Name_Hash(info.Name),
+            info.AllocationSize,
+            info.InitialAllocationCount,
+            info.OverflowAllocationCount,
+            info.Alignment > int(sizeof(void *)) ? info.Alignment : 0
+        );
+    }
+}
+
+bool ThymeReplayAllocator::Reset()
+{
+    TheMemoryPoolFactory->Reset();
+
+    return true;
+}
+
+int64_t ThymeReplayAllocator::Get_Reserved_Bytes()
+{
+    int count = TheMemoryPoolFactory->Get_Pool_Stats(nullptr, 0);
+    std::vector<MemoryPoolStats> stats(count);
+    count = MIN(count, TheMemoryPoolFactory->Get_Pool_Stats(&stats[0], count));
+    int64_t bytes = 0;
+
+    for ( int i = 0; i < count; ++i ) {
+        bytes += stats[i].BlobBytes;
+    }
+
+    DynamicMemoryAllocatorStats dma;
+    TheDynamicMemoryAllocator->Get_Stats(dma);
+
+    return bytes + dma.HugeBytes;
+}
+
+class MallocReplayAllocator : public ReplayAllocator
+{
+public:
+    virtual void Add_Pool(int pool, MemoryTracePool const &info);
+    virtual void *Allocate_Bytes(int bytes) { return malloc(bytes); }
+    virtual void *Allocate_Aligned(int bytes, int alignment);
+    virtual void *Reallocate_Bytes(void *block, int bytes) { return realloc(block, bytes); }
+    virtual void Free_Bytes(void *block) { free(block); }
+    virtual void *Allocate_Block(int pool);
+    virtual void Free_Block(int, void *block) { free(block); }
+    virtual bool Reset() { return false; }
+
+private:
+    std::vector<MemoryTracePool> Pools;
+};
+
+void MallocReplayAllocator::Add_Pool(int pool, MemoryTracePool const &info)
+{
+    if ( int(Pools.size()) <= pool ) {
+        Pools.resize(pool + 1);
+    }
+
+    Pools[pool] = info;
+}
+
+void *MallocReplayAllocator::Allocate_Aligned(int bytes, int alignment)
+{
+    void *block = nullptr;
+
+    if ( posix_memalign(&block, MAX<int>(alignment, sizeof(void *)), bytes) != 0 ) {
+        return nullptr;
+    }
+
+    return block;
+}
+
+void *MallocReplayAllocator::Allocate_Block(int pool)
+{
+    if ( Pools[pool].Alignment > int(sizeof(void *)) ) {
+        return Allocate_Aligned(Pools[pool].AllocationSize, Pools[pool].Alignment);
+    }
+
+    return malloc(Pools[pool].AllocationSize);
+}
+
+struct ReplayBlock
+{
+    void *Block;
+    int Bytes;
+};
+
+struct ReplayStats
+{
+    int64_t Requests[TRACE_RESET + 1];
+    int64_t Skipped;
+    int64_t ThreadRequests[MemoryTrace::MAX_THREADS];
+    uint64_t SessionMicroseconds;
+    int64_t LiveBytes;
+    int LiveBlocks;
+    int64_t PeakLiveBytes;
+    int PeakLiveBlocks;
+    int64_t BaseRss;
+    int64_t PeakFootprint;
+    int64_t FootprintAtPeakLive;
+    int64_t LiveAtPeakSample;
+    int64_t ReservedAtPeakLive;
+    double WorstFragmentation;
+    double ReplaySeconds;
+};
+
+static double Get_Seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static int64_t Get_Rss()
+{
+    long pages = 0;
+    long resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+
+    if ( fp != nullptr ) {
+        if ( fscanf(fp, "%ld %ld", &pages, &resident) != 2 ) {
+            resident = 0;
+        }
+
+        fclose(fp);
+    }
+
+    return int64_t(resident) * sysconf(_SC_PAGESIZE);
+}
+
+//
+// Fragmentation here is the share of what the process gained in RSS since the
+// replay started that isn't holding live requested bytes, so it counts
+// rounding, headers, free blocks in partly used blobs and anything the
+// allocator keeps cached.
+//
+static void Sample_Memory(ReplayStats &stats, ReplayAllocator &allocator)
+{
+    int64_t footprint = Get_Rss() - stats.BaseRss;
+    stats.PeakFootprint = MAX(stats.PeakFootprint, footprint);
+
+    if ( footprint > 0 && stats.LiveBytes > 0 ) {
+        stats.WorstFragmentation = MAX(stats.WorstFragmentation, 1.0 - double(stats.LiveBytes) / footprint);
+    }
+
+    if ( stats.LiveBytes > stats.LiveAtPeakSample ) {
+        stats.LiveAtPeakSample = stats.LiveBytes;
+        stats.FootprintAtPeakLive = footprint;
+        stats.ReservedAtPeakLive = allocator.Get_Reserved_Bytes();
+    }
+}
+
+class TraceReader
+{
+public:
+    TraceReader(FILE *fp) : File(fp), Count(0), Next(0), ReadSeconds(0.0) {}
+
+    MemoryTraceRecord const *Read()
+    {
+        if ( Next == Count ) {
+            double start = Get_Seconds();
+            Count = int(fread(Records, sizeof(MemoryTraceRecord), READ_RECORDS, File));
+            Next = 0;
+            ReadSeconds += Get_Seconds() - start;
+
+            if ( Count == 0 ) {
+                return nullptr;
+            }
+        }
+
+        return &Records[Next++];
+    }
+
+    double Get_Read_Seconds() const { return ReadSeconds; }
+
+private:
+    FILE *File;
+    int Count;
+    int Next;
+    double ReadSeconds;
+    MemoryTraceRecord Records[READ_RECORDS];
+};
+
+static void Touch(void *block, int from, int to, bool touch)
+{
+    if ( touch && block != nullptr && to > from ) {
+        memset(static_cast<char *>(block) + from, TOUCH_BYTE, to - from);
+    }
+}
+
+static void Add_Live(std::vector<ReplayBlock> &blocks, uint32_t id, void *block, int bytes, ReplayStats &stats)
+{
+    if ( blocks.size() <= id ) {
+        blocks.resize(id + 1);
+    }
+
+    blocks[id].Block = block;
+    blocks[id].Bytes = bytes;
+    stats.LiveBytes += bytes;
+    ++stats.LiveBlocks;
+
+    if ( stats.LiveBytes > stats.PeakLiveBytes ) {
+        stats.PeakLiveBytes = stats.LiveBytes;
+    }
+
+    stats.PeakLiveBlocks = MAX(stats.PeakLiveBlocks, stats.LiveBlocks);
+}
+
+static ReplayBlock *Find_Live(std::vector<ReplayBlock> &blocks, uint32_t id)
+{
+    if ( id >= blocks.size() || blocks[id].Block == nullptr ) {
+        return nullptr;
+    }
+
+    return &blocks[id];
+}
+
+static bool Replay(TraceReader &reader, ReplayAllocator &allocator, bool touch, ReplayStats &stats)
+{
+    std::vector<ReplayBlock> blocks;
+    std::vector<int> pool_sizes;
+    MemoryTraceRecord const *record;
+    int64_t count = 0;
+    double sample_seconds = 0.0;
+
+    double start = Get_Seconds();
+
+    while ( (record = reader.Read()) != nullptr ) {
+        stats.SessionMicroseconds += record->Time;
+        ++stats.ThreadRequests[record->Thread];
+
+        if ( record->Type <= TRACE_RESET ) {
+            ++stats.Requests[record->Type];
+        }
+
+        ReplayBlock *live;
+
+        switch ( record->Type ) {
+            case TRACE_POOL: {
+                MemoryTraceRecord desc[(sizeof(MemoryTracePool) + sizeof(MemoryTraceRecord) - 1) / sizeof(MemoryTraceRecord)];
+
+                if ( record->Size != ARRAY_SIZE(desc) ) {
+                    fprintf(stderr, "Pool description is %u records, expected %d.\n", record->Size, int(ARRAY_SIZE(desc)));
+
+                    return false;
+                }
+
+                for ( int i = 0; i < int(ARRAY_SIZE(desc)); ++i ) {
+                    MemoryTraceRecord const *part = reader.Read();
+
+                    if ( part == nullptr ) {
+                        return false;
+                    }
+
+                    desc[i] = *part;
+                }
+
+                MemoryTracePool info = *reinterpret_cast<MemoryTracePool *>(desc);
+                info.Name[MemoryTracePool::NAME_LENGTH - 1] = '\0';
+                allocator.Add_Pool(record->Pool, info);
+
+                if ( int(pool_sizes.size()) <= record->Pool ) {
+                    pool_sizes.resize(record->Pool + 1, 0);
+                }
+
+                pool_sizes[record->Pool] = info.AllocationSize;
+
+                break;
+            }
+            case TRACE_ALLOCATE_BYTES: {
+                void *block = allocator.Allocate_Bytes(record->Size);
+                Touch(block, 0, record->Size, touch);
+                Add_Live(blocks, record->Id, block, record->Size, stats);
+
+                break;
+            }
+            case TRACE_ALLOCATE_ALIGNED: {
+                void *block = allocator.Allocate_Aligned(record->Size, record->Pool);
+                Touch(block, 0, record->Size, touch);
+                Add_Live(blocks, record->Id, block, record->Size, stats);
+
+                break;
+            }
+            case TRACE_REALLOCATE_BYTES:
+                if ( (live = Find_Live(blocks, record->Id)) == nullptr ) {
+                    ++stats.Skipped;
+
+                    break;
+                }
+
+                live->Block = allocator.Reallocate_Bytes(live->Block, record->Size);
+                Touch(live->Block, live->Bytes, record->Size, touch);
+                stats.LiveBytes += int64_t(record->Size) - live->Bytes;
+                stats.PeakLiveBytes = MAX(stats.PeakLiveBytes, stats.LiveBytes);
+                live->Bytes = record->Size;
+
+                break;
+            case TRACE_FREE_BYTES:
+            case TRACE_FREE_BLOCK:
+                if ( (live = Find_Live(blocks, record->Id)) == nullptr ) {
+                    ++stats.Skipped;
+
+                    break;
+                }
+
+                if ( record->Type == TRACE_FREE_BYTES ) {
+                    allocator.Free_Bytes(live->Block);
+                } else {
+                    allocator.Free_Block(record->Pool, live->Block);
+                }
+
+                stats.LiveBytes -= live->Bytes;
+                --stats.LiveBlocks;
+                live->Block = nullptr;
+
+                break;
+            case TRACE_ALLOCATE_BLOCK: {
+                // Pool 0 means the capture ran out of pool ids.
+                if ( record->Pool == 0 || record->Pool >= pool_sizes.size() || pool_sizes[record->Pool] == 0 ) {
+                    ++stats.Skipped;
+
+                    break;
+                }
+
+                void *block = allocator.Allocate_Block(record->Pool);
+                Touch(block, 0, pool_sizes[record->Pool], touch);
+                Add_Live(blocks, record->Id, block, pool_sizes[record->Pool], stats);
+
+                break;
+            }
+            case TRACE_RESET:
+                if ( !allocator.Reset() ) {
+                    for ( size_t i = 0; i < blocks.size(); ++i ) {
+                        if ( blocks[i].Block != nullptr ) {
+                            allocator.Free_Bytes(blocks[i].Block);
+                        }
+                    }
+                }
+
+                blocks.clear();
+                stats.LiveBytes = 0;
+                stats.LiveBlocks = 0;
+
+                break;
+            default:
+                fprintf(stderr, "Unknown record type %d, the trace is damaged.\n", record->Type);
+
+                return false;
+        }
+
+        if ( ++count % SAMPLE_INTERVAL == 0 ) {
+            double sample_start = Get_Seconds();
+            Sample_Memory(stats, allocator);
+            sample_seconds += Get_Seconds() - sample_start;
+        }
+    }
+
+    stats.ReplaySeconds = Get_Seconds() - start - reader.Get_Read_Seconds() - sample_seconds;
+    Sample_Memory(stats, allocator);
+
+    return true;
+}
+
+static void Print_Usage()
+{
+    fprintf(stderr, "Usage: memreplay [--allocator thyme|malloc] [--headered] [--no-virtual] [--no-touch] <trace>\n");
+}
+
+int main(int argc, char **argv)
+{
+    char const *allocator_name = "thyme";
+    char const *filename = nullptr;
+    bool touch = true;
+
+    for ( int i = 1; i < argc; ++i ) {
+        if ( strcmp(argv[i], "--allocator") == 0 && i + 1 < argc ) {
+            allocator_name = argv[++i];
+        } else if ( strcmp(argv[i], "--headered") == 0 ) {
+            MemoryPool::Set_Use_Headerless_Blobs(false);
+        } else if ( strcmp(argv[i], "--no-virtual") == 0 ) {
+            MemoryPool::Set_Use_Virtual_Blobs(false);
+        } else if ( strcmp(argv[i], "--no-touch") == 0 ) {
+            touch = false;
+        } else if ( argv[i][0] != '-' && filename == nullptr ) {
+            filename = argv[i];
+        } else {
+            Print_Usage();
+
+            return 1;
+        }
+    }
+
+    if ( filename == nullptr ) {
+        Print_Usage();
+
+        return 1;
+    }
+
+    FILE *fp = fopen(filename, "rb");
+
+    if ( fp == nullptr ) {
+        fprintf(stderr, "Failed to open '%s'.\n", filename);
+
+        return 1;
+    }
+
+    MemoryTraceHeader header;
+
+    if ( fread(&header, sizeof(header), 1, fp) != 1
+        || memcmp(header.Magic, "THYMTRCE", sizeof(header.Magic)) != 0
+        || header.Version != MemoryTrace::VERSION
+        || header.RecordSize != sizeof(MemoryTraceRecord) ) {
+        fprintf(stderr, "'%s' isn't a version %d memory trace.\n", filename, MemoryTrace::VERSION);
+        fclose(fp);
+
+        return 1;
+    }
+
+    ReplayStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    //
+    // The baseline is taken before the allocator exists so whatever it sets up
+    // front counts against it.
+    //
+    TraceReader *reader = new TraceReader(fp);
+    stats.BaseRss = Get_Rss();
+    ReplayAllocator *allocator;
+
+    if ( strcmp(allocator_name, "thyme") == 0 ) {
+        allocator = new ThymeReplayAllocator;
+    } else if ( strcmp(allocator_name, "malloc") == 0 ) {
+        allocator = new MallocReplayAllocator;
+    } else {
+        fprintf(stderr, "Unknown allocator '%s'.\n", allocator_name);
+        fclose(fp);
+
+        return 1;
+    }
+
+    bool ok = Replay(*reader, *allocator, touch, stats);
+    fclose(fp);
+
+    if ( !ok ) {
+        return 1;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    int64_t requests = 0;
+
+    for ( int i = TRACE_ALLOCATE_BYTES; i <= TRACE_RESET; ++i ) {
+        requests += stats.Requests[i];
+    }
+
+    printf("Replayed %s on %s\n", filename, allocator_name);
+    printf("  requests          %lld (%lld allocate, %lld aligned, %lld reallocate, %lld free, %lld pool allocate, "
+        "%lld pool free, %lld reset), %lld skipped\n",
+        (long long)requests, (long long)stats.Requests[TRACE_ALLOCATE_BYTES],
+        (long long)stats.Requests[TRACE_ALLOCATE_ALIGNED], (long long)stats.Requests[TRACE_REALLOCATE_BYTES],
+        (long long)stats.Requests[TRACE_FREE_BYTES], (long long)stats.Requests[TRACE_ALLOCATE_BLOCK],
+        (long long)stats.Requests[TRACE_FREE_BLOCK], (long long)stats.Requests[TRACE_RESET],
+        (long long)stats.Skipped);
+    printf("  session           %.1f s captured\n", stats.SessionMicroseconds / 1e6);
+
+    for ( int i = 0; i < MemoryTrace::MAX_THREADS; ++i ) {
+        if ( stats.ThreadRequests[i] != 0 ) {
+            printf("  thread %-3d        %lld requests\n", i, (long long)stats.ThreadRequests[i]);
+        }
+    }
+
+    printf("  replay            %.3f s, %.2f M requests/s\n", stats.ReplaySeconds,
+        stats.ReplaySeconds > 0.0 ? requests / stats.ReplaySeconds / 1e6 : 0.0);
+    printf("  peak live         %lld bytes in %d blocks\n", (long long)stats.PeakLiveBytes, stats.PeakLiveBlocks);
+    printf("  peak rss          %lld KiB, %lld KiB over the %lld KiB the replay started with\n",
+        (long long)usage.ru_maxrss, (long long)(stats.PeakFootprint / 1024), (long long)(stats.BaseRss / 1024));
+
+    // Untouched blocks never become resident, RSS says nothing about fragmentation then.
+    if ( touch && stats.FootprintAtPeakLive > 0 ) {
+        printf("  at peak live      %lld KiB rss for %lld KiB live, %.1f%% fragmentation\n",
+            (long long)(stats.FootprintAtPeakLive / 1024), (long long)(stats.LiveAtPeakSample / 1024),
+            100.0 * (1.0 - double(stats.LiveAtPeakSample) / stats.FootprintAtPeakLive));
+    }
+
+    if ( stats.ReservedAtPeakLive > 0 ) {
+        printf("                    %lld KiB held by the allocator, %.1f%% not live\n",
+            (long long)(stats.ReservedAtPeakLive / 1024),
+            100.0 * (1.0 - double(stats.LiveAtPeakSample) / stats.ReservedAtPeakLive));
+    }
+
+    if ( touch ) {
+        printf("  worst sampled     %.1f%% fragmentation\n", 100.0 * stats.WorstFragmentation);
+    }
+
+    return 0;
+}
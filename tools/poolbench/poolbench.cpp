@@ -0,0 +1,801 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: POOLBENCH.CPP
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Times the memory pools and the dynamic memory allocator
+//                 under the allocation patterns the game puts on them.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "critsection.h"
+#include "gamememoryinit.h"
+#include "heapprofiler.h"
+#include "memdynalloc.h"
+#include "mempool.h"
+#include "mempoolfact.h"
+#include "memthreadcache.h"
+#include "minmax.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+//
+// Usage: poolbench [phase...]
+//
+// With no phase named every phase runs.
+//
+//   contention  Threads allocate and free bursts of dmaPool_32 and
+//               GameMessage sized blocks. Runs with the thread caches, with
+//               only the per pool locks, and serialised on the global locks
+//               the allocator took before either existed.
+//   batch       One thread allocates and frees ParticlePool and SightingInfo
+//               sized runs one block at a time and with the batch calls.
+//   frag        A headered PartitionContactListNode sized pool grown to about
+//               1500 blobs, churned on the lock path once most of it is free,
+//               and how many blobs a later Release_Empties gets back.
+//   churn       Threads hand blocks to each other through a shared table and
+//               free them in random order, then checks the pool adds up.
+//   realloc     Reallocates aligned blocks that had to come from the raw
+//               allocator, bigger and smaller, and checks what they held
+//               and that they stayed aligned.
+//   profile     Times contention with the heap profiler running, then checks
+//               the profile it writes accounts for sampled blocks and frees.
+//   reset       Checks a factory Reset keeps the peak's worth of blocks warm in
+//               a dynamic allocator pool as well as in a standalone one.
+//
+// Every run is repeated and the fastest one is reported. Phases that check
+// the pools report what failed and make poolbench exit with 1.
+//
+
+enum {
+    REPEATS = 5,
+    CONTENTION_OPS = 400000,    // Allocate/free pairs per thread.
+    CONTENTION_BURST = 64,      // Blocks held at once, about one message list.
+    GAME_MESSAGE_SIZE = 64,     // Roughly sizeof(GameMessage).
+    BATCH_OPS = 2000000,        // Blocks allocated and freed per timing.
+    BATCH_SIZE = 256,           // About one particle system's emission.
+    PARTICLE_SIZE = 232,        // Roughly sizeof(Particle).
+    SIGHTING_INFO_SIZE = 56,    // Roughly sizeof(SightingInfo).
+    FRAG_BLOCKS = 800000,       // About 1560 blobs at PartitionContactListNode's counts.
+    FRAG_OPS = 2000000,
+    FRAG_REFILL = 30000,
+    CONTACT_NODE_SIZE = 32,     // Roughly sizeof(PartitionContactListNode).
+    CHURN_THREADS = 8,
+    CHURN_OPS = 500000,         // Table operations per thread.
+    CHURN_SLOTS = 4096,         // Blocks that can be parked between threads at once.
+    RESET_DMA_BLOCKS = 20000,   // Well past dmaPool_1024's initial 3000.
+    RESET_POOL_BLOCKS = 2000,
+    PROFILE_BLOCKS = 20000,
+    PROFILE_BLOCK_SIZE = 256,
+    PROFILE_RATE = 4096,        // About 1250 samples over PROFILE_BLOCKS.
+};
+
+enum LockMode
+{
+    LOCK_CACHED,
+    LOCK_POOL,
+    LOCK_GLOBAL,
+};
+
+static SimpleCriticalSectionClass FactoryLock;
+static SimpleCriticalSectionClass DmaLock;
+static LockMode CurrentLockMode = LOCK_CACHED;
+static int Failures = 0;
+
+static double Get_Seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static void Check(bool ok, char const *what)
+{
+    if ( !ok ) {
+        printf("  FAILED: %s\n", what);
+        ++Failures;
+    }
+}
+
+static void Get_Pool_Stats(char const *name, MemoryPoolStats &stats)
+{
+    TheMemoryPoolFactory->Find_Memory_Pool(name)->Get_Stats(stats);
+}
+
+static void Init_Memory()
+{
+    int param_count;
+    PoolInitRec const *params;
+
+    MemoryPoolCriticalSection = &FactoryLock;
+    DmaCriticalSection = &DmaLock;
+    MemoryPoolThreadCache::Init();
+    User_Memory_Get_DMA_Params(&param_count, &params);
+    TheMemoryPoolFactory = new MemoryPoolFactory;
+    TheMemoryPoolFactory->Init();
+    TheDynamicMemoryAllocator = TheMemoryPoolFactory->Create_Dynamic_Memory_Allocator(param_count, params);
+}
+
+//
+// Runs work on each of threads threads at once and returns the wall time of
+// the slowest, best of REPEATS. Threads return their caches as they finish so
+// one run doesn't feed the next.
+//
+template<typename Work>
+static double Time_Threads(int threads, Work work)
+{
+    double best = 1e9;
+
+    for ( int repeat = 0; repeat < REPEATS; ++repeat ) {
+        std::vector<std::thread> workers;
+        double start = Get_Seconds();
+
+        for ( int i = 0; i < threads; ++i ) {
+            workers.push_back(std::thread([&work, i]() {
+                work(i);
+                MemoryPoolThreadCache::Thread_Detach();
+            }));
+        }
+
+        for ( size_t i = 0; i < workers.size(); ++i ) {
+            workers[i].join();
+        }
+
+        best = MIN(best, Get_Seconds() - start);
+    }
+
+    return best;
+}
+
+/////////////
+// Contention
+/////////////
+
+//
+// Before the thread caches and per pool locks every DMA request held the DMA
+// lock and then the factory lock around the pool call, and every pool request
+// held the factory lock. LOCK_GLOBAL puts those locks back around each call.
+//
+static void *Dma_Allocate(int size)
+{
+    if ( CurrentLockMode != LOCK_GLOBAL ) {
+        return TheDynamicMemoryAllocator->Allocate_Bytes_No_Zero(size);
+    }
+
+    ScopedCriticalSectionClass dma(&DmaLock);
+    ScopedCriticalSectionClass factory(&FactoryLock);
+
+    return TheDynamicMemoryAllocator->Allocate_Bytes_No_Zero(size);
+}
+
+static void Dma_Free(void *block)
+{
+    if ( CurrentLockMode != LOCK_GLOBAL ) {
+        TheDynamicMemoryAllocator->Free_Bytes(block);
+
+        return;
+    }
+
+    ScopedCriticalSectionClass dma(&DmaLock);
+    ScopedCriticalSectionClass factory(&FactoryLock);
+    TheDynamicMemoryAllocator->Free_Bytes(block);
+}
+
+static void *Pool_Allocate(MemoryPool *pool)
+{
+    if ( CurrentLockMode != LOCK_GLOBAL ) {
+        return pool->Allocate_Block_No_Zero();
+    }
+
+    ScopedCriticalSectionClass factory(&FactoryLock);
+
+    return pool->Allocate_Block_No_Zero();
+}
+
+static void Pool_Free(MemoryPool *pool, void *block)
+{
+    if ( CurrentLockMode != LOCK_GLOBAL ) {
+        pool->Free_Block(block);
+
+        return;
+    }
+
+    ScopedCriticalSectionClass factory(&FactoryLock);
+    pool->Free_Block(block);
+}
+
+static void Churn_Dma(int thread)
+{
+    void *blocks[CONTENTION_BURST];
+
+    for ( int op = 0; op < CONTENTION_OPS; op += CONTENTION_BURST ) {
+        for ( int i = 0; i < CONTENTION_BURST; ++i ) {
+            blocks[i] = Dma_Allocate(32);
+            *static_cast<int *>(blocks[i]) = thread;
+        }
+
+        for ( int i = 0; i < CONTENTION_BURST; ++i ) {
+            Dma_Free(blocks[i]);
+        }
+    }
+}
+
+static void Churn_Pool(MemoryPool *pool, int thread)
+{
+    void *blocks[CONTENTION_BURST];
+
+    for ( int op = 0; op < CONTENTION_OPS; op += CONTENTION_BURST ) {
+        for ( int i = 0; i < CONTENTION_BURST; ++i ) {
+            blocks[i] = Pool_Allocate(pool);
+            *static_cast<int *>(blocks[i]) = thread;
+        }
+
+        for ( int i = 0; i < CONTENTION_BURST; ++i ) {
+            Pool_Free(pool, blocks[i]);
+        }
+    }
+}
+
+static void Run_Contention()
+{
+    static int const thread_counts[] = { 1, 2, 4, 8 };
+    static char const *const mode_names[] = { "cached", "pool", "global" };
+    MemoryPool *message_pool = TheMemoryPoolFactory->Create_Memory_Pool("GameMessage", GAME_MESSAGE_SIZE, 2048, 32);
+
+    printf("contention, %d allocate/free pairs per thread, %u hardware threads\n", CONTENTION_OPS,
+        std::thread::hardware_concurrency());
+
+    for ( size_t i = 0; i < ARRAY_SIZE(thread_counts); ++i ) {
+        int threads = thread_counts[i];
+        double pairs = double(threads) * CONTENTION_OPS;
+
+        for ( int mode = LOCK_CACHED; mode <= LOCK_GLOBAL; ++mode ) {
+            CurrentLockMode = LockMode(mode);
+            MemoryPoolThreadCache::Set_Enabled(mode == LOCK_CACHED);
+            double dma = Time_Threads(threads, Churn_Dma);
+            double pool = Time_Threads(threads, [message_pool](int thread) { Churn_Pool(message_pool, thread); });
+            printf("  %d threads, %-6s dmaPool_32 %7.1f ns, GameMessage %7.1f ns per pair\n", threads,
+                mode_names[mode], dma * 1e9 / pairs, pool * 1e9 / pairs);
+        }
+    }
+
+    CurrentLockMode = LOCK_CACHED;
+    MemoryPoolThreadCache::Set_Enabled(true);
+    TheMemoryPoolFactory->Destroy_Memory_Pool(message_pool);
+}
+
+////////
+// Batch
+////////
+
+static void Batch_Single(MemoryPool *pool)
+{
+    void *blocks[BATCH_SIZE];
+
+    for ( int op = 0; op < BATCH_OPS; op += BATCH_SIZE ) {
+        for ( int i = 0; i < BATCH_SIZE; ++i ) {
+            blocks[i] = pool->Allocate_Block();
+        }
+
+        for ( int i = 0; i < BATCH_SIZE; ++i ) {
+            pool->Free_Block(blocks[i]);
+        }
+    }
+}
+
+static void Batch_Batched(MemoryPool *pool)
+{
+    void *blocks[BATCH_SIZE];
+
+    for ( int op = 0; op < BATCH_OPS; op += BATCH_SIZE ) {
+        pool->Allocate_Blocks(blocks, BATCH_SIZE);
+        pool->Free_Blocks(blocks, BATCH_SIZE);
+    }
+}
+
+static void Run_Batch_Pool(char const *name, int size, int count, int overflow, bool headerless)
+{
+    MemoryPool::Set_Use_Headerless_Blobs(headerless);
+    MemoryPool *pool = TheMemoryPoolFactory->Create_Memory_Pool(name, size, count, overflow);
+    MemoryPool::Set_Use_Headerless_Blobs(true);
+
+    double single = Time_Threads(1, [pool](int) { Batch_Single(pool); });
+    double batched = Time_Threads(1, [pool](int) { Batch_Batched(pool); });
+
+    printf("  %-22s %s single %6.1f ns, batch %6.1f ns per block, %.1fx\n", name,
+        pool->Is_Headerless() ? "slab    " : "headered", single * 1e9 / BATCH_OPS, batched * 1e9 / BATCH_OPS,
+        single / batched);
+    Check(pool->Check_Free_Lists(), "free lists or blob counts don't add up after the batches");
+
+    TheMemoryPoolFactory->Destroy_Memory_Pool(pool);
+}
+
+static void Run_Batch()
+{
+    printf("batch, runs of %d zeroed blocks, %d blocks per timing\n", BATCH_SIZE, BATCH_OPS);
+    // Counts as UserMemoryPools has them for ParticlePool and SightingInfo.
+    Run_Batch_Pool("ParticleBench", PARTICLE_SIZE, 1400, 1024, true);
+    Run_Batch_Pool("SightingInfoBench", SIGHTING_INFO_SIZE, 8192, 2048, true);
+    Run_Batch_Pool("ParticleBenchHeadered", PARTICLE_SIZE, 1400, 1024, false);
+}
+
+///////////////
+// Fragmentation
+///////////////
+
+static uint32_t Frag_Random(uint32_t &seed)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    return seed;
+}
+
+static MemoryPool *Create_Frag_Pool(std::vector<void *> &blocks)
+{
+    MemoryPool::Set_Use_Headerless_Blobs(false);
+    MemoryPool *pool = TheMemoryPoolFactory->Create_Memory_Pool("FragBench", CONTACT_NODE_SIZE, 2048, 512);
+    MemoryPool::Set_Use_Headerless_Blobs(true);
+
+    blocks.resize(FRAG_BLOCKS);
+
+    for ( int i = 0; i < FRAG_BLOCKS; ++i ) {
+        blocks[i] = pool->Allocate_Block_No_Zero();
+    }
+
+    return pool;
+}
+
+static void Destroy_Frag_Pool(MemoryPool *pool, std::vector<void *> &blocks)
+{
+    for ( size_t i = 0; i < blocks.size(); ++i ) {
+        if ( blocks[i] != nullptr ) {
+            pool->Free_Block(blocks[i]);
+        }
+    }
+
+    TheMemoryPoolFactory->Destroy_Memory_Pool(pool);
+}
+
+//
+// Frees all but keep_percent of the blocks at random, then allocates and frees
+// at random slots. Every time the current blob fills up the pool has to find
+// another one with room.
+//
+static void Run_Frag_Churn(int keep_percent)
+{
+    std::vector<void *> blocks;
+    MemoryPool *pool = Create_Frag_Pool(blocks);
+    uint32_t seed = 12345;
+
+    for ( int i = 0; i < FRAG_BLOCKS; ++i ) {
+        if ( int(Frag_Random(seed) % 100) >= keep_percent ) {
+            pool->Free_Block(blocks[i]);
+            blocks[i] = nullptr;
+        }
+    }
+
+    double start = Get_Seconds();
+
+    for ( int op = 0; op < FRAG_OPS; ++op ) {
+        void *&block = blocks[Frag_Random(seed) % FRAG_BLOCKS];
+
+        if ( block != nullptr ) {
+            pool->Free_Block(block);
+            block = nullptr;
+        } else {
+            block = pool->Allocate_Block_No_Zero();
+        }
+    }
+
+    double seconds = Get_Seconds() - start;
+
+    printf("  %2d%% kept, %d blobs, churn %.3f s, %.1f ns per op\n", keep_percent, pool->Count_Blobs(), seconds,
+        seconds * 1e9 / FRAG_OPS);
+    Check(pool->Check_Free_Lists(), "free lists or blob counts don't add up after the churn");
+
+    Destroy_Frag_Pool(pool, blocks);
+}
+
+//
+// Frees most of the older half of the pool, makes some new allocations and then
+// frees what was left of the older half. Blobs the new blocks didn't land in
+// come back empty.
+//
+static void Run_Frag_Refill()
+{
+    std::vector<void *> blocks;
+    MemoryPool *pool = Create_Frag_Pool(blocks);
+    uint32_t seed = 12345;
+    int blobs = pool->Count_Blobs();
+
+    for ( int i = 0; i < FRAG_BLOCKS / 2; ++i ) {
+        if ( Frag_Random(seed) % 10 != 0 ) {
+            pool->Free_Block(blocks[i]);
+            blocks[i] = nullptr;
+        }
+    }
+
+    for ( int i = 0; i < FRAG_REFILL; ++i ) {
+        blocks.push_back(pool->Allocate_Block_No_Zero());
+    }
+
+    for ( int i = 0; i < FRAG_BLOCKS / 2; ++i ) {
+        if ( blocks[i] != nullptr ) {
+            pool->Free_Block(blocks[i]);
+            blocks[i] = nullptr;
+        }
+    }
+
+    int released = pool->Release_Empties();
+
+    printf("  refill, %d of %d blobs left after Release_Empties, %d bytes released\n", pool->Count_Blobs(), blobs, released);
+    Check(pool->Check_Free_Lists(), "free lists or blob counts don't add up after the refill");
+
+    Destroy_Frag_Pool(pool, blocks);
+}
+
+static void Run_Frag()
+{
+    printf("frag, %d blocks of %d bytes, %d lock path operations, caches off\n", FRAG_BLOCKS, CONTACT_NODE_SIZE,
+        FRAG_OPS);
+    MemoryPoolThreadCache::Set_Enabled(false);
+    Run_Frag_Churn(1);
+    Run_Frag_Churn(25);
+    Run_Frag_Refill();
+    MemoryPoolThreadCache::Set_Enabled(true);
+}
+
+////////
+// Churn
+////////
+
+//
+// Every block parked in the table carries its own address xored with this in
+// its second word, the first is the pool's free list link. A block handed out
+// while someone still holds it, or one that went missing from a free list,
+// shows up as a mark that doesn't match.
+//
+static uintptr_t const CHURN_MARK = uintptr_t(0x5A5A5A5A5A5A5A5AULL);
+static std::atomic<void *> ChurnSlots[CHURN_SLOTS];
+static std::atomic<int> ChurnBadMarks;
+
+static void *Churn_Allocate(MemoryPool *pool)
+{
+    uintptr_t *block = static_cast<uintptr_t *>(pool->Allocate_Block_No_Zero());
+
+    if ( block[1] == (uintptr_t(block) ^ CHURN_MARK) ) {
+        ++ChurnBadMarks;
+    }
+
+    block[1] = uintptr_t(block) ^ CHURN_MARK;
+
+    return block;
+}
+
+static void Churn_Free(MemoryPool *pool, void *ptr)
+{
+    uintptr_t *block = static_cast<uintptr_t *>(ptr);
+
+    if ( block[1] != (uintptr_t(block) ^ CHURN_MARK) ) {
+        ++ChurnBadMarks;
+    }
+
+    block[1] = 0;
+    pool->Free_Block(block);
+}
+
+static void Churn_Thread(MemoryPool *pool, int thread)
+{
+    uint32_t seed = 0x9E3779B9u * (thread + 1);
+
+    for ( int op = 0; op < CHURN_OPS; ++op ) {
+        // xorshift, the order only has to be different on every thread.
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+
+        void *block = ChurnSlots[seed % CHURN_SLOTS].exchange(nullptr);
+
+        //
+        // Mostly free what another thread parked, otherwise park a new block.
+        // Blocks only meet the thread that frees them through the table.
+        //
+        if ( block != nullptr ) {
+            Churn_Free(pool, block);
+        } else {
+            block = Churn_Allocate(pool);
+            void *expected = nullptr;
+
+            if ( !ChurnSlots[(seed >> 12) % CHURN_SLOTS].compare_exchange_strong(expected, block) ) {
+                Churn_Free(pool, block);
+            }
+        }
+    }
+}
+
+static void Run_Churn_Pool(MemoryPool *pool)
+{
+    MemoryPoolStats stats;
+    ChurnBadMarks = 0;
+
+    double seconds = Time_Threads(CHURN_THREADS, [pool](int thread) { Churn_Thread(pool, thread); });
+
+    for ( int i = 0; i < CHURN_SLOTS; ++i ) {
+        void *block = ChurnSlots[i].exchange(nullptr);
+
+        if ( block != nullptr ) {
+            Churn_Free(pool, block);
+        }
+    }
+
+    MemoryPoolThreadCache::Thread_Detach();
+    bool lists_ok = pool->Check_Free_Lists();
+    pool->Get_Stats(stats);
+
+    printf("  %-14s %s, %7.1f ns per op, %d blocks in %d blobs, %d used\n", stats.PoolName,
+        pool->Is_Headerless() ? "slab    " : "headered", seconds * 1e9 / (double(CHURN_THREADS) * CHURN_OPS),
+        stats.TotalBlocks, stats.BlobCount, stats.UsedBlocks);
+    Check(stats.UsedBlocks == 0, "blocks still used after every thread freed its share");
+    Check(lists_ok, "free lists or blob counts don't add up");
+    Check(ChurnBadMarks == 0, "a block was handed out twice or changed while parked");
+}
+
+static void Run_Churn()
+{
+    printf("churn, %d threads, %d table operations each over %d slots, best of %d\n", CHURN_THREADS, CHURN_OPS,
+        CHURN_SLOTS, REPEATS);
+
+    //
+    // Slab blocks always go back through the freeing thread's cache. Headered
+    // ones remember the cache they came from and go on the remote free list when
+    // another thread frees them, which is the lock free path under test.
+    //
+    MemoryPool *slab = TheMemoryPoolFactory->Create_Memory_Pool("ChurnSlab", 48, 1024, 1024);
+    MemoryPool::Set_Use_Headerless_Blobs(false);
+    MemoryPool *headered = TheMemoryPoolFactory->Create_Memory_Pool("ChurnHeadered", 48, 1024, 1024);
+    MemoryPool::Set_Use_Headerless_Blobs(true);
+
+    for ( int cached = 1; cached >= 0; --cached ) {
+        MemoryPoolThreadCache::Set_Enabled(cached != 0);
+        printf(" thread caches %s\n", cached ? "on" : "off");
+        Run_Churn_Pool(slab);
+        Run_Churn_Pool(headered);
+    }
+
+    MemoryPoolThreadCache::Set_Enabled(true);
+    TheMemoryPoolFactory->Destroy_Memory_Pool(slab);
+    TheMemoryPoolFactory->Destroy_Memory_Pool(headered);
+}
+
+//////////
+// Realloc
+//////////
+
+static void Run_Realloc()
+{
+    static int const sizes[] = { 24, 100, 3000, 70000 };
+    static int const alignments[] = { 64, 4096 };
+    int reallocs = 0;
+
+    printf("realloc, aligned raw blocks grown and shrunk\n");
+
+    for ( size_t i = 0; i < ARRAY_SIZE(sizes); ++i ) {
+        for ( size_t j = 0; j < ARRAY_SIZE(alignments); ++j ) {
+            for ( int grow = 0; grow < 2; ++grow ) {
+                int size = sizes[i];
+                int new_size = grow ? size * 3 : size / 2;
+                unsigned char *block = static_cast<unsigned char *>(
+                    TheDynamicMemoryAllocator->Allocate_Bytes_Aligned_No_Zero(size, alignments[j]));
+
+                for ( int k = 0; k < size; ++k ) {
+                    block[k] = (unsigned char)(k * 7 + i);
+                }
+
+                block = static_cast<unsigned char *>(TheDynamicMemoryAllocator->Reallocate_Bytes_No_Zero(block, new_size));
+                bool kept = true;
+
+                for ( int k = 0; k < MIN(size, new_size); ++k ) {
+                    kept = kept && block[k] == (unsigned char)(k * 7 + i);
+                }
+
+                Check(kept, "reallocated aligned block lost its contents");
+                Check((uintptr_t(block) & (alignments[j] - 1)) == 0, "reallocated aligned block lost its alignment");
+                TheDynamicMemoryAllocator->Free_Bytes(block);
+                ++reallocs;
+            }
+        }
+    }
+
+    printf("  %d reallocations\n", reallocs);
+}
+
+//////////
+// Profile
+//////////
+
+static bool Read_Profile_Totals(char const *filename, int &live, int &allocs)
+{
+    FILE *fp = fopen(filename, "r");
+
+    if ( fp == nullptr ) {
+        return false;
+    }
+
+    long long live_bytes;
+    long long alloc_bytes;
+    int rate;
+    bool ok = fscanf(fp, "heap profile: %d: %lld [%d: %lld] @ heap_v2/%d", &live, &live_bytes, &allocs, &alloc_bytes,
+        &rate) == 5;
+    fclose(fp);
+
+    return ok && rate == PROFILE_RATE;
+}
+
+static void Run_Profile()
+{
+    char const *filename = "poolbench.heap";
+    std::vector<void *> blocks(PROFILE_BLOCKS);
+    int expected = PROFILE_BLOCKS * PROFILE_BLOCK_SIZE / PROFILE_RATE;
+    int live = -1;
+    int allocs = -1;
+
+    printf("profile, dmaPool_32 contention with the profiler off and on, ns per pair\n");
+
+    double off = Time_Threads(CHURN_THREADS, Churn_Dma);
+    HeapProfiler::Start();
+    double on = Time_Threads(CHURN_THREADS, Churn_Dma);
+    HeapProfiler::Stop();
+    printf("  %d threads, off %6.1f ns, on %6.1f ns\n", int(CHURN_THREADS), off * 1e9 / CONTENTION_OPS,
+        on * 1e9 / CONTENTION_OPS);
+
+    printf("profile, %d blocks of %d bytes sampled every %d bytes\n", int(PROFILE_BLOCKS), int(PROFILE_BLOCK_SIZE),
+        int(PROFILE_RATE));
+    HeapProfiler::Start(PROFILE_RATE);
+
+    for ( int i = 0; i < PROFILE_BLOCKS; ++i ) {
+        blocks[i] = TheDynamicMemoryAllocator->Allocate_Bytes_No_Zero(PROFILE_BLOCK_SIZE);
+    }
+
+    for ( int i = 1; i < PROFILE_BLOCKS; i += 2 ) {
+        TheDynamicMemoryAllocator->Free_Bytes(blocks[i]);
+    }
+
+    bool written = HeapProfiler::Write_Profile(filename) && Read_Profile_Totals(filename, live, allocs);
+    printf("  half freed, %d live of %d samples, about %d expected\n", live, allocs, expected);
+    Check(written, "heap profile wasn't written");
+    Check(allocs > expected * 7 / 10 && allocs < expected * 13 / 10, "sample count is off the sample rate");
+    Check(live > allocs * 35 / 100 && live < allocs * 65 / 100, "live samples don't follow the frees");
+
+    for ( int i = 0; i < PROFILE_BLOCKS; i += 2 ) {
+        TheDynamicMemoryAllocator->Free_Bytes(blocks[i]);
+    }
+
+    written = HeapProfiler::Write_Profile(filename) && Read_Profile_Totals(filename, live, allocs);
+    printf("  all freed, %d live of %d samples\n", live, allocs);
+    Check(written, "heap profile wasn't written");
+    Check(live == 0, "freed blocks are still live in the profile");
+
+    HeapProfiler::Stop();
+    remove(filename);
+}
+
+////////
+// Reset
+////////
+
+static void Run_Reset()
+{
+    MemoryPool *pool = TheMemoryPoolFactory->Create_Memory_Pool("ResetBench", 64, 100, 100);
+    std::vector<void *> blocks(RESET_DMA_BLOCKS);
+    MemoryPoolStats before;
+    MemoryPoolStats after;
+
+    printf("reset, peak of %d dmaPool_1024 blocks and %d standalone pool blocks\n", RESET_DMA_BLOCKS,
+        RESET_POOL_BLOCKS);
+
+    for ( int i = 0; i < RESET_DMA_BLOCKS; ++i ) {
+        blocks[i] = TheDynamicMemoryAllocator->Allocate_Bytes_No_Zero(1024);
+    }
+
+    for ( int i = 0; i < RESET_DMA_BLOCKS; ++i ) {
+        TheDynamicMemoryAllocator->Free_Bytes(blocks[i]);
+    }
+
+    for ( int i = 0; i < RESET_POOL_BLOCKS; ++i ) {
+        blocks[i] = pool->Allocate_Block_No_Zero();
+    }
+
+    for ( int i = 0; i < RESET_POOL_BLOCKS; ++i ) {
+        pool->Free_Block(blocks[i]);
+    }
+
+    Get_Pool_Stats("dmaPool_1024", before);
+    TheMemoryPoolFactory->Reset();
+    Get_Pool_Stats("dmaPool_1024", after);
+    printf("  dmaPool_1024 %6d blocks in %3d blobs before, %6d in %3d after\n", before.TotalBlocks,
+        before.BlobCount, after.TotalBlocks, after.BlobCount);
+    Check(after.TotalBlocks >= RESET_DMA_BLOCKS, "dmaPool_1024 was trimmed below its peak");
+    Check(after.UsedBlocks == 0, "dmaPool_1024 has used blocks after the reset");
+
+    Get_Pool_Stats("ResetBench", after);
+    printf("  ResetBench   %6d blocks in %3d blobs after\n", after.TotalBlocks, after.BlobCount);
+    Check(after.TotalBlocks >= RESET_POOL_BLOCKS, "ResetBench was trimmed below its peak");
+    Check(after.UsedBlocks == 0, "ResetBench has used blocks after the reset");
+
+    TheMemoryPoolFactory->Destroy_Memory_Pool(pool);
+}
+
+struct BenchPhase
+{
+    char const *Name;
+    void (*Run)();
+};
+
+static BenchPhase const Phases[] = {
+    { "contention", Run_Contention },
+    { "batch", Run_Batch },
+    { "frag", Run_Frag },
+    { "churn", Run_Churn },
+    { "realloc", Run_Realloc },
+    { "profile", Run_Profile },
+    { "reset", Run_Reset },
+};
+
+int main(int argc, char **argv)
+{
+    for ( int i = 1; i < argc; ++i ) {
+        bool known = false;
+
+        for ( size_t j = 0; j < ARRAY_SIZE(Phases); ++j ) {
+            known = known || strcmp(argv[i], Phases[j].Name) == 0;
+        }
+
+        if ( !known ) {
+            fprintf(stderr, "Usage: poolbench [phase...]\n\nPhases:\n");
+
+            for ( size_t j = 0; j < ARRAY_SIZE(Phases); ++j ) {
+                fprintf(stderr, "  %s\n", Phases[j].Name);
+            }
+
+            return 1;
+        }
+    }
+
+    Init_Memory();
+
+    for ( size_t i = 0; i < ARRAY_SIZE(Phases); ++i ) {
+        bool run = argc == 1;
+
+        for ( int j = 1; j < argc; ++j ) {
+            run = run || strcmp(argv[j], Phases[i].Name) == 0;
+        }
+
+        if ( run ) {
+            Phases[i].Run();
+        }
+    }
+
+    return Failures != 0;
+}
@@ -0,0 +1,621 @@
+////////////////////////////////////////////////////////////////////////////////
+//                               --  THYME  --                                //
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Project Name:: Thyme
+//
+//          File:: STRINGBENCH.CPP
+//
+//        Author:: OmniBlade
+//
+//  Contributors::
+//
+//   Description:: Times the AsciiString patterns INI parsing and archive
+//                 lookups lean on, built once as is and once with
+//                 GAME_ASCIISTRING_SSO to compare the two.
+//
+//       License:: Thyme is free software: you can redistribute it and/or
+//                 modify it under the terms of the GNU General Public License
+//                 as published by the Free Software Foundation, either version
+//                 2 of the License, or (at your option) any later version.
+//
+//                 A full copy of the GNU General Public License can be found in
+//                 LICENSE
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "asciistring.h"
+#include "asciistringview.h"
+#include "casefold.h"
+#include "critsection.h"
+#include "gamememoryinit.h"
+#include "memdynalloc.h"
+#include "memtag.h"
+#include "mempool.h"
+#include "mempoolfact.h"
+#include "memthreadcache.h"
+#include "minmax.h"
+#include "rtsutils.h"
+#include "stringformat.h"
+#include "unicodestring.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <time.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//
+// Usage: stringbench [iterations]
+//
+// The workloads are made up from the shapes of the real data, the INI one from
+// object definitions and the archive ones from the paths in the big files. The
+// archive view phase walks the same tree through AsciiStringView. The file
+// table looks whole paths up without case, once in a sorted map and once
+// in a hashed one. The format phases make typical UI and log lines through
+// the printf style Format and through Format_String. The lower phase lowers
+// the archive paths at each casefold level.
+// Every pass redoes the same work, the fastest one is reported. One more pass
+// runs under a memory tag afterwards to count the allocations it makes.
+//
+
+enum {
+    DEFAULT_ITERATIONS = 20,
+    INI_OBJECTS = 2000,
+    ARCHIVE_FILES = 20000,
+    FORMAT_LINES = 20000,
+};
+
+struct BenchDirectory
+{
+    std::map<AsciiString, BenchDirectory> Directories;
+    std::map<AsciiString, AsciiString> Files;
+};
+
+typedef std::map<AsciiString, int, rts::less_than_nocase<AsciiString> > SortedFileTable;
+typedef std::unordered_map<AsciiString, int, AsciiStringHashNoCase, rts::equal_to_nocase<AsciiString> > HashedFileTable;
+
+static SimpleCriticalSectionClass FactoryLock;
+static SimpleCriticalSectionClass DmaLock;
+static SimpleCriticalSectionClass UnicodeLock;
+
+static char const *const FieldNames[] = {
+    "Draw", "Model", "DisplayName", "EditorSorting", "Side", "BuildCost", "BuildTime", "VisionRange",
+    "ShroudClearingRange", "ArmorSet", "Conditions", "Armor", "DamageFX", "WeaponSet", "Weapon",
+    "Behavior", "MaxHealth", "InitialHealth", "KindOf", "Locomotor", "Geometry", "GeometryMajorRadius",
+    "GeometryHeight", "Shadow", "ProductionModifier", "UnitSpecificSounds", "VoiceSelect", "SoundMoveStart",
+    "CommandSet", "Prerequisites", "Object", "End",
+};
+
+static char const *const FieldValues[] = {
+    "W3DTankDraw", "AVCrusader", "OBJECT:Crusader", "VEHICLE", "America", "900", "10.0", "150", "300",
+    "None", "TankArmor", "TankDamageFX", "PRIMARY", "CrusaderTankGun", "SELECTABLE CAN_ATTACK VEHICLE",
+    "BasicHumanLocomotor", "BOX", "15.0", "12.0", "SHADOW_VOLUME", "AmericaTankCrusaderCommandSet",
+    "AmericaVehicleCrusaderVoiceSelect", "ModuleTag_02", "SET_NORMAL", "Yes", "No", "0.75",
+};
+
+static char const *const PathParts[] = {
+    "Data", "INI", "Object", "Art", "Textures", "W3D", "Audio", "Sounds", "English", "Maps",
+    "Window", "Menus", "Generals", "ZH", "America", "China", "GLA", "Civilian", "Vehicles", "Infantry",
+};
+
+static char const *const TextLabels[] = {
+    "GUI:Ok", "GUI:Cancel", "CONTROLBAR:Build", "CONTROLBAR:ToolTipUpgrade", "OBJECT:Ranger",
+    "OBJECT:CrusaderTank", "SCIENCE:Paradrop", "TOOLTIP:SellStructure", "LOAD:Missing", "MAP:Tournament",
+};
+
+static double Get_Seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static void Init_Memory()
+{
+    int param_count;
+    PoolInitRec const *params;
+
+    MemoryPoolCriticalSection = &FactoryLock;
+    DmaCriticalSection = &DmaLock;
+    UnicodeStringCriticalSection = &UnicodeLock;
+    MemoryPoolThreadCache::Init();
+    MemoryTag::Init();
+
+    // Has to be on before the allocator is made, only the counting passes set a tag.
+    MemoryTag::Set_Enabled(true);
+    User_Memory_Get_DMA_Params(&param_count, &params);
+    TheMemoryPoolFactory = new MemoryPoolFactory;
+    TheMemoryPoolFactory->Init();
+    TheDynamicMemoryAllocator = TheMemoryPoolFactory->Create_Dynamic_Memory_Allocator(param_count, params);
+}
+
+static unsigned Next_Random(unsigned &seed)
+{
+    seed = seed * 1103515245u + 12345u;
+
+    return seed >> 8;
+}
+
+static void Build_Ini_Text(std::vector<char> &text)
+{
+    unsigned seed = 1;
+    char line[256];
+
+    for ( int i = 0; i < INI_OBJECTS; ++i ) {
+        int len = snprintf(line, sizeof(line), "Object Unit%05d\n", i);
+        text.insert(text.end(), line, line + len);
+
+        for ( int field = 6 + Next_Random(seed) % 24; field > 0; --field ) {
+            // One at a time, argument order isn't fixed and the text has to be.
+            char const *name = FieldNames[Next_Random(seed) % ARRAY_SIZE(FieldNames)];
+            char const *value1 = FieldValues[Next_Random(seed) % ARRAY_SIZE(FieldValues)];
+            char const *value2 = FieldValues[Next_Random(seed) % ARRAY_SIZE(FieldValues)];
+            len = snprintf(line, sizeof(line), "  %s = %s %s\n", name, value1, value2);
+            text.insert(text.end(), line, line + len);
+        }
+
+        text.insert(text.end(), "End\n", "End\n" + 4);
+    }
+
+    text.push_back('\0');
+}
+
+//
+// Same steps as INI field parsing, a line is copied out of the file buffer,
+// the field name is matched without case and each value token is stored into a
+// field the way Parse_AsciiString does it.
+//
+static int Parse_Ini(char const *text, std::vector<AsciiString> &store)
+{
+    AsciiString line;
+    AsciiString token;
+    int matched = 0;
+
+    store.clear();
+
+    for ( char const *start = text; *start != '\0'; ) {
+        char const *end = strchr(start, '\n');
+        int len = int(end - start);
+
+        if ( len > 0 ) {
+            char *buf = line.Get_Buffer_For_Read(len);
+            memcpy(buf, start, len);
+            buf[len] = '\0';
+        } else {
+            line.Clear();
+        }
+
+        if ( line.Next_Token(&token, " \t=") ) {
+            for ( int i = 0; i < int(ARRAY_SIZE(FieldNames)); ++i ) {
+                if ( token.Compare_No_Case(FieldNames[i]) == 0 ) {
+                    ++matched;
+                    break;
+                }
+            }
+
+            while ( line.Next_Token(&token, " \t=") ) {
+                AsciiString field;
+                field = token;
+                store.push_back(std::move(field));
+            }
+        }
+
+        start = end + 1;
+    }
+
+    return matched;
+}
+
+static AsciiString Make_Path(unsigned &seed)
+{
+    AsciiString path;
+    char name[32];
+
+    for ( int depth = 2 + Next_Random(seed) % 4; depth > 0; --depth ) {
+        path.Concat(PathParts[Next_Random(seed) % ARRAY_SIZE(PathParts)]);
+        path.Concat('\\');
+    }
+
+    snprintf(name, sizeof(name), "File%05u.ini", Next_Random(seed) % 50000);
+    path.Concat(name);
+
+    return path;
+}
+
+static void Add_File(BenchDirectory &root, AsciiString const &filename)
+{
+    AsciiString path = filename;
+    AsciiString token;
+    BenchDirectory *dirp = &root;
+
+    path.To_Lower();
+
+    while ( path.Next_Token(&token, "\\/") && strchr(token.Str(), '.') == nullptr ) {
+        dirp = &dirp->Directories[token];
+    }
+
+    dirp->Files[token] = filename;
+}
+
+//
+// The walk ArchiveFileSystem::Get_File_Info makes, lower the path then find
+// each directory token in turn and finally the file itself.
+//
+static AsciiString Find_File(BenchDirectory &root, AsciiString const &filename)
+{
+    AsciiString path = filename;
+    AsciiString token;
+    BenchDirectory *dirp = &root;
+
+    path.To_Lower();
+    path.Next_Token(&token, "\\/");
+
+    while ( strchr(token.Str(), '.') == nullptr ) {
+        std::map<AsciiString, BenchDirectory>::iterator it = dirp->Directories.find(token);
+
+        if ( it == dirp->Directories.end() ) {
+            return AsciiString::EmptyString;
+        }
+
+        dirp = &it->second;
+        path.Next_Token(&token, "\\/");
+    }
+
+    std::map<AsciiString, AsciiString>::iterator it = dirp->Files.find(token);
+
+    if ( it == dirp->Files.end() ) {
+        return AsciiString::EmptyString;
+    }
+
+    return it->second;
+}
+
+//
+// The same walk as ArchiveFileSystem does it now, tokens are views into the
+// path and lower cased into a stack key for each find.
+//
+static AsciiString Find_File_View(BenchDirectory &root, AsciiString const &filename)
+{
+    AsciiStringView path = filename;
+    AsciiStringView token;
+    BenchDirectory *dirp = &root;
+
+    path.Next_Token(&token, "\\/");
+
+    while ( token.Find('.') == nullptr ) {
+        std::map<AsciiString, BenchDirectory>::iterator it = dirp->Directories.find(AsciiStringKey(token, true));
+
+        if ( it == dirp->Directories.end() ) {
+            return AsciiString::EmptyString;
+        }
+
+        dirp = &it->second;
+        path.Next_Token(&token, "\\/");
+    }
+
+    std::map<AsciiString, AsciiString>::iterator it = dirp->Files.find(AsciiStringKey(token, true));
+
+    if ( it == dirp->Files.end() ) {
+        return AsciiString::EmptyString;
+    }
+
+    return it->second;
+}
+
+static int Get_Allocations(char const *tag_name)
+{
+    MemoryTagStats stats[MemoryTag::MAX_TAGS];
+    int count = MemoryTag::Get_Stats(stats, MemoryTag::MAX_TAGS);
+
+    for ( int i = 0; i < count; ++i ) {
+        if ( strcmp(stats[i].TagName, tag_name) == 0 ) {
+            return stats[i].Allocations;
+        }
+    }
+
+    return 0;
+}
+
+typedef AsciiString (*FindFileFunc)(BenchDirectory &root, AsciiString const &filename);
+
+static int Lookup_Files(FindFileFunc find, BenchDirectory &root, std::vector<AsciiString> const &paths)
+{
+    int found = 0;
+
+    for ( size_t i = 0; i < paths.size(); ++i ) {
+        if ( find(root, paths[i]).Is_Not_Empty() ) {
+            ++found;
+        }
+    }
+
+    return found;
+}
+
+static void Time_Lookup(char const *name, char const *tag_name, FindFileFunc find, BenchDirectory &root, std::vector<AsciiString> const &paths, int iterations)
+{
+    double best = 1e9;
+    int found = 0;
+
+    for ( int i = 0; i < iterations; ++i ) {
+        double start = Get_Seconds();
+        found = Lookup_Files(find, root, paths);
+        best = MIN(best, Get_Seconds() - start);
+    }
+
+    {
+        MemoryTagScope scope(tag_name);
+        Lookup_Files(find, root, paths);
+    }
+
+    printf("  %-17s %8.2f ms, %d allocations, %.0f ns per lookup, %d of %d found\n", name, best * 1000.0,
+        Get_Allocations(tag_name), best * 1e9 / paths.size(), found, int(paths.size()));
+}
+
+//
+// Each line is formatted into the same string every time round, the way UI
+// and log code keeps one to redo. Returns the chars made so both paths can be
+// checked against each other.
+//
+static int Format_Printf(int lines)
+{
+    AsciiString ui;
+    AsciiString log;
+    AsciiString version;
+    UnicodeString missing;
+    int chars = 0;
+
+    for ( int i = 0; i < lines; ++i ) {
+        char const *label = TextLabels[i % ARRAY_SIZE(TextLabels)];
+
+        ui.Format("%s has %d credits", label, i * 25);
+        log.Format("Loaded '%s' in %.2f ms, %u bytes.", label, i * 0.125, unsigned(i * 4096));
+        version.Format("%d.%d.%d.%d", 1, 4, i, i % 7);
+        missing.Format(L"MISSING: '%hs'", label);
+        chars += ui.Get_Length() + log.Get_Length() + version.Get_Length() + missing.Get_Length();
+    }
+
+    return chars;
+}
+
+static int Format_Typed(int lines)
+{
+    AsciiString ui;
+    AsciiString log;
+    AsciiString version;
+    UnicodeString missing;
+    int chars = 0;
+
+    for ( int i = 0; i < lines; ++i ) {
+        char const *label = TextLabels[i % ARRAY_SIZE(TextLabels)];
+
+        Format_String(ui, "{} has {} credits", label, i * 25);
+        Format_String(log, "Loaded '{}' in {:.2f} ms, {} bytes.", label, i * 0.125, unsigned(i * 4096));
+        Format_String(version, "{}.{}.{}.{}", 1, 4, i, i % 7);
+        Format_String(missing, L"MISSING: '{}'", label);
+        chars += ui.Get_Length() + log.Get_Length() + version.Get_Length() + missing.Get_Length();
+    }
+
+    return chars;
+}
+
+typedef int (*FormatFunc)(int lines);
+
+static void Time_Format(char const *name, char const *tag_name, FormatFunc format, int iterations)
+{
+    double best = 1e9;
+    int chars = 0;
+
+    for ( int i = 0; i < iterations; ++i ) {
+        double start = Get_Seconds();
+        chars = format(FORMAT_LINES);
+        best = MIN(best, Get_Seconds() - start);
+    }
+
+    {
+        MemoryTagScope scope(tag_name);
+        format(FORMAT_LINES);
+    }
+
+    printf("  %-17s %8.2f ms, %d allocations, %.0f ns per line, %d chars\n", name, best * 1000.0,
+        Get_Allocations(tag_name), best * 1e9 / (FORMAT_LINES * 4), chars);
+}
+
+//
+// Lowers the archive paths, through tolower as the baseline and then through
+// casefold at every level the CPU has.
+//
+static int Case_Lower_Libc(std::vector<AsciiString> const &, std::vector<AsciiString> const &upper)
+{
+    char buf[AsciiString::MAX_FORMAT_BUF_LEN];
+    int lowered = 0;
+
+    for ( size_t i = 0; i < upper.size(); ++i ) {
+        strcpy(buf, upper[i].Str());
+
+        for ( char *c = buf; *c != '\0'; ++c ) {
+            *c = tolower(*c);
+        }
+
+        lowered += buf[0] != '\0';
+    }
+
+    return lowered;
+}
+
+static int Case_Lower(std::vector<AsciiString> const &, std::vector<AsciiString> const &upper)
+{
+    char buf[AsciiString::MAX_FORMAT_BUF_LEN];
+    int lowered = 0;
+
+    for ( size_t i = 0; i < upper.size(); ++i ) {
+        int len = upper[i].Get_Length();
+        memcpy(buf, upper[i].Str(), len + 1);
+        Lower_Chars(buf, len);
+        lowered += buf[0] != '\0';
+    }
+
+    return lowered;
+}
+
+typedef int (*CaseFunc)(std::vector<AsciiString> const &paths, std::vector<AsciiString> const &upper);
+
+static void Time_Case(char const *name, char const *variant, CaseFunc func, std::vector<AsciiString> const &paths, std::vector<AsciiString> const &upper, int iterations)
+{
+    double best = 1e9;
+    int result = 0;
+
+    for ( int i = 0; i < iterations; ++i ) {
+        double start = Get_Seconds();
+        result = func(paths, upper);
+        best = MIN(best, Get_Seconds() - start);
+    }
+
+    printf("  %-10s %-6s %8.2f ms, %.1f ns per path, %d\n", name, variant, best * 1000.0, best * 1e9 / paths.size(), result);
+}
+
+static void Time_Case_Levels(char const *name, CaseFunc libc, CaseFunc func, std::vector<AsciiString> const &paths, std::vector<AsciiString> const &upper, int iterations)
+{
+    static char const *const level_names[] = { "scalar", "sse2", "avx2" };
+    CaseFoldLevel detected = Get_Case_Fold_Level();
+
+    Time_Case(name, "libc", libc, paths, upper, iterations);
+
+    for ( int level = CASEFOLD_SCALAR; level <= detected; ++level ) {
+        Set_Case_Fold_Level(CaseFoldLevel(level));
+        Time_Case(name, level_names[level], func, paths, upper, iterations);
+    }
+
+    Set_Case_Fold_Level(detected);
+}
+
+template<typename Table>
+static int Lookup_Table(Table &table, std::vector<AsciiString> const &queries)
+{
+    int found = 0;
+
+    for ( size_t i = 0; i < queries.size(); ++i ) {
+        if ( table.find(queries[i]) != table.end() ) {
+            ++found;
+        }
+    }
+
+    return found;
+}
+
+template<typename Table>
+static void Time_Table(char const *name, Table &table, std::vector<AsciiString> const &queries, int iterations)
+{
+    double best = 1e9;
+    int found = 0;
+
+    for ( int i = 0; i < iterations; ++i ) {
+        double start = Get_Seconds();
+        found = Lookup_Table(table, queries);
+        best = MIN(best, Get_Seconds() - start);
+    }
+
+    printf("  %-17s %8.2f ms, %.0f ns per lookup, %d of %d found\n", name, best * 1000.0,
+        best * 1e9 / queries.size(), found, int(queries.size()));
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+
+    if ( iterations <= 0 ) {
+        fprintf(stderr, "Usage: stringbench [iterations]\n");
+
+        return 1;
+    }
+
+    Init_Memory();
+
+#if defined GAME_ASCIISTRING_SSO
+    printf("AsciiString with small string optimisation, %d bytes\n", int(sizeof(AsciiString)));
+#elif defined GAME_ASCIISTRING_CACHE
+    printf("AsciiString with cached length and hashes, %d bytes\n", int(sizeof(AsciiString)));
+#else
+    printf("AsciiString, %d bytes\n", int(sizeof(AsciiString)));
+#endif
+
+    std::vector<char> text;
+    std::vector<AsciiString> store;
+    Build_Ini_Text(text);
+
+    double best = 1e9;
+    int matched = 0;
+
+    for ( int i = 0; i < iterations; ++i ) {
+        double start = Get_Seconds();
+        matched = Parse_Ini(&text[0], store);
+        best = MIN(best, Get_Seconds() - start);
+    }
+
+    {
+        MemoryTagScope scope("IniParse");
+        Parse_Ini(&text[0], store);
+    }
+
+    printf("  ini parse         %8.2f ms, %d allocations, %d fields, %d values\n", best * 1000.0,
+        Get_Allocations("IniParse"), matched, int(store.size()));
+
+    BenchDirectory root;
+    std::vector<AsciiString> paths;
+    unsigned seed = 7;
+
+    double start = Get_Seconds();
+
+    for ( int i = 0; i < ARCHIVE_FILES; ++i ) {
+        paths.push_back(Make_Path(seed));
+        Add_File(root, paths.back());
+    }
+
+    printf("  archive build     %8.2f ms\n", (Get_Seconds() - start) * 1000.0);
+
+    Time_Lookup("archive lookup", "ArchiveLookup", Find_File, root, paths, iterations);
+    Time_Lookup("archive view", "ArchiveView", Find_File_View, root, paths, iterations);
+
+    //
+    // Queries get buffers of their own like names read from an INI would, the
+    // keys share theirs with paths.
+    //
+    SortedFileTable sorted_table;
+    HashedFileTable hashed_table;
+    std::vector<AsciiString> queries;
+
+    for ( size_t i = 0; i < paths.size(); ++i ) {
+        sorted_table[paths[i]] = int(i);
+        hashed_table[paths[i]] = int(i);
+
+        AsciiString query(paths[i].Str());
+        query.To_Lower();
+        queries.push_back(std::move(query));
+    }
+
+    Time_Table("file table sorted", sorted_table, queries, iterations);
+    Time_Table("file table hashed", hashed_table, queries, iterations);
+
+    Time_Format("format printf", "FormatPrintf", Format_Printf, iterations);
+    Time_Format("format typed", "FormatTyped", Format_Typed, iterations);
+
+    std::vector<AsciiString> upper;
+
+    for ( size_t i = 0; i < paths.size(); ++i ) {
+        char buf[AsciiString::MAX_FORMAT_BUF_LEN];
+        strcpy(buf, paths[i].Str());
+
+        for ( char *c = buf; *c != '\0'; ++c ) {
+            *c = toupper(*c);
+        }
+
+        upper.push_back(AsciiString(buf));
+    }
+
+    Time_Case_Levels("lower", Case_Lower_Libc, Case_Lower, paths, upper, iterations);
+
+    return 0;
+}